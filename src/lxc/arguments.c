@@ -229,7 +229,8 @@ extern int lxc_arguments_parse(struct lxc_arguments *args,
 
 	/* Check the command options */
 
-	if (!args->name && strcmp(args->progname, "lxc-autostart") != 0) {
+	if (!args->name && strcmp(args->progname, "lxc-autostart") != 0 &&
+			!args->cache_gc) {
 		lxc_error(args, "missing container name, use --name option");
 		return -1;
 	}
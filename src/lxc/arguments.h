@@ -55,6 +55,8 @@ struct lxc_arguments {
 
 	/* for lxc-start */
 	const char *share_ns[32]; // size must be greater than LXC_NS_MAX
+	int trace;
+	int zygote;
 
 	/* for lxc-checkpoint/restart */
 	const char *statefile;
@@ -78,6 +80,7 @@ struct lxc_arguments {
 
 	/* for lxc-destroy */
 	int force;
+	int async;
 
 	/* close fds from parent? */
 	int close_all_fds;
@@ -88,11 +91,14 @@ struct lxc_arguments {
 	unsigned long fssize;
 	char *lvname, *vgname, *thinpool;
 	char *zfsroot, *lowerdir, *dir;
+	int from_cache, cache_gc;
+	int fsprealloc;
 
 	/* auto-start */
 	int all;
 	int list;
 	char *groups;
+	int parallel;
 
 	/* remaining arguments */
 	char *const *argv;
@@ -1020,6 +1020,10 @@ int attach_child_main(void* data)
 	if (options->stderr_fd > 2)
 		close(options->stderr_fd);
 
+	/* whatever else the caller had open shouldn't follow us into
+	 * the container past exec */
+	lxc_close_inherited(NULL, 0, true);
+
 	/* try to remove CLOEXEC flag from stdin/stdout/stderr,
 	 * but also here, ignore errors */
 	for (fd = 0; fd <= 2; fd++) {
@@ -1031,6 +1035,7 @@ int attach_child_main(void* data)
 	}
 
 	/* we're done, so we can now do whatever the user intended us to do */
+	lxc_log_flush();
 	rexit(payload->exec_function(payload->exec_payload));
 }
 
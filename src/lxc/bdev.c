@@ -37,6 +37,8 @@
 #include <libgen.h>
 #include <linux/loop.h>
 #include <dirent.h>
+#include <stdint.h>
+#include <sys/vfs.h>
 #include "lxc.h"
 #include "config.h"
 #include "conf.h"
@@ -57,6 +59,18 @@
 #define LO_FLAGS_AUTOCLEAR 4
 #endif
 
+#ifndef LOOP_SET_CAPACITY
+#define LOOP_SET_CAPACITY 0x4C07
+#endif
+
+#ifndef EXT4_IOC_RESIZE_FS
+#define EXT4_IOC_RESIZE_FS _IOW('f', 16, uint64_t)
+#endif
+
+#ifndef EXT4_SUPER_MAGIC
+#define EXT4_SUPER_MAGIC 0xEF53
+#endif
+
 lxc_log_define(bdev, lxc);
 
 static int do_rsync(const char *src, const char *dest)
@@ -115,6 +129,7 @@ static int find_fstype_cb(char* buffer, void *data)
 		const char *rootfs;
 		const char *target;
 		int mntopt;
+		const char *options;
 	} *cbarg = data;
 
 	char *fstype;
@@ -130,7 +145,10 @@ static int find_fstype_cb(char* buffer, void *data)
 	DEBUG("trying to mount '%s'->'%s' with fstype '%s'",
 	      cbarg->rootfs, cbarg->target, fstype);
 
-	if (mount(cbarg->rootfs, cbarg->target, fstype, cbarg->mntopt, NULL)) {
+	// not every fs knows the options we'd like, so also try without
+	if (mount(cbarg->rootfs, cbarg->target, fstype, cbarg->mntopt, cbarg->options) &&
+	    (!cbarg->options ||
+	     mount(cbarg->rootfs, cbarg->target, fstype, cbarg->mntopt, NULL))) {
 		DEBUG("mount failed with error: %s", strerror(errno));
 		return 0;
 	}
@@ -141,7 +159,8 @@ static int find_fstype_cb(char* buffer, void *data)
 	return 1;
 }
 
-static int mount_unknow_fs(const char *rootfs, const char *target, int mntopt)
+static int mount_unknow_fs(const char *rootfs, const char *target, int mntopt,
+		const char *options)
 {
 	int i;
 
@@ -149,10 +168,12 @@ static int mount_unknow_fs(const char *rootfs, const char *target, int mntopt)
 		const char *rootfs;
 		const char *target;
 		int mntopt;
+		const char *options;
 	} cbarg = {
 		.rootfs = rootfs,
 		.target = target,
 		.mntopt = mntopt,
+		.options = options,
 	};
 
 	/*
@@ -210,6 +231,71 @@ static int do_mkfs(const char *path, const char *fstype)
 	exit(1);
 }
 
+static int run_fs_tool(const char *tool, const char *arg1, const char *path)
+{
+	pid_t pid;
+
+	if ((pid = fork()) < 0) {
+		ERROR("error forking");
+		return -1;
+	}
+	if (pid > 0)
+		return lxc_wait_for_pid_status(pid);
+
+	process_unlock(); // we're no longer sharing
+	close(0);
+	close(1);
+	open("/dev/null", O_RDONLY);
+	open("/dev/null", O_RDWR);
+	if (arg1)
+		execlp(tool, tool, arg1, path, NULL);
+	else
+		execlp(tool, tool, path, NULL);
+	exit(127);
+}
+
+/*
+ * Grow the filesystem on dev to fill the (already grown) device.  If the
+ * container is running, rootfd is its mounted root and ext4 is asked to
+ * resize online; otherwise the fs is checked and resized offline.
+ */
+static int grow_fs(const char *dev, unsigned long size, int rootfd)
+{
+	struct statfs sfs;
+	uint64_t blocks;
+	int ret;
+
+	if (rootfd >= 0) {
+		if (fstatfs(rootfd, &sfs) < 0) {
+			SYSERROR("failed to stat the container's rootfs");
+			return -1;
+		}
+		if (sfs.f_type != EXT4_SUPER_MAGIC) {
+			ERROR("online resize is only supported for ext4");
+			return -1;
+		}
+		blocks = size / sfs.f_bsize;
+		if (ioctl(rootfd, EXT4_IOC_RESIZE_FS, &blocks) < 0) {
+			SYSERROR("failed to resize %s online", dev);
+			return -1;
+		}
+		return 0;
+	}
+
+	// e2fsck exits 1 when it fixed something, which is fine
+	ret = run_fs_tool("e2fsck", "-fp", dev);
+	if (ret < 0 || !WIFEXITED(ret) || WEXITSTATUS(ret) > 1) {
+		ERROR("filesystem check of %s failed", dev);
+		return -1;
+	}
+	ret = run_fs_tool("resize2fs", NULL, dev);
+	if (ret < 0 || !WIFEXITED(ret) || WEXITSTATUS(ret) != 0) {
+		ERROR("failed to resize the filesystem on %s", dev);
+		return -1;
+	}
+	return 0;
+}
+
 static char *linkderef(char *path, char *dest)
 {
 	struct stat sbuf;
@@ -286,7 +372,7 @@ static int detect_fs(struct bdev *bdev, char *type, int len)
 	if (unshare(CLONE_NEWNS) < 0)
 		exit(1);
 
-	ret = mount_unknow_fs(srcdev, bdev->dest, 0);
+	ret = mount_unknow_fs(srcdev, bdev->dest, 0, NULL);
 	if (ret < 0) {
 		ERROR("failed mounting %s onto %s to detect fstype", srcdev, bdev->dest);
 		exit(1);
@@ -725,6 +811,79 @@ static int zfs_create(struct bdev *bdev, const char *dest, const char *n,
 	exit(1);
 }
 
+/*
+ * lxc's zfs containers are datasets rather than zvols, so there is no fs to
+ * grow; raise the dataset's quota instead.
+ */
+/* read numeric property @prop of zfs dataset @dataset, 0 if it is unset */
+static int zfs_get_prop(const char *dataset, const char *prop,
+			unsigned long *val)
+{
+	struct lxc_popen_FILE *f;
+	char cmd[MAXPATHLEN], output[32], *end;
+	int ret, status;
+
+	ret = snprintf(cmd, MAXPATHLEN, "zfs get -Hp -o value %s %s 2>/dev/null",
+		       prop, dataset);
+	if (ret < 0 || ret >= MAXPATHLEN)
+		return -1;
+
+	f = lxc_popen(cmd);
+	if (f == NULL) {
+		SYSERROR("popen failed");
+		return -1;
+	}
+	ret = fgets(output, sizeof(output), f->f) == NULL;
+	status = lxc_pclose(f);
+	if (ret || WEXITSTATUS(status))
+		return -1;
+
+	errno = 0;
+	*val = strtoul(output, &end, 10);
+	if (errno || end == output || (*end != '\n' && *end != '\0'))
+		return -1;
+	return 0;
+}
+
+static int zfs_resize(struct bdev *bdev, unsigned long newsize, int rootfd)
+{
+	char output[MAXPATHLEN], option[50], *p;
+	unsigned long cursize;
+	int ret;
+	pid_t pid;
+
+	if (!zfs_list_entry(bdev->src, output, MAXPATHLEN)) {
+		ERROR("Error: zfs entry for %s not found", bdev->src);
+		return -1;
+	}
+	if ((p = index(output, ' ')) == NULL)
+		return -1;
+	*p = '\0';
+
+	// without a quota yet, the new one must at least hold what is there
+	if (zfs_get_prop(output, "refquota", &cursize) < 0 ||
+	    (!cursize && zfs_get_prop(output, "referenced", &cursize) < 0)) {
+		ERROR("Error getting size of %s", output);
+		return -1;
+	}
+	if (newsize <= cursize) {
+		ERROR("%s is already %lu bytes, not shrinking", output, cursize);
+		return -1;
+	}
+
+	ret = snprintf(option, 50, "refquota=%lu", newsize);
+	if (ret < 0 || ret >= 50)
+		return -1;
+	if ((pid = fork()) < 0)
+		return -1;
+	if (pid)
+		return wait_for_pid(pid);
+
+	process_unlock(); // we're no longer sharing
+	execlp("zfs", "zfs", "set", option, output, NULL);
+	exit(1);
+}
+
 struct bdev_ops zfs_ops = {
 	.detect = &zfs_detect,
 	.mount = &zfs_mount,
@@ -732,6 +891,7 @@ struct bdev_ops zfs_ops = {
 	.clone_paths = &zfs_clonepaths,
 	.destroy = &zfs_destroy,
 	.create = &zfs_create,
+	.resize = &zfs_resize,
 };
 
 //
@@ -782,7 +942,7 @@ static int lvm_mount(struct bdev *bdev)
 		return -22;
 	/* if we might pass in data sometime, then we'll have to enrich
 	 * mount_unknow_fs */
-	return mount_unknow_fs(bdev->src, bdev->dest, 0);
+	return mount_unknow_fs(bdev->src, bdev->dest, 0, NULL);
 }
 
 static int lvm_umount(struct bdev *bdev)
@@ -1062,6 +1222,46 @@ static int lvm_destroy(struct bdev *orig)
 	return wait_for_pid(pid);
 }
 
+static int lvm_resize(struct bdev *bdev, unsigned long newsize, int rootfd)
+{
+	unsigned long cursize;
+	char sz[24];
+	int ret;
+	pid_t pid;
+
+	if (blk_getsize(bdev, &cursize) < 0) {
+		ERROR("Error getting size of %s", bdev->src);
+		return -1;
+	}
+	if (newsize <= cursize) {
+		ERROR("%s is already %lu bytes, not shrinking", bdev->src, cursize);
+		return -1;
+	}
+
+	// lvextend default size is in M, not bytes.
+	ret = snprintf(sz, 24, "%lu", newsize/1000000);
+	if (ret < 0 || ret >= 24)
+		return -1;
+	if ((pid = fork()) < 0) {
+		SYSERROR("failed fork");
+		return -1;
+	}
+	if (pid > 0) {
+		if (wait_for_pid(pid) < 0) {
+			ERROR("Error extending %s", bdev->src);
+			return -1;
+		}
+	} else {
+		process_unlock(); // we're no longer sharing
+		execlp("lvextend", "lvextend", "-L", sz, bdev->src, (char *)NULL);
+		exit(1);
+	}
+
+	if (blk_getsize(bdev, &newsize) < 0)
+		return -1;
+	return grow_fs(bdev->src, newsize, rootfd);
+}
+
 #define DEFAULT_FS_SIZE 1024000000
 #define DEFAULT_FSTYPE "ext3"
 static int lvm_create(struct bdev *bdev, const char *dest, const char *n,
@@ -1131,6 +1331,7 @@ struct bdev_ops lvm_ops = {
 	.clone_paths = &lvm_clonepaths,
 	.destroy = &lvm_destroy,
 	.create = &lvm_create,
+	.resize = &lvm_resize,
 };
 
 //
@@ -1510,7 +1711,8 @@ static int loop_mount(struct bdev *bdev)
 		goto out;
 	}
 
-	ret = mount_unknow_fs(loname, bdev->dest, 0);
+	// discard lets the loop driver punch freed blocks out of the image
+	ret = mount_unknow_fs(loname, bdev->dest, 0, "discard");
 	if (ret < 0)
 		ERROR("Error mounting %s\n", bdev->src);
 	else
@@ -1542,20 +1744,26 @@ static int loop_umount(struct bdev *bdev)
 	return ret;
 }
 
-static int do_loop_create(const char *path, unsigned long size, const char *fstype)
+/*
+ * Create a loop image of @size bytes.  It is sparse, so it only takes up
+ * what the fs in it uses, unless @prealloc asks for all of the space to be
+ * reserved up front.
+ */
+static int do_loop_create(const char *path, unsigned long size, const char *fstype,
+		int prealloc)
 {
 	int fd, ret;
 	// create the new loopback file.
 	fd = creat(path, S_IRUSR|S_IWUSR);
 	if (fd < 0)
 		return -1;
-	if (lseek(fd, size, SEEK_SET) < 0) {
-		SYSERROR("Error seeking to set new loop file size");
+	if (ftruncate(fd, size) < 0) {
+		SYSERROR("Error setting new loop file size");
 		close(fd);
 		return -1;
 	}
-	if (write(fd, "1", 1) != 1) {
-		SYSERROR("Error creating new loop file");
+	if (prealloc && (errno = posix_fallocate(fd, 0, size)) != 0) {
+		SYSERROR("Error allocating space for new loop file");
 		close(fd);
 		return -1;
 	}
@@ -1635,7 +1843,7 @@ static int loop_clonepaths(struct bdev *orig, struct bdev *new, const char *oldn
 		if (!newsize)
 			size = DEFAULT_FS_SIZE; // default to 1G
 	}
-	return do_loop_create(srcdev, size, fstype);
+	return do_loop_create(srcdev, size, fstype, 0);
 }
 
 static int loop_create(struct bdev *bdev, const char *dest, const char *n,
@@ -1683,7 +1891,7 @@ static int loop_create(struct bdev *bdev, const char *dest, const char *n,
 		return -1;
 	}
 
-	return do_loop_create(srcdev, sz, fstype);
+	return do_loop_create(srcdev, sz, fstype, specs->prealloc);
 }
 
 static int loop_destroy(struct bdev *orig)
@@ -1691,6 +1899,96 @@ static int loop_destroy(struct bdev *orig)
 	return unlink(orig->src + 5);
 }
 
+/*
+ * Find the loop device which a running container has attached to @file.
+ */
+static int find_attached_loopdev(const char *file, char *namep)
+{
+	struct dirent dirent, *direntp;
+	char path[MAXPATHLEN], backing[MAXPATHLEN], *real;
+	DIR *dir;
+	FILE *f;
+	int ret, found = 0;
+
+	real = realpath(file, NULL);
+	if (!real)
+		return -1;
+	dir = opendir("/sys/block");
+	if (!dir) {
+		SYSERROR("Error opening /sys/block");
+		free(real);
+		return -1;
+	}
+	while (!readdir_r(dir, &dirent, &direntp)) {
+		if (!direntp)
+			break;
+		if (strncmp(direntp->d_name, "loop", 4) != 0)
+			continue;
+		ret = snprintf(path, MAXPATHLEN, "/sys/block/%s/loop/backing_file",
+				direntp->d_name);
+		if (ret < 0 || ret >= MAXPATHLEN)
+			continue;
+		f = fopen(path, "r");
+		if (!f)
+			continue;
+		if (fgets(backing, MAXPATHLEN, f)) {
+			backing[strcspn(backing, "\n")] = '\0';
+			if (strcmp(backing, real) == 0) {
+				snprintf(namep, 100, "/dev/%s", direntp->d_name);
+				found = 1;
+			}
+		}
+		fclose(f);
+		if (found)
+			break;
+	}
+	closedir(dir);
+	free(real);
+	return found ? 0 : -1;
+}
+
+static int loop_resize(struct bdev *bdev, unsigned long newsize, int rootfd)
+{
+	const char *file = bdev->src + 5;
+	char loname[100];
+	struct stat sb;
+	int fd, ret;
+
+	if (stat(file, &sb) < 0) {
+		SYSERROR("Error stating %s", file);
+		return -1;
+	}
+	if (newsize <= sb.st_size) {
+		ERROR("%s is already %lu bytes, not shrinking", file,
+			(unsigned long)sb.st_size);
+		return -1;
+	}
+	if (truncate(file, newsize) < 0) {
+		SYSERROR("Error growing %s", file);
+		return -1;
+	}
+	if (rootfd < 0)
+		return grow_fs(file, newsize, -1);
+
+	// tell the loop device attached to the running container
+	if (find_attached_loopdev(file, loname) < 0) {
+		ERROR("No loop device found for %s", file);
+		return -1;
+	}
+	fd = open(loname, O_RDONLY);
+	if (fd < 0) {
+		SYSERROR("Error opening %s", loname);
+		return -1;
+	}
+	ret = ioctl(fd, LOOP_SET_CAPACITY, 0);
+	close(fd);
+	if (ret < 0) {
+		SYSERROR("Error updating capacity of %s", loname);
+		return -1;
+	}
+	return grow_fs(loname, newsize, rootfd);
+}
+
 struct bdev_ops loop_ops = {
 	.detect = &loop_detect,
 	.mount = &loop_mount,
@@ -1698,6 +1996,7 @@ struct bdev_ops loop_ops = {
 	.clone_paths = &loop_clonepaths,
 	.destroy = &loop_destroy,
 	.create = &loop_create,
+	.resize = &loop_resize,
 };
 
 //
@@ -1711,12 +2010,26 @@ static int overlayfs_detect(const char *path)
 	return 0;
 }
 
-//
-// XXXXXXX plain directory bind mount ops
-//
+/*
+ * An overlayfs src is 'overlayfs:lower1:lower2:...:upper', where lower1 is
+ * the topmost read-only layer.  Split a copy of the part after 'overlayfs:'
+ * into the lowerdir list and the upperdir.
+ */
+static int overlayfs_split(char *p, char **lower, char **upper)
+{
+	char *u = rindex(p, ':');
+
+	if (!u || u == p)
+		return -22;
+	*u = '\0';
+	*lower = p;
+	*upper = u + 1;
+	return 0;
+}
+
 static int overlayfs_mount(struct bdev *bdev)
 {
-	char *options, *dup, *lower, *upper;
+	char *options, *dup, *lower, *upper, *work, *p;
 	int len;
 	int ret;
 
@@ -1725,26 +2038,39 @@ static int overlayfs_mount(struct bdev *bdev)
 	if (!bdev->src || !bdev->dest)
 		return -22;
 
-	//  separately mount it first
-	//  mount -t overlayfs -oupperdir=${upper},lowerdir=${lower} lower dest
 	dup = alloca(strlen(bdev->src)+1);
 	strcpy(dup, bdev->src);
-	if (!(lower = index(dup, ':')))
+	if (overlayfs_split(dup + 10, &lower, &upper) < 0)
 		return -22;
-	if (!(upper = index(++lower, ':')))
-		return -22;
-	*upper = '\0';
-	upper++;
 
-	// TODO We should check whether bdev->src is a blockdev, and if so
-	// but for now, only support overlays of a basic directory
+	// upstream overlay needs a workdir on the same fs as the upperdir
+	len = strlen(upper) + strlen("/olwork") + 1;
+	work = alloca(len);
+	strcpy(work, upper);
+	if ((p = rindex(work, '/')) == NULL || p == work)
+		return -22;
+	strcpy(p, "/olwork");
+	if (mkdir_p(work, 0755) < 0) {
+		SYSERROR("overlayfs: error creating workdir %s", work);
+		return -1;
+	}
 
-	len = strlen(lower) + strlen(upper) + strlen("upperdir=,lowerdir=") + 1;
+	//  mount -t overlay -oupperdir=${upper},lowerdir=${lower},workdir=${work} lower dest
+	len = strlen(lower) + strlen(upper) + strlen(work) +
+		strlen("upperdir=,lowerdir=,workdir=") + 1;
 	options = alloca(len);
-	ret = snprintf(options, len, "upperdir=%s,lowerdir=%s", upper, lower);
+	ret = snprintf(options, len, "upperdir=%s,lowerdir=%s,workdir=%s",
+			upper, lower, work);
 	if (ret < 0 || ret >= len)
 		return -1;
-	ret = mount(lower, bdev->dest, "overlayfs", MS_MGC_VAL, options);
+	ret = mount(lower, bdev->dest, "overlay", MS_MGC_VAL, options);
+	if (ret < 0 && errno == ENODEV && !index(lower, ':')) {
+		// older out-of-tree overlayfs: one lowerdir, no workdir
+		ret = snprintf(options, len, "upperdir=%s,lowerdir=%s", upper, lower);
+		if (ret < 0 || ret >= len)
+			return -1;
+		ret = mount(lower, bdev->dest, "overlayfs", MS_MGC_VAL, options);
+	}
 	if (ret < 0)
 		SYSERROR("overlayfs: error mounting %s onto %s options %s",
 			lower, bdev->dest, options);
@@ -1763,6 +2089,87 @@ static int overlayfs_umount(struct bdev *bdev)
 	return umount(bdev->dest);
 }
 
+static bool dir_is_empty(const char *path)
+{
+	DIR *dir;
+	struct dirent dirent, *direntp;
+	bool empty = true;
+
+	dir = opendir(path);
+	if (!dir)
+		return false;
+	while (!readdir_r(dir, &dirent, &direntp)) {
+		if (!direntp)
+			break;
+		if (!strcmp(direntp->d_name, ".") ||
+		    !strcmp(direntp->d_name, ".."))
+			continue;
+		empty = false;
+		break;
+	}
+	closedir(dir);
+	return empty;
+}
+
+/*
+ * Return the (allocated) path of the first free 'layerN' next to the
+ * overlayfs upper dir @upper, or NULL on error.
+ */
+static char *overlayfs_layer_path(const char *upper)
+{
+	char *layer, *p;
+	int i, ret, len;
+
+	len = strlen(upper) + 20;
+	if (!(layer = malloc(len)))
+		return NULL;
+	strcpy(layer, upper);
+	if ((p = rindex(layer, '/')) == NULL) {
+		free(layer);
+		return NULL;
+	}
+	p++;
+	for (i = 0; ; i++) {
+		ret = snprintf(p, len - (p - layer), "layer%d", i);
+		if (ret < 0 || ret >= len - (p - layer)) {
+			free(layer);
+			return NULL;
+		}
+		if (access(layer, F_OK) < 0 && errno == ENOENT)
+			break;
+	}
+	return layer;
+}
+
+/*
+ * Turn the overlayfs upper dir @upper into the read-only layer @layer: it
+ * is renamed, and an empty upper dir with the same ownership and mode is
+ * put in its place.  On error @upper is left as it was.
+ */
+static int overlayfs_push_upper(const char *upper, const char *layer)
+{
+	struct stat sb;
+
+	if (stat(upper, &sb) < 0) {
+		SYSERROR("error: stat %s", upper);
+		return -1;
+	}
+	if (rename(upper, layer) < 0) {
+		SYSERROR("error: rename %s to %s", upper, layer);
+		return -1;
+	}
+	if (mkdir(upper, sb.st_mode & 07777) < 0 ||
+			chown(upper, sb.st_uid, sb.st_gid) < 0) {
+		SYSERROR("error: recreating %s", upper);
+		rmdir(upper);
+		if (rename(layer, upper) < 0)
+			SYSERROR("error: restoring %s from %s", upper, layer);
+		return -1;
+	}
+	INFO("overlayfs: pushed %s down into %s", upper, layer);
+	return 0;
+}
+
 static int overlayfs_clonepaths(struct bdev *orig, struct bdev *new, const char *oldname,
 		const char *cname, const char *oldpath, const char *lxcpath, int snap,
 		unsigned long newsize)
@@ -1814,44 +2221,77 @@ static int overlayfs_clonepaths(struct bdev *orig, struct bdev *new, const char
 		if (ret < 0 || ret >= len)
 			return -ENOMEM;
 	} else if (strcmp(orig->type, "overlayfs") == 0) {
-		// What exactly do we want to do here?
-		// I think we want to use the original lowerdir, with a
-		// private delta which is originally rsynced from the
-		// original delta
-		char *osrc, *odelta, *nsrc, *ndelta;
+		/*
+		 * Push the original's upper dir down into a new read-only
+		 * layer, give the original a fresh upper dir, and stack the
+		 * new container's private upper dir on top of the same layers.
+		 * No data is copied, and an untouched upper is not pushed, so
+		 * repeated snapshots end up sharing the same layers.
+		 */
+		char *osrc, *olower, *oupper, *ndelta, *layer = NULL;
+		char *nosrc = NULL;
 		int len, ret;
+
 		if (!(osrc = strdup(orig->src)))
-			return -22;
-		nsrc = index(osrc, ':') + 1;
-		if (nsrc != osrc + 10 || (odelta = index(nsrc, ':')) == NULL) {
+			return -ENOMEM;
+		if (strncmp(osrc, "overlayfs:", 10) != 0 ||
+				overlayfs_split(osrc + 10, &olower, &oupper) < 0) {
 			free(osrc);
 			return -22;
 		}
-		*odelta = '\0';
-		odelta++;
-		ndelta = dir_new_path(odelta, oldname, cname, oldpath, lxcpath);
+		ndelta = dir_new_path(oupper, oldname, cname, oldpath, lxcpath);
 		if (!ndelta) {
 			free(osrc);
 			return -ENOMEM;
 		}
-		if (do_rsync(odelta, ndelta) < 0) {
-			free(osrc);
-			free(ndelta);
-			ERROR("copying overlayfs delta");
-			return -1;
+		if (mkdir_p(ndelta, 0755) < 0) {
+			SYSERROR("error: mkdir %s", ndelta);
+			goto err_ovl;
 		}
-		len = strlen(nsrc) + strlen(ndelta) + 12;
+		if (!dir_is_empty(oupper)) {
+			if (!(layer = overlayfs_layer_path(oupper)))
+				goto err_ovl;
+			// the original now runs on top of the pushed layer too
+			len = strlen(layer) + strlen(olower) + strlen(oupper) + 13;
+			nosrc = malloc(len);
+			if (!nosrc)
+				goto err_ovl;
+			ret = snprintf(nosrc, len, "overlayfs:%s:%s:%s",
+					layer, olower, oupper);
+			if (ret < 0 || ret >= len)
+				goto err_ovl;
+		}
+		len = (layer ? strlen(layer) + 1 : 0) + strlen(olower) +
+			strlen(ndelta) + 12;
 		new->src = malloc(len);
-		if (!new->src) {
-			free(osrc);
-			free(ndelta);
-			return -ENOMEM;
+		if (!new->src)
+			goto err_ovl;
+		ret = snprintf(new->src, len, "overlayfs:%s%s%s:%s",
+				layer ? layer : "", layer ? ":" : "", olower, ndelta);
+		if (ret < 0 || ret >= len)
+			goto err_ovl;
+		/*
+		 * Push last, once nothing else can fail: after it the
+		 * original's data is only reachable through nosrc, which
+		 * bdev_copy() must get to write into its config.
+		 */
+		if (layer) {
+			if (overlayfs_push_upper(oupper, layer) < 0)
+				goto err_ovl;
+			free(orig->src);
+			orig->src = nosrc;
 		}
-		ret = snprintf(new->src, len, "overlayfs:%s:%s", nsrc, ndelta);
 		free(osrc);
 		free(ndelta);
-		if (ret < 0 || ret >= len)
-			return -ENOMEM;
+		free(layer);
+		return 0;
+
+err_ovl:
+		free(osrc);
+		free(ndelta);
+		free(layer);
+		free(nosrc);
+		return -1;
 	} else {
 		ERROR("overlayfs clone of %s container is not yet supported",
 			orig->type);
@@ -1869,7 +2309,8 @@ int overlayfs_destroy(struct bdev *orig)
 
 	if (strncmp(orig->src, "overlayfs:", 10) != 0)
 		return -22;
-	upper = index(orig->src + 10, ':');
+	// only the upper dir is ours; any lower layers are shared
+	upper = rindex(orig->src + 10, ':');
 	if (!upper)
 		return -22;
 	upper++;
@@ -1955,6 +2396,27 @@ void bdev_put(struct bdev *bdev)
 	free(bdev);
 }
 
+int bdev_get_usage(struct bdev *bdev, unsigned long *allocated,
+			unsigned long *apparent)
+{
+	struct stat sb;
+
+	if (strcmp(bdev->type, "loop") == 0) {
+		if (stat(bdev->src + 5, &sb) < 0)
+			return -1;
+		*allocated = (unsigned long)sb.st_blocks * 512;
+		*apparent = sb.st_size;
+		return 0;
+	}
+	if (bdev->src && stat(bdev->src, &sb) == 0 && S_ISBLK(sb.st_mode)) {
+		if (blk_getsize(bdev, apparent) < 0)
+			return -1;
+		*allocated = *apparent;
+		return 0;
+	}
+	return -1;
+}
+
 struct bdev *bdev_get(const char *type)
 {
 	int i;
@@ -2008,11 +2470,17 @@ struct bdev *bdev_init(const char *src, const char *dst, const char *data)
 /*
  * If we're not snaphotting, then bdev_copy becomes a simple case of mount
  * the original, mount the new, and rsync the contents.
+ *
+ * Snapshotting an overlayfs container changes the original's storage path
+ * as well (its upper dir gets pushed down into a new shared layer).  In that
+ * case *orig_src is set to the original's new, allocated src, which the
+ * caller must save even if the copy itself failed; otherwise it is set to
+ * NULL.
  */
 struct bdev *bdev_copy(const char *src, const char *oldname, const char *cname,
 			const char *oldpath, const char *lxcpath, const char *bdevtype,
 			int snap, const char *bdevdata, unsigned long newsize,
-			int *needs_rdep)
+			int *needs_rdep, char **orig_src)
 {
 	struct bdev *orig, *new;
 	pid_t pid;
@@ -2054,10 +2522,18 @@ struct bdev *bdev_copy(const char *src, const char *oldname, const char *cname,
 	if (!bdevtype && snap && strcmp(orig->type , "dir") == 0)
 		bdevtype = "overlayfs";
 
+	/*
+	 * An overlayfs snapshot keeps using the original's rootfs (or its
+	 * layers) as lower dirs, so the original must not go away under it.
+	 */
 	*needs_rdep = 0;
-	if (bdevtype && strcmp(orig->type, "dir") == 0 &&
+	*orig_src = NULL;
+	if (bdevtype && (strcmp(orig->type, "dir") == 0 ||
+			strcmp(orig->type, "overlayfs") == 0) &&
 			strcmp(bdevtype, "overlayfs") == 0)
 		*needs_rdep = 1;
+	else if (!bdevtype && snap && strcmp(orig->type, "overlayfs") == 0)
+		*needs_rdep = 1;
 
 	new = bdev_get(bdevtype ? bdevtype : orig->type);
 	if (!new) {
@@ -2073,6 +2549,13 @@ struct bdev *bdev_copy(const char *src, const char *oldname, const char *cname,
 		return NULL;
 	}
 
+	if (strcmp(orig->src, src) != 0 && !(*orig_src = strdup(orig->src))) {
+		ERROR("out of memory");
+		bdev_put(orig);
+		bdev_put(new);
+		return NULL;
+	}
+
 	pid = fork();
 	if (pid < 0) {
 		SYSERROR("fork");
@@ -39,6 +39,7 @@ struct bdev;
 struct bdev_specs {
 	char *fstype;
 	unsigned long fssize;  // fs size in bytes
+	int prealloc;  // allocate loop images up front rather than sparse
 	struct {
 		char *zfsroot;
 	} zfs;
@@ -62,6 +63,11 @@ struct bdev_ops {
 	int (*clone_paths)(struct bdev *orig, struct bdev *new, const char *oldname,
 			const char *cname, const char *oldpath, const char *lxcpath,
 			int snap, unsigned long newsize);
+	/*
+	 * grow the storage and the fs on it to newsize bytes.  rootfd is
+	 * the mounted root of the running container, or -1 if it is stopped.
+	 */
+	int (*resize)(struct bdev *bdev, unsigned long newsize, int rootfd);
 };
 
 /*
@@ -93,17 +99,25 @@ char *overlayfs_getlower(char *p);
  * other backing stores, this will allow additional options.  In particular,
  * "overlayfs:/var/lib/lxc/canonical/rootfs:/var/lib/lxc/c1/delta" will mean
  * use /var/lib/lxc/canonical/rootfs as lower dir, and /var/lib/lxc/c1/delta
- * as the upper, writeable layer.
+ * as the upper, writeable layer.  More read-only layers may be stacked in
+ * between, topmost first, as in
+ * "overlayfs:/var/lib/lxc/c1/layer0:/var/lib/lxc/canonical/rootfs:/var/lib/lxc/c1/delta".
  */
 struct bdev *bdev_init(const char *src, const char *dst, const char *data);
 
 struct bdev *bdev_copy(const char *src, const char *oldname, const char *cname,
 			const char *oldpath, const char *lxcpath, const char *bdevtype,
 			int snap, const char *bdevdata, unsigned long newsize,
-			int *needs_rdep);
+			int *needs_rdep, char **orig_src);
 struct bdev *bdev_create(const char *dest, const char *type,
 			const char *cname, struct bdev_specs *specs);
 void bdev_put(struct bdev *bdev);
+/*
+ * Space used by the storage (allocated), and its size as seen by the
+ * container (apparent), in bytes.  Only known for loop and block devices.
+ */
+int bdev_get_usage(struct bdev *bdev, unsigned long *allocated,
+			unsigned long *apparent);
 
 /* define constants if the kernel/glibc headers don't define them */
 #ifndef MS_DIRSYNC
@@ -106,6 +106,8 @@ static const char *lxc_cmd_str(lxc_cmd_t cmd)
 		[LXC_CMD_GET_CLONE_FLAGS] = "get_clone_flags",
 		[LXC_CMD_GET_CGROUP]      = "get_cgroup",
 		[LXC_CMD_GET_CONFIG_ITEM] = "get_config_item",
+		[LXC_CMD_GET_START_TRACE] = "get_start_trace",
+		[LXC_CMD_ZYGOTE_RELEASE]  = "zygote_release",
 	};
 
 	if (cmd >= LXC_CMD_MAX)
@@ -503,6 +505,105 @@ out:
 	return lxc_cmd_rsp_send(fd, &rsp);
 }
 
+/*
+ * lxc_cmd_get_start_trace: Get the start phase timings of the container
+ *
+ * @name     : name of container to connect to
+ * @lxcpath  : the lxcpath in which the container is running
+ * @entries  : set to the trace entries, which the caller must free()
+ *
+ * Returns the number of entries on success, < 0 on failure
+ */
+int lxc_cmd_get_start_trace(const char *name, const char *lxcpath,
+			    struct lxc_trace_entry **entries)
+{
+	int ret, stopped;
+	struct lxc_cmd_rr cmd = {
+		.req = { .cmd = LXC_CMD_GET_START_TRACE },
+	};
+
+	ret = lxc_cmd(name, &cmd, &stopped, lxcpath);
+	if (ret < 0)
+		return ret;
+
+	/* rsp.data is only ours if data followed the response */
+	if (!cmd.rsp.datalen) {
+		*entries = NULL;
+		return cmd.rsp.ret < 0 ? -1 : 0;
+	}
+	if (cmd.rsp.ret < 0 ||
+	    cmd.rsp.datalen % sizeof(struct lxc_trace_entry)) {
+		free(cmd.rsp.data);
+		return -1;
+	}
+	*entries = cmd.rsp.data;
+	return cmd.rsp.datalen / sizeof(struct lxc_trace_entry);
+}
+
+static int lxc_cmd_get_start_trace_callback(int fd, struct lxc_cmd_req *req,
+					    struct lxc_handler *handler)
+{
+	struct lxc_start_trace *t = handler->conf->start_trace;
+	struct lxc_cmd_rsp rsp = {
+		.data = t->entries,
+		.datalen = t->nr * sizeof(struct lxc_trace_entry),
+	};
+
+	return lxc_cmd_rsp_send(fd, &rsp);
+}
+
+/*
+ * lxc_cmd_zygote_release: Let a container parked by a zygote start exec
+ * its init
+ *
+ * @name     : name of container to connect to
+ * @lxcpath  : the lxcpath in which the container is running
+ * @argv     : the init to exec, or NULL for the one it was started with
+ *
+ * Returns 0 on success, < 0 on failure
+ */
+int lxc_cmd_zygote_release(const char *name, const char *lxcpath,
+			   char *const argv[])
+{
+	int ret, stopped, i, len = 0;
+	char buf[LXC_CMD_DATA_MAX];
+	struct lxc_cmd_rr cmd = {
+		.req = { .cmd = LXC_CMD_ZYGOTE_RELEASE, .data = buf },
+	};
+
+	for (i = 0; argv && argv[i]; i++) {
+		size_t l = strlen(argv[i]) + 1;
+
+		if (len + l > sizeof(buf)) {
+			ERROR("command line too long to release '%s'", name);
+			return -E2BIG;
+		}
+		memcpy(buf + len, argv[i], l);
+		len += l;
+	}
+	cmd.req.datalen = len;
+
+	ret = lxc_cmd(name, &cmd, &stopped, lxcpath);
+	if (ret < 0)
+		return ret;
+	if (!ret) {
+		WARN("'%s' has stopped before being released", name);
+		return -1;
+	}
+
+	return cmd.rsp.ret;
+}
+
+static int lxc_cmd_zygote_release_callback(int fd, struct lxc_cmd_req *req,
+					   struct lxc_handler *handler)
+{
+	struct lxc_cmd_rsp rsp = {
+		.ret = lxc_zygote_release(handler, req->data, req->datalen),
+	};
+
+	return lxc_cmd_rsp_send(fd, &rsp);
+}
+
 /*
  * lxc_cmd_get_state: Get current state of the container
  *
@@ -734,6 +835,8 @@ static int lxc_cmd_process(int fd, struct lxc_cmd_req *req,
 		[LXC_CMD_GET_CLONE_FLAGS] = lxc_cmd_get_clone_flags_callback,
 		[LXC_CMD_GET_CGROUP]      = lxc_cmd_get_cgroup_callback,
 		[LXC_CMD_GET_CONFIG_ITEM] = lxc_cmd_get_config_item_callback,
+		[LXC_CMD_GET_START_TRACE] = lxc_cmd_get_start_trace_callback,
+		[LXC_CMD_ZYGOTE_RELEASE]  = lxc_cmd_zygote_release_callback,
 	};
 
 	if (req->cmd >= LXC_CMD_MAX) {
@@ -41,6 +41,8 @@ typedef enum {
 	LXC_CMD_GET_CLONE_FLAGS,
 	LXC_CMD_GET_CGROUP,
 	LXC_CMD_GET_CONFIG_ITEM,
+	LXC_CMD_GET_START_TRACE,
+	LXC_CMD_ZYGOTE_RELEASE,
 	LXC_CMD_MAX,
 } lxc_cmd_t;
 
@@ -78,6 +80,19 @@ extern char *lxc_cmd_get_cgroup_path(const char *name, const char *lxcpath,
 extern int lxc_cmd_get_clone_flags(const char *name, const char *lxcpath);
 extern char *lxc_cmd_get_config_item(const char *name, const char *item, const char *lxcpath);
 extern pid_t lxc_cmd_get_init_pid(const char *name, const char *lxcpath);
+struct lxc_trace_entry;
+/*
+ * Get the per-phase timings of the container's start.  Returns the number
+ * of entries in *entries, which the caller must free(), or < 0 on failure.
+ */
+extern int lxc_cmd_get_start_trace(const char *name, const char *lxcpath,
+				   struct lxc_trace_entry **entries);
+/*
+ * Release a container parked by a zygote start, exec'ing argv (or the
+ * command line it was started with if argv is NULL) as its init.
+ */
+extern int lxc_cmd_zygote_release(const char *name, const char *lxcpath,
+				  char *const argv[]);
 extern lxc_state_t lxc_cmd_get_state(const char *name, const char *lxcpath);
 extern int lxc_cmd_stop(const char *name, const char *lxcpath);
 
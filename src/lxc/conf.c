@@ -50,6 +50,8 @@
 #include <sys/mount.h>
 #include <sys/mman.h>
 #include <sys/prctl.h>
+#include <sys/poll.h>
+#include <spawn.h>
 
 #include <arpa/inet.h>
 #include <fcntl.h>
@@ -278,102 +280,302 @@ static struct caps_opt caps_opt[] = {
 static struct caps_opt caps_opt[] = {};
 #endif
 
-static int run_buffer(char *buffer)
+/*
+ * Hooks and network scripts are run by the engine below.  A script which
+ * is a plain command line (a path and words without any shell syntax) is
+ * posix_spawn'ed directly; anything else still goes through /bin/sh -c.
+ * Each script's stdout is logged line by line, and how long it ran is
+ * logged when it exits.
+ */
+struct hook_proc {
+	const char *script;
+	pid_t pid;
+	int fd;			/* read end of the script's stdout, or -1 */
+	size_t len;		/* bytes of a partial line in buf */
+	char buf[LXC_LOG_BUFFER_SIZE];
+	struct timespec start;
+};
+
+static bool hook_is_plain(const char *script)
 {
-	struct lxc_popen_FILE *f;
-	char *output;
-	int ret;
+	static const char plain[] =
+		"abcdefghijklmnopqrstuvwxyz"
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+		"0123456789/._-+,:@ ";
 
-	f = lxc_popen(buffer);
-	if (!f) {
-		SYSERROR("popen failed");
-		return -1;
+	return script[strspn(script, plain)] == '\0';
+}
+
+/* the old "script arg..." command line, for the shell */
+static char *hook_cmdline(const char *script, char **args)
+{
+	size_t size = strlen(script) + 1;
+	char *buffer;
+	int i;
+
+	for (i = 0; args[i]; i++)
+		size += strlen(args[i]) + 1;
+	buffer = malloc(size);
+	if (!buffer)
+		return NULL;
+	strcpy(buffer, script);
+	for (i = 0; args[i]; i++) {
+		strcat(buffer, " ");
+		strcat(buffer, args[i]);
 	}
+	return buffer;
+}
 
-	output = malloc(LXC_LOG_BUFFER_SIZE);
-	if (!output) {
-		ERROR("failed to allocate memory for script output");
-		lxc_pclose(f);
-		return -1;
+static int hook_spawn(struct hook_proc *h, const char *script, char **args)
+{
+	posix_spawn_file_actions_t fa;
+	posix_spawnattr_t attr;
+	sigset_t mask;
+	char **words = NULL, **argv, **shargv = NULL, *cmdline = NULL;
+	int pipefd[2], nwords = 0, nargs = 0, i, ret = -1;
+#if !(defined(__GLIBC__) && __GLIBC_PREREQ(2, 34))
+	int *fds = NULL, nfds;
+#endif
+
+	h->script = script;
+	h->pid = -1;
+	h->fd = -1;
+	h->len = 0;
+
+	for (nargs = 0; args[nargs]; nargs++)
+		;
+	if (hook_is_plain(script)) {
+		words = lxc_string_split(script, ' ');
+		if (!words)
+			return -1;
+		nwords = lxc_array_len((void **)words);
+	}
+	if (nwords) {
+		argv = alloca((nwords + nargs + 1) * sizeof(char *));
+		for (i = 0; i < nwords; i++)
+			argv[i] = words[i];
+		for (i = 0; i < nargs; i++)
+			argv[nwords + i] = args[i];
+		argv[nwords + nargs] = NULL;
+		shargv = alloca((nwords + nargs + 2) * sizeof(char *));
+	} else {
+		cmdline = hook_cmdline(script, args);
+		if (!cmdline)
+			goto out;
+		argv = alloca(4 * sizeof(char *));
+		argv[0] = "sh";
+		argv[1] = "-c";
+		argv[2] = cmdline;
+		argv[3] = NULL;
 	}
 
-	while(fgets(output, LXC_LOG_BUFFER_SIZE, f->f))
-		DEBUG("script output: %s", output);
+	if (pipe2(pipefd, O_CLOEXEC) < 0) {
+		SYSERROR("failed to create pipe for script '%s'", script);
+		goto out;
+	}
 
-	free(output);
+	posix_spawn_file_actions_init(&fa);
+	posix_spawn_file_actions_adddup2(&fa, pipefd[1], STDOUT_FILENO);
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 34)
+	posix_spawn_file_actions_addclosefrom_np(&fa, STDERR_FILENO + 1);
+#else
+	/* the monitor's fds are not the script's business, see lxc_check_inherited() */
+	nfds = lxc_inherited_fds(&fds);
+	for (i = 0; i < nfds; i++) {
+		int flags = fcntl(fds[i], F_GETFD);
 
-	ret = lxc_pclose(f);
-	if (ret == -1) {
-		SYSERROR("Script exited on error");
-		return -1;
-	} else if (WIFEXITED(ret) && WEXITSTATUS(ret) != 0) {
-		ERROR("Script exited with status %d", WEXITSTATUS(ret));
-		return -1;
-	} else if (WIFSIGNALED(ret)) {
-		ERROR("Script terminated by signal %d (%s)", WTERMSIG(ret),
-		      strsignal(WTERMSIG(ret)));
-		return -1;
+		if (flags >= 0 && !(flags & FD_CLOEXEC))
+			posix_spawn_file_actions_addclose(&fa, fds[i]);
 	}
+	free(fds);
+#endif
+	/* lxc blocks signals in the monitor, don't pass that on */
+	posix_spawnattr_init(&attr);
+	sigemptyset(&mask);
+	posix_spawnattr_setsigmask(&attr, &mask);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+
+	clock_gettime(CLOCK_MONOTONIC, &h->start);
+	if (nwords) {
+		ret = posix_spawnp(&h->pid, argv[0], &fa, &attr, argv, environ);
+		if (ret == ENOEXEC) {
+			/* a script without #!, which the shell runs itself */
+			shargv[0] = "sh";
+			shargv[1] = argv[0];
+			for (i = 1; argv[i]; i++)
+				shargv[i + 1] = argv[i];
+			shargv[i + 1] = NULL;
+			ret = posix_spawn(&h->pid, "/bin/sh", &fa, &attr,
+					  shargv, environ);
+		}
+	} else
+		ret = posix_spawn(&h->pid, "/bin/sh", &fa, &attr, argv, environ);
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&fa);
+	close(pipefd[1]);
 
-	return 0;
+	if (ret) {
+		errno = ret;
+		SYSERROR("failed to execute script '%s'", script);
+		close(pipefd[0]);
+		h->pid = -1;
+		ret = -1;
+		goto out;
+	}
+	h->fd = pipefd[0];
+	ret = 0;
+
+out:
+	if (words)
+		lxc_free_array((void **)words, free);
+	free(cmdline);
+	return ret;
 }
 
-static int run_script_argv(const char *name, const char *section,
-		      const char *script, const char *hook, const char *lxcpath,
-		      char **argsin)
+/* log the complete lines read so far; everything if eof */
+static void hook_log_output(struct hook_proc *h, bool eof)
 {
-	int ret, i;
-	char *buffer;
-	size_t size = 0;
-
-	INFO("Executing script '%s' for container '%s', config section '%s'",
-	     script, name, section);
-
-	for (i=0; argsin && argsin[i]; i++)
-		size += strlen(argsin[i]) + 1;
+	char *p = h->buf, *nl;
 
-	size += strlen(hook) + 1;
+	while ((nl = memchr(p, '\n', h->len - (p - h->buf)))) {
+		*nl = '\0';
+		DEBUG("script output: %s", p);
+		p = nl + 1;
+	}
+	h->len -= p - h->buf;
+	memmove(h->buf, p, h->len);
+	if (h->len && (eof || h->len == sizeof(h->buf) - 1)) {
+		h->buf[h->len] = '\0';
+		DEBUG("script output: %s", h->buf);
+		h->len = 0;
+	}
+}
 
-	size += strlen(script);
-	size += strlen(name);
-	size += strlen(section);
-	size += 3;
+static int hook_reap(struct hook_proc *h)
+{
+	struct timespec end;
+	int status;
 
-	if (size > INT_MAX)
+	if (waitpid(h->pid, &status, 0) < 0) {
+		SYSERROR("Script exited on error");
 		return -1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	INFO("script '%s' took %.3f ms", h->script,
+	     (end.tv_sec - h->start.tv_sec) * 1000.0 +
+	     (end.tv_nsec - h->start.tv_nsec) / 1000000.0);
 
-	buffer = alloca(size);
-	if (!buffer) {
-		ERROR("failed to allocate memory");
+	if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+		ERROR("Script exited with status %d", WEXITSTATUS(status));
+		return -1;
+	} else if (WIFSIGNALED(status)) {
+		ERROR("Script terminated by signal %d (%s)", WTERMSIG(status),
+		      strsignal(WTERMSIG(status)));
 		return -1;
 	}
+	return 0;
+}
 
-	ret = snprintf(buffer, size, "%s %s %s %s", script, name, section, hook);
-	if (ret < 0 || ret >= size) {
-		ERROR("Script name too long");
+/*
+ * Run scripts[0..n) with args appended to each.  In parallel they all
+ * start at once, otherwise one after the other, stopping at the first
+ * failure.  Returns 0 if all of them succeeded.
+ */
+static int run_hooks(const char **scripts, int n, char **args, bool parallel)
+{
+	struct hook_proc *procs;
+	struct pollfd *pfds;
+	int i, first, batch, left, ret = 0;
+	ssize_t r;
+
+	procs = malloc(n * sizeof(*procs));
+	pfds = malloc(n * sizeof(*pfds));
+	if (!procs || !pfds) {
+		ERROR("failed to allocate memory for scripts");
+		free(procs);
+		free(pfds);
 		return -1;
 	}
 
-	for (i=0; argsin && argsin[i]; i++) {
-		int len = size-ret;
-		int rc;
-		rc = snprintf(buffer + ret, len, " %s", argsin[i]);
-		if (rc < 0 || rc >= len) {
-			ERROR("Script args too long");
-			return -1;
+	batch = parallel ? n : 1;
+	for (first = 0; first < n && !ret; first += batch) {
+		left = 0;
+		for (i = first; i < first + batch && i < n; i++) {
+			if (hook_spawn(&procs[i], scripts[i], args) < 0)
+				ret = -1;
+			else
+				left++;
+		}
+
+		while (left) {
+			int nfds = 0;
+
+			for (i = first; i < first + batch && i < n; i++) {
+				if (procs[i].fd < 0)
+					continue;
+				pfds[nfds].fd = procs[i].fd;
+				pfds[nfds].events = POLLIN;
+				nfds++;
+			}
+			if (poll(pfds, nfds, -1) < 0) {
+				if (errno == EINTR)
+					continue;
+				SYSERROR("failed to wait for script output");
+				ret = -1;
+				break;
+			}
+
+			for (i = first; i < first + batch && i < n; i++) {
+				struct hook_proc *h = &procs[i];
+				int j;
+
+				if (h->fd < 0)
+					continue;
+				for (j = 0; j < nfds; j++)
+					if (pfds[j].fd == h->fd)
+						break;
+				if (!pfds[j].revents)
+					continue;
+
+				r = read(h->fd, h->buf + h->len,
+					 sizeof(h->buf) - 1 - h->len);
+				if (r < 0 && errno == EINTR)
+					continue;
+				if (r > 0) {
+					h->len += r;
+					hook_log_output(h, false);
+					continue;
+				}
+				hook_log_output(h, true);
+				close(h->fd);
+				h->fd = -1;
+				left--;
+				if (hook_reap(h) < 0)
+					ret = -1;
+			}
+		}
+
+		/* only reached early if poll failed */
+		for (i = first; i < first + batch && i < n; i++) {
+			if (procs[i].fd < 0)
+				continue;
+			close(procs[i].fd);
+			hook_reap(&procs[i]);
 		}
-		ret += rc;
 	}
 
-	return run_buffer(buffer);
+	free(procs);
+	free(pfds);
+	return ret;
 }
 
 static int run_script(const char *name, const char *section,
 		      const char *script, ...)
 {
-	int ret;
-	char *buffer, *p;
-	size_t size = 0;
+	const char *scripts[1] = { script };
+	char **args;
+	char *p;
+	int i, n = 0;
 	va_list ap;
 
 	INFO("Executing script '%s' for container '%s', config section '%s'",
@@ -381,43 +583,19 @@ static int run_script(const char *name, const char *section,
 
 	va_start(ap, script);
 	while ((p = va_arg(ap, char *)))
-		size += strlen(p) + 1;
+		n++;
 	va_end(ap);
 
-	size += strlen(script);
-	size += strlen(name);
-	size += strlen(section);
-	size += 3;
-
-	if (size > INT_MAX)
-		return -1;
-
-	buffer = alloca(size);
-	if (!buffer) {
-		ERROR("failed to allocate memory");
-		return -1;
-	}
-
-	ret = snprintf(buffer, size, "%s %s %s", script, name, section);
-	if (ret < 0 || ret >= size) {
-		ERROR("Script name too long");
-		return -1;
-	}
-
+	args = alloca((n + 3) * sizeof(char *));
+	args[0] = (char *)name;
+	args[1] = (char *)section;
 	va_start(ap, script);
-	while ((p = va_arg(ap, char *))) {
-		int len = size-ret;
-		int rc;
-		rc = snprintf(buffer + ret, len, " %s", p);
-		if (rc < 0 || rc >= len) {
-			ERROR("Script args too long");
-			return -1;
-		}
-		ret += rc;
-	}
+	for (i = 0; i < n; i++)
+		args[2 + i] = va_arg(ap, char *);
 	va_end(ap);
+	args[2 + n] = NULL;
 
-	return run_buffer(buffer);
+	return run_hooks(scripts, 1, args, false);
 }
 
 static int find_fstype_cb(char* buffer, void *data)
@@ -1282,7 +1460,8 @@ char *mk_devtmpfs(const char *name, char *path, const char *lxcpath)
  * Do we want to add options for max size of /dev and a file to
  * specify which devices to create?
  */
-static int mount_autodev(const char *name, char *root, const char *lxcpath)
+static int mount_autodev(const char *name, char *root, const char *lxcpath,
+			 char *stamp)
 {
 	int ret;
 	struct stat s;
@@ -1291,6 +1470,7 @@ static int mount_autodev(const char *name, char *root, const char *lxcpath)
 	char devtmpfs_path[MAXPATHLEN];
 
 	INFO("Mounting /dev under %s\n", root);
+	*stamp = '\0';
 
 	ret = snprintf(host_path, MAXPATHLEN, "%s/%s/rootfs.dev", lxcpath, name);
 	if (ret < 0 || ret > MAXPATHLEN)
@@ -1318,6 +1498,12 @@ static int mount_autodev(const char *name, char *root, const char *lxcpath)
 		}
 		DEBUG("Bind mounting %s to %s", devtmpfs_path , path );
 		ret = mount(devtmpfs_path, path, NULL, MS_BIND, 0 );
+
+		/* this /dev outlives the container, remember (from the
+		 * host side) whether it was already populated */
+		if (snprintf(stamp, MAXPATHLEN, "%s.populated",
+			     devtmpfs_path) >= MAXPATHLEN)
+			*stamp = '\0';
 	} else {
 		/* Only mount a tmpfs on here if we don't already a mount */
 		if ( ! mount_check_fs( host_path, NULL ) ) {
@@ -1369,11 +1555,216 @@ struct lxc_devs lxc_devs[] = {
 	{ "console",	S_IFCHR | S_IRUSR | S_IWUSR,	       5, 1	},
 };
 
-static int setup_autodev(char *root)
+#define LXC_AUTODEV_TEMPLATE "/dev/.lxc/template"
+
+/*
+ * Host-wide /dev template, populated once per boot from lxc_devs.  Nodes an
+ * administrator adds to it are copied into every autodev container too.  It
+ * is built under a private name and renamed into place, so concurrent starts
+ * never see it half done.  Returns NULL if it can't be had, e.g. without a
+ * devtmpfs /dev or without the right to mknod.
+ */
+static const char *autodev_template(void)
+{
+	char tmp[MAXPATHLEN];
+	char path[MAXPATHLEN];
+	struct lxc_devs *d;
+	struct stat s;
+	mode_t cmask;
+	int i, ret;
+
+	if (stat(LXC_AUTODEV_TEMPLATE, &s) == 0 && S_ISDIR(s.st_mode))
+		return LXC_AUTODEV_TEMPLATE;
+
+	/* getpid() is 1 for every container started in a new pid namespace */
+	ret = snprintf(tmp, MAXPATHLEN, "%s.XXXXXX", LXC_AUTODEV_TEMPLATE);
+	if (ret < 0 || ret >= MAXPATHLEN)
+		return NULL;
+
+	if (!mkdtemp(tmp))
+		return NULL;
+	if (chmod(tmp, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH)) {
+		rmdir(tmp);
+		return NULL;
+	}
+
+	cmask = umask(S_IXUSR | S_IXGRP | S_IXOTH);
+	for (i = 0; i < sizeof(lxc_devs) / sizeof(lxc_devs[0]); i++) {
+		d = &lxc_devs[i];
+		ret = snprintf(path, MAXPATHLEN, "%s/%s", tmp, d->name);
+		if (ret < 0 || ret >= MAXPATHLEN)
+			break;
+		if (mknod(path, d->mode, makedev(d->maj, d->min)))
+			break;
+	}
+	umask(cmask);
+
+	if (i == sizeof(lxc_devs) / sizeof(lxc_devs[0]) &&
+	    rename(tmp, LXC_AUTODEV_TEMPLATE) == 0) {
+		INFO("Prepared the /dev template in %s", LXC_AUTODEV_TEMPLATE);
+		return LXC_AUTODEV_TEMPLATE;
+	}
+
+	/* either we can't mknod, or another start won the rename */
+	lxc_rmdir_onedev(tmp);
+	if (stat(LXC_AUTODEV_TEMPLATE, &s) == 0 && S_ISDIR(s.st_mode))
+		return LXC_AUTODEV_TEMPLATE;
+	return NULL;
+}
+
+/*
+ * Copy one device node into the container /dev.  Returns 1 if it had to be
+ * bind mounted instead, which is the case in a user namespace.  The node
+ * then keeps its host ownership.
+ */
+static int autodev_copy_node(const char *src, mode_t mode, dev_t rdev,
+			     const char *dst)
+{
+	FILE *pathfile;
+	struct stat s;
+
+	if (lstat(dst, &s) == 0) {
+		if ((s.st_mode & S_IFMT) == (mode & S_IFMT) && s.st_rdev == rdev)
+			return 0;
+		/* something else took its place in a kept /dev */
+		if (unlink(dst)) {
+			SYSERROR("Error replacing %s", dst);
+			return -1;
+		}
+	}
+
+	if (mknod(dst, mode, rdev) == 0 || errno == EEXIST)
+		return 0;
+
+	if (errno != EPERM) {
+		SYSERROR("Error creating %s", dst);
+		return -1;
+	}
+
+	pathfile = fopen(dst, "wb");
+	if (!pathfile) {
+		SYSERROR("Error creating %s", dst);
+		return -1;
+	}
+	fclose(pathfile);
+
+	if (mount(src, dst, NULL, MS_BIND, NULL)) {
+		SYSERROR("Failed bind mounting %s onto %s", src, dst);
+		return -1;
+	}
+
+	return 1;
+}
+
+static int autodev_copy_template(const char *template, const char *root,
+				 bool *bound)
+{
+	char src[MAXPATHLEN];
+	char dst[MAXPATHLEN];
+	struct dirent dirent, *direntp;
+	struct stat s;
+	DIR *dir;
+	int ret = 0;
+
+	dir = opendir(template);
+	if (!dir) {
+		SYSERROR("Failed to open %s", template);
+		return -1;
+	}
+
+	while (!readdir_r(dir, &dirent, &direntp)) {
+		if (!direntp)
+			break;
+		if (direntp->d_name[0] == '.')
+			continue;
+
+		ret = snprintf(src, MAXPATHLEN, "%s/%s", template, direntp->d_name);
+		if (ret < 0 || ret >= MAXPATHLEN)
+			goto out_err;
+		ret = snprintf(dst, MAXPATHLEN, "%s/dev/%s", root, direntp->d_name);
+		if (ret < 0 || ret >= MAXPATHLEN)
+			goto out_err;
+
+		if (lstat(src, &s) || !(S_ISCHR(s.st_mode) || S_ISBLK(s.st_mode)))
+			continue;
+
+		ret = autodev_copy_node(src, s.st_mode, s.st_rdev, dst);
+		if (ret < 0)
+			goto out_err;
+		if (ret > 0)
+			*bound = true;
+	}
+
+	closedir(dir);
+	return 0;
+
+out_err:
+	closedir(dir);
+	return -1;
+}
+
+/*
+ * Whether every node of the template is still in the container /dev, with
+ * the right type and device number.  Nodes in a /dev kept across starts can
+ * be removed or replaced in the meantime.
+ */
+static bool autodev_template_intact(const char *template, const char *root)
+{
+	char src[MAXPATHLEN];
+	char dst[MAXPATHLEN];
+	struct dirent dirent, *direntp;
+	struct stat s, d;
+	bool intact = true;
+	DIR *dir;
+	int ret;
+
+	dir = opendir(template);
+	if (!dir)
+		return false;
+
+	while (intact && !readdir_r(dir, &dirent, &direntp)) {
+		if (!direntp)
+			break;
+		if (direntp->d_name[0] == '.')
+			continue;
+
+		ret = snprintf(src, MAXPATHLEN, "%s/%s", template, direntp->d_name);
+		if (ret < 0 || ret >= MAXPATHLEN)
+			intact = false;
+		ret = snprintf(dst, MAXPATHLEN, "%s/dev/%s", root, direntp->d_name);
+		if (ret < 0 || ret >= MAXPATHLEN)
+			intact = false;
+		if (!intact || lstat(src, &s) ||
+		    !(S_ISCHR(s.st_mode) || S_ISBLK(s.st_mode)))
+			continue;
+
+		if (lstat(dst, &d) || (d.st_mode & S_IFMT) != (s.st_mode & S_IFMT) ||
+		    d.st_rdev != s.st_rdev) {
+			INFO("%s is missing or changed", dst);
+			intact = false;
+		}
+	}
+
+	closedir(dir);
+	return intact;
+}
+
+/*
+ * Fill the container /dev from the template, or from lxc_devs and the host
+ * /dev if there is none.  A /dev kept on the host devtmpfs across starts is
+ * stamped with the template it was filled from, so that later starts only
+ * check the nodes are still there.
+ */
+static int setup_autodev(char *root, const char *stamp)
 {
 	int ret;
 	struct lxc_devs *d;
 	char path[MAXPATHLEN];
+	char host[MAXPATHLEN];
+	char want[64], have[64];
+	const char *template;
+	struct stat s;
+	bool bound = false;
 	int i;
 	mode_t cmask;
 
@@ -1385,20 +1776,54 @@ static int setup_autodev(char *root)
 		return -1;
 	}
 
+	*want = '\0';
+	template = autodev_template();
+	if (template && !stat(template, &s))
+		snprintf(want, sizeof(want), "%llu.%lld.%09ld",
+			 (unsigned long long)s.st_ino, (long long)s.st_mtim.tv_sec,
+			 s.st_mtim.tv_nsec);
+
+	if (*want && *stamp) {
+		memset(have, 0, sizeof(have));
+		if (lxc_read_from_file(stamp, have, sizeof(have) - 1) > 0 &&
+		    !strcmp(have, want) &&
+		    autodev_template_intact(template, root)) {
+			INFO("/dev under %s is already populated\n", root);
+			return 0;
+		}
+	}
+
 	INFO("Populating /dev under %s\n", root);
 	cmask = umask(S_IXUSR | S_IXGRP | S_IXOTH);
-	for (i = 0; i < sizeof(lxc_devs) / sizeof(lxc_devs[0]); i++) {
-		d = &lxc_devs[i];
-		ret = snprintf(path, MAXPATHLEN, "%s/dev/%s", root, d->name);
-		if (ret < 0 || ret >= MAXPATHLEN)
-			return -1;
-		ret = mknod(path, d->mode, makedev(d->maj, d->min));
-		if (ret && errno != EEXIST) {
-			SYSERROR("Error creating %s\n", d->name);
-			return -1;
+	if (template) {
+		ret = autodev_copy_template(template, root, &bound);
+	} else {
+		for (i = 0; i < sizeof(lxc_devs) / sizeof(lxc_devs[0]); i++) {
+			d = &lxc_devs[i];
+			ret = snprintf(path, MAXPATHLEN, "%s/dev/%s", root, d->name);
+			if (ret < 0 || ret >= MAXPATHLEN)
+				break;
+			ret = snprintf(host, MAXPATHLEN, "/dev/%s", d->name);
+			if (ret < 0 || ret >= MAXPATHLEN)
+				break;
+			ret = autodev_copy_node(host, d->mode,
+						makedev(d->maj, d->min), path);
+			if (ret < 0)
+				break;
+			if (ret > 0)
+				bound = true;
 		}
+		ret = i < sizeof(lxc_devs) / sizeof(lxc_devs[0]) ? -1 : 0;
 	}
 	umask(cmask);
+	if (ret < 0)
+		return -1;
+
+	/* bind mounts go away with the container, so only a /dev made of
+	 * real nodes may be reused */
+	if (*want && *stamp && !bound &&
+	    lxc_write_to_file(stamp, want, strlen(want), false))
+		WARN("Failed to stamp %s", stamp);
 
 	INFO("Populated /dev under %s\n", root);
 	return 0;
@@ -1859,68 +2284,58 @@ static int mount_entry(const char *fsname, const char *target,
 	return 0;
 }
 
-static inline int mount_entry_on_systemfs(const struct mntent *mntent)
-{
-	unsigned long mntflags;
-	char *mntdata;
-	int ret;
-	FILE *pathfile = NULL;
-	char* pathdirname = NULL;
+#define LXC_MOUNT_CREATE_DIR	(1 << 0)
+#define LXC_MOUNT_CREATE_FILE	(1 << 1)
 
-	if (parse_mntopts(mntent->mnt_opts, &mntflags, &mntdata) < 0) {
-		ERROR("failed to parse mount option '%s'", mntent->mnt_opts);
-		return -1;
-	}
-
-	if (hasmntopt(mntent, "create=dir")) {
-		if (!mkdir_p(mntent->mnt_dir, 0755)) {
-			WARN("Failed to create mount target '%s'", mntent->mnt_dir);
-			ret = -1;
-		}
-	}
-
-	if (hasmntopt(mntent, "create=file") && access(mntent->mnt_dir, F_OK)) {
-		pathdirname = strdup(mntent->mnt_dir);
-		pathdirname = dirname(pathdirname);
-		mkdir_p(pathdirname, 0755);
-		pathfile = fopen(mntent->mnt_dir, "wb");
-		if (!pathfile) {
-			WARN("Failed to create mount target '%s'", mntent->mnt_dir);
-			ret = -1;
-		}
-		else
-			fclose(pathfile);
-	}
-
-	ret = mount_entry(mntent->mnt_fsname, mntent->mnt_dir,
-			  mntent->mnt_type, mntflags, mntdata);
-
-	if (hasmntopt(mntent, "optional") != NULL)
-		ret = 0;
+/*
+ * One lxc.mount or lxc.mount.entry line with its options already split into
+ * mount flags and data and its target resolved against the rootfs.
+ */
+struct lxc_mount_plan_entry {
+	char *fsname;
+	char *target;
+	char *fstype;
+	unsigned long flags;
+	char *data;
+	int create;
+	bool optional;
+};
 
-	free(pathdirname);
-	free(mntdata);
+/*
+ * The fstab entries come first, followed by the lxc.mount.entry ones.  The
+ * name, rootfs and fstab identity are what the targets were resolved with.
+ */
+struct lxc_mount_plan {
+	char *name;
+	char *rootfs_path;
+	char *rootfs_mount;
+	char *fstab;
+	struct stat fstab_st;
+	struct lxc_mount_plan_entry *entries;
+	size_t nr_fstab;
+	size_t nr;
+	size_t capacity;
+};
 
-	return ret;
+static bool mount_plan_streq(const char *a, const char *b)
+{
+	if (!a || !b)
+		return a == b;
+	return strcmp(a, b) == 0;
 }
 
-static int mount_entry_on_absolute_rootfs(const struct mntent *mntent,
-					  const struct lxc_rootfs *rootfs,
-					  const char *lxc_name)
+/*
+ * Resolve an absolute target given with the rootfs->path or
+ * $lxcpath/name/rootfs prefix to one under rootfs->mount.  Returns 1 if the
+ * target is outside the rootfs and the entry should be ignored.
+ */
+static int mount_target_on_absolute_rootfs(const char *target,
+					   const struct lxc_rootfs *rootfs,
+					   const char *lxc_name,
+					   char *path, size_t size)
 {
-	char *aux;
-	char path[MAXPATHLEN];
-	unsigned long mntflags;
-	char *mntdata;
-	int r, ret = 0, offset;
-	const char *lxcpath;
-	FILE *pathfile = NULL;
-	char *pathdirname = NULL;
-
-	if (parse_mntopts(mntent->mnt_opts, &mntflags, &mntdata) < 0) {
-		ERROR("failed to parse mount option '%s'", mntent->mnt_opts);
-		return -1;
-	}
+	const char *lxcpath, *aux;
+	int r, offset;
 
 	lxcpath = default_lxc_path();
 	if (!lxcpath) {
@@ -1930,212 +2345,331 @@ static int mount_entry_on_absolute_rootfs(const struct mntent *mntent,
 
 	/* if rootfs->path is a blockdev path, allow container fstab to
 	 * use $lxcpath/CN/rootfs as the target prefix */
-	r = snprintf(path, MAXPATHLEN, "%s/%s/rootfs", lxcpath, lxc_name);
-	if (r < 0 || r >= MAXPATHLEN)
+	r = snprintf(path, size, "%s/%s/rootfs", lxcpath, lxc_name);
+	if (r < 0 || r >= size)
 		goto skipvarlib;
 
-	aux = strstr(mntent->mnt_dir, path);
+	aux = strstr(target, path);
 	if (aux) {
 		offset = strlen(path);
 		goto skipabs;
 	}
 
 skipvarlib:
-	aux = strstr(mntent->mnt_dir, rootfs->path);
+	aux = strstr(target, rootfs->path);
 	if (!aux) {
-		WARN("ignoring mount point '%s'", mntent->mnt_dir);
-		goto out;
+		WARN("ignoring mount point '%s'", target);
+		return 1;
 	}
 	offset = strlen(rootfs->path);
 
 skipabs:
-
-	r = snprintf(path, MAXPATHLEN, "%s/%s", rootfs->mount,
-		 aux + offset);
-	if (r < 0 || r >= MAXPATHLEN) {
-		WARN("pathnme too long for '%s'", mntent->mnt_dir);
-		ret = -1;
-		goto out;
+	r = snprintf(path, size, "%s/%s", rootfs->mount, aux + offset);
+	if (r < 0 || r >= size) {
+		WARN("pathnme too long for '%s'", target);
+		return -1;
 	}
 
-	if (hasmntopt(mntent, "create=dir")) {
-		if (!mkdir_p(path, 0755)) {
-			WARN("Failed to create mount target '%s'", path);
-			ret = -1;
-		}
-	}
+	return 0;
+}
 
-	if (hasmntopt(mntent, "create=file") && access(path, F_OK)) {
-		pathdirname = strdup(path);
-		pathdirname = dirname(pathdirname);
-		mkdir_p(pathdirname, 0755);
-		pathfile = fopen(path, "wb");
-		if (!pathfile) {
-			WARN("Failed to create mount target '%s'", path);
-			ret = -1;
+static int mount_plan_add(struct lxc_mount_plan *plan,
+			  struct mntent *mntent,
+			  const struct lxc_rootfs *rootfs,
+			  const char *lxc_name)
+{
+	struct lxc_mount_plan_entry *e;
+	char path[MAXPATHLEN];
+	const char *target = mntent->mnt_dir;
+	int ret;
+
+	if (rootfs->path) {
+		/* We have a separate root, mounts are relative to it */
+		if (mntent->mnt_dir[0] != '/') {
+			ret = snprintf(path, sizeof(path), "%s/%s",
+				       rootfs->mount, mntent->mnt_dir);
+			if (ret < 0 || ret >= sizeof(path)) {
+				ERROR("path name too long");
+				return -1;
+			}
+		} else {
+			ret = mount_target_on_absolute_rootfs(mntent->mnt_dir,
+					rootfs, lxc_name, path, sizeof(path));
+			if (ret)
+				return ret < 0 ? -1 : 0;
 		}
-		else
-			fclose(pathfile);
+		target = path;
 	}
 
-	ret = mount_entry(mntent->mnt_fsname, path, mntent->mnt_type,
-			  mntflags, mntdata);
-
-	if (hasmntopt(mntent, "optional") != NULL)
-		ret = 0;
+	if (plan->nr == plan->capacity) {
+		size_t capacity = plan->capacity ? plan->capacity * 2 : 16;
 
-out:
-	free(pathdirname);
-	free(mntdata);
-	return ret;
-}
+		e = realloc(plan->entries, capacity * sizeof(*e));
+		if (!e) {
+			SYSERROR("failed to allocate memory");
+			return -1;
+		}
+		plan->entries = e;
+		plan->capacity = capacity;
+	}
 
-static int mount_entry_on_relative_rootfs(const struct mntent *mntent,
-					  const char *rootfs)
-{
-	char path[MAXPATHLEN];
-	unsigned long mntflags;
-	char *mntdata;
-	int ret;
-	FILE *pathfile = NULL;
-	char *pathdirname = NULL;
+	e = &plan->entries[plan->nr];
+	memset(e, 0, sizeof(*e));
 
-	if (parse_mntopts(mntent->mnt_opts, &mntflags, &mntdata) < 0) {
+	if (parse_mntopts(mntent->mnt_opts, &e->flags, &e->data) < 0) {
 		ERROR("failed to parse mount option '%s'", mntent->mnt_opts);
 		return -1;
 	}
 
-	/* relative to root mount point */
-	ret = snprintf(path, sizeof(path), "%s/%s", rootfs, mntent->mnt_dir);
-	if (ret >= sizeof(path)) {
-		ERROR("path name too long");
+	e->fsname = strdup(mntent->mnt_fsname);
+	e->target = strdup(target);
+	e->fstype = strdup(mntent->mnt_type);
+	if (!e->fsname || !e->target || !e->fstype) {
+		SYSERROR("failed to allocate memory");
+		free(e->fsname);
+		free(e->target);
+		free(e->fstype);
+		free(e->data);
 		return -1;
 	}
 
-	if (hasmntopt(mntent, "create=dir")) {
-		if (!mkdir_p(path, 0755)) {
-			WARN("Failed to create mount target '%s'", path);
-			ret = -1;
-		}
-	}
+	if (hasmntopt(mntent, "create=dir"))
+		e->create |= LXC_MOUNT_CREATE_DIR;
+	if (hasmntopt(mntent, "create=file"))
+		e->create |= LXC_MOUNT_CREATE_FILE;
+	e->optional = hasmntopt(mntent, "optional") != NULL;
 
-	if (hasmntopt(mntent, "create=file") && access(path, F_OK)) {
-		pathdirname = strdup(path);
-		pathdirname = dirname(pathdirname);
-		mkdir_p(pathdirname, 0755);
-		pathfile = fopen(path, "wb");
-		if (!pathfile) {
-			WARN("Failed to create mount target '%s'", path);
-			ret = -1;
-		}
-		else
-			fclose(pathfile);
+	plan->nr++;
+	return 0;
+}
+
+static int mount_plan_add_file(struct lxc_mount_plan *plan, FILE *file,
+			       const struct lxc_rootfs *rootfs,
+			       const char *lxc_name)
+{
+	struct mntent mntent;
+	char buf[4096];
+
+	while (getmntent_r(file, &mntent, buf, sizeof(buf))) {
+		if (mount_plan_add(plan, &mntent, rootfs, lxc_name))
+			return -1;
 	}
 
-	ret = mount_entry(mntent->mnt_fsname, path, mntent->mnt_type,
-			  mntflags, mntdata);
+	return 0;
+}
 
-	if (hasmntopt(mntent, "optional") != NULL)
-		ret = 0;
+static void mount_plan_free(struct lxc_mount_plan *plan)
+{
+	size_t i;
 
-	free(pathdirname);
-	free(mntdata);
+	if (!plan)
+		return;
 
-	return ret;
+	for (i = 0; i < plan->nr; i++) {
+		free(plan->entries[i].fsname);
+		free(plan->entries[i].target);
+		free(plan->entries[i].fstype);
+		free(plan->entries[i].data);
+	}
+	free(plan->entries);
+	free(plan->name);
+	free(plan->rootfs_path);
+	free(plan->rootfs_mount);
+	free(plan->fstab);
+	free(plan);
 }
 
-static int mount_file_entries(const struct lxc_rootfs *rootfs, FILE *file,
-	const char *lxc_name)
+void lxc_mount_plan_free(struct lxc_conf *conf)
 {
-	struct mntent mntent;
-	char buf[4096];
-	int ret = -1;
+	mount_plan_free(conf->mount_plan);
+	conf->mount_plan = NULL;
+}
+
+static bool mount_plan_is_current(const struct lxc_mount_plan *plan,
+				  const struct lxc_conf *conf,
+				  const char *name)
+{
+	struct stat st;
+
+	if (!plan)
+		return false;
+
+	if (!mount_plan_streq(plan->name, name) ||
+	    !mount_plan_streq(plan->rootfs_path, conf->rootfs.path) ||
+	    !mount_plan_streq(plan->rootfs_mount, conf->rootfs.mount) ||
+	    !mount_plan_streq(plan->fstab, conf->fstab))
+		return false;
+
+	if (!conf->fstab)
+		return true;
+
+	if (stat(conf->fstab, &st) < 0)
+		return false;
+
+	return st.st_dev == plan->fstab_st.st_dev &&
+	       st.st_ino == plan->fstab_st.st_ino &&
+	       st.st_size == plan->fstab_st.st_size &&
+	       st.st_mtim.tv_sec == plan->fstab_st.st_mtim.tv_sec &&
+	       st.st_mtim.tv_nsec == plan->fstab_st.st_mtim.tv_nsec;
+}
+
+static char *mount_plan_strdup(const char *s, bool *oom)
+{
+	char *dup;
+
+	if (!s)
+		return NULL;
+
+	dup = strdup(s);
+	if (!dup)
+		*oom = true;
+	return dup;
+}
+
+int lxc_mount_plan_compile(struct lxc_conf *conf, const char *name)
+{
+	struct lxc_mount_plan *plan;
+	struct lxc_list *iterator;
+	FILE *file;
+	bool oom = false;
+	int ret;
+
+	if (mount_plan_is_current(conf->mount_plan, conf, name))
+		return 0;
+
+	lxc_mount_plan_free(conf);
+
+	plan = calloc(1, sizeof(*plan));
+	if (!plan) {
+		SYSERROR("failed to allocate memory");
+		return -1;
+	}
+
+	plan->name = mount_plan_strdup(name, &oom);
+	plan->rootfs_path = mount_plan_strdup(conf->rootfs.path, &oom);
+	plan->rootfs_mount = mount_plan_strdup(conf->rootfs.mount, &oom);
+	plan->fstab = mount_plan_strdup(conf->fstab, &oom);
+	if (oom) {
+		SYSERROR("failed to allocate memory");
+		goto out_free;
+	}
 
-	while (getmntent_r(file, &mntent, buf, sizeof(buf))) {
+	if (conf->fstab) {
+		file = setmntent(conf->fstab, "r");
+		if (!file) {
+			SYSERROR("failed to use '%s'", conf->fstab);
+			goto out_free;
+		}
 
-		if (!rootfs->path) {
-			if (mount_entry_on_systemfs(&mntent))
-				goto out;
-			continue;
+		if (fstat(fileno(file), &plan->fstab_st) < 0) {
+			SYSERROR("failed to stat '%s'", conf->fstab);
+			endmntent(file);
+			goto out_free;
 		}
 
-		/* We have a separate root, mounts are relative to it */
-		if (mntent.mnt_dir[0] != '/') {
-			if (mount_entry_on_relative_rootfs(&mntent,
-							   rootfs->mount))
-				goto out;
-			continue;
+		ret = mount_plan_add_file(plan, file, &conf->rootfs, name);
+		endmntent(file);
+		if (ret < 0)
+			goto out_free;
+	}
+	plan->nr_fstab = plan->nr;
+
+	if (!lxc_list_empty(&conf->mount_list)) {
+		/* let getmntent_r() do the field splitting and unescaping,
+		 * just as it does for the fstab */
+		file = tmpfile();
+		if (!file) {
+			ERROR("tmpfile error: %m");
+			goto out_free;
 		}
 
-		if (mount_entry_on_absolute_rootfs(&mntent, rootfs, lxc_name))
-			goto out;
+		lxc_list_for_each(iterator, &conf->mount_list)
+			fprintf(file, "%s\n", (char *)iterator->elem);
+
+		rewind(file);
+
+		ret = mount_plan_add_file(plan, file, &conf->rootfs, name);
+		fclose(file);
+		if (ret < 0)
+			goto out_free;
 	}
 
-	ret = 0;
+	conf->mount_plan = plan;
+	DEBUG("compiled %zu mount entries for '%s'", plan->nr, name);
+	return 0;
 
-	INFO("mount points have been setup");
-out:
-	return ret;
+out_free:
+	mount_plan_free(plan);
+	return -1;
 }
 
-static int setup_mount(const struct lxc_rootfs *rootfs, const char *fstab,
-	const char *lxc_name)
+static int mount_plan_entry_run(const struct lxc_mount_plan_entry *e)
 {
-	FILE *file;
+	FILE *pathfile;
+	char *pathdirname;
 	int ret;
 
-	if (!fstab)
-		return 0;
+	if (e->create & LXC_MOUNT_CREATE_DIR) {
+		if (mkdir_p(e->target, 0755))
+			WARN("Failed to create mount target '%s'", e->target);
+	}
 
-	file = setmntent(fstab, "r");
-	if (!file) {
-		SYSERROR("failed to use '%s'", fstab);
-		return -1;
+	if ((e->create & LXC_MOUNT_CREATE_FILE) && access(e->target, F_OK)) {
+		pathdirname = strdup(e->target);
+		if (pathdirname) {
+			mkdir_p(dirname(pathdirname), 0755);
+			free(pathdirname);
+		}
+		pathfile = fopen(e->target, "wb");
+		if (!pathfile)
+			WARN("Failed to create mount target '%s'", e->target);
+		else
+			fclose(pathfile);
 	}
 
-	ret = mount_file_entries(rootfs, file, lxc_name);
+	ret = mount_entry(e->fsname, e->target, e->fstype, e->flags, e->data);
+
+	if (e->optional)
+		ret = 0;
 
-	endmntent(file);
 	return ret;
 }
 
-static int setup_mount_entries(const struct lxc_rootfs *rootfs, struct lxc_list *mount,
-	const char *lxc_name)
+static int mount_plan_run(const struct lxc_mount_plan *plan,
+			  size_t first, size_t last)
 {
-	FILE *file;
-	struct lxc_list *iterator;
-	char *mount_entry;
-	int ret;
+	size_t i;
 
-	file = tmpfile();
-	if (!file) {
-		ERROR("tmpfile error: %m");
-		return -1;
+	for (i = first; i < last; i++) {
+		if (mount_plan_entry_run(&plan->entries[i]))
+			return -1;
 	}
 
-	lxc_list_for_each(iterator, mount) {
-		mount_entry = iterator->elem;
-		fprintf(file, "%s\n", mount_entry);
-	}
+	INFO("mount points have been setup");
+	return 0;
+}
 
-	rewind(file);
+static int setup_mount(const struct lxc_mount_plan *plan)
+{
+	if (!plan->fstab)
+		return 0;
 
-	ret = mount_file_entries(rootfs, file, lxc_name);
+	return mount_plan_run(plan, 0, plan->nr_fstab);
+}
 
-	fclose(file);
-	return ret;
+static int setup_mount_entries(const struct lxc_mount_plan *plan)
+{
+	return mount_plan_run(plan, plan->nr_fstab, plan->nr);
 }
 
-static int setup_caps(struct lxc_list *caps)
+static int setup_caps(struct lxc_strlist *caps)
 {
-	struct lxc_list *iterator;
 	char *drop_entry;
 	char *ptr;
+	size_t n;
 	int i, capid;
 
-	lxc_list_for_each(iterator, caps) {
-
-		drop_entry = iterator->elem;
+	lxc_strlist_for_each(drop_entry, caps, n) {
 
 		capid = -1;
 
@@ -2182,11 +2716,11 @@ static int setup_caps(struct lxc_list *caps)
 	return 0;
 }
 
-static int dropcaps_except(struct lxc_list *caps)
+static int dropcaps_except(struct lxc_strlist *caps)
 {
-	struct lxc_list *iterator;
 	char *keep_entry;
 	char *ptr;
+	size_t n;
 	int i, capid;
 	int numcaps = lxc_caps_last_cap() + 1;
 	INFO("found %d capabilities\n", numcaps);
@@ -2198,9 +2732,7 @@ static int dropcaps_except(struct lxc_list *caps)
 	int *caplist = alloca(numcaps * sizeof(int));
 	memset(caplist, 0, numcaps * sizeof(int));
 
-	lxc_list_for_each(iterator, caps) {
-
-		keep_entry = iterator->elem;
+	lxc_strlist_for_each(keep_entry, caps, n) {
 
 		capid = -1;
 
@@ -2580,12 +3112,8 @@ struct lxc_conf *lxc_conf_init(void)
 	lxc_list_init(&new->cgroup);
 	lxc_list_init(&new->network);
 	lxc_list_init(&new->mount_list);
-	lxc_list_init(&new->caps);
-	lxc_list_init(&new->keepcaps);
 	lxc_list_init(&new->id_map);
-	for (i=0; i<NUM_LXC_HOOKS; i++)
-		lxc_list_init(&new->hooks[i]);
-	lxc_list_init(&new->groups);
+	lxc_list_init(&new->loglevels);
 	new->lsm_aa_profile = NULL;
 	new->lsm_se_context = NULL;
 	new->lsm_umount_proc = 0;
@@ -2598,61 +3126,15 @@ struct lxc_conf *lxc_conf_init(void)
 
 static int instanciate_veth(struct lxc_handler *handler, struct lxc_netdev *netdev)
 {
-	char veth1buf[IFNAMSIZ], *veth1;
-	char veth2buf[IFNAMSIZ], *veth2;
+	char *veth1, *veth2;
 	int err;
 
+	/* create_links() made the pair, already up with a private address */
 	if (netdev->priv.veth_attr.pair)
 		veth1 = netdev->priv.veth_attr.pair;
-	else {
-		err = snprintf(veth1buf, sizeof(veth1buf), "vethXXXXXX");
-		if (err >= sizeof(veth1buf)) { /* can't *really* happen, but... */
-			ERROR("veth1 name too long");
-			return -1;
-		}
-		veth1 = lxc_mkifname(veth1buf);
-		if (!veth1) {
-			ERROR("failed to allocate a temporary name");
-			return -1;
-		}
-		/* store away for deconf */
-		memcpy(netdev->priv.veth_attr.veth1, veth1, IFNAMSIZ);
-	}
-
-	snprintf(veth2buf, sizeof(veth2buf), "vethXXXXXX");
-	veth2 = lxc_mkifname(veth2buf);
-	if (!veth2) {
-		ERROR("failed to allocate a temporary name");
-		goto out_delete;
-	}
-
-	err = lxc_veth_create(veth1, veth2);
-	if (err) {
-		ERROR("failed to create %s-%s : %s", veth1, veth2,
-		      strerror(-err));
-		goto out_delete;
-	}
-
-	/* changing the high byte of the mac address to 0xfe, the bridge interface
-	 * will always keep the host's mac address and not take the mac address
-	 * of a container */
-	err = setup_private_host_hw_addr(veth1);
-	if (err) {
-		ERROR("failed to change mac address of host interface '%s' : %s",
-			veth1, strerror(-err));
-		goto out_delete;
-	}
-
-	if (netdev->mtu) {
-		err = lxc_netdev_set_mtu(veth1, atoi(netdev->mtu));
-		if (!err)
-			err = lxc_netdev_set_mtu(veth2, atoi(netdev->mtu));
-		if (err) {
-			ERROR("failed to set mtu '%s' for %s-%s : %s",
-			      netdev->mtu, veth1, veth2, strerror(-err));
-			goto out_delete;
-		}
-	}
+	else
+		veth1 = netdev->priv.veth_attr.veth1;
+	veth2 = netdev->priv.veth_attr.veth2;
 
 	if (netdev->link) {
 		err = lxc_bridge_attach(netdev->link, veth1);
@@ -2669,12 +3151,6 @@ static int instanciate_veth(struct lxc_handler *handler, struct lxc_netdev *netd
 		goto out_delete;
 	}
 
-	err = lxc_netdev_up(veth1);
-	if (err) {
-		ERROR("failed to set %s up : %s", veth1, strerror(-err));
-		goto out_delete;
-	}
-
 	if (netdev->upscript) {
 		err = run_script(handler->name, "net", netdev->upscript, "up",
 				 "veth", veth1, (char*) NULL);
@@ -2689,10 +3165,6 @@ static int instanciate_veth(struct lxc_handler *handler, struct lxc_netdev *netd
 
 out_delete:
 	lxc_netdev_delete_by_name(veth1);
-	if (!netdev->priv.veth_attr.pair && veth1)
-		free(veth1);
-	if(veth2)
-		free(veth2);
 	return -1;
 }
 
@@ -2717,32 +3189,9 @@ static int shutdown_veth(struct lxc_handler *handler, struct lxc_netdev *netdev)
 
 static int instanciate_macvlan(struct lxc_handler *handler, struct lxc_netdev *netdev)
 {
-	char peerbuf[IFNAMSIZ], *peer;
+	char *peer = netdev->priv.macvlan_attr.peer;
 	int err;
 
-	if (!netdev->link) {
-		ERROR("no link specified for macvlan netdev");
-		return -1;
-	}
-
-	err = snprintf(peerbuf, sizeof(peerbuf), "mcXXXXXX");
-	if (err >= sizeof(peerbuf))
-		return -1;
-
-	peer = lxc_mkifname(peerbuf);
-	if (!peer) {
-		ERROR("failed to make a temporary name");
-		return -1;
-	}
-
-	err = lxc_macvlan_create(netdev->link, peer,
-				 netdev->priv.macvlan_attr.mode);
-	if (err) {
-		ERROR("failed to create macvlan interface '%s' on '%s' : %s",
-		      peer, netdev->link, strerror(-err));
-		goto out;
-	}
-
 	netdev->ifindex = if_nametoindex(peer);
 	if (!netdev->ifindex) {
 		ERROR("failed to retrieve the index for %s", peer);
@@ -2762,7 +3211,6 @@ static int instanciate_macvlan(struct lxc_handler *handler, struct lxc_netdev *n
 	return 0;
 out:
 	lxc_netdev_delete_by_name(peer);
-	free(peer);
 	return -1;
 }
 
@@ -2780,30 +3228,17 @@ static int shutdown_macvlan(struct lxc_handler *handler, struct lxc_netdev *netd
 	return 0;
 }
 
+static void vlan_name(struct lxc_netdev *netdev, char *name)
+{
+	snprintf(name, IFNAMSIZ, "vlan%d", netdev->priv.vlan_attr.vid);
+}
+
 /* XXX: merge with instanciate_macvlan */
 static int instanciate_vlan(struct lxc_handler *handler, struct lxc_netdev *netdev)
 {
 	char peer[IFNAMSIZ];
-	int err;
-
-	if (!netdev->link) {
-		ERROR("no link specified for vlan netdev");
-		return -1;
-	}
-
-	err = snprintf(peer, sizeof(peer), "vlan%d", netdev->priv.vlan_attr.vid);
-	if (err >= sizeof(peer)) {
-		ERROR("peer name too long");
-		return -1;
-	}
-
-	err = lxc_vlan_create(netdev->link, peer, netdev->priv.vlan_attr.vid);
-	if (err) {
-		ERROR("failed to create vlan interface '%s' on '%s' : %s",
-		      peer, netdev->link, strerror(-err));
-		return -1;
-	}
 
+	vlan_name(netdev, peer);
 	netdev->ifindex = if_nametoindex(peer);
 	if (!netdev->ifindex) {
 		ERROR("failed to retrieve the ifindex for %s", peer);
@@ -2811,7 +3246,7 @@ static int instanciate_vlan(struct lxc_handler *handler, struct lxc_netdev *netd
 		return -1;
 	}
 
-	DEBUG("instanciated vlan '%s', ifindex is '%d'", " vlan1000",
+	DEBUG("instanciated vlan '%s', ifindex is '%d'", peer,
 	      netdev->ifindex);
 
 	return 0;
@@ -2920,19 +3355,91 @@ int lxc_requests_empty_network(struct lxc_handler *handler)
 	return 0;
 }
 
-int lxc_create_network(struct lxc_handler *handler)
+/* store a random name made from template in buf */
+static int netdev_tmpname(const char *template, char *buf)
+{
+	char tmp[IFNAMSIZ], *name;
+
+	snprintf(tmp, sizeof(tmp), "%s", template);
+	name = lxc_mkifname(tmp);
+	if (!name) {
+		ERROR("failed to allocate a temporary name");
+		return -1;
+	}
+	memcpy(buf, name, IFNAMSIZ);
+	free(name);
+	return 0;
+}
+
+/* fill in what it takes to create netdev, returns 1 if there is nothing */
+static int netdev_link(struct lxc_netdev *netdev, struct lxc_link_create *l)
+{
+	switch (netdev->type) {
+	case LXC_NET_VETH:
+		if (!netdev->priv.veth_attr.pair &&
+		    netdev_tmpname("vethXXXXXX", netdev->priv.veth_attr.veth1))
+			return -1;
+		if (netdev_tmpname("vethXXXXXX", netdev->priv.veth_attr.veth2))
+			return -1;
+		if (netdev->priv.veth_attr.pair)
+			l->name = netdev->priv.veth_attr.pair;
+		else
+			l->name = netdev->priv.veth_attr.veth1;
+		l->peer = netdev->priv.veth_attr.veth2;
+		l->mtu = netdev->mtu ? atoi(netdev->mtu) : 0;
+		break;
+	case LXC_NET_MACVLAN:
+		if (!netdev->link) {
+			ERROR("no link specified for macvlan netdev");
+			return -1;
+		}
+		if (netdev_tmpname("mcXXXXXX", netdev->priv.macvlan_attr.peer))
+			return -1;
+		l->name = netdev->priv.macvlan_attr.peer;
+		l->master = netdev->link;
+		l->mode = netdev->priv.macvlan_attr.mode;
+		break;
+	case LXC_NET_VLAN:
+		if (!netdev->link) {
+			ERROR("no link specified for vlan netdev");
+			return -1;
+		}
+		vlan_name(netdev, l->buf);
+		l->name = l->buf;
+		l->master = netdev->link;
+		l->vid = netdev->priv.vlan_attr.vid;
+		break;
+	default:
+		return 1;
+	}
+
+	l->type = netdev->type;
+	return 0;
+}
+
+/*
+ * Create all the veth, macvlan and vlan devices with one netlink batch
+ * rather than a few round trips each; the instanciate callbacks then
+ * only have to finish setting them up.
+ */
+static int create_links(struct lxc_list *network)
 {
-	struct lxc_list *network = &handler->conf->network;
 	struct lxc_list *iterator;
-	struct lxc_netdev *netdev;
-	int am_root = (getuid() == 0);
+	struct lxc_link_create *links;
+	int *errs, nr = 0, i, ret = -1;
 
-	if (!am_root)
+	lxc_list_for_each(iterator, network)
+		nr++;
+	if (!nr)
 		return 0;
 
-	lxc_list_for_each(iterator, network) {
+	links = alloca(nr * sizeof(*links));
+	errs = alloca(nr * sizeof(*errs));
+	memset(links, 0, nr * sizeof(*links));
 
-		netdev = iterator->elem;
+	nr = 0;
+	lxc_list_for_each(iterator, network) {
+		struct lxc_netdev *netdev = iterator->elem;
 
 		if (netdev->type < 0 || netdev->type > LXC_NET_MAXCONFTYPE) {
 			ERROR("invalid network configuration type '%d'",
@@ -2940,14 +3447,90 @@ int lxc_create_network(struct lxc_handler *handler)
 			return -1;
 		}
 
+		ret = netdev_link(netdev, &links[nr]);
+		if (ret < 0)
+			return -1;
+		if (!ret)
+			nr++;
+	}
+
+	if (!nr || !lxc_links_create(links, nr, errs))
+		return 0;
+
+	for (i = 0; i < nr; i++) {
+		if (errs[i])
+			ERROR("failed to create %s interface '%s' : %s",
+			      lxc_net_type_to_str(links[i].type), links[i].name,
+			      strerror(-errs[i]));
+		else
+			lxc_netdev_delete_by_name(links[i].name);
+	}
+	return -1;
+}
+
+/* the name create_links() gave netdev's device, NULL if it made none */
+static const char *netdev_link_name(struct lxc_netdev *netdev, char *buf)
+{
+	switch (netdev->type) {
+	case LXC_NET_VETH:
+		if (netdev->priv.veth_attr.pair)
+			return netdev->priv.veth_attr.pair;
+		return netdev->priv.veth_attr.veth1;
+	case LXC_NET_MACVLAN:
+		return netdev->priv.macvlan_attr.peer;
+	case LXC_NET_VLAN:
+		vlan_name(netdev, buf);
+		return buf;
+	default:
+		return NULL;
+	}
+}
+
+int lxc_create_network(struct lxc_handler *handler)
+{
+	struct lxc_list *network = &handler->conf->network;
+	struct lxc_list *iterator;
+	struct lxc_netdev *netdev, *failed = NULL;
+	int am_root = (getuid() == 0);
+	char buf[IFNAMSIZ];
+	const char *name;
+
+	if (!am_root)
+		return 0;
+
+	if (create_links(network))
+		return -1;
+
+	lxc_list_for_each(iterator, network) {
+
+		netdev = iterator->elem;
+
 		if (netdev_conf[netdev->type](handler, netdev)) {
 			ERROR("failed to create netdev");
-			return -1;
+			failed = netdev;
+			break;
 		}
 
 	}
 
-	return 0;
+	if (!failed)
+		return 0;
+
+	/*
+	 * The failed one cleaned up after itself, but the batch also made
+	 * the devices of the others, before and after it.
+	 */
+	lxc_list_for_each(iterator, network) {
+		netdev = iterator->elem;
+		if (netdev == failed)
+			continue;
+		name = netdev_link_name(netdev, buf);
+		if (!name)
+			continue;
+		lxc_netdev_delete_by_name(name);
+		netdev->ifindex = 0;
+	}
+	return -1;
 }
 
 void lxc_delete_network(struct lxc_handler *handler)
@@ -3003,6 +3586,7 @@ int unpriv_assign_nic(struct lxc_netdev *netdev, pid_t pid)
 	char *args[] = { "lxc-user-nic", pidstr, "veth", netdev->link, netdev->name, NULL };
 	snprintf(pidstr, 19, "%lu", (unsigned long) pid);
 	pidstr[19] = '\0';
+	lxc_log_flush();
 	execvp("lxc-user-nic", args);
 	SYSERROR("execvp lxc-user-nic");
 	exit(1);
@@ -3011,10 +3595,20 @@ int unpriv_assign_nic(struct lxc_netdev *netdev, pid_t pid)
 int lxc_assign_network(struct lxc_list *network, pid_t pid)
 {
 	struct lxc_list *iterator;
-	struct lxc_netdev *netdev;
+	struct lxc_netdev *netdev, **netdevs;
 	int am_root = (getuid() == 0);
-	int err;
+	int *ifindexes, *errs, nr = 0, i, ret = 0;
+
+	lxc_list_for_each(iterator, network)
+		nr++;
+	if (!nr)
+		return 0;
+
+	netdevs = alloca(nr * sizeof(*netdevs));
+	ifindexes = alloca(nr * sizeof(*ifindexes));
+	errs = alloca(nr * sizeof(*errs));
 
+	nr = 0;
 	lxc_list_for_each(iterator, network) {
 
 		netdev = iterator->elem;
@@ -3030,17 +3624,24 @@ int lxc_assign_network(struct lxc_list *network, pid_t pid)
 		if (!netdev->ifindex)
 			continue;
 
-		err = lxc_netdev_move_by_index(netdev->ifindex, pid);
-		if (err) {
+		netdevs[nr] = netdev;
+		ifindexes[nr++] = netdev->ifindex;
+	}
+
+	/* move them all with one netlink batch */
+	if (nr && lxc_netdev_move_many(ifindexes, nr, pid, errs))
+		ret = -1;
+
+	for (i = 0; i < nr; i++) {
+		if (errs[i]) {
 			ERROR("failed to move '%s' to the container : %s",
-			      netdev->link, strerror(-err));
-			return -1;
+			      netdevs[i]->link, strerror(-errs[i]));
+			continue;
 		}
-
-		DEBUG("move '%s' to '%d'", netdev->name, pid);
+		DEBUG("move '%s' to '%d'", netdevs[i]->name, pid);
 	}
 
-	return 0;
+	return ret;
 }
 
 static int write_id_mapping(enum idtype idtype, pid_t pid, const char *buf,
@@ -3248,10 +3849,8 @@ int lxc_create_tty(const char *name, struct lxc_conf *conf)
 
 		struct lxc_pty_info *pty_info = &tty_info->pty_info[i];
 
-		process_lock();
 		ret = openpty(&pty_info->master, &pty_info->slave,
 			    pty_info->name, NULL, NULL);
-		process_unlock();
 		if (ret) {
 			SYSERROR("failed to create pty #%d", i);
 			tty_info->nbtty = i;
@@ -3346,6 +3945,7 @@ int chown_mapped_root(char *path, struct lxc_conf *conf)
 			return -1;
 		}
 
+		lxc_log_flush();
 		ret = execvp("lxc-usernsexec", args);
 		SYSERROR("Failed executing usernsexec");
 		exit(1);
@@ -3461,6 +4061,8 @@ int check_autodev( const char *rootfs, void *data )
 
 int lxc_setup(const char *name, struct lxc_conf *lxc_conf, const char *lxcpath, struct cgroup_process_info *cgroup_info, void *data)
 {
+	char autodev_stamp[MAXPATHLEN] = "";
+
 	if (lxc_conf->inherit_ns_fd[LXC_NS_UTS] == -1) {
 		if (setup_utsname(lxc_conf->utsname)) {
 			ERROR("failed to setup the utsname for '%s'", name);
@@ -3472,26 +4074,30 @@ int lxc_setup(const char *name, struct lxc_conf *lxc_conf, const char *lxcpath,
 		ERROR("failed to setup the network for '%s'", name);
 		return -1;
 	}
+	lxc_trace_mark(lxc_conf->start_trace, "network.setup");
 
 	if (run_lxc_hooks(name, "pre-mount", lxc_conf, lxcpath, NULL)) {
 		ERROR("failed to run pre-mount hooks for container '%s'.", name);
 		return -1;
 	}
+	lxc_trace_mark(lxc_conf->start_trace, "hook.pre-mount");
 
 	if (setup_rootfs(lxc_conf)) {
 		ERROR("failed to setup rootfs for '%s'", name);
 		return -1;
 	}
+	lxc_trace_mark(lxc_conf->start_trace, "rootfs");
 
 	if (lxc_conf->autodev < 0) {
 		lxc_conf->autodev = check_autodev(lxc_conf->rootfs.mount, data);
 	}
 
 	if (lxc_conf->autodev > 0) {
-		if (mount_autodev(name, lxc_conf->rootfs.mount, lxcpath)) {
+		if (mount_autodev(name, lxc_conf->rootfs.mount, lxcpath, autodev_stamp)) {
 			ERROR("failed to mount /dev in the container");
 			return -1;
 		}
+		lxc_trace_mark(lxc_conf->start_trace, "autodev.mount");
 	}
 
 	/* do automatic mounts (mainly /proc and /sys), but exclude
@@ -3502,15 +4108,22 @@ int lxc_setup(const char *name, struct lxc_conf *lxc_conf, const char *lxcpath,
 		return -1;
 	}
 
-	if (setup_mount(&lxc_conf->rootfs, lxc_conf->fstab, name)) {
+	/* normally compiled by the parent already, see lxc_init() */
+	if (lxc_mount_plan_compile(lxc_conf, name)) {
+		ERROR("failed to compile the mounts for '%s'", name);
+		return -1;
+	}
+
+	if (setup_mount(lxc_conf->mount_plan)) {
 		ERROR("failed to setup the mounts for '%s'", name);
 		return -1;
 	}
 
-	if (!lxc_list_empty(&lxc_conf->mount_list) && setup_mount_entries(&lxc_conf->rootfs, &lxc_conf->mount_list, name)) {
+	if (!lxc_list_empty(&lxc_conf->mount_list) && setup_mount_entries(lxc_conf->mount_plan)) {
 		ERROR("failed to setup the mount entries for '%s'", name);
 		return -1;
 	}
+	lxc_trace_mark(lxc_conf->start_trace, "mounts");
 
 	/* now mount only cgroup, if wanted;
 	 * before, /sys could not have been mounted
@@ -3525,16 +4138,18 @@ int lxc_setup(const char *name, struct lxc_conf *lxc_conf, const char *lxcpath,
 		ERROR("failed to run mount hooks for container '%s'.", name);
 		return -1;
 	}
+	lxc_trace_mark(lxc_conf->start_trace, "hook.mount");
 
 	if (lxc_conf->autodev > 0) {
 		if (run_lxc_hooks(name, "autodev", lxc_conf, lxcpath, NULL)) {
 			ERROR("failed to run autodev hooks for container '%s'.", name);
 			return -1;
 		}
-		if (setup_autodev(lxc_conf->rootfs.mount)) {
+		if (setup_autodev(lxc_conf->rootfs.mount, autodev_stamp)) {
 			ERROR("failed to populate /dev in the container");
 			return -1;
 		}
+		lxc_trace_mark(lxc_conf->start_trace, "autodev.populate");
 	}
 
 	if (!lxc_conf->is_execute && setup_console(&lxc_conf->rootfs, &lxc_conf->console, lxc_conf->ttydir)) {
@@ -3551,6 +4166,7 @@ int lxc_setup(const char *name, struct lxc_conf *lxc_conf, const char *lxcpath,
 		ERROR("failed to setup the ttys for '%s'", name);
 		return -1;
 	}
+	lxc_trace_mark(lxc_conf->start_trace, "console");
 
 	/* mount /proc if needed for LSM transition */
 	if (lsm_proc_mount(lxc_conf) < 0) {
@@ -3562,6 +4178,7 @@ int lxc_setup(const char *name, struct lxc_conf *lxc_conf, const char *lxcpath,
 		ERROR("failed to set rootfs for '%s'", name);
 		return -1;
 	}
+	lxc_trace_mark(lxc_conf->start_trace, "pivot_root");
 
 	if (setup_pts(lxc_conf->pts)) {
 		ERROR("failed to setup the new pts instance");
@@ -3574,20 +4191,21 @@ int lxc_setup(const char *name, struct lxc_conf *lxc_conf, const char *lxcpath,
 	}
 
 	if (lxc_list_empty(&lxc_conf->id_map)) {
-		if (!lxc_list_empty(&lxc_conf->keepcaps)) {
-			if (!lxc_list_empty(&lxc_conf->caps)) {
+		if (lxc_strlist_len(lxc_conf->keepcaps)) {
+			if (lxc_strlist_len(lxc_conf->caps)) {
 				ERROR("Simultaneously requested dropping and keeping caps");
 				return -1;
 			}
-			if (dropcaps_except(&lxc_conf->keepcaps)) {
+			if (dropcaps_except(lxc_conf->keepcaps)) {
 				ERROR("failed to keep requested caps\n");
 				return -1;
 			}
-		} else if (setup_caps(&lxc_conf->caps)) {
+		} else if (setup_caps(lxc_conf->caps)) {
 			ERROR("failed to drop capabilities");
 			return -1;
 		}
 	}
+	lxc_trace_mark(lxc_conf->start_trace, "caps");
 
 	NOTICE("'%s' is setup.", name);
 
@@ -3597,8 +4215,10 @@ int lxc_setup(const char *name, struct lxc_conf *lxc_conf, const char *lxcpath,
 int run_lxc_hooks(const char *name, char *hook, struct lxc_conf *conf,
 		  const char *lxcpath, char *argv[])
 {
-	int which = -1;
-	struct lxc_list *it;
+	int which = -1, n, nargs, i;
+	const char **scripts;
+	char **args;
+	bool parallel;
 
 	if (strcmp(hook, "pre-start") == 0)
 		which = LXCHOOK_PRESTART;
@@ -3616,13 +4236,89 @@ int run_lxc_hooks(const char *name, char *hook, struct lxc_conf *conf,
 		which = LXCHOOK_CLONE;
 	else
 		return -1;
-	lxc_list_for_each(it, &conf->hooks[which]) {
-		int ret;
-		char *hookname = it->elem;
-		ret = run_script_argv(name, "lxc", hookname, hook, lxcpath, argv);
-		if (ret)
-			return ret;
+	parallel = conf->hooks_parallel & (1 << which);
+
+	n = lxc_strlist_len(conf->hooks[which]);
+	if (!n)
+		return 0;
+
+	scripts = (const char **)conf->hooks[which]->items;
+	for (i = 0; i < n; i++)
+		INFO("Executing script '%s' for container '%s', config section '%s'%s",
+		     scripts[i], name, "lxc", parallel ? " in parallel" : "");
+
+	for (nargs = 0; argv && argv[nargs]; nargs++)
+		;
+	args = alloca((nargs + 4) * sizeof(char *));
+	args[0] = (char *)name;
+	args[1] = "lxc";
+	args[2] = hook;
+	for (i = 0; i < nargs; i++)
+		args[3 + i] = argv[i];
+	args[3 + nargs] = NULL;
+
+	return run_hooks(scripts, n, args, parallel);
+}
+
+void lxc_netdevs_changed(struct lxc_conf *c)
+{
+	free(c->netdevs);
+	c->netdevs = NULL;
+	c->nr_netdevs = 0;
+	c->netdevs_size = 0;
+}
+
+static int lxc_netdevs_grow(struct lxc_conf *c, int nr)
+{
+	struct lxc_netdev **netdevs;
+	int size;
+
+	if (nr <= c->netdevs_size)
+		return 0;
+
+	size = c->netdevs_size ? c->netdevs_size : 8;
+	while (size < nr)
+		size *= 2;
+
+	netdevs = realloc(c->netdevs, size * sizeof(*netdevs));
+	if (!netdevs)
+		return -1;
+
+	c->netdevs = netdevs;
+	c->netdevs_size = size;
+	return 0;
+}
+
+struct lxc_netdev *lxc_get_netdev(struct lxc_conf *c, int idx)
+{
+	struct lxc_list *it;
+	int n = 0;
+
+	/* rebuilt lazily after a nic went away */
+	if (!c->netdevs) {
+		lxc_list_for_each(it, &c->network)
+			n++;
+		if (lxc_netdevs_grow(c, n ? n : 1) < 0)
+			return NULL;
+		c->nr_netdevs = 0;
+		lxc_list_for_each(it, &c->network)
+			c->netdevs[c->nr_netdevs++] = it->elem;
+	}
+
+	if (idx < 0 || idx >= c->nr_netdevs)
+		return NULL;
+	return c->netdevs[idx];
+}
+
+int lxc_add_netdev(struct lxc_conf *c, struct lxc_list *list)
+{
+	if (c->netdevs) {
+		if (lxc_netdevs_grow(c, c->nr_netdevs + 1) < 0)
+			return -1;
+		c->netdevs[c->nr_netdevs++] = list->elem;
 	}
+
+	lxc_list_add_tail(&c->network, list);
 	return 0;
 }
 
@@ -3696,6 +4392,7 @@ int lxc_clear_nic(struct lxc_conf *c, const char *key)
 
 	if (!p1) {
 		lxc_remove_nic(it);
+		lxc_netdevs_changed(c);
 	} else if (strcmp(p1, "ipv4") == 0) {
 		struct lxc_list *it2,*next;
 		lxc_list_for_each_safe(it2, &netdev->ipv4, next) {
@@ -3754,6 +4451,8 @@ int lxc_clear_nic(struct lxc_conf *c, const char *key)
 int lxc_clear_config_network(struct lxc_conf *c)
 {
 	struct lxc_list *it,*next;
+
+	lxc_netdevs_changed(c);
 	lxc_list_for_each_safe(it, &c->network, next) {
 		lxc_remove_nic(it);
 	}
@@ -3762,13 +4461,8 @@ int lxc_clear_config_network(struct lxc_conf *c)
 
 int lxc_clear_config_caps(struct lxc_conf *c)
 {
-	struct lxc_list *it,*next;
-
-	lxc_list_for_each_safe(it, &c->caps, next) {
-		lxc_list_del(it);
-		free(it->elem);
-		free(it);
-	}
+	lxc_strlist_put(c->caps);
+	c->caps = NULL;
 	return 0;
 }
 
@@ -3790,13 +4484,8 @@ int lxc_clear_idmaps(struct lxc_conf *c)
 
 int lxc_clear_config_keepcaps(struct lxc_conf *c)
 {
-	struct lxc_list *it,*next;
-
-	lxc_list_for_each_safe(it, &c->keepcaps, next) {
-		lxc_list_del(it);
-		free(it->elem);
-		free(it);
-	}
+	lxc_strlist_put(c->keepcaps);
+	c->keepcaps = NULL;
 	return 0;
 }
 
@@ -3823,12 +4512,22 @@ int lxc_clear_cgroups(struct lxc_conf *c, const char *key)
 }
 
 int lxc_clear_groups(struct lxc_conf *c)
+{
+	lxc_strlist_put(c->groups);
+	c->groups = NULL;
+	return 0;
+}
+
+int lxc_clear_loglevels(struct lxc_conf *c)
 {
 	struct lxc_list *it,*next;
+	struct lxc_category_level *ll;
 
-	lxc_list_for_each_safe(it, &c->groups, next) {
+	lxc_list_for_each_safe(it, &c->loglevels, next) {
+		ll = it->elem;
 		lxc_list_del(it);
-		free(it->elem);
+		free(ll->category);
+		free(ll);
 		free(it);
 	}
 	return 0;
@@ -3838,6 +4537,8 @@ int lxc_clear_mount_entries(struct lxc_conf *c)
 {
 	struct lxc_list *it,*next;
 
+	lxc_mount_plan_free(c);
+
 	lxc_list_for_each_safe(it, &c->mount_list, next) {
 		lxc_list_del(it);
 		free(it->elem);
@@ -3848,7 +4549,6 @@ int lxc_clear_mount_entries(struct lxc_conf *c)
 
 int lxc_clear_hooks(struct lxc_conf *c, const char *key)
 {
-	struct lxc_list *it,*next;
 	bool all = false, done = false;
 	const char *k = key + 9;
 	int i;
@@ -3858,11 +4558,8 @@ int lxc_clear_hooks(struct lxc_conf *c, const char *key)
 
 	for (i=0; i<NUM_LXC_HOOKS; i++) {
 		if (all || strcmp(k, lxchook_names[i]) == 0) {
-			lxc_list_for_each_safe(it, &c->hooks[i], next) {
-				lxc_list_del(it);
-				free(it->elem);
-				free(it);
-			}
+			lxc_strlist_put(c->hooks[i]);
+			c->hooks[i] = NULL;
 			done = true;
 		}
 	}
@@ -3922,6 +4619,8 @@ void lxc_conf_free(struct lxc_conf *conf)
 	lxc_clear_saved_nics(conf);
 	lxc_clear_idmaps(conf);
 	lxc_clear_groups(conf);
+	lxc_clear_loglevels(conf);
+	free(conf->start_trace);
 	free(conf);
 }
 
@@ -34,6 +34,8 @@
 #include <lxc/list.h>
 
 #include <lxc/start.h> /* for lxc_handler */
+#include "trace.h"
+#include "strlist.h"
 
 #if HAVE_SCMP_FILTER_CTX
 typedef void * scmp_filter_ctx;
@@ -86,6 +88,7 @@ struct lxc_route6 {
 struct ifla_veth {
 	char *pair; /* pair name */
 	char veth1[IFNAMSIZ]; /* needed for deconf */
+	char veth2[IFNAMSIZ]; /* container side, until it is moved */
 };
 
 struct ifla_vlan {
@@ -97,6 +100,7 @@ struct ifla_vlan {
 
 struct ifla_macvlan {
 	int mode; /* private, vepa, bridge */
+	char peer[IFNAMSIZ]; /* until it is moved */
 };
 
 union netdev_p {
@@ -247,6 +251,14 @@ enum {
 	LXC_AUTO_ALL_MASK             = 0x07F,   /* all known settings */
 };
 
+/*
+ * Level of one log category, as given by lxc.loglevel.<category>
+ */
+struct lxc_category_level {
+	char *category;
+	int level;
+};
+
 /*
  * Defines the global container configuration
  * @rootfs     : root directory to run the container
@@ -276,6 +288,8 @@ struct saved_nic {
 	char *orig_name;
 };
 
+struct lxc_mount_plan;
+
 struct lxc_conf {
 	int is_execute;
 	char *fstab;
@@ -292,14 +306,16 @@ struct lxc_conf {
 	int num_savednics;
 	int auto_mounts;
 	struct lxc_list mount_list;
-	struct lxc_list caps;
-	struct lxc_list keepcaps;
+	// the string lists are interned and shared, see strlist.h
+	struct lxc_strlist *caps;
+	struct lxc_strlist *keepcaps;
 	struct lxc_tty_info tty_info;
 	struct lxc_console console;
 	struct lxc_rootfs rootfs;
 	char *ttydir;
 	int close_all_fds;
-	struct lxc_list hooks[NUM_LXC_HOOKS];
+	struct lxc_strlist *hooks[NUM_LXC_HOOKS];
+	int hooks_parallel;  // bitmask of hook types whose scripts run concurrently
 
 	char *lsm_aa_profile;
 	char *lsm_se_context;
@@ -321,13 +337,29 @@ struct lxc_conf {
 	// store the config file specified values here.
 	char *logfile;  // the logfile as specifed in config
 	int loglevel;   // loglevel as specifed in config (if any)
+	int logbuffer;  // lxc.logbuffer in KiB, 0 if unbuffered
+	int logformat;  // lxc.logformat, LXC_LOG_FORMAT_TEXT or _BINARY
+	struct lxc_list loglevels; // lxc.loglevel.<category>, see below
 
 	int inherit_ns_fd[LXC_NS_MAX];
 
 	int start_auto;
 	int start_delay;
 	int start_order;
-	struct lxc_list groups;
+	struct lxc_strlist *groups;
+
+	// per-phase timings of the last start, see trace.h
+	struct lxc_start_trace *start_trace;  // allocated by lxc_init()
+	int print_start_trace;  // if 1, dump it to stderr once running
+	int zygote;  // if 1, park right before exec'ing init until released
+
+	// lxc.mount and lxc.mount.entry compiled for the current rootfs
+	struct lxc_mount_plan *mount_plan;
+
+	// the elements of network by position, see lxc_get_netdev()
+	struct lxc_netdev **netdevs;
+	int nr_netdevs;
+	int netdevs_size;
 };
 
 int run_lxc_hooks(const char *name, char *hook, struct lxc_conf *conf,
@@ -353,6 +385,15 @@ extern int lxc_find_gateway_addresses(struct lxc_handler *handler);
 extern int lxc_create_tty(const char *name, struct lxc_conf *conf);
 extern void lxc_delete_tty(struct lxc_tty_info *tty_info);
 
+/*
+ * Return the idx'th network device in O(1), or NULL.  lxc_add_netdev()
+ * appends one, any other change to the network list must go through
+ * lxc_netdevs_changed().
+ */
+extern struct lxc_netdev *lxc_get_netdev(struct lxc_conf *c, int idx);
+extern int lxc_add_netdev(struct lxc_conf *c, struct lxc_list *list);
+extern void lxc_netdevs_changed(struct lxc_conf *c);
+
 extern int lxc_clear_config_network(struct lxc_conf *c);
 extern int lxc_clear_nic(struct lxc_conf *c, const char *key);
 extern int lxc_clear_config_caps(struct lxc_conf *c);
@@ -362,6 +403,14 @@ extern int lxc_clear_mount_entries(struct lxc_conf *c);
 extern int lxc_clear_hooks(struct lxc_conf *c, const char *key);
 extern int lxc_clear_idmaps(struct lxc_conf *c);
 extern int lxc_clear_groups(struct lxc_conf *c);
+extern int lxc_clear_loglevels(struct lxc_conf *c);
+
+/*
+ * Compile lxc.mount and lxc.mount.entry into conf->mount_plan, unless the
+ * plan already there still matches the rootfs, name and fstab file.
+ */
+extern int lxc_mount_plan_compile(struct lxc_conf *conf, const char *name);
+extern void lxc_mount_plan_free(struct lxc_conf *conf);
 
 /*
  * Configure the container from inside
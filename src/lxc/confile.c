@@ -29,7 +29,10 @@
 #include <fcntl.h>
 #include <ctype.h>
 #include <signal.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/param.h>
 #include <sys/utsname.h>
@@ -63,12 +66,15 @@ static int config_cgroup(const char *, const char *, struct lxc_conf *);
 static int config_idmap(const char *, const char *, struct lxc_conf *);
 static int config_loglevel(const char *, const char *, struct lxc_conf *);
 static int config_logfile(const char *, const char *, struct lxc_conf *);
+static int config_logbuffer(const char *, const char *, struct lxc_conf *);
+static int config_logformat(const char *, const char *, struct lxc_conf *);
 static int config_mount(const char *, const char *, struct lxc_conf *);
 static int config_rootfs(const char *, const char *, struct lxc_conf *);
 static int config_rootfs_mount(const char *, const char *, struct lxc_conf *);
 static int config_pivotdir(const char *, const char *, struct lxc_conf *);
 static int config_utsname(const char *, const char *, struct lxc_conf *);
 static int config_hook(const char *, const char *, struct lxc_conf *lxc_conf);
+static int config_hook_parallel(const char *, const char *, struct lxc_conf *lxc_conf);
 static int config_network_type(const char *, const char *, struct lxc_conf *);
 static int config_network_flags(const char *, const char *, struct lxc_conf *);
 static int config_network_link(const char *, const char *, struct lxc_conf *);
@@ -95,6 +101,10 @@ static int config_stopsignal(const char *, const char *, struct lxc_conf *);
 static int config_start(const char *, const char *, struct lxc_conf *);
 static int config_group(const char *, const char *, struct lxc_conf *);
 
+/*
+ * A key is handled by the longest entry that is a prefix of it.  An entry
+ * must not be a prefix of one listed after it.
+ */
 static struct lxc_config_t config[] = {
 
 	{ "lxc.arch",                 config_personality          },
@@ -106,8 +116,11 @@ static struct lxc_config_t config[] = {
 	{ "lxc.se_context",           config_lsm_se_context       },
 	{ "lxc.cgroup",               config_cgroup               },
 	{ "lxc.id_map",               config_idmap                },
+	{ "lxc.loglevel.",            config_loglevel             },
 	{ "lxc.loglevel",             config_loglevel             },
 	{ "lxc.logfile",              config_logfile              },
+	{ "lxc.logbuffer",            config_logbuffer            },
+	{ "lxc.logformat",            config_logformat            },
 	{ "lxc.mount",                config_mount                },
 	{ "lxc.rootfs.mount",         config_rootfs_mount         },
 	{ "lxc.rootfs",               config_rootfs               },
@@ -120,6 +133,7 @@ static struct lxc_config_t config[] = {
 	{ "lxc.hook.start",           config_hook                 },
 	{ "lxc.hook.post-stop",       config_hook                 },
 	{ "lxc.hook.clone",           config_hook                 },
+	{ "lxc.hook.parallel",        config_hook_parallel        },
 	{ "lxc.network.type",         config_network_type         },
 	{ "lxc.network.flags",        config_network_flags        },
 	{ "lxc.network.link",         config_network_link         },
@@ -135,7 +149,7 @@ static struct lxc_config_t config[] = {
 	{ "lxc.network.ipv4",         config_network_ipv4         },
 	{ "lxc.network.ipv6.gateway", config_network_ipv6_gateway },
 	{ "lxc.network.ipv6",         config_network_ipv6         },
-	/* config_network_nic must come after all other 'lxc.network.*' entries */
+	/* matched by everything the entries above don't */
 	{ "lxc.network.",             config_network_nic          },
 	{ "lxc.cap.drop",             config_cap_drop             },
 	{ "lxc.cap.keep",             config_cap_keep             },
@@ -179,15 +193,259 @@ struct signame signames[] = {
 
 static const size_t config_size = sizeof(config)/sizeof(struct lxc_config_t);
 
+/*
+ * Hash index over the names of a key table.  Finding the longest name that
+ * prefixes a key takes one probe per distinct name length, and an exact
+ * match a single one, whatever the size of the table.  Each table starts
+ * with a 'const char *name' member.
+ */
+#define CONFIG_INDEX_SIZE 256
+#define CONFIG_INDEX_LENS 32
+
+struct config_index {
+	const void *table;
+	size_t stride;
+	size_t count;
+	int nr_lens;
+	unsigned char lens[CONFIG_INDEX_LENS];	/* distinct lengths, longest first */
+	short slots[CONFIG_INDEX_SIZE];		/* table index + 1, 0 if free */
+};
+
+#define CONFIG_INDEX(t) { t, sizeof(t[0]), sizeof(t)/sizeof(t[0]) }
+
+static inline const char *config_index_name(const struct config_index *idx,
+					    int i)
+{
+	return *(const char * const *)((const char *)idx->table + i * idx->stride);
+}
+
+static inline unsigned int config_key_hash(const char *key, size_t len)
+{
+	unsigned int hash = 2166136261U;
+
+	while (len--) {
+		hash ^= (unsigned char)*key++;
+		hash *= 16777619U;
+	}
+	return hash & (CONFIG_INDEX_SIZE - 1);
+}
+
+static void config_index_build(struct config_index *idx)
+{
+	unsigned int h;
+	size_t len;
+	int i, j, k;
+
+	for (i = 0; i < idx->count; i++) {
+		const char *name = config_index_name(idx, i);
+
+		len = strlen(name);
+		for (j = 0; j < idx->nr_lens && idx->lens[j] > len; j++)
+			;
+		if (j == idx->nr_lens || idx->lens[j] != len) {
+			if (idx->nr_lens == CONFIG_INDEX_LENS || len > 255 ||
+			    2 * idx->count > CONFIG_INDEX_SIZE) {
+				/* can't happen unless the tables outgrow us */
+				ERROR("config key index too small");
+				abort();
+			}
+			for (k = idx->nr_lens++; k > j; k--)
+				idx->lens[k] = idx->lens[k - 1];
+			idx->lens[j] = len;
+		}
+
+		for (h = config_key_hash(name, len); idx->slots[h];
+		     h = (h + 1) & (CONFIG_INDEX_SIZE - 1)) {
+			if (!strcmp(config_index_name(idx, idx->slots[h] - 1), name))
+				break;
+		}
+		/* the first of duplicate names wins, as with a scan */
+		if (!idx->slots[h])
+			idx->slots[h] = i + 1;
+	}
+}
+
+/*
+ * Return the index of the longest name which is a prefix of key, or with
+ * exact set the one equal to key, or -1.
+ */
+static int config_index_lookup(const struct config_index *idx, const char *key,
+			       bool exact)
+{
+	size_t keylen = strlen(key);
+	const char *name;
+	unsigned int h;
+	int i;
+
+	for (i = 0; i < idx->nr_lens; i++) {
+		size_t len = idx->lens[i];
+
+		if (len > keylen || (exact && len != keylen))
+			continue;
+
+		for (h = config_key_hash(key, len); idx->slots[h];
+		     h = (h + 1) & (CONFIG_INDEX_SIZE - 1)) {
+			name = config_index_name(idx, idx->slots[h] - 1);
+			if (!strncmp(name, key, len) && name[len] == '\0')
+				return idx->slots[h] - 1;
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * Which lxc_get_config_item() and lxc_clear_config_item() branch handles a
+ * key.  The exact names are tried before the prefixes.
+ */
+enum {
+	CONFIG_GET_MOUNT_ENTRY,
+	CONFIG_GET_MOUNT,
+	CONFIG_GET_TTY,
+	CONFIG_GET_PTS,
+	CONFIG_GET_TTYDIR,
+	CONFIG_GET_ARCH,
+	CONFIG_GET_AA_PROFILE,
+	CONFIG_GET_SE_CONTEXT,
+	CONFIG_GET_LOGFILE,
+	CONFIG_GET_LOGLEVEL,
+	CONFIG_GET_LOGBUFFER,
+	CONFIG_GET_LOGFORMAT,
+	CONFIG_GET_LOGLEVEL_CATEGORY,
+	CONFIG_GET_CGROUP_ALL,
+	CONFIG_GET_CGROUP,
+	CONFIG_GET_UTSNAME,
+	CONFIG_GET_CONSOLE,
+	CONFIG_GET_ROOTFS_MOUNT,
+	CONFIG_GET_ROOTFS,
+	CONFIG_GET_PIVOTDIR,
+	CONFIG_GET_CAP_DROP,
+	CONFIG_GET_CAP_KEEP,
+	CONFIG_GET_HOOK_PARALLEL,
+	CONFIG_GET_HOOK,
+	CONFIG_GET_NETWORK,
+	CONFIG_GET_NIC,
+	CONFIG_GET_START_AUTO,
+	CONFIG_GET_START_DELAY,
+	CONFIG_GET_START_ORDER,
+	CONFIG_GET_GROUP,
+};
+
+enum {
+	CONFIG_CLEAR_NETWORK,
+	CONFIG_CLEAR_NIC,
+	CONFIG_CLEAR_CAP_DROP,
+	CONFIG_CLEAR_CAP_KEEP,
+	CONFIG_CLEAR_CGROUP,
+	CONFIG_CLEAR_MOUNT_ENTRIES,
+	CONFIG_CLEAR_HOOK_PARALLEL,
+	CONFIG_CLEAR_HOOK,
+	CONFIG_CLEAR_GROUP,
+};
+
+struct config_key {
+	const char *name;
+	int id;
+};
+
+static struct config_key config_get_exact[] = {
+	{ "lxc.mount.entry",   CONFIG_GET_MOUNT_ENTRY   },
+	{ "lxc.mount",         CONFIG_GET_MOUNT         },
+	{ "lxc.tty",           CONFIG_GET_TTY           },
+	{ "lxc.pts",           CONFIG_GET_PTS           },
+	{ "lxc.devttydir",     CONFIG_GET_TTYDIR        },
+	{ "lxc.arch",          CONFIG_GET_ARCH          },
+	{ "lxc.aa_profile",    CONFIG_GET_AA_PROFILE    },
+	{ "lxc.se_context",    CONFIG_GET_SE_CONTEXT    },
+	{ "lxc.logfile",       CONFIG_GET_LOGFILE       },
+	{ "lxc.loglevel",      CONFIG_GET_LOGLEVEL      },
+	{ "lxc.logbuffer",     CONFIG_GET_LOGBUFFER     },
+	{ "lxc.logformat",     CONFIG_GET_LOGFORMAT     },
+	{ "lxc.cgroup",        CONFIG_GET_CGROUP_ALL    },
+	{ "lxc.utsname",       CONFIG_GET_UTSNAME       },
+	{ "lxc.console",       CONFIG_GET_CONSOLE       },
+	{ "lxc.rootfs.mount",  CONFIG_GET_ROOTFS_MOUNT  },
+	{ "lxc.rootfs",        CONFIG_GET_ROOTFS        },
+	{ "lxc.pivotdir",      CONFIG_GET_PIVOTDIR      },
+	{ "lxc.cap.drop",      CONFIG_GET_CAP_DROP      },
+	{ "lxc.cap.keep",      CONFIG_GET_CAP_KEEP      },
+	{ "lxc.hook.parallel", CONFIG_GET_HOOK_PARALLEL },
+	{ "lxc.network",       CONFIG_GET_NETWORK       },
+	{ "lxc.start.auto",    CONFIG_GET_START_AUTO    },
+	{ "lxc.start.delay",   CONFIG_GET_START_DELAY   },
+	{ "lxc.start.order",   CONFIG_GET_START_ORDER   },
+	{ "lxc.group",         CONFIG_GET_GROUP         },
+};
+
+static struct config_key config_get_prefix[] = {
+	{ "lxc.loglevel.",     CONFIG_GET_LOGLEVEL_CATEGORY },
+	{ "lxc.cgroup.",       CONFIG_GET_CGROUP        },
+	{ "lxc.hook",          CONFIG_GET_HOOK          },
+	{ "lxc.network.",      CONFIG_GET_NIC           },
+};
+
+static struct config_key config_clear_exact[] = {
+	{ "lxc.network",       CONFIG_CLEAR_NETWORK       },
+	{ "lxc.cap.drop",      CONFIG_CLEAR_CAP_DROP      },
+	{ "lxc.cap.keep",      CONFIG_CLEAR_CAP_KEEP      },
+	{ "lxc.mount.entries", CONFIG_CLEAR_MOUNT_ENTRIES },
+	{ "lxc.hook.parallel", CONFIG_CLEAR_HOOK_PARALLEL },
+};
+
+static struct config_key config_clear_prefix[] = {
+	{ "lxc.network.",      CONFIG_CLEAR_NIC           },
+	{ "lxc.cgroup",        CONFIG_CLEAR_CGROUP        },
+	{ "lxc.hook",          CONFIG_CLEAR_HOOK          },
+	{ "lxc.group",         CONFIG_CLEAR_GROUP         },
+};
+
+static struct config_index config_idx = CONFIG_INDEX(config);
+static struct config_index config_get_exact_idx = CONFIG_INDEX(config_get_exact);
+static struct config_index config_get_prefix_idx = CONFIG_INDEX(config_get_prefix);
+static struct config_index config_clear_exact_idx = CONFIG_INDEX(config_clear_exact);
+static struct config_index config_clear_prefix_idx = CONFIG_INDEX(config_clear_prefix);
+static pthread_once_t config_idx_once = PTHREAD_ONCE_INIT;
+
+static void config_index_init(void)
+{
+	config_index_build(&config_idx);
+	config_index_build(&config_get_exact_idx);
+	config_index_build(&config_get_prefix_idx);
+	config_index_build(&config_clear_exact_idx);
+	config_index_build(&config_clear_prefix_idx);
+}
+
+static int config_key_id(struct config_index *exact,
+			 struct config_index *prefix, const char *key)
+{
+	const struct config_key *keys;
+	int i;
+
+	pthread_once(&config_idx_once, config_index_init);
+
+	i = config_index_lookup(exact, key, true);
+	if (i >= 0) {
+		keys = exact->table;
+		return keys[i].id;
+	}
+
+	i = config_index_lookup(prefix, key, false);
+	if (i >= 0) {
+		keys = prefix->table;
+		return keys[i].id;
+	}
+
+	return -1;
+}
+
 extern struct lxc_config_t *lxc_getconfig(const char *key)
 {
 	int i;
 
-	for (i = 0; i < config_size; i++)
-		if (!strncmp(config[i].name, key,
-			     strlen(config[i].name)))
-			return &config[i];
-	return NULL;
+	pthread_once(&config_idx_once, config_index_init);
+
+	i = config_index_lookup(&config_idx, key, false);
+	return i < 0 ? NULL : &config[i];
 }
 
 #define strprint(str, inlen, ...) \
@@ -302,7 +560,6 @@ out:
 static int config_network_type(const char *key, const char *value,
 			       struct lxc_conf *lxc_conf)
 {
-	struct lxc_list *network = &lxc_conf->network;
 	struct lxc_netdev *netdev;
 	struct lxc_list *list;
 
@@ -329,7 +586,12 @@ static int config_network_type(const char *key, const char *value,
 	lxc_list_init(list);
 	list->elem = netdev;
 
-	lxc_list_add_tail(network, list);
+	if (lxc_add_netdev(lxc_conf, list)) {
+		SYSERROR("failed to allocate memory");
+		free(list);
+		free(netdev);
+		return -1;
+	}
 
 	if (!strcmp(value, "veth"))
 		netdev->type = LXC_NET_VETH;
@@ -368,12 +630,14 @@ static int config_ip_prefix(struct in_addr *addr)
  */
 static int get_network_netdev_idx(const char *key)
 {
-	int ret, idx;
+	unsigned long idx;
+	char *end;
 
 	if (*key < '0' || *key > '9')
 		return -1;
-	ret = sscanf(key, "%d", &idx);
-	if (ret != 1)
+	errno = 0;
+	idx = strtoul(key, &end, 10);
+	if (errno || idx > INT_MAX)
 		return -1;
 	return idx;
 }
@@ -383,20 +647,13 @@ static int get_network_netdev_idx(const char *key)
  * the netdev of the first configured nic
  */
 static struct lxc_netdev *get_netdev_from_key(const char *key,
-					      struct lxc_list *network)
+					      struct lxc_conf *c)
 {
-	int i = 0, idx = get_network_netdev_idx(key);
-	struct lxc_netdev *netdev = NULL;
-	struct lxc_list *it;
+	int idx = get_network_netdev_idx(key);
+
 	if (idx == -1)
 		return NULL;
-	lxc_list_for_each(it, network) {
-		if (idx == i++) {
-			netdev = it->elem;
-			break;
-		}
-	}
-	return netdev;
+	return lxc_get_netdev(c, idx);
 }
 
 extern int lxc_list_nicconfigs(struct lxc_conf *c, const char *key,
@@ -405,7 +662,7 @@ extern int lxc_list_nicconfigs(struct lxc_conf *c, const char *key,
 	struct lxc_netdev *netdev;
 	int fulllen = 0, len;
 
-	netdev = get_netdev_from_key(key+12, &c->network);
+	netdev = get_netdev_from_key(key+12, c);
 	if (!netdev)
 		return -1;
 
@@ -444,8 +701,9 @@ extern int lxc_list_nicconfigs(struct lxc_conf *c, const char *key,
 }
 
 static struct lxc_netdev *network_netdev(const char *key, const char *value,
-					 struct lxc_list *network)
+					 struct lxc_conf *lxc_conf)
 {
+	struct lxc_list *network = &lxc_conf->network;
 	struct lxc_netdev *netdev = NULL;
 
 	if (lxc_list_empty(network)) {
@@ -457,7 +715,7 @@ static struct lxc_netdev *network_netdev(const char *key, const char *value,
 	if (get_network_netdev_idx(key+12) == -1)
 		netdev = lxc_list_last_elem(network);
 	else
-		netdev = get_netdev_from_key(key+12, network);
+		netdev = get_netdev_from_key(key+12, lxc_conf);
 
 	if (!netdev) {
 		ERROR("no network device defined for '%s' = '%s' option",
@@ -514,7 +772,7 @@ static int config_network_flags(const char *key, const char *value,
 {
 	struct lxc_netdev *netdev;
 
-	netdev = network_netdev(key, value, &lxc_conf->network);
+	netdev = network_netdev(key, value, lxc_conf);
 	if (!netdev)
 		return -1;
 
@@ -528,7 +786,7 @@ static int config_network_link(const char *key, const char *value,
 {
 	struct lxc_netdev *netdev;
 
-	netdev = network_netdev(key, value, &lxc_conf->network);
+	netdev = network_netdev(key, value, lxc_conf);
 	if (!netdev)
 		return -1;
 
@@ -540,7 +798,7 @@ static int config_network_name(const char *key, const char *value,
 {
 	struct lxc_netdev *netdev;
 
-	netdev = network_netdev(key, value, &lxc_conf->network);
+	netdev = network_netdev(key, value, lxc_conf);
 	if (!netdev)
 		return -1;
 
@@ -552,7 +810,7 @@ static int config_network_veth_pair(const char *key, const char *value,
 {
 	struct lxc_netdev *netdev;
 
-	netdev = network_netdev(key, value, &lxc_conf->network);
+	netdev = network_netdev(key, value, lxc_conf);
 	if (!netdev)
 		return -1;
 
@@ -564,7 +822,7 @@ static int config_network_macvlan_mode(const char *key, const char *value,
 {
 	struct lxc_netdev *netdev;
 
-	netdev = network_netdev(key, value, &lxc_conf->network);
+	netdev = network_netdev(key, value, lxc_conf);
 	if (!netdev)
 		return -1;
 
@@ -576,7 +834,7 @@ static int config_network_hwaddr(const char *key, const char *value,
 {
 	struct lxc_netdev *netdev;
 
-	netdev = network_netdev(key, value, &lxc_conf->network);
+	netdev = network_netdev(key, value, lxc_conf);
 	if (!netdev)
 		return -1;
 
@@ -588,7 +846,7 @@ static int config_network_vlan_id(const char *key, const char *value,
 {
 	struct lxc_netdev *netdev;
 
-	netdev = network_netdev(key, value, &lxc_conf->network);
+	netdev = network_netdev(key, value, lxc_conf);
 	if (!netdev)
 		return -1;
 
@@ -603,7 +861,7 @@ static int config_network_mtu(const char *key, const char *value,
 {
 	struct lxc_netdev *netdev;
 
-	netdev = network_netdev(key, value, &lxc_conf->network);
+	netdev = network_netdev(key, value, lxc_conf);
 	if (!netdev)
 		return -1;
 
@@ -618,7 +876,7 @@ static int config_network_ipv4(const char *key, const char *value,
 	struct lxc_list *list;
 	char *cursor, *slash, *addr = NULL, *bcast = NULL, *prefix = NULL;
 
-	netdev = network_netdev(key, value, &lxc_conf->network);
+	netdev = network_netdev(key, value, lxc_conf);
 	if (!netdev)
 		return -1;
 
@@ -700,7 +958,7 @@ static int config_network_ipv4_gateway(const char *key, const char *value,
 	struct lxc_netdev *netdev;
 	struct in_addr *gw;
 
-	netdev = network_netdev(key, value, &lxc_conf->network);
+	netdev = network_netdev(key, value, lxc_conf);
 	if (!netdev)
 		return -1;
 
@@ -742,7 +1000,7 @@ static int config_network_ipv6(const char *key, const char *value,
 	char *slash,*valdup;
 	char *netmask;
 
-	netdev = network_netdev(key, value, &lxc_conf->network);
+	netdev = network_netdev(key, value, lxc_conf);
 	if (!netdev)
 		return -1;
 
@@ -798,7 +1056,7 @@ static int config_network_ipv6_gateway(const char *key, const char *value,
 {
 	struct lxc_netdev *netdev;
 
-	netdev = network_netdev(key, value, &lxc_conf->network);
+	netdev = network_netdev(key, value, lxc_conf);
 	if (!netdev)
 		return -1;
 
@@ -837,7 +1095,7 @@ static int config_network_script_up(const char *key, const char *value,
 {
 	struct lxc_netdev *netdev;
 
-	netdev = network_netdev(key, value, &lxc_conf->network);
+	netdev = network_netdev(key, value, lxc_conf);
 	if (!netdev)
  		return -1;
 
@@ -849,7 +1107,7 @@ static int config_network_script_down(const char *key, const char *value,
 {
 	struct lxc_netdev *netdev;
 
-	netdev = network_netdev(key, value, &lxc_conf->network);
+	netdev = network_netdev(key, value, lxc_conf);
 	if (!netdev)
  		return -1;
 
@@ -858,18 +1116,73 @@ static int config_network_script_down(const char *key, const char *value,
 
 static int add_hook(struct lxc_conf *lxc_conf, int which, char *hook)
 {
-	struct lxc_list *hooklist;
+	struct lxc_strlist *hooks;
 
-	hooklist = malloc(sizeof(*hooklist));
-	if (!hooklist) {
-		free(hook);
+	hooks = lxc_strlist_append(lxc_conf->hooks[which], hook);
+	free(hook);
+	if (!hooks)
 		return -1;
+	lxc_conf->hooks[which] = hooks;
+	return 0;
+}
+
+/*
+ * lxc.hook.parallel lists the hook types (e.g. "pre-start mount") whose
+ * scripts don't depend on each other and may be run concurrently.
+ */
+static int config_hook_parallel(const char *key, const char *value,
+				struct lxc_conf *lxc_conf)
+{
+	char *copy, *token, *saveptr = NULL;
+	int i, mask = 0;
+
+	if (!value || strlen(value) == 0) {
+		lxc_conf->hooks_parallel = 0;
+		return 0;
 	}
-	hooklist->elem = hook;
-	lxc_list_add_tail(&lxc_conf->hooks[which], hooklist);
+
+	copy = strdup(value);
+	if (!copy) {
+		SYSERROR("failed to dup string '%s'", value);
+		return -1;
+	}
+	for (token = strtok_r(copy, " \t,", &saveptr); token;
+	     token = strtok_r(NULL, " \t,", &saveptr)) {
+		for (i = 0; i < NUM_LXC_HOOKS; i++)
+			if (strcmp(token, lxchook_names[i]) == 0)
+				break;
+		if (i == NUM_LXC_HOOKS) {
+			ERROR("unknown hook type '%s' in %s", token, key);
+			free(copy);
+			return -1;
+		}
+		mask |= 1 << i;
+	}
+	free(copy);
+
+	lxc_conf->hooks_parallel |= mask;
 	return 0;
 }
 
+static int lxc_get_item_hook_parallel(struct lxc_conf *c, char *retv, int inlen)
+{
+	int i, len, fulllen = 0;
+	const char *sep = "";
+
+	if (!retv)
+		inlen = 0;
+	else
+		memset(retv, 0, inlen);
+
+	for (i = 0; i < NUM_LXC_HOOKS; i++) {
+		if (!(c->hooks_parallel & (1 << i)))
+			continue;
+		strprint(retv, inlen, "%s%s", sep, lxchook_names[i]);
+		sep = " ";
+	}
+	return fulllen;
+}
+
 static int config_seccomp(const char *key, const char *value,
 				 struct lxc_conf *lxc_conf)
 {
@@ -954,7 +1267,7 @@ static int config_group(const char *key, const char *value,
 		      struct lxc_conf *lxc_conf)
 {
 	char *groups, *groupptr, *sptr, *token;
-	struct lxc_list *grouplist;
+	struct lxc_strlist *grouplist;
 	int ret = -1;
 
 	if (!strlen(value))
@@ -975,20 +1288,12 @@ static int config_group(const char *key, const char *value,
                         break;
 		}
 
-		grouplist = malloc(sizeof(*grouplist));
+		grouplist = lxc_strlist_append(lxc_conf->groups, token);
 		if (!grouplist) {
 			SYSERROR("failed to allocate groups list");
 			break;
 		}
-
-		grouplist->elem = strdup(token);
-		if (!grouplist->elem) {
-			SYSERROR("failed to dup '%s'", token);
-			free(grouplist);
-			break;
-		}
-
-		lxc_list_add_tail(&lxc_conf->groups, grouplist);
+		lxc_conf->groups = grouplist;
         }
 
 	free(groups);
@@ -1047,11 +1352,94 @@ static int config_logfile(const char *key, const char *value,
 	return ret;
 }
 
+static struct lxc_category_level *loglevel_find(struct lxc_conf *lxc_conf,
+					  const char *category)
+{
+	struct lxc_list *it;
+	struct lxc_category_level *ll;
+
+	lxc_list_for_each(it, &lxc_conf->loglevels) {
+		ll = it->elem;
+		if (!strcmp(ll->category, category))
+			return ll;
+	}
+	return NULL;
+}
+
+/*
+ * lxc.loglevel.<category> is not overridden by the command line: there is
+ * no way to give it there.  An empty value hands the category back to its
+ * parent's level.
+ */
+static int config_loglevel_category(const char *category, const char *value,
+				    struct lxc_conf *lxc_conf)
+{
+	struct lxc_category_level *ll;
+	struct lxc_list *list;
+	int newlevel, ret;
+
+	if (!*category) {
+		ERROR("no log category in lxc.loglevel.");
+		return -1;
+	}
+
+	if (!value || strlen(value) == 0)
+		newlevel = LXC_LOG_PRIORITY_NOTSET;
+	else if (value[0] >= '0' && value[0] <= '9')
+		newlevel = atoi(value);
+	else {
+		newlevel = lxc_log_priority_to_int(value);
+		if (newlevel == LXC_LOG_PRIORITY_NOTSET) {
+			ERROR("invalid log priority '%s'", value);
+			return -1;
+		}
+	}
+
+	ret = lxc_log_set_category_level(category, newlevel);
+	if (ret < 0)
+		return -1;
+	if (ret > 0)
+		INFO("no log category '%s' in this program", category);
+
+	ll = loglevel_find(lxc_conf, category);
+	if (newlevel == LXC_LOG_PRIORITY_NOTSET) {
+		struct lxc_list *it, *next;
+
+		lxc_list_for_each_safe(it, &lxc_conf->loglevels, next) {
+			if (it->elem != ll)
+				continue;
+			lxc_list_del(it);
+			free(ll->category);
+			free(ll);
+			free(it);
+		}
+		return 0;
+	}
+
+	if (!ll) {
+		ll = malloc(sizeof(*ll));
+		list = malloc(sizeof(*list));
+		if (!ll || !list || !(ll->category = strdup(category))) {
+			SYSERROR("failed to allocate memory");
+			free(ll);
+			free(list);
+			return -1;
+		}
+		lxc_list_add_elem(list, ll);
+		lxc_list_add_tail(&lxc_conf->loglevels, list);
+	}
+	ll->level = newlevel;
+	return 0;
+}
+
 static int config_loglevel(const char *key, const char *value,
 			     struct lxc_conf *lxc_conf)
 {
 	int newlevel;
 
+	if (!strncmp(key, "lxc.loglevel.", 13))
+		return config_loglevel_category(key + 13, value, lxc_conf);
+
 	if (!value || strlen(value) == 0)
 		return 0;
 
@@ -1069,6 +1457,49 @@ static int config_loglevel(const char *key, const char *value,
 	return lxc_log_set_level(newlevel);
 }
 
+static int config_logbuffer(const char *key, const char *value,
+			    struct lxc_conf *lxc_conf)
+{
+	unsigned long kib;
+	char *end;
+
+	if (!value || strlen(value) == 0)
+		kib = 0;
+	else {
+		errno = 0;
+		kib = strtoul(value, &end, 10);
+		if (errno || *end || kib > INT_MAX / 1024) {
+			ERROR("invalid log buffer size '%s'", value);
+			return -1;
+		}
+	}
+
+	if (lxc_log_set_buffer(kib * 1024))
+		return -1;
+	lxc_conf->logbuffer = kib;
+	return 0;
+}
+
+static int config_logformat(const char *key, const char *value,
+			    struct lxc_conf *lxc_conf)
+{
+	int format;
+
+	if (!value || strlen(value) == 0 || strcmp(value, "text") == 0)
+		format = LXC_LOG_FORMAT_TEXT;
+	else if (strcmp(value, "binary") == 0)
+		format = LXC_LOG_FORMAT_BINARY;
+	else {
+		ERROR("invalid log format '%s'", value);
+		return -1;
+	}
+
+	if (lxc_log_set_format(format))
+		return -1;
+	lxc_conf->logformat = format;
+	return 0;
+}
+
 static int config_autodev(const char *key, const char *value,
 			  struct lxc_conf *lxc_conf)
 {
@@ -1340,6 +1771,9 @@ static int config_mount(const char *key, const char *value,
 	char *mntelem;
 	struct lxc_list *mntlist;
 
+	/* any change here makes the compiled plan stale */
+	lxc_mount_plan_free(lxc_conf);
+
 	if (!value || strlen(value) == 0)
 		return lxc_clear_mount_entries(lxc_conf);
 
@@ -1383,7 +1817,7 @@ static int config_cap_keep(const char *key, const char *value,
 			   struct lxc_conf *lxc_conf)
 {
 	char *keepcaps, *keepptr, *sptr, *token;
-	struct lxc_list *keeplist;
+	struct lxc_strlist *keeplist;
 	int ret = -1;
 
 	if (!strlen(value))
@@ -1404,20 +1838,12 @@ static int config_cap_keep(const char *key, const char *value,
                         break;
 		}
 
-		keeplist = malloc(sizeof(*keeplist));
+		keeplist = lxc_strlist_append(lxc_conf->keepcaps, token);
 		if (!keeplist) {
 			SYSERROR("failed to allocate keepcap list");
 			break;
 		}
-
-		keeplist->elem = strdup(token);
-		if (!keeplist->elem) {
-			SYSERROR("failed to dup '%s'", token);
-			free(keeplist);
-			break;
-		}
-
-		lxc_list_add_tail(&lxc_conf->keepcaps, keeplist);
+		lxc_conf->keepcaps = keeplist;
         }
 
 	free(keepcaps);
@@ -1429,7 +1855,7 @@ static int config_cap_drop(const char *key, const char *value,
 			   struct lxc_conf *lxc_conf)
 {
 	char *dropcaps, *dropptr, *sptr, *token;
-	struct lxc_list *droplist;
+	struct lxc_strlist *droplist;
 	int ret = -1;
 
 	if (!strlen(value))
@@ -1450,20 +1876,12 @@ static int config_cap_drop(const char *key, const char *value,
                         break;
 		}
 
-		droplist = malloc(sizeof(*droplist));
+		droplist = lxc_strlist_append(lxc_conf->caps, token);
 		if (!droplist) {
 			SYSERROR("failed to allocate drop list");
 			break;
 		}
-
-		droplist->elem = strdup(token);
-		if (!droplist->elem) {
-			SYSERROR("failed to dup '%s'", token);
-			free(droplist);
-			break;
-		}
-
-		lxc_list_add_tail(&lxc_conf->caps, droplist);
+		lxc_conf->caps = droplist;
         }
 
 	free(dropcaps);
@@ -1527,63 +1945,430 @@ static int config_utsname(const char *key, const char *value,
 	return 0;
 }
 
-static int parse_line(char *buffer, void *data)
+/*
+ * Compiled config cache.  Loading a container's config through
+ * lxc_config_read_cached() records every key and value handed to a setter,
+ * with the includes already expanded, and the identity of every file read.
+ * The next load only stats those files and replays the setters from one
+ * mapping, without reading or splitting any text.  The cache is a hidden
+ * file next to the config, owned like it.
+ *
+ * A file rewritten in place within the same timestamp tick keeps its
+ * identity, so, as git does for its index, a cache is only trusted for
+ * files whose mtime is strictly older than the cache's own.
+ */
+#define CONFIG_CACHE_MAGIC "LXCCONF1"
+
+struct config_cache_header {
+	char magic[8];
+	uint64_t size;
+	uint32_t nr_files;
+	uint32_t nr_items;
+};
+
+struct config_cache_file {
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	uint32_t len;		/* of the path following, without NUL */
+	uint32_t pad;
+};
+
+struct config_cache_item {
+	uint32_t keylen;	/* key and value follow, NUL terminated */
+	uint32_t valuelen;
+};
+
+#define CONFIG_CACHE_ALIGN(n) (((n) + 7) & ~(size_t)7)
+
+struct config_recorder {
+	char *files;
+	size_t files_len;
+	size_t files_size;
+	char *items;
+	size_t items_len;
+	size_t items_size;
+	uint32_t nr_files;
+	uint32_t nr_items;
+	bool failed;
+};
+
+static __thread struct config_recorder *config_recorder;
+
+static void *config_record_reserve(char **buf, size_t *len, size_t *size,
+				   size_t n)
+{
+	char *p;
+
+	if (*len + n > *size) {
+		size_t newsize = *size ? *size : 4096;
+
+		while (newsize < *len + n)
+			newsize *= 2;
+		p = realloc(*buf, newsize);
+		if (!p) {
+			config_recorder->failed = true;
+			return NULL;
+		}
+		*buf = p;
+		*size = newsize;
+	}
+
+	p = *buf + *len;
+	memset(p, 0, n);
+	*len += n;
+	return p;
+}
+
+static void config_record_file(const char *file)
+{
+	struct config_recorder *r = config_recorder;
+	struct config_cache_file *f;
+	size_t len = strlen(file);
+	struct stat st;
+
+	if (r->failed)
+		return;
+
+	if (stat(file, &st) < 0) {
+		r->failed = true;
+		return;
+	}
+
+	f = config_record_reserve(&r->files, &r->files_len, &r->files_size,
+				  sizeof(*f) + CONFIG_CACHE_ALIGN(len + 1));
+	if (!f)
+		return;
+
+	f->dev = st.st_dev;
+	f->ino = st.st_ino;
+	f->size = st.st_size;
+	f->mtime_sec = st.st_mtim.tv_sec;
+	f->mtime_nsec = st.st_mtim.tv_nsec;
+	f->len = len;
+	memcpy(f + 1, file, len);
+	r->nr_files++;
+}
+
+static void config_record_item(const char *key, const char *value)
+{
+	struct config_recorder *r = config_recorder;
+	struct config_cache_item *item;
+	size_t keylen = strlen(key), valuelen = strlen(value);
+
+	if (r->failed)
+		return;
+
+	item = config_record_reserve(&r->items, &r->items_len, &r->items_size,
+			sizeof(*item) + CONFIG_CACHE_ALIGN(keylen + valuelen + 2));
+	if (!item)
+		return;
+
+	item->keylen = keylen;
+	item->valuelen = valuelen;
+	memcpy(item + 1, key, keylen);
+	memcpy((char *)(item + 1) + keylen + 1, value, valuelen);
+	r->nr_items++;
+}
+
+static int config_cache_path(const char *file, char *path, size_t size)
 {
+	const char *slash = strrchr(file, '/');
+	int ret;
+
+	if (slash)
+		ret = snprintf(path, size, "%.*s/.%s.cache",
+			       (int)(slash - file), file, slash + 1);
+	else
+		ret = snprintf(path, size, ".%s.cache", file);
+	if (ret < 0 || ret >= size)
+		return -1;
+	return 0;
+}
+
+/* is f's mtime strictly older than ts */
+static bool config_cache_file_older(const struct config_cache_file *f,
+				    const struct timespec *ts)
+{
+	return f->mtime_sec < ts->tv_sec ||
+	       (f->mtime_sec == ts->tv_sec && f->mtime_nsec < ts->tv_nsec);
+}
+
+static void config_cache_write(const char *file, struct config_recorder *r)
+{
+	struct config_cache_header hdr;
+	const struct config_cache_file *f;
+	char path[MAXPATHLEN], tmp[MAXPATHLEN];
+	struct stat st, cst;
+	const char *p;
+	uint32_t i;
+	int fd, ret;
+
+	if (r->failed || stat(file, &st) < 0 ||
+	    config_cache_path(file, path, sizeof(path)) < 0)
+		return;
+
+	ret = snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+	if (ret < 0 || ret >= sizeof(tmp))
+		return;
+
+	/* not being able to write next to the config is fine */
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		return;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, CONFIG_CACHE_MAGIC, sizeof(hdr.magic));
+	hdr.size = sizeof(hdr) + r->files_len + r->items_len;
+	hdr.nr_files = r->nr_files;
+	hdr.nr_items = r->nr_items;
+
+	if (geteuid() == 0 && st.st_uid != 0)
+		(void)fchown(fd, st.st_uid, st.st_gid);
+	(void)fchmod(fd, st.st_mode & 0644);
+
+	if (lxc_write_nointr(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+	    lxc_write_nointr(fd, r->files, r->files_len) != r->files_len ||
+	    lxc_write_nointr(fd, r->items, r->items_len) != r->items_len ||
+	    fstat(fd, &cst) < 0) {
+		WARN("Failed to write config cache %s", path);
+		close(fd);
+		unlink(tmp);
+		return;
+	}
+
+	/* a file changed in this very tick could change again unnoticed */
+	for (i = 0, p = r->files; i < r->nr_files; i++) {
+		f = (const struct config_cache_file *)p;
+		if (!config_cache_file_older(f, &cst.st_mtim)) {
+			DEBUG("Not caching %s, it was just modified", file);
+			close(fd);
+			unlink(tmp);
+			return;
+		}
+		p += sizeof(*f) + CONFIG_CACHE_ALIGN(f->len + 1);
+	}
+
+	if (close(fd) < 0 || rename(tmp, path) < 0) {
+		WARN("Failed to write config cache %s", path);
+		unlink(tmp);
+		return;
+	}
+
+	DEBUG("Wrote config cache %s", path);
+}
+
+static bool config_cache_file_current(const struct config_cache_file *f,
+				      const char *path,
+				      const struct timespec *written)
+{
+	struct stat st;
+
+	if (!config_cache_file_older(f, written) || stat(path, &st) < 0)
+		return false;
+
+	return st.st_dev == f->dev && st.st_ino == f->ino &&
+	       st.st_size == f->size && st.st_mtim.tv_sec == f->mtime_sec &&
+	       st.st_mtim.tv_nsec == f->mtime_nsec;
+}
+
+/*
+ * Replay the cache for file into conf.  Returns 1 if there is no usable
+ * cache, without having touched conf.
+ */
+static int config_cache_load(const char *file, struct lxc_conf *conf)
+{
+	const struct config_cache_header *hdr;
+	const struct config_cache_file *f;
+	const struct config_cache_item *item;
 	struct lxc_config_t *config;
-	char *line, *linep;
+	char path[MAXPATHLEN];
+	struct stat st, cst;
+	const char *key, *value, *p, *end, *items;
+	char *buf;
+	uint32_t i;
+	int fd, ret = 1;
+
+	if (config_cache_path(file, path, sizeof(path)) < 0)
+		return 1;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 1;
+
+	if (fstat(fd, &cst) < 0 || stat(file, &st) < 0 ||
+	    cst.st_uid != st.st_uid || cst.st_size < sizeof(*hdr)) {
+		close(fd);
+		return 1;
+	}
+
+	buf = mmap(NULL, cst.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (buf == MAP_FAILED)
+		return 1;
+
+	hdr = (const struct config_cache_header *)buf;
+	end = buf + cst.st_size;
+	if (memcmp(hdr->magic, CONFIG_CACHE_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->size != cst.st_size)
+		goto out;
+
+	/* the first file is the config itself */
+	p = buf + sizeof(*hdr);
+	for (i = 0; i < hdr->nr_files; i++) {
+		f = (const struct config_cache_file *)p;
+		if (end - p < sizeof(*f) ||
+		    end - p - sizeof(*f) < CONFIG_CACHE_ALIGN(f->len + 1))
+			goto out;
+		key = (const char *)(f + 1);
+		if (key[f->len] != '\0' || (i == 0 && strcmp(key, file)))
+			goto out;
+		if (!config_cache_file_current(f, key, &cst.st_mtim))
+			goto out;
+		p += sizeof(*f) + CONFIG_CACHE_ALIGN(f->len + 1);
+	}
+	if (!hdr->nr_files)
+		goto out;
+	items = p;
+
+	/* validate all of it before changing conf */
+	item = (const struct config_cache_item *)p;
+	for (i = 0; i < hdr->nr_items; i++) {
+		if (end - p < sizeof(*item) ||
+		    end - p - sizeof(*item) <
+		    CONFIG_CACHE_ALIGN((size_t)item->keylen + item->valuelen + 2))
+			goto out;
+		key = (const char *)(item + 1);
+		if (key[item->keylen] != '\0' ||
+		    key[item->keylen + 1 + item->valuelen] != '\0')
+			goto out;
+		p += sizeof(*item) +
+		     CONFIG_CACHE_ALIGN((size_t)item->keylen + item->valuelen + 2);
+		item = (const struct config_cache_item *)p;
+	}
+
+	if (!conf->rcfile)
+		conf->rcfile = strdup(file);
+
+	ret = 0;
+	p = items;
+	for (i = 0; i < hdr->nr_items; i++) {
+		item = (const struct config_cache_item *)p;
+		key = (const char *)(item + 1);
+		value = key + item->keylen + 1;
+		p += sizeof(*item) +
+		     CONFIG_CACHE_ALIGN((size_t)item->keylen + item->valuelen + 2);
+
+		config = lxc_getconfig(key);
+		if (!config) {
+			ERROR("unknown key %s", key);
+			ret = -1;
+			break;
+		}
+		if (config->cb(key, value, conf)) {
+			ERROR("Failed to parse config: %s = %s", key, value);
+			ret = -1;
+			break;
+		}
+	}
+
+out:
+	munmap(buf, cst.st_size);
+	return ret;
+}
+
+/*
+ * Split a config line in place: the key and value are terminated and
+ * trimmed where they are.  Returns 1 if the line is an assignment, 0 if it
+ * is to be ignored and -1 if it is malformed.
+ */
+static int split_config_line(char *buffer, char **keyp, char **valuep)
+{
+	char *line, *end;
 	char *dot;
 	char *key;
 	char *value;
-	int ret = 0;
 
 	if (lxc_is_line_empty(buffer))
 		return 0;
 
-	/* we have to dup the buffer otherwise, at the re-exec for
-	 * reboot we modified the original string on the stack by
-	 * replacing '=' by '\0' below
-	 */
-	linep = line = strdup(buffer);
-	if (!line) {
-		SYSERROR("failed to allocate memory for '%s'", buffer);
-		return -1;
-	}
-
-	line += lxc_char_left_gc(line, strlen(line));
+	end = buffer + strlen(buffer);
+	line = buffer + lxc_char_left_gc(buffer, end - buffer);
 
 	/* martian option - ignoring it, the commented lines beginning by '#'
 	 * fall in this case
 	 */
 	if (strncmp(line, "lxc.", 4))
-		goto out;
-
-	ret = -1;
+		return 0;
 
-	dot = strstr(line, "=");
+	dot = strchr(line, '=');
 	if (!dot) {
 		ERROR("invalid configuration line: %s", line);
-		goto out;
+		return -1;
 	}
 
 	*dot = '\0';
 	value = dot + 1;
 
 	key = line;
-	key[lxc_char_right_gc(key, strlen(key))] = '\0';
+	key[lxc_char_right_gc(key, dot - key)] = '\0';
+
+	value += lxc_char_left_gc(value, end - value);
+	value[lxc_char_right_gc(value, end - value)] = '\0';
+
+	*keyp = key;
+	*valuep = value;
+	return 1;
+}
+
+static int parse_line_inplace(char *buffer, void *data)
+{
+	struct lxc_config_t *config;
+	char *key;
+	char *value;
+	int ret;
 
-	value += lxc_char_left_gc(value, strlen(value));
-	value[lxc_char_right_gc(value, strlen(value))] = '\0';
+	ret = split_config_line(buffer, &key, &value);
+	if (ret <= 0)
+		return ret;
 
 	config = lxc_getconfig(key);
 	if (!config) {
 		ERROR("unknown key %s", key);
-		goto out;
+		return -1;
 	}
 
-	ret = config->cb(key, value, data);
+	if (config->cb(key, value, data))
+		return -1;
 
-out:
-	free(linep);
+	/* includes are recorded as the files they pull in */
+	if (config_recorder && config->cb != config_includefile)
+		config_record_item(key, value);
+	return 0;
+}
+
+static int parse_line(char *buffer, void *data)
+{
+	char *line;
+	int ret;
+
+	if (lxc_is_line_empty(buffer))
+		return 0;
+
+	/* we have to dup the buffer otherwise, at the re-exec for
+	 * reboot we modified the original string on the stack by
+	 * replacing '=' by '\0' below
+	 */
+	line = strdup(buffer);
+	if (!line) {
+		SYSERROR("failed to allocate memory for '%s'", buffer);
+		return -1;
+	}
+
+	ret = parse_line_inplace(line, data);
+	free(line);
 	return ret;
 }
 
@@ -1601,7 +2386,117 @@ int lxc_config_read(const char *file, struct lxc_conf *conf)
 	if( ! conf->rcfile ) {
 		conf->rcfile = strdup( file );
 	}
-	return lxc_file_for_each_line(file, parse_line, conf);
+	if (config_recorder)
+		config_record_file(file);
+	return lxc_file_for_each_line_inplace(file, parse_line_inplace, conf);
+}
+
+struct config_peek {
+	const char **keys;
+	char **values;
+	int count;
+};
+
+static int config_peek_value(char **valuep, const char *value)
+{
+	size_t oldlen, len;
+	char *v;
+
+	/* like the list keys, an empty assignment drops what came before */
+	if (!*valuep || !**valuep || !*value) {
+		v = strdup(value);
+		if (!v)
+			return -1;
+		free(*valuep);
+		*valuep = v;
+		return 0;
+	}
+
+	oldlen = strlen(*valuep);
+	len = strlen(value);
+	v = realloc(*valuep, oldlen + len + 2);
+	if (!v)
+		return -1;
+	v[oldlen] = '\n';
+	memcpy(v + oldlen + 1, value, len + 1);
+	*valuep = v;
+	return 0;
+}
+
+static int config_peek_line(char *buffer, void *data)
+{
+	struct config_peek *peek = data;
+	char *key;
+	char *value;
+	int i, ret;
+
+	ret = split_config_line(buffer, &key, &value);
+	if (ret <= 0)
+		return ret;
+
+	if (!strcmp(key, "lxc.include")) {
+		if (access(value, R_OK) == -1)
+			return -1;
+		return lxc_file_for_each_line_inplace(value, config_peek_line, peek);
+	}
+
+	for (i = 0; i < peek->count; i++) {
+		if (strcmp(key, peek->keys[i]))
+			continue;
+		if (config_peek_value(&peek->values[i], value)) {
+			SYSERROR("failed to allocate memory for '%s'", key);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int lxc_config_peek(const char *path, const char **keys, char **values,
+		    int count)
+{
+	struct config_peek peek = {
+		.keys = keys,
+		.values = values,
+		.count = count,
+	};
+	int i;
+
+	for (i = 0; i < count; i++)
+		values[i] = NULL;
+
+	if (access(path, R_OK) == -1)
+		return -1;
+
+	if (lxc_file_for_each_line_inplace(path, config_peek_line, &peek)) {
+		for (i = 0; i < count; i++) {
+			free(values[i]);
+			values[i] = NULL;
+		}
+		return -1;
+	}
+	return 0;
+}
+
+int lxc_config_read_cached(const char *file, struct lxc_conf *conf)
+{
+	struct config_recorder r;
+	int ret;
+
+	ret = config_cache_load(file, conf);
+	if (ret <= 0)
+		return ret;
+
+	memset(&r, 0, sizeof(r));
+	config_recorder = &r;
+	ret = lxc_config_read(file, conf);
+	config_recorder = NULL;
+
+	if (!ret)
+		config_cache_write(file, &r);
+
+	free(r.files);
+	free(r.items);
+	return ret;
 }
 
 int lxc_config_define_add(struct lxc_list *defines, char* arg)
@@ -1769,7 +2664,8 @@ static int lxc_get_item_hooks(struct lxc_conf *c, char *retv, int inlen,
 {
 	char *subkey;
 	int len, fulllen = 0, found = -1;
-	struct lxc_list *it;
+	char *item;
+	size_t n;
 	int i;
 
 	/* "lxc.hook.mount" */
@@ -1794,8 +2690,8 @@ static int lxc_get_item_hooks(struct lxc_conf *c, char *retv, int inlen,
 	else
 		memset(retv, 0, inlen);
 
-	lxc_list_for_each(it, &c->hooks[found]) {
-		strprint(retv, inlen, "%s\n", (char *)it->elem);
+	lxc_strlist_for_each(item, c->hooks[found], n) {
+		strprint(retv, inlen, "%s\n", item);
 	}
 	return fulllen;
 }
@@ -1803,15 +2699,16 @@ static int lxc_get_item_hooks(struct lxc_conf *c, char *retv, int inlen,
 static int lxc_get_item_groups(struct lxc_conf *c, char *retv, int inlen)
 {
 	int len, fulllen = 0;
-	struct lxc_list *it;
+	char *item;
+	size_t i;
 
 	if (!retv)
 		inlen = 0;
 	else
 		memset(retv, 0, inlen);
 
-	lxc_list_for_each(it, &c->groups) {
-		strprint(retv, inlen, "%s\n", (char *)it->elem);
+	lxc_strlist_for_each(item, c->groups, i) {
+		strprint(retv, inlen, "%s\n", item);
 	}
 	return fulllen;
 }
@@ -1819,15 +2716,16 @@ static int lxc_get_item_groups(struct lxc_conf *c, char *retv, int inlen)
 static int lxc_get_item_cap_drop(struct lxc_conf *c, char *retv, int inlen)
 {
 	int len, fulllen = 0;
-	struct lxc_list *it;
+	char *item;
+	size_t i;
 
 	if (!retv)
 		inlen = 0;
 	else
 		memset(retv, 0, inlen);
 
-	lxc_list_for_each(it, &c->caps) {
-		strprint(retv, inlen, "%s\n", (char *)it->elem);
+	lxc_strlist_for_each(item, c->caps, i) {
+		strprint(retv, inlen, "%s\n", item);
 	}
 	return fulllen;
 }
@@ -1835,15 +2733,16 @@ static int lxc_get_item_cap_drop(struct lxc_conf *c, char *retv, int inlen)
 static int lxc_get_item_cap_keep(struct lxc_conf *c, char *retv, int inlen)
 {
 	int len, fulllen = 0;
-	struct lxc_list *it;
+	char *item;
+	size_t i;
 
 	if (!retv)
 		inlen = 0;
 	else
 		memset(retv, 0, inlen);
 
-	lxc_list_for_each(it, &c->keepcaps) {
-		strprint(retv, inlen, "%s\n", (char *)it->elem);
+	lxc_strlist_for_each(item, c->keepcaps, i) {
+		strprint(retv, inlen, "%s\n", item);
 	}
 	return fulllen;
 }
@@ -1888,7 +2787,7 @@ static int lxc_get_item_nic(struct lxc_conf *c, char *retv, int inlen,
 	if (!p1 || *(p1+1) == '\0') return -1;
 	p1++;
 
-	netdev = get_netdev_from_key(key, &c->network);
+	netdev = get_netdev_from_key(key, c);
 	if (!netdev)
 		return -1;
 	if (strcmp(p1, "name") == 0) {
@@ -1995,59 +2894,88 @@ int lxc_get_config_item(struct lxc_conf *c, const char *key, char *retv,
 {
 	const char *v = NULL;
 
-	if (strcmp(key, "lxc.mount.entry") == 0)
+	switch (config_key_id(&config_get_exact_idx, &config_get_prefix_idx, key)) {
+	case CONFIG_GET_MOUNT_ENTRY:
 		return lxc_get_mount_entries(c, retv, inlen);
-	else if (strcmp(key, "lxc.mount") == 0)
+	case CONFIG_GET_MOUNT:
 		v = c->fstab;
-	else if (strcmp(key, "lxc.tty") == 0)
+		break;
+	case CONFIG_GET_TTY:
 		return lxc_get_conf_int(c, retv, inlen, c->tty);
-	else if (strcmp(key, "lxc.pts") == 0)
+	case CONFIG_GET_PTS:
 		return lxc_get_conf_int(c, retv, inlen, c->pts);
-	else if (strcmp(key, "lxc.devttydir") == 0)
+	case CONFIG_GET_TTYDIR:
 		v = c->ttydir;
-	else if (strcmp(key, "lxc.arch") == 0)
+		break;
+	case CONFIG_GET_ARCH:
 		return lxc_get_arch_entry(c, retv, inlen);
-	else if (strcmp(key, "lxc.aa_profile") == 0)
+	case CONFIG_GET_AA_PROFILE:
 		v = c->lsm_aa_profile;
-	else if (strcmp(key, "lxc.se_context") == 0)
+		break;
+	case CONFIG_GET_SE_CONTEXT:
 		v = c->lsm_se_context;
-	else if (strcmp(key, "lxc.logfile") == 0)
+		break;
+	case CONFIG_GET_LOGFILE:
 		v = lxc_log_get_file();
-	else if (strcmp(key, "lxc.loglevel") == 0)
+		break;
+	case CONFIG_GET_LOGLEVEL:
 		v = lxc_log_priority_to_string(lxc_log_get_level());
-	else if (strcmp(key, "lxc.cgroup") == 0) // all cgroup info
+		break;
+	case CONFIG_GET_LOGBUFFER:
+		return lxc_get_conf_int(c, retv, inlen, c->logbuffer);
+	case CONFIG_GET_LOGFORMAT:
+		v = c->logformat == LXC_LOG_FORMAT_BINARY ? "binary" : "text";
+		break;
+	case CONFIG_GET_LOGLEVEL_CATEGORY: {
+		struct lxc_category_level *ll = loglevel_find(c, key + 13);
+
+		if (!ll)
+			return 0;
+		v = lxc_log_priority_to_string(ll->level);
+		break;
+	}
+	case CONFIG_GET_CGROUP_ALL: // all cgroup info
 		return lxc_get_cgroup_entry(c, retv, inlen, "all");
-	else if (strncmp(key, "lxc.cgroup.", 11) == 0) // specific cgroup info
+	case CONFIG_GET_CGROUP: // specific cgroup info
 		return lxc_get_cgroup_entry(c, retv, inlen, key + 11);
-	else if (strcmp(key, "lxc.utsname") == 0)
+	case CONFIG_GET_UTSNAME:
 		v = c->utsname ? c->utsname->nodename : NULL;
-	else if (strcmp(key, "lxc.console") == 0)
+		break;
+	case CONFIG_GET_CONSOLE:
 		v = c->console.path;
-	else if (strcmp(key, "lxc.rootfs.mount") == 0)
+		break;
+	case CONFIG_GET_ROOTFS_MOUNT:
 		v = c->rootfs.mount;
-	else if (strcmp(key, "lxc.rootfs") == 0)
+		break;
+	case CONFIG_GET_ROOTFS:
 		v = c->rootfs.path;
-	else if (strcmp(key, "lxc.pivotdir") == 0)
+		break;
+	case CONFIG_GET_PIVOTDIR:
 		v = c->rootfs.pivot;
-	else if (strcmp(key, "lxc.cap.drop") == 0)
+		break;
+	case CONFIG_GET_CAP_DROP:
 		return lxc_get_item_cap_drop(c, retv, inlen);
-	else if (strcmp(key, "lxc.cap.keep") == 0)
+	case CONFIG_GET_CAP_KEEP:
 		return lxc_get_item_cap_keep(c, retv, inlen);
-	else if (strncmp(key, "lxc.hook", 8) == 0)
+	case CONFIG_GET_HOOK_PARALLEL:
+		return lxc_get_item_hook_parallel(c, retv, inlen);
+	case CONFIG_GET_HOOK:
 		return lxc_get_item_hooks(c, retv, inlen, key);
-	else if (strcmp(key, "lxc.network") == 0)
+	case CONFIG_GET_NETWORK:
 		return lxc_get_item_network(c, retv, inlen);
-	else if (strncmp(key, "lxc.network.", 12) == 0)
+	case CONFIG_GET_NIC:
 		return lxc_get_item_nic(c, retv, inlen, key + 12);
-	else if (strcmp(key, "lxc.start.auto") == 0)
+	case CONFIG_GET_START_AUTO:
 		return lxc_get_conf_int(c, retv, inlen, c->start_auto);
-	else if (strcmp(key, "lxc.start.delay") == 0)
+	case CONFIG_GET_START_DELAY:
 		return lxc_get_conf_int(c, retv, inlen, c->start_delay);
-	else if (strcmp(key, "lxc.start.order") == 0)
+	case CONFIG_GET_START_ORDER:
 		return lxc_get_conf_int(c, retv, inlen, c->start_order);
-	else if (strcmp(key, "lxc.group") == 0)
+	case CONFIG_GET_GROUP:
 		return lxc_get_item_groups(c, retv, inlen);
-	else return -1;
+	default:
+		return -1;
+	}
 
 	if (!v)
 		return 0;
@@ -2058,22 +2986,27 @@ int lxc_get_config_item(struct lxc_conf *c, const char *key, char *retv,
 
 int lxc_clear_config_item(struct lxc_conf *c, const char *key)
 {
-	if (strcmp(key, "lxc.network") == 0)
+	switch (config_key_id(&config_clear_exact_idx, &config_clear_prefix_idx, key)) {
+	case CONFIG_CLEAR_NETWORK:
 		return lxc_clear_config_network(c);
-	else if (strncmp(key, "lxc.network.", 12) == 0)
+	case CONFIG_CLEAR_NIC:
 		return lxc_clear_nic(c, key + 12);
-	else if (strcmp(key, "lxc.cap.drop") == 0)
+	case CONFIG_CLEAR_CAP_DROP:
 		return lxc_clear_config_caps(c);
-	else if (strcmp(key, "lxc.cap.keep") == 0)
+	case CONFIG_CLEAR_CAP_KEEP:
 		return lxc_clear_config_keepcaps(c);
-	else if (strncmp(key, "lxc.cgroup", 10) == 0)
+	case CONFIG_CLEAR_CGROUP:
 		return lxc_clear_cgroups(c, key);
-	else if (strcmp(key, "lxc.mount.entries") == 0)
+	case CONFIG_CLEAR_MOUNT_ENTRIES:
 		return lxc_clear_mount_entries(c);
-	else if (strncmp(key, "lxc.hook", 8) == 0)
+	case CONFIG_CLEAR_HOOK_PARALLEL:
+		c->hooks_parallel = 0;
+		return 0;
+	case CONFIG_CLEAR_HOOK:
 		return lxc_clear_hooks(c, key);
-	else if (strncmp(key, "lxc.group", 9) == 0)
+	case CONFIG_CLEAR_GROUP:
 		return lxc_clear_groups(c);
+	}
 
 	return -1;
 }
@@ -2084,6 +3017,8 @@ int lxc_clear_config_item(struct lxc_conf *c, const char *key)
 void write_config(FILE *fout, struct lxc_conf *c)
 {
 	struct lxc_list *it;
+	char *item;
+	size_t n;
 	int i;
 
 	if (c->fstab)
@@ -2135,6 +3070,15 @@ void write_config(FILE *fout, struct lxc_conf *c)
 		fprintf(fout, "lxc.loglevel = %s\n", lxc_log_priority_to_string(c->loglevel));
 	if (c->logfile)
 		fprintf(fout, "lxc.logfile = %s\n", c->logfile);
+	if (c->logbuffer)
+		fprintf(fout, "lxc.logbuffer = %d\n", c->logbuffer);
+	if (c->logformat == LXC_LOG_FORMAT_BINARY)
+		fprintf(fout, "lxc.logformat = binary\n");
+	lxc_list_for_each(it, &c->loglevels) {
+		struct lxc_category_level *ll = it->elem;
+		fprintf(fout, "lxc.loglevel.%s = %s\n", ll->category,
+			lxc_log_priority_to_string(ll->level));
+	}
 	lxc_list_for_each(it, &c->cgroup) {
 		struct lxc_cgroup *cg = it->elem;
 		fprintf(fout, "lxc.cgroup.%s = %s\n", cg->subsystem, cg->value);
@@ -2203,10 +3147,10 @@ void write_config(FILE *fout, struct lxc_conf *c)
 			fprintf(fout, "lxc.network.ipv6 = %s\n", buf);
 		}
 	}
-	lxc_list_for_each(it, &c->caps)
-		fprintf(fout, "lxc.cap.drop = %s\n", (char *)it->elem);
-	lxc_list_for_each(it, &c->keepcaps)
-		fprintf(fout, "lxc.cap.keep = %s\n", (char *)it->elem);
+	lxc_strlist_for_each(item, c->caps, n)
+		fprintf(fout, "lxc.cap.drop = %s\n", item);
+	lxc_strlist_for_each(item, c->keepcaps, n)
+		fprintf(fout, "lxc.cap.keep = %s\n", item);
 	lxc_list_for_each(it, &c->id_map) {
 		struct id_map *idmap = it->elem;
 		fprintf(fout, "lxc.id_map = %c %lu %lu %lu\n",
@@ -2214,9 +3158,13 @@ void write_config(FILE *fout, struct lxc_conf *c)
 			idmap->hostid, idmap->range);
 	}
 	for (i=0; i<NUM_LXC_HOOKS; i++) {
-		lxc_list_for_each(it, &c->hooks[i])
+		lxc_strlist_for_each(item, c->hooks[i], n)
 			fprintf(fout, "lxc.hook.%s = %s\n",
-				lxchook_names[i], (char *)it->elem);
+				lxchook_names[i], item);
+	}
+	for (i=0; i<NUM_LXC_HOOKS; i++) {
+		if (c->hooks_parallel & (1 << i))
+			fprintf(fout, "lxc.hook.parallel = %s\n", lxchook_names[i]);
 	}
 	if (c->console.path)
 		fprintf(fout, "lxc.console = %s\n", c->console.path);
@@ -40,7 +40,13 @@ extern struct lxc_config_t *lxc_getconfig(const char *key);
 extern int lxc_list_nicconfigs(struct lxc_conf *c, const char *key, char *retv, int inlen);
 extern int lxc_listconfigs(char *retv, int inlen);
 extern int lxc_config_read(const char *file, struct lxc_conf *conf);
+/* lxc_config_read() through a compiled cache kept next to file; only for
+ * files we own, i.e. a container's own config */
+extern int lxc_config_read_cached(const char *file, struct lxc_conf *conf);
 extern int lxc_config_readline(char *buffer, struct lxc_conf *conf);
+/* scan a config (and its includes) for keys only; see lxccontainer.h */
+extern int lxc_config_peek(const char *path, const char **keys, char **values,
+			   int count);
 
 extern int lxc_config_define_add(struct lxc_list *defines, char* arg);
 extern int lxc_config_define_load(struct lxc_list *defines,
@@ -23,6 +23,7 @@
 
 #include <assert.h>
 #include <signal.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -52,6 +53,8 @@
 lxc_log_define(lxc_console, lxc);
 
 static struct lxc_list lxc_ttys;
+/* protects lxc_ttys only; see the LOCKING note in lxccontainer.c */
+static pthread_mutex_t lxc_ttys_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 typedef void (*sighandler_t)(int);
 struct lxc_tty_state
@@ -103,10 +106,12 @@ void lxc_console_sigwinch(int sig)
 	struct lxc_list *it;
 	struct lxc_tty_state *ts;
 
+	pthread_mutex_lock(&lxc_ttys_mutex);
 	lxc_list_for_each(it, &lxc_ttys) {
 		ts = it->elem;
 		lxc_console_winch(ts);
 	}
+	pthread_mutex_unlock(&lxc_ttys_mutex);
 }
 
 static int lxc_console_cb_sigwinch_fd(int fd, uint32_t events, void *cbdata,
@@ -134,13 +139,10 @@ static int lxc_console_cb_sigwinch_fd(int fd, uint32_t events, void *cbdata,
  * member of the returned lxc_tty_state can be select()/poll()ed/epoll()ed
  * on (ie added to a mainloop) for SIGWINCH.
  *
- * Must be called with process_lock held to protect the lxc_ttys list, or
- * from a non-threaded context.
- *
  * Note that SIGWINCH isn't installed as a classic asychronous handler,
  * rather signalfd(2) is used so that we can handle the signal when we're
  * ready for it. This avoids deadlocks since a signal handler
- * (ie lxc_console_sigwinch()) would need to take the thread mutex to
+ * (ie lxc_console_sigwinch()) would need to take lxc_ttys_mutex to
  * prevent lxc_ttys list corruption, but using the fd we can provide the
  * tty_state needed to the callback (lxc_console_cb_sigwinch_fd()).
  */
@@ -160,7 +162,9 @@ static struct lxc_tty_state *lxc_console_sigwinch_init(int srcfd, int dstfd)
 
 	/* add tty to list to be scanned at SIGWINCH time */
 	lxc_list_add_elem(&ts->node, ts);
+	pthread_mutex_lock(&lxc_ttys_mutex);
 	lxc_list_add_tail(&lxc_ttys, &ts->node);
+	pthread_mutex_unlock(&lxc_ttys_mutex);
 
 	sigemptyset(&mask);
 	sigaddset(&mask, SIGWINCH);
@@ -181,7 +185,9 @@ static struct lxc_tty_state *lxc_console_sigwinch_init(int srcfd, int dstfd)
 err2:
 	sigprocmask(SIG_SETMASK, &ts->oldmask, NULL);
 err1:
+	pthread_mutex_lock(&lxc_ttys_mutex);
 	lxc_list_del(&ts->node);
+	pthread_mutex_unlock(&lxc_ttys_mutex);
 	free(ts);
 	ts = NULL;
 out:
@@ -195,16 +201,15 @@ out:
  *
  * Restore the saved signal handler that was in effect at the time
  * lxc_console_sigwinch_init() was called.
- *
- * Must be called with process_lock held to protect the lxc_ttys list, or
- * from a non-threaded context.
  */
 static void lxc_console_sigwinch_fini(struct lxc_tty_state *ts)
 {
 	if (ts->sigfd >= 0) {
 		close(ts->sigfd);
 	}
+	pthread_mutex_lock(&lxc_ttys_mutex);
 	lxc_list_del(&ts->node);
+	pthread_mutex_unlock(&lxc_ttys_mutex);
 	sigprocmask(SIG_SETMASK, &ts->oldmask, NULL);
 	free(ts);
 }
@@ -372,10 +377,8 @@ static int lxc_console_peer_proxy_alloc(struct lxc_console *console, int sockfd)
 	/* this is the proxy pty that will be given to the client, and that
 	 * the real pty master will send to / recv from
 	 */
-	process_lock();
 	ret = openpty(&console->peerpty.master, &console->peerpty.slave,
 		    console->peerpty.name, NULL, NULL);
-	process_unlock();
 	if (ret) {
 		SYSERROR("failed to create proxy pty");
 		return -1;
@@ -571,10 +574,8 @@ int lxc_console_create(struct lxc_conf *conf)
 	if (console->path && !strcmp(console->path, "none"))
 		return 0;
 
-	process_lock();
 	ret = openpty(&console->master, &console->slave,
 		    console->name, NULL, NULL);
-	process_unlock();
 	if (ret) {
 		SYSERROR("failed to allocate a pty");
 		return -1;
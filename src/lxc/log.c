@@ -27,6 +27,14 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <sched.h>
 
 #define __USE_GNU /* for *_CLOEXEC */
 
@@ -51,6 +59,193 @@ static int lxc_loglevel_specified = 0;
 
 lxc_log_define(lxc_log, lxc);
 
+/*
+ * With lxc.logbuffer set, logfile lines below NOTICE are collected in a
+ * buffer per thread and written in batches.  Only the owning thread
+ * touches its buffer, so there is no lock.  A buffer is flushed when it
+ * is full, before any line at NOTICE or above, before fork() and
+ * lxc_clone(), when a lxc_clone() child returns, before liblxc's children
+ * exec, before the mainloop waits, at thread exit, at exit() and on a
+ * fatal signal.
+ */
+#define LXC_LOG_BUFFERS_MAX	64
+#define LXC_LOG_BUFFER_MAX	(1024 * 1024)
+
+struct log_buffer {
+	size_t size;
+	size_t len;
+	unsigned long lines;
+	char data[];
+};
+
+static size_t log_buffer_size;
+/* lines lost because a batch could not be written */
+static unsigned long log_dropped;
+static __thread struct log_buffer *log_buffer;
+/* every thread's buffer, so that a crash can flush them all */
+static struct log_buffer *log_buffers[LXC_LOG_BUFFERS_MAX];
+static pthread_key_t log_buffer_key;
+static pthread_once_t log_buffer_once = PTHREAD_ONCE_INIT;
+
+static void log_buffer_write(struct log_buffer *b)
+{
+	char notice[LXC_LOG_BUFFER_SIZE];
+	struct iovec iov[2];
+	struct timeval tv;
+	unsigned long dropped;
+	ssize_t ret;
+	size_t total;
+	int n = 0;
+
+	if (!b || !b->len)
+		return;
+
+	dropped = __atomic_exchange_n(&log_dropped, 0, __ATOMIC_RELAXED);
+	if (dropped) {
+		gettimeofday(&tv, NULL);
+		n = snprintf(notice, sizeof(notice),
+			     "%15s %10ld.%03d %-8s %s - %lu log lines dropped\n",
+			     log_prefix, tv.tv_sec, (int)(tv.tv_usec / 1000),
+			     "WARN", "lxc_log", dropped);
+		if (n < 0 || n >= sizeof(notice))
+			n = 0;
+	}
+	iov[0].iov_base = notice;
+	iov[0].iov_len = n;
+	iov[1].iov_base = b->data;
+	iov[1].iov_len = b->len;
+	total = n + b->len;
+
+	ret = lxc_log_fd == -1 ? -1 : writev(lxc_log_fd, iov, 2);
+	if (ret != total) {
+		/* O_APPEND: a short write means the rest is gone too */
+		__atomic_add_fetch(&log_dropped, dropped + b->lines,
+				   __ATOMIC_RELAXED);
+	}
+	b->len = 0;
+	b->lines = 0;
+}
+
+extern void lxc_log_flush(void)
+{
+	log_buffer_write(log_buffer);
+}
+
+static void log_buffer_unregister(struct log_buffer *b)
+{
+	int i;
+
+	for (i = 0; i < LXC_LOG_BUFFERS_MAX; i++)
+		__sync_bool_compare_and_swap(&log_buffers[i], b, NULL);
+}
+
+static void log_buffer_destroy(void *data)
+{
+	struct log_buffer *b = data;
+
+	log_buffer_write(b);
+	log_buffer_unregister(b);
+	if (b == log_buffer)
+		log_buffer = NULL;
+	free(b);
+}
+
+static void log_crash_handler(int sig)
+{
+	int i;
+
+	/* best effort: other threads may be appending to theirs */
+	for (i = 0; i < LXC_LOG_BUFFERS_MAX; i++)
+		log_buffer_write(log_buffers[i]);
+	/* SA_RESETHAND put the default action back */
+	raise(sig);
+}
+
+static pthread_once_t log_process_once = PTHREAD_ONCE_INIT;
+
+static void log_process_init(void)
+{
+	pthread_atfork(lxc_log_flush, NULL, lxc_log_child_init);
+	atexit(lxc_log_flush);
+}
+
+static void log_buffer_init(void)
+{
+	static const int fatal[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+	struct sigaction sa, old;
+	int i;
+
+	if (pthread_key_create(&log_buffer_key, log_buffer_destroy))
+		return;
+	pthread_once(&log_process_once, log_process_init);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = log_crash_handler;
+	sa.sa_flags = SA_RESETHAND;
+	sigemptyset(&sa.sa_mask);
+	for (i = 0; i < sizeof(fatal) / sizeof(fatal[0]); i++) {
+		/* leave the program's own handlers alone */
+		if (sigaction(fatal[i], NULL, &old) == 0 &&
+		    old.sa_handler == SIG_DFL)
+			sigaction(fatal[i], &sa, NULL);
+	}
+}
+
+static struct log_buffer *log_buffer_get(size_t size)
+{
+	struct log_buffer *b = log_buffer;
+	int i;
+
+	if (b && b->size == size)
+		return b;
+	if (b) {
+		/* lxc.logbuffer changed */
+		log_buffer_destroy(b);
+		pthread_setspecific(log_buffer_key, NULL);
+	}
+
+	pthread_once(&log_buffer_once, log_buffer_init);
+
+	b = malloc(sizeof(*b) + size);
+	if (!b)
+		return NULL;
+	b->size = size;
+	b->len = 0;
+	b->lines = 0;
+
+	for (i = 0; i < LXC_LOG_BUFFERS_MAX; i++)
+		if (__sync_bool_compare_and_swap(&log_buffers[i], NULL, b))
+			break;
+	if (i == LXC_LOG_BUFFERS_MAX || pthread_setspecific(log_buffer_key, b)) {
+		/* too many threads: this one writes line by line */
+		log_buffer_unregister(b);
+		free(b);
+		return NULL;
+	}
+	log_buffer = b;
+	return b;
+}
+
+static int log_buffer_append(const char *line, size_t len)
+{
+	size_t size = __atomic_load_n(&log_buffer_size, __ATOMIC_RELAXED);
+	struct log_buffer *b = NULL;
+
+	if (size)
+		b = log_buffer_get(size);
+	if (!b) {
+		lxc_log_flush();
+		return write(lxc_log_fd, line, len);
+	}
+
+	if (b->len + len > b->size)
+		log_buffer_write(b);
+	memcpy(b->data + b->len, line, len);
+	b->len += len;
+	b->lines++;
+	return len;
+}
+
 /*---------------------------------------------------------------------------*/
 static int log_append_stderr(const struct lxc_log_appender *appender,
 			     struct lxc_log_event *event)
@@ -64,7 +259,356 @@ static int log_append_stderr(const struct lxc_log_appender *appender,
 	return 0;
 }
 
+/*
+ * With lxc.logformat = binary, logfile events are written as records
+ * which refer to their format string and category by number and carry
+ * the arguments unformatted, see log.h.  The numbers are handed out per
+ * process image: a forked or cloned child starts a session of its own.
+ */
+#define LXC_LOG_IDS_SIZE	4096	/* a power of two */
+
+struct log_id {
+	const void *key;	/* the format string or category name */
+	const char *types;	/* of the format's arguments, NULL for text */
+	uint32_t id;		/* 0 until the definition is written */
+};
+
+static int log_format = LXC_LOG_FORMAT_TEXT;
+static struct log_id log_ids[LXC_LOG_IDS_SIZE];
+static uint32_t log_next_id;
+static uint32_t log_session;
+static __thread uint32_t log_tid;
+
+static int log_emit(const char *data, size_t len, int priority);
+
+extern void lxc_log_child_init(void)
+{
+	int i;
+
+	/* the other threads' buffers were copied but they didn't come along */
+	for (i = 0; i < LXC_LOG_BUFFERS_MAX; i++) {
+		if (log_buffers[i] && log_buffers[i] != log_buffer) {
+			free(log_buffers[i]);
+			log_buffers[i] = NULL;
+		}
+	}
+
+	for (i = 0; i < LXC_LOG_IDS_SIZE; i++)
+		free((char *)log_ids[i].types);
+	memset(log_ids, 0, sizeof(log_ids));
+	log_next_id = 0;
+	log_session = 0;
+	log_tid = 0;
+}
+
+static uint64_t log_clock_ns(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void log_rec_header(void *rec, int type, size_t len)
+{
+	struct lxc_log_rec_header hdr = { 0, type, len };
+
+	memcpy(rec, &hdr, sizeof(hdr));
+}
+
+static uint32_t log_session_get(int priority)
+{
+	char buffer[sizeof(struct lxc_log_rec_session) + LXC_LOG_PREFIX_SIZE];
+	struct lxc_log_rec_session rec;
+	uint32_t session;
+	size_t len;
+
+	session = __atomic_load_n(&log_session, __ATOMIC_ACQUIRE);
+	if (session)
+		return session;
+
+	rec.pid = getpid();
+	rec.monotonic = log_clock_ns(CLOCK_MONOTONIC);
+	rec.realtime = log_clock_ns(CLOCK_REALTIME);
+	/* pids repeat across pid namespaces and container reboots */
+	session = (rec.pid * 2654435761u) ^ rec.monotonic ^ (rec.monotonic >> 32);
+	if (!session)
+		session = 1;
+	if (!__sync_bool_compare_and_swap(&log_session, 0, session))
+		return log_session;
+
+	pthread_once(&log_process_once, log_process_init);
+
+	rec.session = session;
+	len = strlen(log_prefix) + 1;
+	log_rec_header(&rec, LXC_LOG_REC_SESSION, sizeof(rec) + len);
+	memcpy(buffer, &rec, sizeof(rec));
+	memcpy(buffer + sizeof(rec), log_prefix, len);
+	log_emit(buffer, sizeof(rec) + len, priority);
+	return session;
+}
+
+/*
+ * Work out what a format string's arguments are, see log.h.  Returns
+ * NULL for what the decoder could not print the same: %m, which reads
+ * errno, %n, wide characters and long doubles.
+ */
+static char *log_format_types(const char *fmt)
+{
+	char types[64];
+	size_t n = 0;
+	const char *p;
+	char length;
+
+	for (p = fmt; *p; p++) {
+		if (*p != '%')
+			continue;
+		p++;
+		if (*p == '%')
+			continue;
+
+		while (*p && strchr("-+ #0'", *p))
+			p++;
+		if (*p == '*') {
+			types[n++] = 'i';
+			p++;
+		}
+		while (*p >= '0' && *p <= '9')
+			p++;
+		if (*p == '.') {
+			p++;
+			if (*p == '*') {
+				types[n++] = 'i';
+				p++;
+			}
+			while (*p >= '0' && *p <= '9')
+				p++;
+		}
+
+		length = 0;
+		if (p[0] == 'h') {
+			p += p[1] == 'h' ? 2 : 1;
+		} else if (p[0] == 'l' && p[1] == 'l') {
+			length = 'q';
+			p += 2;
+		} else if (strchr("lqjzt", *p)) {
+			length = *p++;
+		} else if (*p == 'L') {
+			return NULL;
+		}
+
+		if (n + 1 >= sizeof(types))
+			return NULL;
+
+		switch (*p) {
+		case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+			types[n++] = length ? length : 'i';
+			break;
+		case 'c':
+			if (length)
+				return NULL;
+			types[n++] = 'i';
+			break;
+		case 'e': case 'E': case 'f': case 'F':
+		case 'g': case 'G': case 'a': case 'A':
+			if (length && length != 'l')
+				return NULL;
+			types[n++] = 'd';
+			break;
+		case 's':
+			if (length)
+				return NULL;
+			types[n++] = 's';
+			break;
+		case 'p':
+			if (length)
+				return NULL;
+			types[n++] = 'p';
+			break;
+		default:
+			return NULL;
+		}
+	}
+
+	types[n] = '\0';
+	return strdup(types);
+}
+
+/*
+ * Returns the id of a format string or category name, writing its
+ * definition the first time, or NULL when the table is full.
+ */
+static struct log_id *log_id_get(uint32_t session, const char *key,
+				 struct lxc_log_event *event, int type)
+{
+	char buffer[LXC_LOG_BUFFER_SIZE];
+	struct lxc_log_rec_def def;
+	struct log_id *e;
+	const char *k, *strings[3];
+	size_t h, len, n;
+	int i, count;
+
+	h = ((uintptr_t)key >> 3) * 2654435761u;
+	for (n = 0; n < LXC_LOG_IDS_SIZE; n++, h++) {
+		e = &log_ids[h & (LXC_LOG_IDS_SIZE - 1)];
+		k = __atomic_load_n(&e->key, __ATOMIC_ACQUIRE);
+		if (!k && __sync_bool_compare_and_swap(&e->key, NULL, key))
+			break;
+		if (!k)
+			k = e->key;
+		if (k != key)
+			continue;
+
+		/* another thread is writing the definition */
+		while (!__atomic_load_n(&e->id, __ATOMIC_ACQUIRE))
+			sched_yield();
+		return e;
+	}
+	if (n == LXC_LOG_IDS_SIZE)
+		return NULL;
+
+	strings[0] = key;
+	count = 1;
+	if (type == LXC_LOG_REC_FORMAT) {
+		e->types = log_format_types(key);
+		strings[1] = event->locinfo->file;
+		strings[2] = e->types ? e->types : "";
+		count = 3;
+	}
+
+	def.session = session;
+	def.id = __atomic_add_fetch(&log_next_id, 1, __ATOMIC_RELAXED);
+	def.line = type == LXC_LOG_REC_FORMAT ? event->locinfo->line : 0;
+	len = sizeof(def);
+	for (i = 0; i < count; i++) {
+		n = strlen(strings[i]) + 1;
+		if (len + n > sizeof(buffer))
+			n = sizeof(buffer) - len;
+		memcpy(buffer + len, strings[i], n);
+		len += n;
+		buffer[len - 1] = '\0';
+	}
+	log_rec_header(&def, type, len);
+	memcpy(buffer, &def, sizeof(def));
+	log_emit(buffer, len, event->priority);
+
+	__atomic_store_n(&e->id, def.id, __ATOMIC_RELEASE);
+	return e;
+}
+
+/* Returns the number of bytes used, or -1 if they don't fit */
+static int log_pack_args(char *buf, size_t size, const char *types,
+			 va_list ap)
+{
+	const char *s;
+	size_t len = 0, n;
+	int64_t v;
+	int32_t i;
+	double d;
+	uint16_t slen;
+
+	for (; *types; types++) {
+		switch (*types) {
+		case 'i':
+			if (len + sizeof(i) > size)
+				return -1;
+			i = va_arg(ap, int);
+			memcpy(buf + len, &i, sizeof(i));
+			len += sizeof(i);
+			continue;
+		case 'd':
+			if (len + sizeof(d) > size)
+				return -1;
+			d = va_arg(ap, double);
+			memcpy(buf + len, &d, sizeof(d));
+			len += sizeof(d);
+			continue;
+		case 's':
+			s = va_arg(ap, const char *);
+			n = s ? strlen(s) : 0;
+			if (len + sizeof(slen) + n > size)
+				return -1;
+			slen = s ? n : LXC_LOG_ARG_NULL;
+			memcpy(buf + len, &slen, sizeof(slen));
+			if (s)
+				memcpy(buf + len + sizeof(slen), s, n);
+			len += sizeof(slen) + n;
+			continue;
+		case 'l': v = va_arg(ap, long); break;
+		case 'q': v = va_arg(ap, long long); break;
+		case 'j': v = va_arg(ap, intmax_t); break;
+		case 'z': v = va_arg(ap, size_t); break;
+		case 't': v = va_arg(ap, ptrdiff_t); break;
+		case 'p': v = (uintptr_t)va_arg(ap, void *); break;
+		default:
+			return -1;
+		}
+		if (len + sizeof(v) > size)
+			return -1;
+		memcpy(buf + len, &v, sizeof(v));
+		len += sizeof(v);
+	}
+	return len;
+}
+
+static int log_append_binary(struct lxc_log_event *event)
+{
+	char buffer[LXC_LOG_BUFFER_SIZE];
+	struct lxc_log_rec_event rec;
+	struct log_id *format, *category;
+	size_t size = sizeof(buffer) - sizeof(rec);
+	char *args = buffer + sizeof(rec);
+	int saved_errno = errno;
+	int n = -1;
+	va_list ap;
+
+	rec.session = log_session_get(event->priority);
+	if (!log_tid)
+		log_tid = syscall(SYS_gettid);
+	rec.tid = log_tid;
+	rec.monotonic = log_clock_ns(CLOCK_MONOTONIC);
+	rec.priority = event->priority;
+	rec.pad = 0;
+
+	category = log_id_get(rec.session, event->category, event,
+			      LXC_LOG_REC_CATEGORY);
+	rec.category = category ? category->id : 0;
+
+	format = log_id_get(rec.session, event->fmt, event, LXC_LOG_REC_FORMAT);
+	if (format && format->types) {
+		va_copy(ap, *event->vap);
+		n = log_pack_args(args, size, format->types, ap);
+		va_end(ap);
+	}
+	if (n >= 0) {
+		rec.format = format->id;
+	} else {
+		/* not something we can pack: send the text */
+		rec.format = 0;
+		errno = saved_errno;	/* for %m */
+		n = vsnprintf(args, size, event->fmt, *event->vap);
+		if (n < 0)
+			n = 0;
+		if (n >= size)
+			n = size - 1;
+	}
+
+	log_rec_header(&rec, LXC_LOG_REC_EVENT, sizeof(rec) + n);
+	memcpy(buffer, &rec, sizeof(rec));
+	return log_emit(buffer, sizeof(rec) + n, event->priority);
+}
+
 /*---------------------------------------------------------------------------*/
+static int log_emit(const char *data, size_t len, int priority)
+{
+	if (priority < LXC_LOG_PRIORITY_NOTICE)
+		return log_buffer_append(data, len);
+
+	/* keep the buffered lines ahead of this one */
+	lxc_log_flush();
+	return write(lxc_log_fd, data, len);
+}
+
 static int log_append_logfile(const struct lxc_log_appender *appender,
 			      struct lxc_log_event *event)
 {
@@ -75,6 +619,9 @@ static int log_append_logfile(const struct lxc_log_appender *appender,
 	if (lxc_log_fd == -1)
 		return 0;
 
+	if (__atomic_load_n(&log_format, __ATOMIC_RELAXED) == LXC_LOG_FORMAT_BINARY)
+		return log_append_binary(event);
+
 	ms = event->timestamp.tv_usec / 1000;
 	n = snprintf(buffer, sizeof(buffer),
 		     "%15s %10ld.%03d %-8s %s - ",
@@ -95,7 +642,7 @@ static int log_append_logfile(const struct lxc_log_appender *appender,
 
 	buffer[n] = '\n';
 
-	return write(lxc_log_fd, buffer, n + 1);
+	return log_emit(buffer, n + 1, event->priority);
 }
 
 static struct lxc_log_appender log_appender_stderr = {
@@ -124,6 +671,23 @@ struct lxc_log_category lxc_log_category_lxc = {
 	.parent		= &log_root
 };
 
+/* every category, so lxc.loglevel.<category> can find them */
+static struct lxc_log_category *log_categories;
+
+extern void lxc_log_category_register(struct lxc_log_category *category)
+{
+	do {
+		category->next = log_categories;
+	} while (!__sync_bool_compare_and_swap(&log_categories, category->next,
+					       category));
+}
+
+__attribute__((constructor))
+static void lxc_log_category_register_lxc(void)
+{
+	lxc_log_category_register(&lxc_log_category_lxc);
+}
+
 /*---------------------------------------------------------------------------*/
 static int build_dir(const char *name)
 {
@@ -243,6 +807,7 @@ static int __lxc_log_set_file(const char *fname, int create_dirs)
 {
 	if (lxc_log_fd != -1) {
 		// we are overriding the default.
+		lxc_log_flush();
 		close(lxc_log_fd);
 		free(log_fname);
 	}
@@ -366,6 +931,32 @@ extern int lxc_log_set_level(int level)
 	return 0;
 }
 
+/*
+ * This is called for lxc.loglevel.<category>.  Categories are named as in
+ * their lxc_log_define(), with or without the "lxc_" prefix, and pass
+ * their level on to those below them which have none of their own.
+ * Returns 1 if no category by that name is linked in.
+ */
+extern int lxc_log_set_category_level(const char *name, int level)
+{
+	struct lxc_log_category *c;
+	int found = 0;
+
+	if (level < 0 || level > LXC_LOG_PRIORITY_NOTSET) {
+		ERROR("invalid log priority %d", level);
+		return -1;
+	}
+
+	for (c = log_categories; c; c = c->next) {
+		if (strcmp(c->name, name) &&
+		    (strncmp(c->name, "lxc_", 4) || strcmp(c->name + 4, name)))
+			continue;
+		c->priority = level;
+		found = 1;
+	}
+	return found ? 0 : 1;
+}
+
 extern int lxc_log_get_level(void)
 {
 	if (!lxc_loglevel_specified)
@@ -394,6 +985,44 @@ extern int lxc_log_set_file(const char *fname)
 	return __lxc_log_set_file(fname, 0);
 }
 
+/*
+ * This is called when we read a lxc.logbuffer entry in a lxc.conf file.
+ * A size of 0 writes each line as it is logged.
+ */
+extern int lxc_log_set_buffer(size_t size)
+{
+	if (size && (size < LXC_LOG_BUFFER_SIZE || size > LXC_LOG_BUFFER_MAX)) {
+		ERROR("invalid log buffer size %zu", size);
+		return -1;
+	}
+	lxc_log_flush();
+	__atomic_store_n(&log_buffer_size, size, __ATOMIC_RELAXED);
+	return 0;
+}
+
+extern size_t lxc_log_get_buffer(void)
+{
+	return __atomic_load_n(&log_buffer_size, __ATOMIC_RELAXED);
+}
+
+/*
+ * This is called when we read a lxc.logformat entry in a lxc.conf file.
+ */
+extern int lxc_log_set_format(int format)
+{
+	if (format != LXC_LOG_FORMAT_TEXT && format != LXC_LOG_FORMAT_BINARY) {
+		ERROR("invalid log format %d", format);
+		return -1;
+	}
+	__atomic_store_n(&log_format, format, __ATOMIC_RELAXED);
+	return 0;
+}
+
+extern int lxc_log_get_format(void)
+{
+	return __atomic_load_n(&log_format, __ATOMIC_RELAXED);
+}
+
 extern const char *lxc_log_get_file(void)
 {
 	return log_fname;
@@ -29,6 +29,7 @@
 #include <sys/time.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #ifndef O_CLOEXEC
 #define O_CLOEXEC 02000000
@@ -92,8 +93,21 @@ struct lxc_log_category {
 	int				priority;
 	struct lxc_log_appender		*appender;
 	const struct lxc_log_category	*parent;
+	struct lxc_log_category		*next;	/* all categories, by name */
 };
 
+/*
+ * Configured with --disable-debug-log, TRACE() and DEBUG() compile to
+ * nothing, their arguments included.
+ */
+#ifdef LXC_LOG_NO_DEBUG
+#define LXC_LOG_PRIORITY_MIN	LXC_LOG_PRIORITY_INFO
+#else
+#define LXC_LOG_PRIORITY_MIN	LXC_LOG_PRIORITY_TRACE
+#endif
+
+extern void lxc_log_category_register(struct lxc_log_category *category);
+
 /*
  * Returns true if the chained priority is equal to or higher than
  * given priority.
@@ -212,7 +226,21 @@ static inline void LXC_##PRIORITY(struct lxc_log_locinfo* locinfo,	\
 		LXC_LOG_PRIORITY_NOTSET,				\
 		NULL,							\
 		&lxc_log_category_##parent				\
-	};
+	};								\
+									\
+	__attribute__((constructor))					\
+	static void lxc_log_category_register_##name(void)		\
+	{								\
+		lxc_log_category_register(&lxc_log_category_##name);	\
+	}								\
+									\
+	/* checked by the log macros before their arguments */		\
+	static inline int lxc_log_enabled(int priority)		\
+	{								\
+		return priority >= LXC_LOG_PRIORITY_MIN &&		\
+		       lxc_log_priority_is_enabled(			\
+				&lxc_log_category_##name, priority);	\
+	}
 
 #define lxc_log_define(name, parent)					\
 	lxc_log_category_define(name, parent)				\
@@ -236,48 +264,66 @@ static inline void LXC_##PRIORITY(struct lxc_log_locinfo* locinfo,	\
 extern struct lxc_log_category lxc_log_category_lxc;
 
 #define TRACE(format, ...) do {						\
-	struct lxc_log_locinfo locinfo = LXC_LOG_LOCINFO_INIT;		\
-	LXC_TRACE(&locinfo, format, ##__VA_ARGS__);			\
+	if (lxc_log_enabled(LXC_LOG_PRIORITY_TRACE)) {			\
+		struct lxc_log_locinfo locinfo = LXC_LOG_LOCINFO_INIT;	\
+		LXC_TRACE(&locinfo, format, ##__VA_ARGS__);		\
+	}								\
 } while (0)
 
 #define DEBUG(format, ...) do {						\
-	struct lxc_log_locinfo locinfo = LXC_LOG_LOCINFO_INIT;		\
-	LXC_DEBUG(&locinfo, format, ##__VA_ARGS__);			\
+	if (lxc_log_enabled(LXC_LOG_PRIORITY_DEBUG)) {			\
+		struct lxc_log_locinfo locinfo = LXC_LOG_LOCINFO_INIT;	\
+		LXC_DEBUG(&locinfo, format, ##__VA_ARGS__);		\
+	}								\
 } while (0)
 
 #define INFO(format, ...) do {						\
-	struct lxc_log_locinfo locinfo = LXC_LOG_LOCINFO_INIT;		\
-	LXC_INFO(&locinfo, format, ##__VA_ARGS__);			\
+	if (lxc_log_enabled(LXC_LOG_PRIORITY_INFO)) {			\
+		struct lxc_log_locinfo locinfo = LXC_LOG_LOCINFO_INIT;	\
+		LXC_INFO(&locinfo, format, ##__VA_ARGS__);		\
+	}								\
 } while (0)
 
 #define NOTICE(format, ...) do {					\
-	struct lxc_log_locinfo locinfo = LXC_LOG_LOCINFO_INIT;		\
-	LXC_NOTICE(&locinfo, format, ##__VA_ARGS__);			\
+	if (lxc_log_enabled(LXC_LOG_PRIORITY_NOTICE)) {			\
+		struct lxc_log_locinfo locinfo = LXC_LOG_LOCINFO_INIT;	\
+		LXC_NOTICE(&locinfo, format, ##__VA_ARGS__);		\
+	}								\
 } while (0)
 
 #define WARN(format, ...) do {						\
-	struct lxc_log_locinfo locinfo = LXC_LOG_LOCINFO_INIT;		\
-	LXC_WARN(&locinfo, format, ##__VA_ARGS__);			\
+	if (lxc_log_enabled(LXC_LOG_PRIORITY_WARN)) {			\
+		struct lxc_log_locinfo locinfo = LXC_LOG_LOCINFO_INIT;	\
+		LXC_WARN(&locinfo, format, ##__VA_ARGS__);		\
+	}								\
 } while (0)
 
 #define ERROR(format, ...) do {						\
-	struct lxc_log_locinfo locinfo = LXC_LOG_LOCINFO_INIT;		\
-	LXC_ERROR(&locinfo, format, ##__VA_ARGS__);			\
+	if (lxc_log_enabled(LXC_LOG_PRIORITY_ERROR)) {			\
+		struct lxc_log_locinfo locinfo = LXC_LOG_LOCINFO_INIT;	\
+		LXC_ERROR(&locinfo, format, ##__VA_ARGS__);		\
+	}								\
 } while (0)
 
 #define CRIT(format, ...) do {						\
-	struct lxc_log_locinfo locinfo = LXC_LOG_LOCINFO_INIT;		\
-	LXC_CRIT(&locinfo, format, ##__VA_ARGS__);			\
+	if (lxc_log_enabled(LXC_LOG_PRIORITY_CRIT)) {			\
+		struct lxc_log_locinfo locinfo = LXC_LOG_LOCINFO_INIT;	\
+		LXC_CRIT(&locinfo, format, ##__VA_ARGS__);		\
+	}								\
 } while (0)
 
 #define ALERT(format, ...) do {						\
-	struct lxc_log_locinfo locinfo = LXC_LOG_LOCINFO_INIT;		\
-	LXC_ALERT(&locinfo, format, ##__VA_ARGS__);			\
+	if (lxc_log_enabled(LXC_LOG_PRIORITY_ALERT)) {			\
+		struct lxc_log_locinfo locinfo = LXC_LOG_LOCINFO_INIT;	\
+		LXC_ALERT(&locinfo, format, ##__VA_ARGS__);		\
+	}								\
 } while (0)
 
 #define FATAL(format, ...) do {						\
-	struct lxc_log_locinfo locinfo = LXC_LOG_LOCINFO_INIT;		\
-	LXC_FATAL(&locinfo, format, ##__VA_ARGS__);			\
+	if (lxc_log_enabled(LXC_LOG_PRIORITY_FATAL)) {			\
+		struct lxc_log_locinfo locinfo = LXC_LOG_LOCINFO_INIT;	\
+		LXC_FATAL(&locinfo, format, ##__VA_ARGS__);		\
+	}								\
 } while (0)
 
 
@@ -288,12 +334,83 @@ extern struct lxc_log_category lxc_log_category_lxc;
 
 extern int lxc_log_fd;
 
+/* lxc.logformat */
+enum lxc_log_format {
+	LXC_LOG_FORMAT_TEXT,
+	LXC_LOG_FORMAT_BINARY,
+};
+
+/*
+ * Records written with lxc.logformat = binary, read by lxc-log-decode.
+ * Each starts with a NUL byte, which never starts a text line, so a file
+ * may hold both.  Fields are in the writer's byte order.
+ *
+ * A session is one process image: it numbers the format strings and
+ * categories it logs with and defines each once, before its first event
+ * in that thread's stream.  Another thread's events may reach the file
+ * ahead of the definition.
+ */
+#define LXC_LOG_REC_SESSION	1	/* + prefix\0 */
+#define LXC_LOG_REC_CATEGORY	2	/* def + name\0 */
+#define LXC_LOG_REC_FORMAT	3	/* def + format\0 file\0 types\0 */
+#define LXC_LOG_REC_EVENT	4	/* + packed arguments */
+
+/*
+ * Argument types of a format string, packed in this order: 'i' int as 4
+ * bytes; 'l' long, 'q' long long, 'j' intmax_t, 'z' size_t, 't' ptrdiff_t,
+ * 'p' pointer and 'd' double as 8 bytes; 's' string as a 16 bit length
+ * and the bytes, LXC_LOG_ARG_NULL for a NULL pointer.  An event of format
+ * 0 carries its message as text instead.
+ */
+#define LXC_LOG_ARG_NULL	0xffff
+
+struct lxc_log_rec_header {
+	uint8_t		zero;
+	uint8_t		type;
+	uint16_t	len;		/* of the whole record */
+} __attribute__((packed));
+
+struct lxc_log_rec_session {
+	struct lxc_log_rec_header hdr;
+	uint32_t	session;
+	uint32_t	pid;
+	uint64_t	monotonic;	/* ns, both taken at the same time */
+	uint64_t	realtime;
+} __attribute__((packed));
+
+struct lxc_log_rec_def {
+	struct lxc_log_rec_header hdr;
+	uint32_t	session;
+	uint32_t	id;
+	uint32_t	line;
+} __attribute__((packed));
+
+struct lxc_log_rec_event {
+	struct lxc_log_rec_header hdr;
+	uint32_t	session;
+	uint32_t	tid;
+	uint64_t	monotonic;	/* ns */
+	uint32_t	format;
+	uint16_t	category;
+	uint8_t		priority;
+	uint8_t		pad;
+} __attribute__((packed));
+
 extern int lxc_log_init(const char *name, const char *file,
 			const char *priority, const char *prefix, int quiet,
 			const char *lxcpath);
 
 extern int lxc_log_set_file(const char *fname);
 extern int lxc_log_set_level(int level);
+extern int lxc_log_set_category_level(const char *name, int level);
+extern int lxc_log_set_buffer(size_t size);
+extern size_t lxc_log_get_buffer(void);
+extern int lxc_log_set_format(int format);
+extern int lxc_log_get_format(void);
+/* write out the calling thread's buffered log lines, see lxc.logbuffer */
+extern void lxc_log_flush(void);
+/* to be called first thing in the child of a raw clone() */
+extern void lxc_log_child_init(void);
 extern void lxc_log_set_prefix(const char *prefix);
 extern const char *lxc_log_get_file(void);
 extern int lxc_log_get_level(void);
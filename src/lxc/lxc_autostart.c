@@ -20,6 +20,7 @@
 
 #include <string.h>
 #include <unistd.h>
+#include <sys/param.h>
 
 #include <lxc/lxccontainer.h>
 
@@ -37,6 +38,7 @@ static int my_parser(struct lxc_arguments* args, int c, char* arg)
 	case 'a': args->all = 1; break;
 	case 'g': args->groups = arg; break;
 	case 't': args->timeout = atoi(arg); break;
+	case 'j': args->parallel = atoi(arg); break;
 	}
 	return 0;
 }
@@ -49,6 +51,7 @@ static const struct option my_longopts[] = {
 	{"all", no_argument, 0, 'a'},
 	{"groups", required_argument, 0, 'g'},
 	{"timeout", required_argument, 0, 't'},
+	{"parallel", required_argument, 0, 'j'},
 	{"help", no_argument, 0, 'h'},
 	LXC_COMMON_OPTIONS
 };
@@ -67,11 +70,13 @@ Options:\n\
 \n\
   -a, --all         list all auto-started containers (ignore groups)\n\
   -g, --groups      list of groups (comma separated) to select\n\
-  -t, --timeout=T   wait T seconds before hard-stopping\n",
+  -t, --timeout=T   wait T seconds before hard-stopping\n\
+  -j, --parallel=N  act on up to N containers of the same order at once\n",
 	.options  = my_longopts,
 	.parser   = my_parser,
 	.checker  = NULL,
 	.timeout = 30,
+	.parallel = 1,
 };
 
 int lists_contain_common_entry(struct lxc_list *p1, struct lxc_list *p2) {
@@ -138,35 +143,6 @@ struct lxc_list *get_list(char *input, char *delimiter) {
 	return workstr_list;
 }
 
-struct lxc_list *get_config_list(struct lxc_container *c, char *key) {
-	int len = 0;
-	char* value = NULL;
-	struct lxc_list *config_list = NULL;
-
-	len = c->get_config_item(c, key, NULL, 0);
-	if (len < 0)
-		return NULL;
-
-	value = (char*) malloc(sizeof(char)*len + 1);
-	if (value == NULL)
-		return NULL;
-
-	if (c->get_config_item(c, key, value, len + 1) != len) {
-		free(value);
-		return NULL;
-	}
-
-	if (strlen(value) == 0) {
-		free(value);
-		return NULL;
-	}
-
-	config_list = get_list(value, "\n");
-	free(value);
-
-	return config_list;
-}
-
 int get_config_integer(struct lxc_container *c, char *key) {
 	int len = 0;
 	int ret = 0;
@@ -204,135 +180,190 @@ static int cmporder(const void *p1, const void *p2) {
 		return (c1_order - c2_order) * -1;
 }
 
+static void free_list(struct lxc_list *list)
+{
+	struct lxc_list *it, *next;
+
+	if (!list)
+		return;
+
+	lxc_list_for_each_safe(it, list, next) {
+		lxc_list_del(it);
+		free(it->elem);
+		free(it);
+	}
+	free(list);
+}
+
+/*
+ * Decide from the config alone whether a container is a candidate, so that
+ * only those get a struct lxc_container.
+ */
+static bool autostart_candidate(const char *lxcpath, const char *name,
+				struct lxc_list *cmd_groups_list)
+{
+	const char *keys[] = { "lxc.start.auto", "lxc.group" };
+	char *values[2];
+	char path[MAXPATHLEN];
+	struct lxc_list *c_groups_list = NULL;
+	const char *autostart;
+	bool ret = false;
+	int len;
+
+	len = snprintf(path, MAXPATHLEN, "%s/%s/config", lxcpath, name);
+	if (len < 0 || len >= MAXPATHLEN)
+		return false;
+
+	if (lxc_config_peek(path, keys, values, 2) < 0)
+		return false;
+
+	/* the last assignment wins */
+	autostart = values[0];
+	if (autostart && strrchr(autostart, '\n'))
+		autostart = strrchr(autostart, '\n') + 1;
+	if (!autostart || atoi(autostart) != 1)
+		goto out;
+
+	if (!my_args.all) {
+		/* Filter by group */
+		/* one lxc.group line may name several, as in config_group() */
+		if (values[1] && *values[1])
+			c_groups_list = get_list(values[1], "\n \t");
+
+		if (!lists_contain_common_entry(cmd_groups_list, c_groups_list))
+			goto out;
+	}
+	ret = true;
+
+out:
+	free_list(c_groups_list);
+	free(values[0]);
+	free(values[1]);
+	return ret;
+}
+
 int main(int argc, char *argv[])
 {
 	int count = 0;
 	int i = 0;
 	int ret = 0;
-	struct lxc_container **containers = NULL;
+	int nr_todo = 0;
+	char **names = NULL;
+	const char *lxcpath;
+	struct lxc_container **todo = NULL;
+	struct lxc_batch_result *results = NULL;
 	struct lxc_list *cmd_groups_list = NULL;
-	struct lxc_list *c_groups_list = NULL;
-	struct lxc_list *it, *next;
-	char *const default_start_args[] = {
-		"/sbin/init",
-		'\0',
-	};
+	enum lxc_batch_action action;
+	const char *failure;
 
 	if (lxc_arguments_parse(&my_args, argc, argv))
 		return 1;
 
-	count = list_defined_containers(NULL, NULL, &containers);
+	lxcpath = my_args.lxcpath[0];
+
+	/* names only: containers are set up once they pass the filters */
+	count = list_defined_containers(lxcpath, &names, NULL);
 
 	if (count < 0)
 		return 1;
 
-	qsort(&containers[0], count, sizeof(struct lxc_container *), cmporder);
-
 	if (my_args.groups && !my_args.all)
 		cmd_groups_list = get_list((char*)my_args.groups, ",");
 
+	if (my_args.shutdown) {
+		action = LXC_BATCH_SHUTDOWN;
+		failure = "Error shutting down container";
+	} else if (my_args.hardstop) {
+		action = LXC_BATCH_STOP;
+		failure = "Error killing container";
+	} else if (my_args.reboot) {
+		action = LXC_BATCH_REBOOT;
+		failure = "Error rebooting container";
+	} else {
+		action = LXC_BATCH_START;
+		failure = "Error starting container";
+	}
+
+	todo = malloc((count ? count : 1) * sizeof(*todo));
+	if (!todo)
+		return 1;
+
 	for (i = 0; i < count; i++) {
-		struct lxc_container *c = containers[i];
+		struct lxc_container *c;
+
+		if (!autostart_candidate(lxcpath, names[i], cmd_groups_list))
+			continue;
+
+		c = lxc_container_new(names[i], lxcpath);
+		if (!c)
+			continue;
 
 		if (!c->may_control(c)) {
 			lxc_container_put(c);
 			continue;
 		}
 
-		if (get_config_integer(c, "lxc.start.auto") != 1) {
+		if (c->is_running(c) == (action == LXC_BATCH_START)) {
 			lxc_container_put(c);
 			continue;
 		}
 
-		if (!my_args.all) {
-			/* Filter by group */
-			c_groups_list = get_config_list(c, "lxc.group");
+		todo[nr_todo++] = c;
+	}
 
-			ret = lists_contain_common_entry(cmd_groups_list, c_groups_list);
+	for (i = 0; i < count; i++)
+		free(names[i]);
+	free(names);
+	free_list(cmd_groups_list);
 
-			if (c_groups_list) {
-				lxc_list_for_each_safe(it, c_groups_list, next) {
-					lxc_list_del(it);
-					free(it->elem);
-					free(it);
-				}
-				free(c_groups_list);
-			}
+	qsort(&todo[0], nr_todo, sizeof(struct lxc_container *), cmporder);
 
-			if (ret == 0) {
-				lxc_container_put(c);
-				continue;
-			}
-		}
+	if (my_args.list) {
+		for (i = 0; i < nr_todo; i++) {
+			struct lxc_container *c = todo[i];
 
-		c->want_daemonize(c, 1);
-
-		if (my_args.shutdown) {
-			/* Shutdown the container */
-			if (c->is_running(c)) {
-				if (my_args.list)
-					printf("%s\n", c->name);
-				else {
-					my_args.timeout = 0;
-					if (!c->shutdown(c, my_args.timeout))
-						fprintf(stderr, "Error shutting down container: %s\n", c->name);
-				}
-			}
-		}
-		else if (my_args.hardstop) {
-			/* Kill the container */
-			if (c->is_running(c)) {
-				if (my_args.list)
-					printf("%s\n", c->name);
-				else {
-					if (!c->stop(c))
-						fprintf(stderr, "Error killing container: %s\n", c->name);
-				}
-			}
-		}
-		else if (my_args.reboot) {
-			/* Reboot the container */
-			if (c->is_running(c)) {
-				if (my_args.list)
-					printf("%s %d\n", c->name,
-					       get_config_integer(c, "lxc.start.delay"));
-				else {
-					if (!c->reboot(c))
-						fprintf(stderr, "Error rebooting container: %s\n", c->name);
-					else
-						sleep(get_config_integer(c, "lxc.start.delay"));
-				}
-			}
-		}
-		else {
-			/* Start the container */
-			if (!c->is_running(c)) {
-				if (my_args.list)
-					printf("%s %d\n", c->name,
-					       get_config_integer(c, "lxc.start.delay"));
-				else {
-					if (!c->start(c, 0, default_start_args))
-						fprintf(stderr, "Error starting container: %s\n", c->name);
-					else
-						sleep(get_config_integer(c, "lxc.start.delay"));
-				}
-			}
+			if (action == LXC_BATCH_START || action == LXC_BATCH_REBOOT)
+				printf("%s %d\n", c->name,
+				       get_config_integer(c, "lxc.start.delay"));
+			else
+				printf("%s\n", c->name);
 		}
+		goto done;
+	}
 
+	if (nr_todo) {
+		results = calloc(nr_todo, sizeof(*results));
+		if (!results) {
+			ret = 1;
+			goto out;
+		}
 
-		lxc_container_put(c);
-	}
+		/* shutdown has always waited for as long as it takes */
+		if (lxc_containers_batch(todo, nr_todo, action, my_args.parallel,
+					 0, results) < 0) {
+			fprintf(stderr, "Failed to process the containers\n");
+			ret = 1;
+			goto out;
+		}
 
-	if (cmd_groups_list) {
-		lxc_list_for_each_safe(it, cmd_groups_list, next) {
-			lxc_list_del(it);
-			free(it->elem);
-			free(it);
+		for (i = 0; i < nr_todo; i++) {
+			if (!results[i].done)
+				continue;
+			if (!results[i].success)
+				fprintf(stderr, "%s: %s\n", failure, todo[i]->name);
+			printf("%s %s %.3fs\n", todo[i]->name,
+			       results[i].success ? "ok" : "failed",
+			       results[i].seconds);
 		}
-		free(cmd_groups_list);
 	}
+done:
+	ret = 0;
 
-	free(containers);
+out:
+	for (i = 0; i < nr_todo; i++)
+		lxc_container_put(todo[i]);
+	free(todo);
+	free(results);
 
-	return 0;
+	return ret;
 }
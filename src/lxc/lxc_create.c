@@ -70,6 +70,9 @@ static int my_parser(struct lxc_arguments* args, int c, char* arg)
 	case '4': args->fssize = get_fssize(arg); break;
 	case '5': args->zfsroot = arg; break;
 	case '6': args->dir = arg; break;
+	case '7': args->from_cache = 1; break;
+	case '8': args->cache_gc = 1; break;
+	case '9': args->fsprealloc = 1; break;
 	}
 	return 0;
 }
@@ -85,6 +88,9 @@ static const struct option my_longopts[] = {
 	{"fssize", required_argument, 0, '4'},
 	{"zfsroot", required_argument, 0, '5'},
 	{"dir", required_argument, 0, '6'},
+	{"from-cache", no_argument, 0, '7'},
+	{"cache-gc", no_argument, 0, '8'},
+	{"fsprealloc", no_argument, 0, '9'},
 	LXC_COMMON_OPTIONS
 };
 
@@ -138,9 +144,13 @@ Options :\n\
                      (Default: ext3))\n\
   --fssize=SIZE      Create filesystem of size SIZE\n\
                      (Default: 1G))\n\
+  --fsprealloc       Allocate a loop image's SIZE up front rather than sparse\n\
   --dir=DIR          Place rootfs directory under DIR\n\
   --zfsroot=PATH     Create zfs under given zfsroot\n\
-                     (Default: tank/lxc))\n",
+                     (Default: tank/lxc))\n\
+  --from-cache       Snapshot the rootfs from the image cache, running\n\
+                     the template only if no matching image exists\n\
+  --cache-gc         Remove unused images from the image cache and exit\n",
 	.options  = my_longopts,
 	.parser   = my_parser,
 	.checker  = NULL,
@@ -156,6 +166,10 @@ bool validate_bdev_args(struct lxc_arguments *a)
 				return false;
 			}
 		}
+		if (a->fsprealloc && strcmp(a->bdevtype, "loop") != 0) {
+			fprintf(stderr, "--fsprealloc is only valid with -B loop\n");
+			return false;
+		}
 		if (strcmp(a->bdevtype, "lvm") != 0) {
 			if (a->lvname || a->vgname || a->thinpool) {
 				fprintf(stderr, "--lvname, --vgname and --thinpool are only valid with -B lvm\n");
@@ -188,6 +202,17 @@ int main(int argc, char *argv[])
 			 my_args.progname, my_args.quiet, my_args.lxcpath[0]))
 		exit(1);
 
+	if (my_args.cache_gc) {
+		int removed = lxc_image_cache_gc(my_args.lxcpath[0]);
+		if (removed < 0) {
+			fprintf(stderr, "Error collecting the image cache\n");
+			exit(1);
+		}
+		if (!my_args.quiet)
+			printf("Removed %d unused image(s)\n", removed);
+		exit(0);
+	}
+
 	memset(&spec, 0, sizeof(spec));
 	if (!my_args.bdevtype)
 		my_args.bdevtype = "_unset";
@@ -224,6 +249,8 @@ int main(int argc, char *argv[])
 		spec.fstype = my_args.fstype;
 	if (my_args.fssize)
 		spec.fssize = my_args.fssize;
+	if (my_args.fsprealloc)
+		spec.prealloc = 1;
 
 	if (strcmp(my_args.bdevtype, "zfs") == 0 || strcmp(my_args.bdevtype, "best") == 0) {
 		if (my_args.zfsroot)
@@ -246,6 +273,13 @@ int main(int argc, char *argv[])
 		my_args.bdevtype = NULL;
 	if (my_args.quiet)
 		flags = LXC_CREATE_QUIET;
+	if (my_args.from_cache) {
+		if (!my_args.template) {
+			fprintf(stderr, "--from-cache requires a template\n");
+			exit(1);
+		}
+		flags |= LXC_CREATE_CACHE;
+	}
 	if (!c->create(c, my_args.template, my_args.bdevtype, &spec, flags, &argv[optind])) {
 		ERROR("Error creating container %s", c->name);
 		lxc_container_put(c);
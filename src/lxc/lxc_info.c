@@ -27,6 +27,7 @@
 #include <unistd.h>
 #include <limits.h>
 #include <libgen.h>
+#include <sys/param.h>
 #include <sys/types.h>
 
 #include <lxc/lxc.h>
@@ -36,6 +37,7 @@
 
 #include "commands.h"
 #include "arguments.h"
+#include "bdev.h"
 
 static bool ips;
 static bool state;
@@ -190,6 +192,35 @@ static void print_net_stats(const char *name, const char *lxcpath)
 	}
 }
 
+static void print_rootfs_usage(struct lxc_container *c)
+{
+	unsigned long allocated, apparent;
+	char buf[MAXPATHLEN], abuf[64], pbuf[64];
+	struct bdev *bdev;
+	int ret;
+
+	ret = c->get_config_item(c, "lxc.rootfs", buf, sizeof(buf));
+	if (ret <= 0 || ret >= sizeof(buf))
+		return;
+	bdev = bdev_init(buf, NULL, NULL);
+	if (!bdev)
+		return;
+	ret = bdev_get_usage(bdev, &allocated, &apparent);
+	bdev_put(bdev);
+	if (ret < 0)
+		return;
+
+	/* a sparse loop image uses less than the container sees */
+	if (humanize) {
+		size_humanize(allocated, abuf, sizeof(abuf));
+		size_humanize(apparent, pbuf, sizeof(pbuf));
+	} else {
+		snprintf(abuf, sizeof(abuf), "%lu", allocated);
+		snprintf(pbuf, sizeof(pbuf), "%lu", apparent);
+	}
+	printf("%-15s %s / %s\n", "Rootfs use:", abuf, pbuf);
+}
+
 static void print_stats(struct lxc_container *c)
 {
 	int i, ret;
@@ -324,6 +355,7 @@ static int print_info(const char *name, const char *lxcpath)
 
 	if (stats) {
 		print_stats(c);
+		print_rootfs_usage(c);
 		print_net_stats(name, lxcpath);
 	}
 
@@ -0,0 +1,636 @@
+/*
+ * lxc: linux Container library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * lxc-log-decode: print a log file written with lxc.logformat = binary as
+ * text, the way it would have been written, or as JSON, one object per
+ * line.  Text lines in the file are passed through.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+#include "config.h"
+#include "log.h"
+
+struct session {
+	uint32_t session;
+	uint32_t pid;
+	uint64_t monotonic;
+	uint64_t realtime;
+	const char *prefix;
+};
+
+struct def {
+	uint32_t session;
+	uint32_t id;
+	int type;
+	uint32_t line;
+	const char *name;	/* format string or category */
+	const char *file;
+	const char *types;
+};
+
+static struct session *sessions;
+static size_t nsessions;
+static struct def *defs;
+static size_t ndefs;
+static int json;
+
+static void usage(const char *name)
+{
+	printf("usage: %s [-h] [-j] [file...]\n", name);
+	printf("\n");
+	printf("  -j, --json  print one JSON object per message\n");
+	printf("\n");
+	printf("Prints a log written with lxc.logformat = binary, read from\n");
+	printf("the files or standard input.\n");
+}
+
+static char *read_all(int fd, size_t *lenp)
+{
+	size_t len = 0, size = 0;
+	char *buf = NULL, *n;
+	ssize_t ret;
+
+	for (;;) {
+		if (len == size) {
+			size = size ? size * 2 : 65536;
+			n = realloc(buf, size);
+			if (!n) {
+				free(buf);
+				return NULL;
+			}
+			buf = n;
+		}
+		ret = read(fd, buf + len, size - len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0) {
+			free(buf);
+			return NULL;
+		}
+		if (ret == 0)
+			break;
+		len += ret;
+	}
+	*lenp = len;
+	return buf;
+}
+
+/* Returns the length of the record at p, or 0 if it is not one */
+static size_t record_len(const char *p, const char *end)
+{
+	struct lxc_log_rec_header hdr;
+
+	if (end - p < sizeof(hdr))
+		return 0;
+	memcpy(&hdr, p, sizeof(hdr));
+	if (hdr.zero || hdr.len < sizeof(hdr) || hdr.len > end - p)
+		return 0;
+	return hdr.len;
+}
+
+/* Points strs at the NUL terminated strings from p to end */
+static int record_strings(const char *p, const char *end, const char **strs,
+			  int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		const char *nul = memchr(p, '\0', end - p);
+
+		if (!nul)
+			return -1;
+		strs[i] = p;
+		p = nul + 1;
+	}
+	return 0;
+}
+
+static int add_definition(const char *p, size_t len, int type)
+{
+	struct lxc_log_rec_def rec;
+	const char *strs[3];
+	struct def *d;
+
+	if (len < sizeof(rec))
+		return -1;
+	memcpy(&rec, p, sizeof(rec));
+	if (record_strings(p + sizeof(rec), p + len, strs,
+			   type == LXC_LOG_REC_FORMAT ? 3 : 1))
+		return -1;
+
+	d = realloc(defs, (ndefs + 1) * sizeof(*defs));
+	if (!d)
+		return -1;
+	defs = d;
+	d = &defs[ndefs++];
+	d->session = rec.session;
+	d->id = rec.id;
+	d->type = type;
+	d->line = rec.line;
+	d->name = strs[0];
+	d->file = type == LXC_LOG_REC_FORMAT ? strs[1] : NULL;
+	d->types = type == LXC_LOG_REC_FORMAT ? strs[2] : NULL;
+	return 0;
+}
+
+static int add_session(const char *p, size_t len)
+{
+	struct lxc_log_rec_session rec;
+	struct session *s;
+	const char *prefix;
+
+	if (len < sizeof(rec))
+		return -1;
+	memcpy(&rec, p, sizeof(rec));
+	if (record_strings(p + sizeof(rec), p + len, &prefix, 1))
+		return -1;
+
+	s = realloc(sessions, (nsessions + 1) * sizeof(*sessions));
+	if (!s)
+		return -1;
+	sessions = s;
+	s = &sessions[nsessions++];
+	s->session = rec.session;
+	s->pid = rec.pid;
+	s->monotonic = rec.monotonic;
+	s->realtime = rec.realtime;
+	s->prefix = prefix;
+	return 0;
+}
+
+static int cmp_def(const void *a, const void *b)
+{
+	const struct def *x = a, *y = b;
+
+	if (x->session != y->session)
+		return x->session < y->session ? -1 : 1;
+	if (x->type != y->type)
+		return x->type - y->type;
+	if (x->id != y->id)
+		return x->id < y->id ? -1 : 1;
+	return 0;
+}
+
+static int cmp_session(const void *a, const void *b)
+{
+	const struct session *x = a, *y = b;
+
+	if (x->session != y->session)
+		return x->session < y->session ? -1 : 1;
+	return 0;
+}
+
+static const struct def *find_def(uint32_t session, int type, uint32_t id)
+{
+	struct def key = { .session = session, .type = type, .id = id };
+
+	return bsearch(&key, defs, ndefs, sizeof(*defs), cmp_def);
+}
+
+static const struct session *find_session(uint32_t session)
+{
+	struct session key = { .session = session };
+
+	return bsearch(&key, sessions, nsessions, sizeof(*sessions),
+		       cmp_session);
+}
+
+/* the packed arguments of an event, see log.h */
+struct args {
+	const char *p;
+	const char *end;
+	const char *types;
+	int short_read;
+};
+
+static int64_t next_int(struct args *a)
+{
+	int64_t v = 0;
+	int32_t i;
+	char t = *a->types;
+
+	if (!t || t == 's' || t == 'd') {
+		a->short_read = 1;
+		return 0;
+	}
+	a->types++;
+	if (t == 'i') {
+		if (a->end - a->p < sizeof(i)) {
+			a->short_read = 1;
+			return 0;
+		}
+		memcpy(&i, a->p, sizeof(i));
+		a->p += sizeof(i);
+		return i;
+	}
+	if (a->end - a->p < sizeof(v)) {
+		a->short_read = 1;
+		return 0;
+	}
+	memcpy(&v, a->p, sizeof(v));
+	a->p += sizeof(v);
+	return v;
+}
+
+static double next_double(struct args *a)
+{
+	double d;
+
+	if (*a->types != 'd' || a->end - a->p < sizeof(d)) {
+		a->short_read = 1;
+		return 0;
+	}
+	a->types++;
+	memcpy(&d, a->p, sizeof(d));
+	a->p += sizeof(d);
+	return d;
+}
+
+/* Copies the next string argument to buf, returns NULL for a NULL one */
+static const char *next_string(struct args *a, char *buf, size_t size)
+{
+	uint16_t len;
+
+	if (*a->types != 's' || a->end - a->p < sizeof(len)) {
+		a->short_read = 1;
+		return "";
+	}
+	a->types++;
+	memcpy(&len, a->p, sizeof(len));
+	a->p += sizeof(len);
+	if (len == LXC_LOG_ARG_NULL)
+		return NULL;
+	if (len > a->end - a->p || len >= size) {
+		a->short_read = 1;
+		return "";
+	}
+	memcpy(buf, a->p, len);
+	buf[len] = '\0';
+	a->p += len;
+	return buf;
+}
+
+/*
+ * Print a message from its format string and packed arguments.  Each
+ * conversion is handed to snprintf() on its own, with '*' widths filled
+ * in and the argument cast to what its length modifier says.
+ */
+/*
+ * Whether log_format_types() records conversion @conv with length modifier
+ * @length.  Anything else, wide characters and strings or long doubles in
+ * particular, is never written in binary and can't be passed on safely.
+ */
+static bool format_recorded(const char *length, char conv)
+{
+	if (length[0] == 'L')
+		return false;
+
+	switch (conv) {
+	case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+		return true;
+	case 'e': case 'E': case 'f': case 'F':
+	case 'g': case 'G': case 'a': case 'A':
+		return !length[0] || !strcmp(length, "l");
+	case 'c': case 's': case 'p':
+		return !length[0];
+	}
+	return false;
+}
+
+static void format_message(char *out, size_t size, const char *fmt,
+			   struct args *a)
+{
+	char spec[64], str[LXC_LOG_BUFFER_SIZE];
+	size_t n = 0, s;
+	const char *p, *v;
+	char length[3];
+	int64_t i;
+	int ret;
+
+#define PUT(...) do {							\
+	ret = snprintf(out + n, size - n, __VA_ARGS__);			\
+	if (ret > 0)							\
+		n += (size_t)ret < size - n ? (size_t)ret : size - n - 1; \
+} while (0)
+
+	out[0] = '\0';
+	for (p = fmt; *p && n < size - 1; p++) {
+		if (*p != '%') {
+			out[n++] = *p;
+			out[n] = '\0';
+			continue;
+		}
+		if (p[1] == '%') {
+			PUT("%%");
+			p++;
+			continue;
+		}
+
+		/* flags, width and precision */
+		spec[0] = '%';
+		s = 1;
+		for (p++; *p && strchr("-+ #0'.*0123456789", *p); p++) {
+			if (s > sizeof(spec) - 24)
+				break;
+			if (*p == '*')
+				s += sprintf(spec + s, "%d", (int)next_int(a));
+			else
+				spec[s++] = *p;
+		}
+
+		memset(length, 0, sizeof(length));
+		if ((p[0] == 'h' || p[0] == 'l') && p[1] == p[0]) {
+			length[0] = length[1] = *p;
+			p += 2;
+		} else if (*p && strchr("hlqjztL", *p)) {
+			length[0] = *p++;
+		}
+		if (!*p)
+			break;
+		s += sprintf(spec + s, "%s%c", length, *p);
+		spec[s] = '\0';
+
+		if (!format_recorded(length, *p)) {
+			PUT("%s", spec);
+			continue;
+		}
+
+		switch (*p) {
+		case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+			i = next_int(a);
+			switch (length[0]) {
+			case 'l':
+				if (length[1])
+					PUT(spec, (long long)i);
+				else
+					PUT(spec, (long)i);
+				break;
+			case 'q': PUT(spec, (long long)i); break;
+			case 'j': PUT(spec, (intmax_t)i); break;
+			case 'z': PUT(spec, (size_t)i); break;
+			case 't': PUT(spec, (ptrdiff_t)i); break;
+			default:  PUT(spec, (int)i); break;
+			}
+			break;
+		case 'c':
+			PUT(spec, (int)next_int(a));
+			break;
+		case 'e': case 'E': case 'f': case 'F':
+		case 'g': case 'G': case 'a': case 'A':
+			PUT(spec, next_double(a));
+			break;
+		case 's':
+			v = next_string(a, str, sizeof(str));
+			PUT(spec, v ? v : "(null)");
+			break;
+		case 'p':
+			PUT(spec, (void *)(uintptr_t)next_int(a));
+			break;
+		default:
+			PUT("%s", spec);
+			break;
+		}
+	}
+#undef PUT
+}
+
+static void print_json_string(const char *s)
+{
+	putchar('"');
+	for (; *s; s++) {
+		switch (*s) {
+		case '"':  fputs("\\\"", stdout); break;
+		case '\\': fputs("\\\\", stdout); break;
+		case '\n': fputs("\\n", stdout); break;
+		case '\r': fputs("\\r", stdout); break;
+		case '\t': fputs("\\t", stdout); break;
+		default:
+			if ((unsigned char)*s < 0x20)
+				printf("\\u%04x", *s);
+			else
+				putchar(*s);
+		}
+	}
+	putchar('"');
+}
+
+static void print_text_line(const char *p, size_t len)
+{
+	char *line;
+
+	if (!json) {
+		fwrite(p, 1, len, stdout);
+		putchar('\n');
+		return;
+	}
+
+	line = strndup(p, len);
+	if (!line)
+		return;
+	fputs("{\"text\":", stdout);
+	print_json_string(line);
+	fputs("}\n", stdout);
+	free(line);
+}
+
+static void print_event(const char *p, size_t len)
+{
+	char message[4 * LXC_LOG_BUFFER_SIZE];
+	struct lxc_log_rec_event rec;
+	const struct session *s;
+	const struct def *format, *category;
+	const char *cat = "?";
+	uint64_t ns;
+	struct args a;
+
+	if (len < sizeof(rec))
+		return;
+	memcpy(&rec, p, sizeof(rec));
+	p += sizeof(rec);
+	len -= sizeof(rec);
+
+	s = find_session(rec.session);
+	category = find_def(rec.session, LXC_LOG_REC_CATEGORY, rec.category);
+	if (category)
+		cat = category->name;
+
+	format = NULL;
+	if (rec.format == 0) {
+		snprintf(message, sizeof(message), "%.*s", (int)len, p);
+	} else {
+		format = find_def(rec.session, LXC_LOG_REC_FORMAT, rec.format);
+		if (!format) {
+			snprintf(message, sizeof(message),
+				 "<format %u of session %08x is missing>",
+				 rec.format, rec.session);
+		} else {
+			a.p = p;
+			a.end = p + len;
+			a.types = format->types;
+			a.short_read = 0;
+			format_message(message, sizeof(message), format->name, &a);
+			if (a.short_read)
+				strncat(message, " <arguments cut short>",
+					sizeof(message) - strlen(message) - 1);
+		}
+	}
+
+	/* wall clock time, if the session says how the clocks compare */
+	ns = rec.monotonic;
+	if (s)
+		ns = s->realtime + (rec.monotonic - s->monotonic);
+
+	if (!json) {
+		printf("%15s %10llu.%03u %-8s %s - %s\n",
+		       s ? s->prefix : "?",
+		       (unsigned long long)(ns / 1000000000),
+		       (unsigned)(ns % 1000000000 / 1000000),
+		       lxc_log_priority_to_string(rec.priority), cat, message);
+		return;
+	}
+
+	printf("{\"time\":%llu.%09u,", (unsigned long long)(ns / 1000000000),
+	       (unsigned)(ns % 1000000000));
+	if (s) {
+		fputs("\"prefix\":", stdout);
+		print_json_string(s->prefix);
+		printf(",\"pid\":%u,", s->pid);
+	}
+	printf("\"tid\":%u,\"level\":\"%s\",\"category\":", rec.tid,
+	       lxc_log_priority_to_string(rec.priority));
+	print_json_string(cat);
+	if (format) {
+		fputs(",\"file\":", stdout);
+		print_json_string(format->file);
+		printf(",\"line\":%u", format->line);
+	}
+	fputs(",\"message\":", stdout);
+	print_json_string(message);
+	fputs("}\n", stdout);
+}
+
+/*
+ * Definitions may come after events which use them, so the first pass
+ * collects them and the second prints.
+ */
+static int decode(const char *name, const char *buf, size_t size)
+{
+	const char *p, *end = buf + size, *nl;
+	struct lxc_log_rec_header hdr;
+	size_t len;
+	int pass, bad = 0;
+
+	for (pass = 0; pass < 2; pass++) {
+		for (p = buf; p < end; p += len) {
+			if (*p) {
+				nl = memchr(p, '\n', end - p);
+				len = nl ? nl - p + 1 : end - p;
+				if (pass)
+					print_text_line(p, nl ? len - 1 : len);
+				continue;
+			}
+
+			len = record_len(p, end);
+			if (!len) {
+				if (!pass)
+					bad++;
+				len = 1;
+				continue;
+			}
+			memcpy(&hdr, p, sizeof(hdr));
+
+			if (!pass) {
+				if (hdr.type == LXC_LOG_REC_SESSION)
+					bad += add_session(p, len) < 0;
+				else if (hdr.type == LXC_LOG_REC_CATEGORY ||
+					 hdr.type == LXC_LOG_REC_FORMAT)
+					bad += add_definition(p, len, hdr.type) < 0;
+			} else if (hdr.type == LXC_LOG_REC_EVENT) {
+				print_event(p, len);
+			}
+		}
+
+		if (!pass) {
+			qsort(sessions, nsessions, sizeof(*sessions), cmp_session);
+			qsort(defs, ndefs, sizeof(*defs), cmp_def);
+		}
+	}
+
+	if (bad)
+		fprintf(stderr, "%s: skipped %d bad bytes or records\n", name, bad);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	static const struct option options[] = {
+		{ "json", no_argument, 0, 'j' },
+		{ "help", no_argument, 0, 'h' },
+		{ 0, 0, 0, 0 },
+	};
+	int c, i, fd, ret = 0;
+	size_t size;
+	char *buf;
+
+	while ((c = getopt_long(argc, argv, "jh", options, NULL)) != -1) {
+		switch (c) {
+		case 'j': json = 1; break;
+		case 'h': usage(argv[0]); exit(0);
+		default: usage(argv[0]); exit(1);
+		}
+	}
+
+	for (i = optind; i < argc || i == optind; i++) {
+		const char *name = i < argc ? argv[i] : "-";
+
+		fd = strcmp(name, "-") ? open(name, O_RDONLY | O_CLOEXEC) : 0;
+		if (fd < 0) {
+			fprintf(stderr, "%s: %s\n", name, strerror(errno));
+			ret = 1;
+			continue;
+		}
+		buf = read_all(fd, &size);
+		if (fd)
+			close(fd);
+		if (!buf) {
+			fprintf(stderr, "%s: %s\n", name, strerror(errno));
+			ret = 1;
+			continue;
+		}
+
+		decode(name, buf, size);
+
+		/* the definitions point into buf */
+		free(sessions);
+		free(defs);
+		sessions = NULL;
+		defs = NULL;
+		nsessions = ndefs = 0;
+		free(buf);
+	}
+
+	return ret;
+}
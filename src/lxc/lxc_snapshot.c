@@ -20,6 +20,7 @@
 #include <lxc/lxccontainer.h>
 
 #include <stdio.h>
+#include <string.h>
 #include <libgen.h>
 #include <unistd.h>
 #include <ctype.h>
@@ -42,9 +43,14 @@ char *snapshot;
 #define DO_LIST 1
 #define DO_RESTORE 2
 #define DO_DESTROY 3
+#define DO_EXPORT 4
+#define DO_IMPORT 5
 int action;
 int print_comments;
 char *commentfile;
+char *parent;
+char *base;
+int export_flags;
 
 int do_snapshot(struct lxc_container *c)
 {
@@ -119,6 +125,32 @@ int do_destroy_snapshots(struct lxc_container *c)
 	return -1;
 }
 
+int do_export_snapshot(struct lxc_container *c)
+{
+	if (isatty(1)) {
+		ERROR("Refusing to write a snapshot stream to a terminal");
+		return -1;
+	}
+	if (c->snapshot_export(c, snapshot, parent, 1, export_flags))
+		return 0;
+
+	ERROR("Error exporting snapshot %s", snapshot);
+	return -1;
+}
+
+int do_import_snapshot(const char *name, const char *lxcpath)
+{
+	struct lxc_container *c;
+
+	c = lxc_snapshot_import(0, name, lxcpath, base);
+	if (!c) {
+		ERROR("Error importing %s", name);
+		return -1;
+	}
+	lxc_container_put(c);
+	return 0;
+}
+
 static int my_parser(struct lxc_arguments* args, int c, char* arg)
 {
 	switch (c) {
@@ -127,6 +159,22 @@ static int my_parser(struct lxc_arguments* args, int c, char* arg)
 	case 'd': snapshot = arg; action = DO_DESTROY; break;
 	case 'c': commentfile = arg; break;
 	case 'C': print_comments = true; break;
+	case 'e': snapshot = arg; action = DO_EXPORT; break;
+	case 'p': parent = arg; break;
+	case 'i': action = DO_IMPORT; break;
+	case 'b': base = arg; break;
+	case 'z':
+		if (strcmp(arg, "gzip") == 0)
+			export_flags = LXC_EXPORT_GZIP;
+		else if (strcmp(arg, "zstd") == 0)
+			export_flags = LXC_EXPORT_ZSTD;
+		else if (strcmp(arg, "lz4") == 0)
+			export_flags = LXC_EXPORT_LZ4;
+		else if (strcmp(arg, "none") != 0) {
+			lxc_error(args, "unknown compression '%s'", arg);
+			return -1;
+		}
+		break;
 	}
 	return 0;
 }
@@ -137,6 +185,11 @@ static const struct option my_longopts[] = {
 	{"destroy", required_argument, 0, 'd'},
 	{"comment", required_argument, 0, 'c'},
 	{"showcomments", no_argument, 0, 'C'},
+	{"export", required_argument, 0, 'e'},
+	{"parent", required_argument, 0, 'p'},
+	{"compress", required_argument, 0, 'z'},
+	{"import", no_argument, 0, 'i'},
+	{"base", required_argument, 0, 'b'},
 	LXC_COMMON_OPTIONS
 };
 
@@ -145,6 +198,7 @@ static struct lxc_arguments my_args = {
 	.progname = "lxc-snapshot",
 	.help     = "\
 --name=NAME [-P lxcpath] [-L [-C]] [-c commentfile] [-r snapname [newname]]\n\
+       [-e snapname [-p parent] [-z compression]] [-i [-b base]]\n\
 \n\
 lxc-snapshot snapshots a container\n\
 \n\
@@ -154,7 +208,12 @@ Options :\n\
   -C, --showcomments  show snapshot comments in list\n\
   -c, --comment=file  add file as a comment\n\
   -r, --restore=name  restore snapshot name, i.e. 'snap0'\n\
-  -d, --destroy=name  destroy snapshot name, i.e. 'snap0'\n",
+  -d, --destroy=name  destroy snapshot name, i.e. 'snap0'\n\
+  -e, --export=name   write snapshot name to stdout\n\
+  -p, --parent=name   only export the changes since snapshot name\n\
+  -z, --compress=type compress the export with gzip, zstd or lz4\n\
+  -i, --import        create container NAME from a stream on stdin\n\
+  -b, --base=name     container to apply an incremental stream to\n",
 	.options  = my_longopts,
 	.parser   = my_parser,
 	.checker  = NULL,
@@ -195,6 +254,9 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (action == DO_IMPORT)
+		exit(do_import_snapshot(my_args.name, my_args.lxcpath[0]) < 0 ? 1 : 0);
+
 	c = lxc_container_new(my_args.name, my_args.lxcpath[0]);
 	if (!c) {
 		fprintf(stderr, "System error loading container\n");
@@ -220,6 +282,9 @@ int main(int argc, char *argv[])
 	case DO_DESTROY:
 		ret = do_destroy_snapshots(c);
 		break;
+	case DO_EXPORT:
+		ret = do_export_snapshot(c);
+		break;
 	}
 
 	lxc_container_put(c);
@@ -50,10 +50,13 @@
 #include "config.h"
 #include "confile.h"
 #include "arguments.h"
+#include "commands.h"
 
 #define OPT_SHARE_NET OPT_USAGE+1
 #define OPT_SHARE_IPC OPT_USAGE+2
 #define OPT_SHARE_UTS OPT_USAGE+3
+#define OPT_TRACE OPT_USAGE+4
+#define OPT_ZYGOTE OPT_USAGE+5
 
 lxc_log_define(lxc_start_ui, lxc_start);
 
@@ -155,6 +158,8 @@ static int my_parser(struct lxc_arguments* args, int c, char* arg)
 	case OPT_SHARE_NET: args->share_ns[LXC_NS_NET] = arg; break;
 	case OPT_SHARE_IPC: args->share_ns[LXC_NS_IPC] = arg; break;
 	case OPT_SHARE_UTS: args->share_ns[LXC_NS_UTS] = arg; break;
+	case OPT_TRACE: args->trace = 1; break;
+	case OPT_ZYGOTE: args->zygote = 1; args->daemonize = 1; break;
 	}
 	return 0;
 }
@@ -170,6 +175,8 @@ static const struct option my_longopts[] = {
 	{"share-net", required_argument, 0, OPT_SHARE_NET},
 	{"share-ipc", required_argument, 0, OPT_SHARE_IPC},
 	{"share-uts", required_argument, 0, OPT_SHARE_UTS},
+	{"trace", no_argument, 0, OPT_TRACE},
+	{"zygote", no_argument, 0, OPT_ZYGOTE},
 	LXC_COMMON_OPTIONS
 };
 
@@ -192,6 +199,10 @@ Options :\n\
 		         Note: --daemon implies --close-all-fds\n\
   -s, --define KEY=VAL   Assign VAL to configuration variable KEY\n\
       --share-[net|ipc|uts]=NAME Share a namespace with another container or pid\n\
+      --trace            Print how long each start phase took\n\
+      --zygote           Set the container up in the background and park it\n\
+                         right before exec'ing COMMAND, until released\n\
+                         through the start_from_zygote() API\n\
 ",
 	.options   = my_longopts,
 	.parser    = my_parser,
@@ -340,8 +351,27 @@ int main(int argc, char *argv[])
 	if (my_args.close_all_fds)
 		c->want_close_all_fds(c, true);
 
+	/* in the foreground, the trace is printed once the container runs */
+	if (my_args.trace && !my_args.daemonize)
+		conf->print_start_trace = 1;
+
+	if (my_args.zygote)
+		conf->zygote = 1;
+
 	err = c->start(c, 0, args) ? 0 : -1;
 
+	if (!err && my_args.trace && my_args.daemonize) {
+		struct lxc_trace_entry *entries = NULL;
+		int n;
+
+		n = lxc_cmd_get_start_trace(c->name, c->config_path, &entries);
+		if (n < 0)
+			ERROR("failed to get the start trace");
+		else
+			lxc_trace_print(stderr, entries, n);
+		free(entries);
+	}
+
 	if (my_args.pidfile)
 		unlink(my_args.pidfile);
 
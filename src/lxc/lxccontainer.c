@@ -30,6 +30,11 @@
 #include <fcntl.h>
 #include <sched.h>
 #include <dirent.h>
+#include <inttypes.h>
+#include <ftw.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <time.h>
 #include "config.h"
 #include "lxc.h"
 #include "state.h"
@@ -185,7 +190,14 @@ void remove_partial(struct lxc_container *c, int fd)
  * 2. container_disk_lock(c) protects the on-disk container data - in particular the
  *    container configuration file.
  *    The container_disk_lock also takes the container_mem_lock.
- * 3. thread_mutex protects process data (ex: fd table) from multiple threads.
+ *    Paths which only read the on-disk data take container_disk_lock_shared
+ *    instead, so readers in other processes don't queue behind each other.
+ * 3. There is no process-wide lock.  Shared state belongs to one subsystem
+ *    and is guarded there: the console's lxc_ttys list by lxc_ttys_mutex,
+ *    the host probe and config key index by pthread_once, and the
+ *    lxc_global_config_value() table by publishing each value once with
+ *    a compare-and-swap.  Threads working on different containers share
+ *    no lock.  process_lock() is only kept for API users.
  * NOTHING mutexes two independent programs with their own struct
  * lxc_container for the same c->name, between API calls.  For instance,
  * c->config_read(); c->start();  Between those calls, data on disk
@@ -400,11 +412,21 @@ static pid_t lxcapi_init_pid(struct lxc_container *c)
 
 static bool load_config_locked(struct lxc_container *c, const char *fname)
 {
+	int ret;
+
 	if (!c->lxc_conf)
 		c->lxc_conf = lxc_conf_init();
-	if (c->lxc_conf && !lxc_config_read(fname, c->lxc_conf))
-		return true;
-	return false;
+	if (!c->lxc_conf)
+		return false;
+	/*
+	 * Only the container's own config gets a cache: -f files and the
+	 * default config live in places that are not ours to write to.
+	 */
+	if (c->configfile && strcmp(fname, c->configfile) == 0)
+		ret = lxc_config_read_cached(fname, c->lxc_conf);
+	else
+		ret = lxc_config_read(fname, c->lxc_conf);
+	return ret == 0;
 }
 
 static bool lxcapi_load_config(struct lxc_container *c, const char *alt_file)
@@ -429,7 +451,7 @@ static bool lxcapi_load_config(struct lxc_container *c, const char *alt_file)
 		need_disklock = true;
 
 	if (need_disklock)
-		lret = container_disk_lock(c);
+		lret = container_disk_lock_shared(c);
 	else
 		lret = container_mem_lock(c);
 	if (lret)
@@ -497,6 +519,14 @@ static bool wait_on_daemonized_start(struct lxc_container *c, int pid)
 	ret = waitpid(pid, &status, 0);
 	if (ret == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
 		DEBUG("failed waiting for first dual-fork child");
+
+	/*
+	 * a zygote stays STARTING; the monitor only answers commands
+	 * once it is parked, so asking for its init pid waits for that
+	 */
+	if (c->lxc_conf->zygote)
+		return lxcapi_wait(c, "STARTING", timeout) &&
+			lxc_cmd_get_init_pid(c->name, c->config_path) > 0;
 	return lxcapi_wait(c, "RUNNING", timeout);
 }
 
@@ -570,6 +600,11 @@ static bool lxcapi_start(struct lxc_container *c, int useinit, char * const argv
 		return false;
 	conf = c->lxc_conf;
 	daemonize = c->daemonize;
+	/* compile before a daemonized start forks, so later starts reuse it */
+	if (lxc_mount_plan_compile(conf, c->name) < 0) {
+		container_mem_unlock(c);
+		return false;
+	}
 	container_mem_unlock(c);
 
 	if (useinit) {
@@ -645,6 +680,18 @@ reboot:
 	}
 }
 
+static bool lxcapi_start_from_zygote(struct lxc_container *c, char * const argv[])
+{
+	if (!c)
+		return false;
+
+	if (lxc_cmd_zygote_release(c->name, c->config_path, argv) < 0) {
+		ERROR("Error releasing %s", c->name);
+		return false;
+	}
+	return true;
+}
+
 /*
  * note there MUST be an ending NULL
  */
@@ -1022,6 +1069,7 @@ static bool create_run_template(struct lxc_container *c, char *tpath, bool quiet
 			newargv = n2;
 		}
 		/* execute */
+		lxc_log_flush();
 		execvp(tpath, newargv);
 		SYSERROR("failed to execute template %s", tpath);
 		exit(1);
@@ -1138,6 +1186,9 @@ static void lxcapi_clear_config(struct lxc_container *c)
 }
 
 static bool lxcapi_destroy(struct lxc_container *c);
+static bool create_from_image_cache(struct lxc_container *c, const char *t,
+		char *tpath, const char *bdevtype, struct bdev_specs *specs,
+		int flags, char *const argv[]);
 /*
  * lxcapi_create:
  * create a container with the given parameters.
@@ -1191,6 +1242,15 @@ static bool lxcapi_create(struct lxc_container *c, const char *t,
 		}
 	}
 
+	if ((flags & LXC_CREATE_CACHE) && tpath) {
+		if (!c->lxc_conf->rootfs.path) {
+			ret = create_from_image_cache(c, t, tpath, bdevtype, specs,
+					flags, argv);
+			goto out;
+		}
+		WARN("lxc.rootfs is set for %s, not using the image cache", c->name);
+	}
+
 	if (!create_container_dir(c))
 		goto free_tpath;
 
@@ -1818,12 +1878,35 @@ static int lxc_rmdir_onedev_wrapper(void *data)
 	return lxc_rmdir_onedev(arg);
 }
 
+/*
+ * Whether removing the rootfs just means removing a directory below the
+ * container directory @path, which an async destroy moves away anyway.
+ */
+static bool rootfs_in_container_dir(struct bdev *r, const char *path)
+{
+	const char *p = r->src;
+	size_t len = strlen(path);
+
+	if (strcmp(r->type, "dir") == 0) {
+		if (strncmp(p, "dir:", 4) == 0)
+			p += 4;
+	} else if (strcmp(r->type, "overlayfs") == 0) {
+		if (!(p = rindex(p, ':')))
+			return false;
+		p++;
+	} else
+		return false;
+	return strncmp(p, path, len) == 0 && p[len] == '/';
+}
+
 // do we want the api to support --force, or leave that to the caller?
-static bool lxcapi_destroy(struct lxc_container *c)
+static bool do_lxcapi_destroy(struct lxc_container *c, bool async)
 {
 	struct bdev *r = NULL;
 	bool bret = false, am_unpriv;
 	int ret;
+	const char *p1;
+	char *path, *trash;
 
 	if (!c || !lxcapi_is_defined(c))
 		return false;
@@ -1844,10 +1927,19 @@ static bool lxcapi_destroy(struct lxc_container *c)
 		goto out;
 	}
 
+	// unprivileged containers have to be removed from within their userns
+	if (am_unpriv)
+		async = false;
+
+	p1 = lxcapi_get_config_path(c);
+	path = alloca(strlen(p1) + strlen(c->name) + 2);
+	sprintf(path, "%s/%s", p1, c->name);
+
 	if (!am_unpriv && c->lxc_conf->rootfs.path && c->lxc_conf->rootfs.mount) {
 		r = bdev_init(c->lxc_conf->rootfs.path, c->lxc_conf->rootfs.mount, NULL);
 		if (r) {
-			if (r->ops->destroy(r) < 0) {
+			if ((!async || !rootfs_in_container_dir(r, path)) &&
+					r->ops->destroy(r) < 0) {
 				bdev_put(r);
 				ERROR("Error destroying rootfs for %s", c->name);
 				goto out;
@@ -1858,12 +1950,13 @@ static bool lxcapi_destroy(struct lxc_container *c)
 
 	mod_all_rdeps(c, false);
 
-	const char *p1 = lxcapi_get_config_path(c);
-	char *path = alloca(strlen(p1) + strlen(c->name) + 2);
-	sprintf(path, "%s/%s", p1, c->name);
 	if (am_unpriv)
 		ret = userns_exec_1(c->lxc_conf, lxc_rmdir_onedev_wrapper, path);
-	else
+	else if (async) {
+		trash = alloca(strlen(p1) + strlen("/.lxc-trash") + 1);
+		sprintf(trash, "%s/.lxc-trash", p1);
+		ret = lxc_rmdir_onedev_async(path, trash);
+	} else
 		ret = lxc_rmdir_onedev(path);
 	if (ret < 0) {
 		ERROR("Error destroying container directory for %s", c->name);
@@ -1876,6 +1969,16 @@ out:
 	return bret;
 }
 
+static bool lxcapi_destroy(struct lxc_container *c)
+{
+	return do_lxcapi_destroy(c, false);
+}
+
+static bool lxcapi_destroy_async(struct lxc_container *c)
+{
+	return do_lxcapi_destroy(c, true);
+}
+
 static bool set_config_item_locked(struct lxc_container *c, const char *key, const char *v)
 {
 	struct lxc_config_t *config;
@@ -2023,7 +2126,7 @@ static int lxcapi_get_cgroup_item(struct lxc_container *c, const char *subsys, c
 	if (is_stopped(c))
 		return -1;
 
-	if (container_disk_lock(c))
+	if (container_disk_lock_shared(c))
 		return -1;
 
 	ret = lxc_cgroup_get(subsys, retv, inlen, c->name, c->config_path);
@@ -2032,6 +2135,54 @@ static int lxcapi_get_cgroup_item(struct lxc_container *c, const char *subsys, c
 	return ret;
 }
 
+static bool lxcapi_resize_rootfs(struct lxc_container *c, unsigned long size)
+{
+	struct bdev *bdev;
+	char path[MAXPATHLEN];
+	pid_t pid;
+	int ret, rootfd = -1;
+	bool bret = false;
+
+	if (!c || !c->lxc_conf || !c->lxc_conf->rootfs.path)
+		return false;
+
+	if (container_disk_lock(c))
+		return false;
+
+	bdev = bdev_init(c->lxc_conf->rootfs.path, NULL, NULL);
+	if (!bdev) {
+		ERROR("Failed to find original backing store type");
+		goto out;
+	}
+	if (!bdev->ops->resize) {
+		ERROR("%s backing store can not be resized", bdev->type);
+		goto out;
+	}
+
+	// a running container's fs has to be grown in place
+	pid = lxcapi_init_pid(c);
+	if (pid > 0) {
+		ret = snprintf(path, MAXPATHLEN, "/proc/%d/root", pid);
+		if (ret < 0 || ret >= MAXPATHLEN)
+			goto out;
+		rootfd = open(path, O_RDONLY | O_DIRECTORY);
+		if (rootfd < 0) {
+			SYSERROR("Failed to open %s", path);
+			goto out;
+		}
+	}
+
+	bret = bdev->ops->resize(bdev, size, rootfd) == 0;
+
+out:
+	if (rootfd >= 0)
+		close(rootfd);
+	if (bdev)
+		bdev_put(bdev);
+	container_disk_unlock(c);
+	return bret;
+}
+
 const char *lxc_get_default_config_path(void)
 {
 	return default_lxc_path();
@@ -2121,8 +2272,9 @@ err:
 static int copyhooks(struct lxc_container *oldc, struct lxc_container *c)
 {
 	int i, len, ret;
-	struct lxc_list *it;
+	struct lxc_strlist *hooks;
 	char *cpath;
+	size_t j;
 
 	len = strlen(oldc->config_path) + strlen(oldc->name) + 3;
 	cpath = alloca(len);
@@ -2131,8 +2283,8 @@ static int copyhooks(struct lxc_container *oldc, struct lxc_container *c)
 		return -1;
 
 	for (i=0; i<NUM_LXC_HOOKS; i++) {
-		lxc_list_for_each(it, &c->lxc_conf->hooks[i]) {
-			char *hookname = it->elem;
+		for (j = 0; j < lxc_strlist_len(c->lxc_conf->hooks[i]); j++) {
+			char *hookname = c->lxc_conf->hooks[i]->items[j];
 			char *fname = strrchr(hookname, '/');
 			char tmppath[MAXPATHLEN];
 			if (!fname) // relative path - we don't support, but maybe we should
@@ -2146,15 +2298,16 @@ static int copyhooks(struct lxc_container *oldc, struct lxc_container *c)
 					c->config_path, c->name, fname+1);
 			if (ret < 0 || ret >= MAXPATHLEN)
 				return -1;
-			ret = copy_file(it->elem, tmppath);
+			ret = copy_file(hookname, tmppath);
 			if (ret < 0)
 				return -1;
-			free(it->elem);
-			it->elem = strdup(tmppath);
-			if (!it->elem) {
+			/* the list may be shared: this makes our own copy */
+			hooks = lxc_strlist_set(c->lxc_conf->hooks[i], j, tmppath);
+			if (!hooks) {
 				ERROR("out of memory copying hook path");
 				return -1;
 			}
+			c->lxc_conf->hooks[i] = hooks;
 		}
 	}
 
@@ -2273,15 +2426,46 @@ static bool add_rdepends(struct lxc_container *c, struct lxc_container *c0)
 	return bret;
 }
 
+/*
+ * Snapshotting an overlayfs container pushes its upper dir down into a new
+ * lower layer, so its rootfs path changes.  We're called with c0's memlock
+ * held, so write the config out here rather than through save_config.
+ */
+static bool update_orig_rootfs(struct lxc_container *c0, char *src)
+{
+	FILE *fout;
+	bool bret = false;
+
+	free(c0->lxc_conf->rootfs.path);
+	c0->lxc_conf->rootfs.path = src;
+
+	if (lxclock(c0->slock, 0))
+		return false;
+	fout = fopen(c0->configfile, "w");
+	if (fout) {
+		write_config(fout, c0->lxc_conf);
+		bret = fclose(fout) == 0;
+	}
+	lxcunlock(c0->slock);
+	return bret;
+}
+
 static int copy_storage(struct lxc_container *c0, struct lxc_container *c,
 		const char *newtype, int flags, const char *bdevdata, unsigned long newsize)
 {
 	struct bdev *bdev;
 	int need_rdep;
+	char *orig_src;
 
 	bdev = bdev_copy(c0->lxc_conf->rootfs.path, c0->name, c->name,
 			c0->config_path, c->config_path, newtype, !!(flags & LXC_CLONE_SNAPSHOT),
-			bdevdata, newsize, &need_rdep);
+			bdevdata, newsize, &need_rdep, &orig_src);
+	if (orig_src && !update_orig_rootfs(c0, orig_src)) {
+		ERROR("Error saving new rootfs path %s for %s", orig_src, c0->name);
+		if (bdev)
+			bdev_put(bdev);
+		return -1;
+	}
 	if (!bdev) {
 		ERROR("Error copying storage");
 		return -1;
@@ -2343,7 +2527,7 @@ static int clone_update_rootfs(struct lxc_container *c0,
 		bdev->dest = strdup(bdev->src);
 	}
 
-	if (!lxc_list_empty(&conf->hooks[LXCHOOK_CLONE])) {
+	if (lxc_strlist_len(conf->hooks[LXCHOOK_CLONE])) {
 		/* Start of environment variable setup for hooks */
 		if (setenv("LXC_SRC_NAME", c0->name, 1)) {
 			SYSERROR("failed to set environment variable for source container name");
@@ -2527,6 +2711,325 @@ out:
 	return NULL;
 }
 
+/*
+ * Image cache.
+ *
+ * lxc-create --from-cache keeps the result of a template run as a regular
+ * container under ${lxcpath}cache, named after a digest of everything which
+ * influences the template's output: the template script itself, its name
+ * and arguments, the requested backing store and the starting configuration.
+ * The first create of a given image runs the template as usual, later ones
+ * are snapshot clones of the cached image (overlayfs for directories,
+ * btrfs/zfs/lvm snapshots otherwise).  Every container cloned from an image
+ * holds a reverse dependency on it, so lxc_image_cache_gc() only removes
+ * images which nobody uses any more.
+ */
+#define IMAGE_KEY_LEN 41
+
+/*
+ * see monitor.c: a stable, well distributed hash for image cache names
+ * without libgnutls, and the checksum of snapshot streams
+ */
+#define FNV1A_64_INIT ((uint64_t)0xcbf29ce484222325ULL)
+static uint64_t fnv_64a_buf(void *buf, size_t len, uint64_t hval)
+{
+	unsigned char *bp;
+
+	for(bp = buf; bp < (unsigned char *)buf + len; bp++)
+	{
+		hval ^= (uint64_t)*bp;
+		hval += (hval << 1) + (hval << 4) + (hval << 5) +
+			(hval << 7) + (hval << 8) + (hval << 40);
+	}
+
+	return hval;
+}
+
+static bool image_cache_path(const char *lxcpath, char *path, size_t len)
+{
+	int ret;
+
+	// /var/lib/lxc -> /var/lib/lxccache, like lxcsnaps
+	ret = snprintf(path, len, "%scache", lxcpath);
+	return ret >= 0 && ret < len;
+}
+
+/*
+ * Compute the cache key for a template run.  With GnuTLS we use the
+ * same SHA-1 template digest that prepend_lxc_header() records, without
+ * it the template is identified by its inode, size and mtime.
+ */
+static bool image_cache_key(struct lxc_container *c, char *tpath,
+		const char *t, const char *bdevtype, struct bdev_specs *specs,
+		char *const argv[], char *key)
+{
+	char *buf = NULL;
+	size_t buflen = 0;
+	FILE *f;
+	int i;
+	bool bret = false;
+#if HAVE_LIBGNUTLS
+	unsigned char md_value[SHA_DIGEST_LENGTH];
+#else
+	struct stat st;
+	uint64_t hash;
+#endif
+
+	f = open_memstream(&buf, &buflen);
+	if (!f) {
+		SYSERROR("Out of memory");
+		return false;
+	}
+
+#if HAVE_LIBGNUTLS
+	if (sha1sum_file(tpath, md_value) < 0) {
+		ERROR("Error getting sha1sum of %s", tpath);
+		fclose(f);
+		goto out;
+	}
+	fprintf(f, "digest=");
+	for (i=0; i<SHA_DIGEST_LENGTH; i++)
+		fprintf(f, "%02x", md_value[i]);
+	fprintf(f, "\n");
+#else
+	if (stat(tpath, &st) < 0) {
+		SYSERROR("Error stating template %s", tpath);
+		fclose(f);
+		goto out;
+	}
+	fprintf(f, "template=%s:%llu:%llu:%llu\n", tpath,
+		(unsigned long long)st.st_ino, (unsigned long long)st.st_size,
+		(unsigned long long)st.st_mtime);
+#endif
+	fprintf(f, "name=%s\nbdev=%s\n", t, bdevtype ? bdevtype : "");
+	// everything deciding where and how the image's storage is made
+	if (specs)
+		fprintf(f, "fstype=%s\nfssize=%lu\nprealloc=%d\n"
+			"zfsroot=%s\nvg=%s\nlv=%s\nthinpool=%s\n",
+			specs->fstype ? specs->fstype : "", specs->fssize,
+			specs->prealloc,
+			specs->zfs.zfsroot ? specs->zfs.zfsroot : "",
+			specs->lvm.vg ? specs->lvm.vg : "",
+			specs->lvm.lv ? specs->lvm.lv : "",
+			specs->lvm.thinpool ? specs->lvm.thinpool : "");
+	if (argv)
+		for (i = 0; argv[i]; i++)
+			fprintf(f, "arg=%s\n", argv[i]);
+	write_config(f, c->lxc_conf);
+	if (fclose(f) != 0) {
+		SYSERROR("Error building cache key");
+		goto out;
+	}
+
+#if HAVE_LIBGNUTLS
+	if (sha1sum_buf(buf, buflen, md_value) < 0)
+		goto out;
+	for (i=0; i<SHA_DIGEST_LENGTH; i++)
+		sprintf(key + 2*i, "%02x", md_value[i]);
+#else
+	hash = fnv_64a_buf(buf, buflen, FNV1A_64_INIT);
+	sprintf(key, "%016" PRIx64, hash);
+#endif
+	bret = true;
+
+out:
+	free(buf);
+	return bret;
+}
+
+/*
+ * Make sure @c holds a reverse dependency on @img.  Overlayfs clones of a
+ * directory image get one from copy_storage(), btrfs, zfs and lvm
+ * snapshots do not, but the image must not be collected under them either.
+ */
+static bool image_cache_ref(struct lxc_container *c, struct lxc_container *img)
+{
+	char path[MAXPATHLEN];
+	char *lxcpath = NULL, *lxcname = NULL;
+	size_t pathlen = 0, namelen = 0;
+	bool found = false;
+	FILE *f;
+	int ret;
+
+	ret = snprintf(path, MAXPATHLEN, "%s/%s/lxc_rdepends",
+		c->config_path, c->name);
+	if (ret < 0 || ret >= MAXPATHLEN)
+		return false;
+	f = fopen(path, "r");
+	if (f) {
+		while (!found && getline(&lxcpath, &pathlen, f) != -1) {
+			if (getline(&lxcname, &namelen, f) == -1)
+				break;
+			strip_newline(lxcpath);
+			strip_newline(lxcname);
+			found = strcmp(lxcpath, img->config_path) == 0 &&
+				strcmp(lxcname, img->name) == 0;
+		}
+		free(lxcpath);
+		free(lxcname);
+		fclose(f);
+	}
+	if (found)
+		return true;
+
+	if (!add_rdepends(c, img))
+		return false;
+	return mod_rdep(img, true);
+}
+
+static struct lxc_lock *image_cache_lock(const char *cachepath, const char *key)
+{
+	char name[IMAGE_KEY_LEN + 7];
+	struct lxc_lock *l;
+
+	/* not the image's own slock: the clone below takes that one */
+	snprintf(name, sizeof(name), "image-%s", key);
+	l = lxc_newlock(cachepath, name);
+	if (!l)
+		return NULL;
+	if (lxclock(l, 0)) {
+		lxc_putlock(l);
+		return NULL;
+	}
+	return l;
+}
+
+static void image_cache_unlock(struct lxc_lock *l)
+{
+	lxcunlock(l);
+	lxc_putlock(l);
+}
+
+/*
+ * Create @c as a snapshot clone of the cached image for this template run,
+ * populating the cache first if needed.
+ */
+static bool create_from_image_cache(struct lxc_container *c, const char *t,
+		char *tpath, const char *bdevtype, struct bdev_specs *specs,
+		int flags, char *const argv[])
+{
+	char cachepath[MAXPATHLEN], key[IMAGE_KEY_LEN];
+	struct lxc_container *img = NULL, *c2 = NULL;
+	struct bdev_specs ispecs;
+	struct lxc_lock *l;
+	struct bdev *bdev;
+	int cflags = LXC_CLONE_KEEPMACADDR;
+	bool bret = false;
+
+	if (!image_cache_path(c->config_path, cachepath, MAXPATHLEN))
+		return false;
+	if (!image_cache_key(c, tpath, t, bdevtype, specs, argv, key))
+		return false;
+	if (mkdir_p(cachepath, 0755) < 0) {
+		ERROR("Failed to create image cache directory %s", cachepath);
+		return false;
+	}
+
+	if (!(l = image_cache_lock(cachepath, key))) {
+		ERROR("Failed to lock image %s", key);
+		return false;
+	}
+
+	img = lxc_container_new(key, cachepath);
+	if (!img)
+		goto out;
+
+	if (!lxcapi_is_defined(img)) {
+		INFO("Populating image cache entry %s for template %s", key, t);
+
+		if (!create_container_dir(img) || !c->save_config(c, img->configfile) ||
+				!img->load_config(img, NULL)) {
+			ERROR("Failed to set up image %s", key);
+			goto out;
+		}
+
+		memset(&ispecs, 0, sizeof(ispecs));
+		if (specs)
+			ispecs = *specs;
+		// the lv is named after the image, not after this container
+		ispecs.lvm.lv = NULL;
+
+		if (!img->create(img, t, bdevtype, &ispecs,
+				flags & ~LXC_CREATE_CACHE, argv)) {
+			ERROR("Failed to populate image %s", key);
+			goto out;
+		}
+	} else
+		INFO("Using cached image %s for template %s", key, t);
+
+	bdev = bdev_init(img->lxc_conf->rootfs.path, img->lxc_conf->rootfs.mount, NULL);
+	if (!bdev) {
+		ERROR("Failed to find backing store type of image %s", key);
+		goto out;
+	}
+	// loop images cannot be snapshotted and unprivileged users cannot
+	// mount overlayfs, so those get a full copy.
+	if (strcmp(bdev->type, "loop") != 0 && geteuid() == 0)
+		cflags |= LXC_CLONE_SNAPSHOT;
+	bdev_put(bdev);
+
+	c2 = lxcapi_clone(img, c->name, c->config_path, cflags, NULL, NULL, 0, NULL);
+	if (!c2) {
+		ERROR("Failed to clone image %s into %s", key, c->name);
+		goto out;
+	}
+
+	if (!image_cache_ref(c2, img))
+		WARN("Error recording dependency of %s on image %s", c->name, key);
+
+	lxcapi_clear_config(c);
+	bret = load_config_locked(c, c->configfile);
+
+out:
+	if (c2)
+		lxc_container_put(c2);
+	if (img)
+		lxc_container_put(img);
+	image_cache_unlock(l);
+	return bret;
+}
+
+int lxc_image_cache_gc(const char *lxcpath)
+{
+	char cachepath[MAXPATHLEN];
+	struct lxc_container **images;
+	struct lxc_lock *l;
+	int i, n, removed = 0;
+
+	if (!lxcpath)
+		lxcpath = default_lxc_path();
+	if (!image_cache_path(lxcpath, cachepath, MAXPATHLEN))
+		return -1;
+	if (!file_exists(cachepath))
+		return 0;
+
+	n = list_defined_containers(cachepath, NULL, &images);
+	if (n < 0)
+		return -1;
+
+	for (i = 0; i < n; i++) {
+		struct lxc_container *img = images[i];
+
+		if ((l = image_cache_lock(cachepath, img->name)) == NULL) {
+			ERROR("Failed to lock image %s", img->name);
+			lxc_container_put(img);
+			continue;
+		}
+		if (!has_snapshots(img)) {
+			if (lxcapi_destroy(img)) {
+				INFO("Removed unused image %s", img->name);
+				removed++;
+			} else
+				ERROR("Error removing unused image %s", img->name);
+		}
+		image_cache_unlock(l);
+		lxc_container_put(img);
+	}
+	free(images);
+
+	return removed;
+}
+
 static bool lxcapi_rename(struct lxc_container *c, const char *newname)
 {
 	struct bdev *bdev;
@@ -2889,9 +3392,1086 @@ err:
 	return false;
 }
 
-static bool lxcapi_may_control(struct lxc_container *c)
-{
-	return lxc_try_cmd(c->name, c->config_path) == 0;
+/*
+ * Snapshot streams.  A stream starts with a text header:
+ *
+ *	lxc-snapshot-stream 1
+ *	name <snapshot name>
+ *	bdev <backing store type of the snapshot>
+ *	compression none|gzip|zstd|lz4
+ *	parent <snapshot name>		(incremental streams only)
+ *	dir <the snapshot's directory>
+ *	file <length> <octal mode> <name>	(any number of times)
+ *	config <length>
+ *	<empty line>
+ *
+ * followed by the snapshot's config file and the contents of the files
+ * named in the header, in that order.  Those are the fstab and hook
+ * scripts which were kept in the snapshot's directory, the importer puts
+ * them into the new container's.  Then comes the payload, in
+ * chunks each prefixed by a 32 bit big endian length.  A zero length chunk
+ * ends it, and is followed by the 64 bit big endian FNV-1a hash of all of
+ * the stream before it, which catches truncated or corrupted streams (it
+ * is not a signature, streams must come from a trusted source).
+ *
+ * The payload starts with a 64 bit big endian length and that many bytes
+ * of NUL terminated paths which were removed since the parent snapshot,
+ * followed by a tar archive of the rootfs, or for incremental streams of
+ * what changed since the parent, compressed as the header says.
+ */
+#define STREAM_MAGIC "lxc-snapshot-stream 1"
+#define STREAM_CHUNK (64 * 1024)
+#define STREAM_MAX_HEADER 8192
+
+struct snap_stream {
+	int fd;
+	uint64_t hash;
+};
+
+/* a file of the snapshot's directory, sent along with its config */
+struct stream_file {
+	char *name;
+	char *data;
+	size_t len;
+	mode_t mode;
+};
+
+static bool write_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t ret;
+
+	while (len > 0) {
+		ret = lxc_write_nointr(fd, p, len);
+		if (ret <= 0)
+			return false;
+		p += ret;
+		len -= ret;
+	}
+	return true;
+}
+
+static bool read_all(int fd, void *buf, size_t len)
+{
+	char *p = buf;
+	ssize_t ret;
+
+	while (len > 0) {
+		ret = lxc_read_nointr(fd, p, len);
+		if (ret <= 0)
+			return false;
+		p += ret;
+		len -= ret;
+	}
+	return true;
+}
+
+static bool stream_write(struct snap_stream *s, const void *buf, size_t len)
+{
+	s->hash = fnv_64a_buf((void *)buf, len, s->hash);
+	return write_all(s->fd, buf, len);
+}
+
+static bool stream_read(struct snap_stream *s, void *buf, size_t len)
+{
+	if (!read_all(s->fd, buf, len))
+		return false;
+	s->hash = fnv_64a_buf(buf, len, s->hash);
+	return true;
+}
+
+static void put_be64(unsigned char *p, uint64_t v)
+{
+	int i;
+
+	for (i = 7; i >= 0; i--, v >>= 8)
+		p[i] = v & 0xff;
+}
+
+static uint64_t get_be64(const unsigned char *p)
+{
+	uint64_t v = 0;
+	int i;
+
+	for (i = 0; i < 8; i++)
+		v = (v << 8) | p[i];
+	return v;
+}
+
+static const char *stream_compression(int flags)
+{
+	if (flags & LXC_EXPORT_ZSTD)
+		return "zstd";
+	if (flags & LXC_EXPORT_LZ4)
+		return "lz4";
+	if (flags & LXC_EXPORT_GZIP)
+		return "gzip";
+	return "none";
+}
+
+/* run argv with the given stdin and stdout, returns its pid or -1 */
+static pid_t stream_spawn(char *const argv[], int in, int out)
+{
+	pid_t pid;
+
+	pid = fork();
+	if (pid != 0)
+		return pid;
+
+	if ((in != 0 && dup2(in, 0) < 0) || (out != 1 && dup2(out, 1) < 0))
+		exit(1);
+	execvp(argv[0], argv);
+	SYSERROR("failed to exec %s", argv[0]);
+	exit(1);
+}
+
+/*
+ * Kill the child forked for streaming, together with the tar and the
+ * compression tool it spawned, which share its process group, and wait
+ * for all of them to be gone.  Only the child itself is ours to reap, so
+ * the others are waited for by polling their group, for a few seconds.
+ */
+static void stream_kill(pid_t pid)
+{
+	int i;
+
+	kill(-pid, SIGKILL);
+	for (i = 0; i < 500 && kill(-pid, 0) == 0; i++) {
+		if (waitpid(-pid, NULL, WNOHANG) <= 0)
+			usleep(10000);
+	}
+	if (i == 500)
+		WARN("Streaming processes of group %d did not go away", pid);
+}
+
+/*
+ * Run tar with @args, piping its output through, or its input from,
+ * compression tool @comp unless that is "none".  Used from the forked
+ * children below, so exits instead of returning.
+ */
+static void stream_run_tar(char **args, const char *comp, bool create)
+{
+	char *zargs[] = { (char *)comp, "-q", create ? "-c" : "-dc", NULL };
+	int p[2], ret = 0;
+	pid_t tar, z;
+
+	if (strcmp(comp, "none") == 0) {
+		execvp(args[0], args);
+		SYSERROR("failed to exec tar");
+		exit(1);
+	}
+	if (pipe2(p, O_CLOEXEC) < 0)
+		exit(1);
+	if (create) {
+		tar = stream_spawn(args, 0, p[1]);
+		z = stream_spawn(zargs, p[0], 1);
+	} else {
+		z = stream_spawn(zargs, 0, p[1]);
+		tar = stream_spawn(args, p[0], 1);
+	}
+	close(p[0]);
+	close(p[1]);
+	if (tar < 0 || wait_for_pid(tar) < 0)
+		ret = 1;
+	if (z < 0 || wait_for_pid(z) < 0)
+		ret = 1;
+	exit(ret);
+}
+
+/* mount @c's rootfs on its own rootfs dir in our (private) mount ns */
+static char *stream_mount_rootfs(struct lxc_container *c)
+{
+	struct bdev *bdev;
+	char *dest;
+	int ret;
+
+	dest = malloc(MAXPATHLEN);
+	if (!dest)
+		return NULL;
+	ret = snprintf(dest, MAXPATHLEN, "%s/%s/rootfs", c->config_path, c->name);
+	if (ret < 0 || ret >= MAXPATHLEN) {
+		free(dest);
+		return NULL;
+	}
+	bdev = bdev_init(c->lxc_conf->rootfs.path, dest, NULL);
+	if (!bdev || bdev->ops->mount(bdev) < 0) {
+		ERROR("Failed to mount rootfs of %s", c->name);
+		if (bdev)
+			bdev_put(bdev);
+		free(dest);
+		return NULL;
+	}
+	bdev_put(bdev);
+	return dest;
+}
+
+static bool stream_private_mounts(void)
+{
+	if (unshare(CLONE_NEWNS) < 0) {
+		SYSERROR("unshare CLONE_NEWNS");
+		return false;
+	}
+	if (detect_shared_rootfs() &&
+			mount("", "/", NULL, MS_SLAVE|MS_REC, 0) < 0) {
+		SYSERROR("Failed to make / rslave");
+		return false;
+	}
+	return true;
+}
+
+/* state for the nftw() walks below, which only run in a forked child */
+static const char *walk_other;
+static size_t walk_rootlen;
+static FILE *walk_out;
+
+static bool stat_differs(const struct stat *a, const struct stat *b)
+{
+	if (a->st_mode != b->st_mode || a->st_uid != b->st_uid ||
+			a->st_gid != b->st_gid)
+		return true;
+	if ((S_ISCHR(a->st_mode) || S_ISBLK(a->st_mode)) && a->st_rdev != b->st_rdev)
+		return true;
+	if (!S_ISDIR(a->st_mode) && a->st_size != b->st_size)
+		return true;
+	return a->st_mtim.tv_sec != b->st_mtim.tv_sec ||
+		a->st_mtim.tv_nsec != b->st_mtim.tv_nsec;
+}
+
+/*
+ * Write out the paths (relative to the walked tree) which walk_other
+ * doesn't have at all, or, for changes, has in a different state.
+ */
+static int walk_compare(const char *fpath, const struct stat *sb,
+		struct FTW *ftwbuf, bool changes)
+{
+	char path[MAXPATHLEN];
+	const char *rel = fpath + walk_rootlen;
+	struct stat other;
+	int ret;
+
+	if (*rel == '\0')
+		return FTW_CONTINUE;
+	rel++;
+	ret = snprintf(path, MAXPATHLEN, "%s/%s", walk_other, rel);
+	if (ret < 0 || ret >= MAXPATHLEN)
+		return FTW_STOP;
+	if (lstat(path, &other) < 0) {
+		if (errno != ENOENT)
+			return FTW_STOP;
+		if (fwrite(rel, strlen(rel) + 1, 1, walk_out) != 1)
+			return FTW_STOP;
+		// a removed dir takes its contents with it
+		return changes ? FTW_CONTINUE : FTW_SKIP_SUBTREE;
+	}
+	if (changes && stat_differs(sb, &other) &&
+			fwrite(rel, strlen(rel) + 1, 1, walk_out) != 1)
+		return FTW_STOP;
+	return FTW_CONTINUE;
+}
+
+static int walk_deleted(const char *fpath, const struct stat *sb,
+		int typeflag, struct FTW *ftwbuf)
+{
+	return walk_compare(fpath, sb, ftwbuf, false);
+}
+
+static int walk_changed(const char *fpath, const struct stat *sb,
+		int typeflag, struct FTW *ftwbuf)
+{
+	return walk_compare(fpath, sb, ftwbuf, true);
+}
+
+static bool stream_walk(const char *root, const char *other, FILE *out,
+		bool changes)
+{
+	walk_other = other;
+	walk_rootlen = strlen(root);
+	walk_out = out;
+	return nftw(root, changes ? walk_changed : walk_deleted, 20,
+			FTW_PHYS | FTW_MOUNT | FTW_ACTIONRETVAL) == 0;
+}
+
+/*
+ * Forked child of lxcapi_snapshot_export(): writes the payload (the list
+ * of removed paths, then the tar stream) to stdout.
+ */
+static void snapshot_export_child(struct lxc_container *snap,
+		struct lxc_container *psnap, const char *comp)
+{
+	char *root, *proot = NULL, *deleted = NULL;
+	char *tarargs[] = { "tar", "--numeric-owner", "--xattrs",
+		"--xattrs-include=*", "--sparse", "-cpf", "-", "-C", NULL,
+		".", NULL, NULL, NULL, NULL };
+	unsigned char lenbuf[8];
+	size_t dlen = 0;
+	FILE *f;
+	int p[2];
+	pid_t pid;
+
+	if (!stream_private_mounts())
+		exit(1);
+	if (!(root = stream_mount_rootfs(snap)))
+		exit(1);
+	if (psnap && !(proot = stream_mount_rootfs(psnap)))
+		exit(1);
+	tarargs[8] = root;
+
+	if (proot) {
+		f = open_memstream(&deleted, &dlen);
+		if (!f || !stream_walk(proot, root, f, false) || fclose(f)) {
+			ERROR("Failed to compare %s against %s", root, proot);
+			exit(1);
+		}
+	}
+	put_be64(lenbuf, dlen);
+	if (!write_all(1, lenbuf, 8) || !write_all(1, deleted, dlen))
+		exit(1);
+	free(deleted);
+
+	if (!proot)
+		stream_run_tar(tarargs, comp, true);
+
+	// only archive what changed, in the order found, parents first
+	tarargs[9] = "--no-recursion";
+	tarargs[10] = "--null";
+	tarargs[11] = "-T";
+	tarargs[12] = "-";
+	if (pipe2(p, O_CLOEXEC) < 0)
+		exit(1);
+	pid = fork();
+	if (pid < 0)
+		exit(1);
+	if (pid == 0) {
+		close(p[1]);
+		if (dup2(p[0], 0) < 0)
+			exit(1);
+		stream_run_tar(tarargs, comp, true);
+	}
+	close(p[0]);
+	f = fdopen(p[1], "w");
+	if (!f || !stream_walk(root, proot, f, true)) {
+		ERROR("Failed to compare %s against %s", root, proot);
+		exit(1);
+	}
+	fclose(f);
+	exit(wait_for_pid(pid) < 0 ? 1 : 0);
+}
+
+static void stream_free_files(struct stream_file *files, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		free(files[i].name);
+		free(files[i].data);
+	}
+	free(files);
+}
+
+static bool stream_in_dir(const char *path, const char *dir)
+{
+	size_t len = strlen(dir);
+
+	return path && strncmp(path, dir, len) == 0 && path[len] == '/';
+}
+
+/*
+ * Add @path to the @n @files to send along if it is in the snapshot's
+ * directory @dir, reading it in.
+ */
+static bool stream_add_file(struct stream_file **files, int *n,
+		const char *dir, const char *path)
+{
+	struct stream_file *f;
+	const char *name;
+	struct stat sb;
+	int i, fd;
+
+	if (!stream_in_dir(path, dir))
+		return true;
+	name = path + strlen(dir) + 1;
+	if (strchr(name, '/') || strchr(name, '\n') || name[0] == '.' ||
+			strcmp(name, "config") == 0) {
+		WARN("Not sending %s along, it is not a plain file of %s", path, dir);
+		return true;
+	}
+	for (i = 0; i < *n; i++)
+		if (strcmp((*files)[i].name, name) == 0)
+			return true;
+
+	f = realloc(*files, (*n + 1) * sizeof(**files));
+	if (!f)
+		return false;
+	*files = f;
+	f += *n;
+	memset(f, 0, sizeof(*f));
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &sb) < 0 || !S_ISREG(sb.st_mode) ||
+			!(f->name = strdup(name)) ||
+			!(f->data = malloc(sb.st_size + 1)) ||
+			!read_all(fd, f->data, sb.st_size)) {
+		SYSERROR("Failed to read %s", path);
+		if (fd >= 0)
+			close(fd);
+		free(f->name);
+		free(f->data);
+		return false;
+	}
+	close(fd);
+	f->len = sb.st_size;
+	f->mode = sb.st_mode & 07777;
+	(*n)++;
+	return true;
+}
+
+/*
+ * Collect the files in the snapshot's directory @dir which @conf refers
+ * to, its fstab and hook scripts, like clone copies them.
+ */
+static bool stream_own_files(struct lxc_conf *conf, const char *dir,
+		struct stream_file **files, int *n)
+{
+	int i;
+	size_t j;
+
+	if (!stream_add_file(files, n, dir, conf->fstab))
+		return false;
+	for (i = 0; i < NUM_LXC_HOOKS; i++)
+		for (j = 0; j < lxc_strlist_len(conf->hooks[i]); j++)
+			if (!stream_add_file(files, n, dir, conf->hooks[i]->items[j]))
+				return false;
+	return true;
+}
+
+/*
+ * Stream snapshot @snapname of @c to @fd.  If @parent is given, only send
+ * what changed since that snapshot.
+ */
+static bool lxcapi_snapshot_export(struct lxc_container *c, const char *snapname,
+		const char *parent, int fd, int flags)
+{
+	char clonelxcpath[MAXPATHLEN], header[STREAM_MAX_HEADER];
+	char snapdir[MAXPATHLEN], filelines[STREAM_MAX_HEADER];
+	struct lxc_container *snap = NULL, *psnap = NULL;
+	struct stream_file *files = NULL;
+	int i, nfiles = 0;
+	size_t flen = 0;
+	struct snap_stream s = { .fd = fd, .hash = FNV1A_64_INIT };
+	char *config = NULL, *buf = NULL;
+	const char *comp = stream_compression(flags);
+	struct bdev *bdev;
+	unsigned char lenbuf[8];
+	struct stat sb;
+	bool bret = false;
+	ssize_t nread;
+	uint32_t len;
+	int ret, p[2] = { -1, -1 };
+	pid_t pid = -1;
+	FILE *f;
+
+	if (!c || !snapname || !c->name || !c->config_path)
+		return false;
+
+	ret = snprintf(clonelxcpath, MAXPATHLEN, "%ssnaps/%s", c->config_path, c->name);
+	if (ret < 0 || ret >= MAXPATHLEN)
+		return false;
+
+	snap = lxc_container_new(snapname, clonelxcpath);
+	if (!snap || !lxcapi_is_defined(snap) || !snap->lxc_conf ||
+			!snap->lxc_conf->rootfs.path) {
+		ERROR("Could not open snapshot %s", snapname);
+		goto out;
+	}
+	if (parent) {
+		psnap = lxc_container_new(parent, clonelxcpath);
+		if (!psnap || !lxcapi_is_defined(psnap) || !psnap->lxc_conf ||
+				!psnap->lxc_conf->rootfs.path) {
+			ERROR("Could not open snapshot %s", parent);
+			goto out;
+		}
+	}
+
+	if (stat(snap->configfile, &sb) < 0 || !(config = malloc(sb.st_size + 1)) ||
+			!(f = fopen(snap->configfile, "r"))) {
+		SYSERROR("Failed to read %s", snap->configfile);
+		goto out;
+	}
+	ret = fread(config, 1, sb.st_size, f) == (size_t)sb.st_size;
+	fclose(f);
+	if (!ret) {
+		SYSERROR("Failed to read %s", snap->configfile);
+		goto out;
+	}
+
+	ret = snprintf(snapdir, MAXPATHLEN, "%s/%s", clonelxcpath, snapname);
+	if (ret < 0 || ret >= MAXPATHLEN)
+		goto out;
+	if (!stream_own_files(snap->lxc_conf, snapdir, &files, &nfiles))
+		goto out;
+	filelines[0] = '\0';
+	for (i = 0; i < nfiles; i++) {
+		ret = snprintf(filelines + flen, sizeof(filelines) - flen,
+				"file %zu %o %s\n", files[i].len,
+				(unsigned int)files[i].mode, files[i].name);
+		if (ret < 0 || ret >= sizeof(filelines) - flen)
+			goto out;
+		flen += ret;
+	}
+
+	if (!(bdev = bdev_init(snap->lxc_conf->rootfs.path, NULL, NULL))) {
+		ERROR("Failed to find backing store type of %s", snapname);
+		goto out;
+	}
+	ret = snprintf(header, STREAM_MAX_HEADER, "%s\nname %s\nbdev %s\n"
+			"compression %s\n%s%s%sdir %s\n%sconfig %lld\n\n",
+			STREAM_MAGIC, snapname, bdev->type, comp,
+			parent ? "parent " : "", parent ? parent : "",
+			parent ? "\n" : "", snapdir, filelines,
+			(long long)sb.st_size);
+	bdev_put(bdev);
+	if (ret < 0 || ret >= STREAM_MAX_HEADER)
+		goto out;
+
+	if (!stream_write(&s, header, strlen(header)) ||
+			!stream_write(&s, config, sb.st_size))
+		goto out_write;
+	for (i = 0; i < nfiles; i++)
+		if (!stream_write(&s, files[i].data, files[i].len))
+			goto out_write;
+
+	if (pipe2(p, O_CLOEXEC) < 0 || !(buf = malloc(STREAM_CHUNK + 4)))
+		goto out;
+	pid = fork();
+	if (pid < 0)
+		goto out;
+	if (pid == 0) {
+		// its own process group, so tar and the compressor die with it
+		setpgid(0, 0);
+		close(p[0]);
+		if (dup2(p[1], 1) < 0)
+			exit(1);
+		snapshot_export_child(snap, psnap, comp);
+	}
+	setpgid(pid, pid);
+	close(p[1]);
+	p[1] = -1;
+
+	while ((nread = lxc_read_nointr(p[0], buf + 4, STREAM_CHUNK)) > 0) {
+		len = htonl(nread);
+		memcpy(buf, &len, 4);
+		if (!stream_write(&s, buf, nread + 4))
+			goto out_write;
+	}
+	ret = wait_for_pid(pid);
+	if (nread < 0 || ret < 0) {
+		ERROR("Failed to archive snapshot %s", snapname);
+		goto out;
+	}
+	pid = -1;
+
+	// the terminator is only sent once everything else went well
+	len = 0;
+	if (!stream_write(&s, &len, 4))
+		goto out_write;
+	put_be64(lenbuf, s.hash);
+	if (!write_all(fd, lenbuf, 8))
+		goto out_write;
+	bret = true;
+	goto out;
+
+out_write:
+	SYSERROR("Error writing snapshot stream");
+out:
+	if (p[0] >= 0)
+		close(p[0]);
+	if (p[1] >= 0)
+		close(p[1]);
+	if (pid > 0)
+		stream_kill(pid);
+	free(buf);
+	free(config);
+	stream_free_files(files, nfiles);
+	if (psnap)
+		lxc_container_put(psnap);
+	if (snap)
+		lxc_container_put(snap);
+	return bret;
+}
+
+/*
+ * Remove @rel below the directory @dfd without following symlinks on
+ * the way, so an entry can't point us outside of the rootfs.
+ */
+static int stream_remove(int dfd, char *rel)
+{
+	char *p, *next, path[MAXPATHLEN];
+	struct stat sb;
+	int fd, ret;
+
+	if (*rel == '/')
+		return -1;
+	dfd = dup(dfd);
+	for (p = rel; (next = strchr(p, '/')) != NULL; p = next + 1) {
+		*next = '\0';
+		if (strcmp(p, "..") == 0)
+			goto err;
+		fd = openat(dfd, p, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+		*next = '/';
+		close(dfd);
+		if (fd < 0)
+			return errno == ENOENT ? 0 : -1;
+		dfd = fd;
+	}
+	if (strcmp(p, "..") == 0 || strcmp(p, ".") == 0)
+		goto err;
+	if (fstatat(dfd, p, &sb, AT_SYMLINK_NOFOLLOW) < 0) {
+		ret = errno == ENOENT ? 0 : -1;
+		close(dfd);
+		return ret;
+	}
+	if (S_ISDIR(sb.st_mode)) {
+		ret = snprintf(path, MAXPATHLEN, "/proc/self/fd/%d/%s", dfd, p);
+		if (ret < 0 || ret >= MAXPATHLEN)
+			goto err;
+		ret = lxc_rmdir_onedev(path);
+	} else
+		ret = unlinkat(dfd, p, 0);
+	close(dfd);
+	return ret;
+
+err:
+	close(dfd);
+	return -1;
+}
+
+/*
+ * Forked child of lxc_snapshot_import(): reads the payload on stdin and
+ * applies it to @c's rootfs.
+ */
+static void snapshot_import_child(struct lxc_container *c, const char *comp)
+{
+	char *tarargs[] = { "tar", "--numeric-owner", "--xattrs",
+		"--xattrs-include=*", "-xpf", "-", "-C", NULL, NULL };
+	unsigned char lenbuf[8];
+	char *root, *deleted, *p;
+	uint64_t dlen;
+	int dfd;
+
+	if (!stream_private_mounts())
+		exit(1);
+	if (!(root = stream_mount_rootfs(c)))
+		exit(1);
+	tarargs[7] = root;
+
+	if (!read_all(0, lenbuf, 8))
+		exit(1);
+	dlen = get_be64(lenbuf);
+	if (dlen) {
+		if (dlen > SIZE_MAX - 1 || !(deleted = malloc(dlen + 1)) ||
+				!read_all(0, deleted, dlen))
+			exit(1);
+		deleted[dlen] = '\0';
+		if ((dfd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+			exit(1);
+		for (p = deleted; p < deleted + dlen; p += strlen(p) + 1) {
+			if (stream_remove(dfd, p) < 0) {
+				ERROR("Failed to remove %s from %s", p, root);
+				exit(1);
+			}
+		}
+		close(dfd);
+		free(deleted);
+	}
+
+	stream_run_tar(tarargs, comp, false);
+}
+
+/* like write_all(), but a dead reader gets us EPIPE rather than SIGPIPE */
+static bool stream_send(int fd, const char *buf, size_t len)
+{
+	ssize_t ret;
+
+	while (len > 0) {
+		ret = send(fd, buf, len, MSG_NOSIGNAL);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return false;
+		buf += ret;
+		len -= ret;
+	}
+	return true;
+}
+
+/* read the stream header into @buf, up to and including the empty line */
+static bool stream_read_header(struct snap_stream *s, char *buf, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size - 1; i++) {
+		if (!stream_read(s, buf + i, 1))
+			return false;
+		if (buf[i] == '\n' && i > 0 && buf[i-1] == '\n') {
+			buf[i+1] = '\0';
+			return true;
+		}
+	}
+	return false;
+}
+
+static char *stream_header_value(char *header, const char *key)
+{
+	size_t len = strlen(key);
+	char *p, *end;
+
+	for (p = header; (end = strchr(p, '\n')) != NULL; p = end + 1) {
+		if (strncmp(p, key, len) == 0 && p[len] == ' ')
+			return strndup(p + len + 1, end - p - len - 1);
+	}
+	return NULL;
+}
+
+/*
+ * Parse the file lines of @header into @files, their contents still to be
+ * read.  The names are kept to plain files in the container directory.
+ */
+static bool stream_header_files(char *header, struct stream_file **files,
+		int *n)
+{
+	struct stream_file *f;
+	unsigned long long len;
+	unsigned int mode;
+	char *p, *end, *name;
+	int off;
+
+	for (p = header; (end = strchr(p, '\n')) != NULL; p = end + 1) {
+		if (strncmp(p, "file ", 5) != 0)
+			continue;
+		if (sscanf(p + 5, "%llu %o %n", &len, &mode, &off) != 2 ||
+				len >= SIZE_MAX)
+			return false;
+		name = p + 5 + off;
+		if (name == end || name[0] == '.' ||
+				memchr(name, '/', end - name) ||
+				(end - name == 6 && strncmp(name, "config", 6) == 0))
+			return false;
+
+		f = realloc(*files, (*n + 1) * sizeof(**files));
+		if (!f)
+			return false;
+		*files = f;
+		f += *n;
+		memset(f, 0, sizeof(*f));
+		if (!(f->name = strndup(name, end - name)))
+			return false;
+		f->len = len;
+		f->mode = mode & 07777;
+		(*n)++;
+	}
+	return true;
+}
+
+/* write @f into @c's container directory */
+static bool stream_write_file(struct lxc_container *c,
+		const struct stream_file *f)
+{
+	char path[MAXPATHLEN];
+	int ret;
+
+	ret = snprintf(path, MAXPATHLEN, "%s/%s/%s", c->config_path, c->name,
+			f->name);
+	if (ret < 0 || ret >= MAXPATHLEN)
+		return false;
+	if (lxc_write_to_file(path, f->data, f->len, false) < 0 ||
+			chmod(path, f->mode) < 0) {
+		SYSERROR("Failed to write %s", path);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * @path, which is in the sender's snapshot directory @olddir, moved into
+ * @c's own directory.  If @files is given, it must be one of those.
+ */
+static char *stream_relocate(struct lxc_container *c, const char *olddir,
+		const char *path, const struct stream_file *files, int n)
+{
+	const char *name = path + strlen(olddir) + 1;
+	char newpath[MAXPATHLEN];
+	int i, ret;
+
+	for (i = 0; files && i < n; i++)
+		if (strcmp(files[i].name, name) == 0)
+			break;
+	if (files && i == n) {
+		ERROR("%s was not sent along with the snapshot", path);
+		return NULL;
+	}
+	ret = snprintf(newpath, MAXPATHLEN, "%s/%s/%s", c->config_path, c->name,
+			name);
+	if (ret < 0 || ret >= MAXPATHLEN)
+		return NULL;
+	return strdup(newpath);
+}
+
+/*
+ * Point the fstab, hooks and logfile of @c's config which were in the
+ * sender's snapshot directory @olddir at @c's own directory, like clone
+ * does for a copy.
+ */
+static bool stream_relocate_paths(struct lxc_container *c, const char *olddir,
+		const struct stream_file *files, int n)
+{
+	struct lxc_conf *conf = c->lxc_conf;
+	struct lxc_strlist *hooks;
+	char *path;
+	size_t j;
+	int i;
+
+	if (stream_in_dir(conf->fstab, olddir)) {
+		if (!(path = stream_relocate(c, olddir, conf->fstab, files, n)))
+			return false;
+		free(conf->fstab);
+		conf->fstab = path;
+	}
+	if (stream_in_dir(conf->logfile, olddir)) {
+		if (!(path = stream_relocate(c, olddir, conf->logfile, NULL, 0)))
+			return false;
+		free(conf->logfile);
+		conf->logfile = path;
+	}
+	for (i = 0; i < NUM_LXC_HOOKS; i++) {
+		for (j = 0; j < lxc_strlist_len(conf->hooks[i]); j++) {
+			if (!stream_in_dir(conf->hooks[i]->items[j], olddir))
+				continue;
+			path = stream_relocate(c, olddir, conf->hooks[i]->items[j],
+					files, n);
+			if (!path)
+				return false;
+			/* the list may be shared: this makes our own copy */
+			hooks = lxc_strlist_set(conf->hooks[i], j, path);
+			free(path);
+			if (!hooks) {
+				ERROR("out of memory relocating hook path");
+				return false;
+			}
+			conf->hooks[i] = hooks;
+		}
+	}
+	return true;
+}
+
+/*
+ * Re-read @c's config from the stream's @config, keeping the rootfs path
+ * of the storage we set up for it, and moving the paths into the sender's
+ * snapshot directory @olddir over to the @n @files written into @c's.
+ */
+static bool stream_set_config(struct lxc_container *c, const char *config,
+		size_t len, const char *olddir, const struct stream_file *files,
+		int n)
+{
+	char *rootfs;
+	bool bret = false;
+
+	if (!c->lxc_conf || !c->lxc_conf->rootfs.path)
+		return false;
+	rootfs = strdup(c->lxc_conf->rootfs.path);
+	if (!rootfs)
+		return false;
+	if (lxc_write_to_file(c->configfile, config, len, false) < 0)
+		goto out;
+	lxcapi_clear_config(c);
+	if (!lxcapi_load_config(c, NULL))
+		goto out;
+	if (!lxcapi_set_config_item(c, "lxc.rootfs", rootfs) ||
+			!lxcapi_set_config_item(c, "lxc.utsname", c->name))
+		goto out;
+	if (olddir && !stream_relocate_paths(c, olddir, files, n))
+		goto out;
+	bret = lxcapi_save_config(c, NULL);
+out:
+	free(rootfs);
+	return bret;
+}
+
+struct lxc_container *lxc_snapshot_import(int fd, const char *name,
+		const char *lxcpath, const char *base)
+{
+	char header[STREAM_MAX_HEADER];
+	struct snap_stream s = { .fd = fd, .hash = FNV1A_64_INIT };
+	struct lxc_container *c = NULL, *b = NULL;
+	char *parent = NULL, *comp = NULL, *clen = NULL, *config = NULL;
+	char *buf = NULL, *olddir = NULL;
+	struct stream_file *files = NULL;
+	int i, nfiles = 0;
+	unsigned char hashbuf[8];
+	struct bdev *bdev;
+	bool ok = false;
+	size_t len;
+	uint32_t chunk;
+	int sv[2] = { -1, -1 };
+	pid_t pid = -1;
+
+	if (!name)
+		return NULL;
+	if (!lxcpath)
+		lxcpath = default_lxc_path();
+
+	if (!stream_read_header(&s, header, STREAM_MAX_HEADER) ||
+			strncmp(header, STREAM_MAGIC "\n", strlen(STREAM_MAGIC) + 1) != 0) {
+		ERROR("Not a snapshot stream");
+		return NULL;
+	}
+	parent = stream_header_value(header, "parent");
+	comp = stream_header_value(header, "compression");
+	clen = stream_header_value(header, "config");
+	olddir = stream_header_value(header, "dir");
+	if (!comp || !clen || (strcmp(comp, "none") && strcmp(comp, "gzip") &&
+			strcmp(comp, "zstd") && strcmp(comp, "lz4")) ||
+			!stream_header_files(header, &files, &nfiles)) {
+		ERROR("Bad snapshot stream header");
+		goto out;
+	}
+	len = strtoul(clen, NULL, 10);
+	if (!(config = malloc(len)) || !stream_read(&s, config, len)) {
+		ERROR("Error reading snapshot stream");
+		goto out;
+	}
+	for (i = 0; i < nfiles; i++) {
+		if (!(files[i].data = malloc(files[i].len + 1)) ||
+				!stream_read(&s, files[i].data, files[i].len)) {
+			ERROR("Error reading snapshot stream");
+			goto out;
+		}
+	}
+
+	if (parent) {
+		// an incremental stream applies on top of a copy of its base
+		if (!base) {
+			ERROR("Incremental stream against %s needs a base container", parent);
+			goto out;
+		}
+		b = lxc_container_new(base, lxcpath);
+		if (!b || !lxcapi_is_defined(b)) {
+			ERROR("Base container %s not found", base);
+			goto out;
+		}
+		c = b->clone(b, name, lxcpath, LXC_CLONE_KEEPNAME | LXC_CLONE_KEEPMACADDR,
+				NULL, NULL, 0, NULL);
+		if (!c) {
+			ERROR("Error copying base container %s", base);
+			goto out;
+		}
+	} else {
+		c = lxc_container_new(name, lxcpath);
+		if (!c)
+			goto out;
+		if (lxcapi_is_defined(c)) {
+			ERROR("Container %s already exists", name);
+			lxc_container_put(c);
+			c = NULL;
+			goto out;
+		}
+		if (!create_container_dir(c) ||
+				lxc_write_to_file(c->configfile, config, len, false) < 0 ||
+				!lxcapi_load_config(c, NULL))
+			goto out;
+		// storage of our own, not wherever the sender kept it
+		free(c->lxc_conf->rootfs.path);
+		c->lxc_conf->rootfs.path = NULL;
+		if (!(bdev = do_bdev_create(c, "dir", NULL)))
+			goto out;
+		bdev_put(bdev);
+	}
+	for (i = 0; i < nfiles; i++)
+		if (!stream_write_file(c, &files[i]))
+			goto out;
+	if (!stream_set_config(c, config, len, olddir, files, nfiles))
+		goto out;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0 ||
+			!(buf = malloc(STREAM_CHUNK)))
+		goto out;
+	pid = fork();
+	if (pid < 0)
+		goto out;
+	if (pid == 0) {
+		setpgid(0, 0);
+		close(sv[0]);
+		if (dup2(sv[1], 0) < 0)
+			exit(1);
+		snapshot_import_child(c, comp);
+	}
+	setpgid(pid, pid);
+	close(sv[1]);
+	sv[1] = -1;
+
+	for (;;) {
+		if (!stream_read(&s, &chunk, 4)) {
+			ERROR("Snapshot stream ended early");
+			goto out;
+		}
+		chunk = ntohl(chunk);
+		if (!chunk)
+			break;
+		while (chunk > 0) {
+			len = chunk > STREAM_CHUNK ? STREAM_CHUNK : chunk;
+			if (!stream_read(&s, buf, len)) {
+				ERROR("Snapshot stream ended early");
+				goto out;
+			}
+			if (!stream_send(sv[0], buf, len))
+				goto out;
+			chunk -= len;
+		}
+	}
+	/*
+	 * Check the stream before tar sees the end of its input: on a
+	 * mismatch it is killed mid-archive, and the container removed.
+	 */
+	if (!read_all(fd, hashbuf, 8) || get_be64(hashbuf) != s.hash) {
+		ERROR("Snapshot stream checksum mismatch");
+		goto out;
+	}
+	close(sv[0]);
+	sv[0] = -1;
+	ok = wait_for_pid(pid) == 0;
+	if (!ok)
+		ERROR("Error unpacking snapshot stream into %s", name);
+	else
+		pid = -1;
+
+out:
+	if (sv[0] >= 0)
+		close(sv[0]);
+	if (sv[1] >= 0)
+		close(sv[1]);
+	if (pid > 0)
+		stream_kill(pid);
+	if (!ok && c) {
+		// nothing of a failed import is left behind
+		if (lxcapi_is_defined(c) && !lxcapi_destroy(c))
+			ERROR("Failed to remove partially imported container %s", name);
+		lxc_container_put(c);
+		c = NULL;
+	}
+	if (b)
+		lxc_container_put(b);
+	free(buf);
+	free(config);
+	free(clen);
+	free(comp);
+	free(parent);
+	free(olddir);
+	stream_free_files(files, nfiles);
+	return c;
+}
+
+static bool lxcapi_may_control(struct lxc_container *c)
+{
+	return lxc_try_cmd(c->name, c->config_path) == 0;
 }
 
 static bool add_remove_device_node(struct lxc_container *c, const char *src_path, const char *dest_path, bool add)
@@ -3087,6 +4667,9 @@ struct lxc_container *lxc_container_new(const char *name, const char *configpath
 	c->wait = lxcapi_wait;
 	c->set_config_item = lxcapi_set_config_item;
 	c->destroy = lxcapi_destroy;
+	c->destroy_async = lxcapi_destroy_async;
+	c->resize_rootfs = lxcapi_resize_rootfs;
+	c->start_from_zygote = lxcapi_start_from_zygote;
 	c->rename = lxcapi_rename;
 	c->save_config = lxcapi_save_config;
 	c->get_keys = lxcapi_get_keys;
@@ -3111,6 +4694,7 @@ struct lxc_container *lxc_container_new(const char *name, const char *configpath
 	c->snapshot_list = lxcapi_snapshot_list;
 	c->snapshot_restore = lxcapi_snapshot_restore;
 	c->snapshot_destroy = lxcapi_snapshot_destroy;
+	c->snapshot_export = lxcapi_snapshot_export;
 	c->may_control = lxcapi_may_control;
 	c->add_device_node = lxcapi_add_device_node;
 	c->remove_device_node = lxcapi_remove_device_node;
@@ -3418,3 +5002,233 @@ free_ct_name:
 	free(ct_name);
 	return ret;
 }
+
+struct batch_job {
+	struct lxc_container *c;
+	int idx;
+	int order;
+	int delay;
+	pid_t pid;
+	int fd;
+	struct timespec begin;
+};
+
+static int batch_cmp(const struct batch_job *j1, const struct batch_job *j2)
+{
+	if (j1->order != j2->order)
+		return j1->order < j2->order ? -1 : 1;
+	return strcmp(j1->c->name, j2->c->name);
+}
+
+static int batch_cmp_up(const void *p1, const void *p2)
+{
+	return batch_cmp(p1, p2);
+}
+
+static int batch_cmp_down(const void *p1, const void *p2)
+{
+	return batch_cmp(p2, p1);
+}
+
+static bool batch_act(struct lxc_container *c, enum lxc_batch_action action,
+		      int timeout)
+{
+	char *const default_args[] = {
+		"/sbin/init",
+		NULL,
+	};
+
+	switch (action) {
+	case LXC_BATCH_START:
+		c->want_daemonize(c, true);
+		return c->start(c, 0, default_args);
+	case LXC_BATCH_STOP:
+		return c->stop(c);
+	case LXC_BATCH_SHUTDOWN:
+		return c->shutdown(c, timeout);
+	case LXC_BATCH_REBOOT:
+		return c->reboot(c);
+	}
+	return false;
+}
+
+/*
+ * Run the action in a child, which reports the outcome through a pipe once
+ * the container is up or down.
+ */
+static int batch_spawn(struct batch_job *job, enum lxc_batch_action action,
+		       int timeout)
+{
+	int p[2];
+	char ok;
+
+	if (pipe2(p, O_CLOEXEC) < 0) {
+		SYSERROR("Failed to create a pipe for %s", job->c->name);
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &job->begin);
+	job->pid = fork();
+	if (job->pid < 0) {
+		SYSERROR("Failed to fork for %s", job->c->name);
+		close(p[0]);
+		close(p[1]);
+		return -1;
+	}
+
+	if (job->pid == 0) {
+		close(p[0]);
+		ok = batch_act(job->c, action, timeout);
+		if (lxc_write_nointr(p[1], &ok, 1) != 1)
+			_exit(EXIT_FAILURE);
+		_exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+
+	close(p[1]);
+	job->fd = p[0];
+	return 0;
+}
+
+/*
+ * Collect the outcome of a finished job, or return -1 if it is still
+ * busy.  A child which died without reporting counts as a failure.
+ */
+static int batch_reap(struct batch_job *job, bool readable,
+		      struct lxc_batch_result *result)
+{
+	struct timespec end;
+	char ok = 0;
+	int status;
+
+	if (readable) {
+		if (lxc_read_nointr(job->fd, &ok, 1) != 1)
+			ok = 0;
+		waitpid(job->pid, &status, 0);
+	} else if (waitpid(job->pid, &status, WNOHANG) != job->pid) {
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	close(job->fd);
+	job->fd = -1;
+
+	result->done = true;
+	result->success = ok;
+	result->seconds = (end.tv_sec - job->begin.tv_sec) +
+			  (end.tv_nsec - job->begin.tv_nsec) / 1e9;
+	INFO("%s %s after %.3fs", job->c->name,
+	     ok ? "succeeded" : "failed", result->seconds);
+	return ok ? 0 : 1;
+}
+
+int lxc_containers_batch(struct lxc_container **containers, int count,
+		enum lxc_batch_action action, int concurrency, int timeout,
+		struct lxc_batch_result *results)
+{
+	struct batch_job *jobs, **active;
+	struct lxc_batch_result *res;
+	struct pollfd *pfds;
+	bool start = action == LXC_BATCH_START;
+	int i, j, n = 0, nr_active, next, end, delay, failed = 0;
+
+	if (count < 0 || (count > 0 && !containers))
+		return -1;
+	if (concurrency < 1)
+		concurrency = 1;
+
+	res = results ? results : calloc(count ? count : 1, sizeof(*res));
+	jobs = malloc((count ? count : 1) * sizeof(*jobs));
+	active = malloc(concurrency * sizeof(*active));
+	pfds = malloc(concurrency * sizeof(*pfds));
+	if (!res || !jobs || !active || !pfds) {
+		ERROR("Out of memory");
+		failed = -1;
+		goto out;
+	}
+	memset(res, 0, count * sizeof(*res));
+
+	for (i = 0; i < count; i++) {
+		struct lxc_container *c = containers[i];
+
+		if (!c || !c->lxc_conf || c->is_running(c) == start)
+			continue;
+
+		jobs[n].c = c;
+		jobs[n].idx = i;
+		jobs[n].order = c->lxc_conf->start_order;
+		jobs[n].delay = c->lxc_conf->start_delay;
+		jobs[n].fd = -1;
+		n++;
+	}
+
+	qsort(jobs, n, sizeof(*jobs),
+	      start || action == LXC_BATCH_REBOOT ? batch_cmp_down : batch_cmp_up);
+
+	for (i = 0; i < n; i = end) {
+		end = i + 1;
+		if (concurrency > 1) {
+			while (end < n && jobs[end].order == jobs[i].order)
+				end++;
+		}
+
+		delay = 0;
+		nr_active = 0;
+		next = i;
+		while (next < end || nr_active) {
+			while (next < end && nr_active < concurrency) {
+				if (batch_spawn(&jobs[next], action, timeout) < 0) {
+					res[jobs[next].idx].done = true;
+					failed++;
+				} else {
+					active[nr_active++] = &jobs[next];
+				}
+				next++;
+			}
+			if (!nr_active)
+				break;
+
+			for (j = 0; j < nr_active; j++) {
+				pfds[j].fd = active[j]->fd;
+				pfds[j].events = POLLIN;
+				pfds[j].revents = 0;
+			}
+			/* the timeout only catches children dying unheard */
+			if (poll(pfds, nr_active, 100) < 0 && errno != EINTR) {
+				SYSERROR("Failed to poll");
+				break;
+			}
+
+			for (j = nr_active - 1; j >= 0; j--) {
+				struct batch_job *job = active[j];
+				int ret;
+
+				ret = batch_reap(job, pfds[j].revents != 0,
+						 &res[job->idx]);
+				if (ret < 0)
+					continue;
+				if (ret > 0)
+					failed++;
+				else if (job->delay > delay)
+					delay = job->delay;
+				active[j] = active[--nr_active];
+			}
+		}
+
+		/* wait out anything left over by a poll failure */
+		for (j = 0; j < nr_active; j++) {
+			if (batch_reap(active[j], true, &res[active[j]->idx]))
+				failed++;
+		}
+
+		if ((start || action == LXC_BATCH_REBOOT) && delay && end < n)
+			sleep(delay);
+	}
+
+out:
+	if (res != results)
+		free(res);
+	free(jobs);
+	free(active);
+	free(pfds);
+	return failed;
+}
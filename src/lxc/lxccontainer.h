@@ -37,7 +37,11 @@ extern "C" {
 #define LXC_CLONE_SNAPSHOT        (1 << 2) /*!< Snapshot the original filesystem(s) */
 #define LXC_CLONE_MAXFLAGS        (1 << 3) /*!< Number of \c LXC_CLONE_* flags */
 #define LXC_CREATE_QUIET          (1 << 0) /*!< Redirect \c stdin to \c /dev/zero and \c stdout and \c stderr to \c /dev/null */
-#define LXC_CREATE_MAXFLAGS       (1 << 1) /*!< Number of \c LXC_CREATE* flags */
+#define LXC_CREATE_CACHE          (1 << 1) /*!< Snapshot the rootfs from the image cache, populating it if needed */
+#define LXC_CREATE_MAXFLAGS       (1 << 2) /*!< Number of \c LXC_CREATE* flags */
+#define LXC_EXPORT_GZIP           (1 << 0) /*!< Compress exported snapshots with gzip */
+#define LXC_EXPORT_ZSTD           (1 << 1) /*!< Compress exported snapshots with zstd */
+#define LXC_EXPORT_LZ4            (1 << 2) /*!< Compress exported snapshots with lz4 */
 
 struct bdev_specs;
 
@@ -295,12 +299,17 @@ struct lxc_container {
 	 * \param bdevtype Backing store type to use (if \c NULL, \c dir will be used).
 	 * \param specs Additional parameters for the backing store (for
 	 *  example LVM volume group to use).
-	 * \param flags \c LXC_CREATE_* options (currently only \ref
-	 *  LXC_CREATE_QUIET is supported).
+	 * \param flags \c LXC_CREATE_* options (\ref LXC_CREATE_QUIET
+	 *  and \ref LXC_CREATE_CACHE).
 	 * \param argv Arguments to pass to the template, terminated by \c NULL (if no
 	 *  arguments are required, just pass \c NULL).
 	 *
 	 * \return \c true on success, else \c false.
+	 *
+	 * \note With \ref LXC_CREATE_CACHE, the template output is kept
+	 *  under \c ${lxcpath}cache, keyed by the template, its arguments,
+	 *  the backing store and the starting configuration, and the
+	 *  container's rootfs becomes a snapshot of that image.
 	 */
 	bool (*create)(struct lxc_container *c, const char *t, const char *bdevtype,
 			struct bdev_specs *specs, int flags, char *const argv[]);
@@ -315,8 +324,8 @@ struct lxc_container {
 	 * \param bdevtype Backing store type to use (if \c NULL, \c dir will be used).
 	 * \param specs Additional parameters for the backing store (for
 	 *  example LVM volume group to use).
-	 * \param flags \c LXC_CREATE_* options (currently only \ref
-	 *  LXC_CREATE_QUIET is supported).
+	 * \param flags \c LXC_CREATE_* options (\ref LXC_CREATE_QUIET
+	 *  and \ref LXC_CREATE_CACHE).
 	 * \param ... Command-line to pass to init (must end in \c NULL).
 	 *
 	 * \return \c true on success, else \c false.
@@ -719,6 +728,67 @@ struct lxc_container {
 	 * \return \c true on success, else \c false.
 	 */
 	bool (*remove_device_node)(struct lxc_container *c, const char *src_path, const char *dest_path);
+
+	/*!
+	 * \brief Delete the container, leaving the bulk of the work to
+	 *  a background process.
+	 *
+	 * \param c Container.
+	 *
+	 * \return \c true on success, else \c false.
+	 *
+	 * \note The container directory is moved into \c .lxc-trash in
+	 *  the lxcpath, and is deleted from there after this returns.
+	 *  Unprivileged containers are destroyed synchronously.
+	 */
+	bool (*destroy_async)(struct lxc_container *c);
+
+	/*!
+	 * \brief Grow the container's root filesystem.
+	 *
+	 * \param c Container.
+	 * \param size New size in bytes.
+	 *
+	 * \return \c true on success, else \c false.
+	 *
+	 * \note Only loop, lvm and zfs backing stores can be resized, and
+	 *  they can not be shrunk.  A running container's ext4 rootfs
+	 *  is grown online.
+	 */
+	bool (*resize_rootfs)(struct lxc_container *c, unsigned long size);
+
+	/*!
+	 * \brief Release a container parked by \c lxc-start \c --zygote.
+	 *
+	 * The parked container already has its namespaces, rootfs and
+	 * network set up and only has to exec its init.
+	 *
+	 * \param c Container.
+	 * \param argv \c NULL-terminated list of arguments to exec as
+	 *  init, or \c NULL for the one the container was started with.
+	 *
+	 * \return \c true on success, else \c false.
+	 */
+	bool (*start_from_zygote)(struct lxc_container *c, char * const argv[]);
+
+	/*!
+	 * \brief Write the specified snapshot to a file descriptor.
+	 *
+	 * \param c Container.
+	 * \param snapname Name of snapshot.
+	 * \param parent Name of an older snapshot to send only the changes
+	 *  against, or \c NULL to send the whole snapshot.
+	 * \param fd File descriptor to write the stream to.
+	 * \param flags At most one of the \c LXC_EXPORT_* compression flags.
+	 *
+	 * \return \c true on success, else \c false.
+	 *
+	 * \note The stream holds the snapshot's configuration and a tar
+	 *  archive of its root filesystem, and is read back by
+	 *  \ref lxc_snapshot_import().
+	 */
+	bool (*snapshot_export)(struct lxc_container *c, const char *snapname,
+			const char *parent, int fd, int flags);
 };
 
 /*!
@@ -747,6 +817,23 @@ struct lxc_snapshot {
  */
 struct lxc_container *lxc_container_new(const char *name, const char *configpath);
 
+/*!
+ * \brief Create a new container from a snapshot stream.
+ *
+ * \param fd File descriptor to read the stream from, as written by
+ *  \c snapshot_export().
+ * \param name Name for the new container.
+ * \param lxcpath Configuration path for the new container (or \c NULL
+ *  for the default).
+ * \param base For an incremental stream, the name of a container in
+ *  \p lxcpath holding the parent snapshot, which is copied and then
+ *  updated.  Ignored for full streams.
+ *
+ * \return Newly-allocated container, or \c NULL on error.
+ */
+struct lxc_container *lxc_snapshot_import(int fd, const char *name,
+		const char *lxcpath, const char *base);
+
 /*!
  * \brief Add a reference to the specified container.
  *
@@ -830,6 +917,18 @@ const char *lxc_get_default_zfs_root(void);
  */
 const char *lxc_get_version(void);
 
+/*!
+ * \brief Remove unused images from the image cache of a lxcpath.
+ *
+ * \param lxcpath lxcpath whose image cache to collect (if \c NULL,
+ *  the default lxcpath is used).
+ *
+ * \return Number of images removed, or \c -1 on error.
+ *
+ * \note Images which still have containers cloned from them are kept.
+ */
+int lxc_image_cache_gc(const char *lxcpath);
+
 /*!
  * \brief Get a list of defined containers in a lxcpath.
  *
@@ -843,6 +942,28 @@ const char *lxc_get_version(void);
  */
 int list_defined_containers(const char *lxcpath, char ***names, struct lxc_container ***cret);
 
+/*!
+ * \brief Read a few keys from a container configuration file without
+ *  loading it.
+ *
+ * \param path Path of the configuration file.
+ * \param keys Keys to look for, e.g. \c "lxc.start.auto".
+ * \param[out] values Caller-allocated array of \p count entries.
+ * \param count Number of entries in \p keys and \p values.
+ *
+ * \return \c 0 on success, or \c -1 if the file or a file it includes
+ *  could not be read or has a malformed line.
+ *
+ * \note Only the lines are scanned: no key is validated and nothing is
+ *  set up, which makes this much cheaper than \ref lxc_container_new when
+ *  only a key or two are wanted, as with \ref list_defined_containers
+ *  called with \c names only.
+ * \note \c values[i] is \c NULL if \c keys[i] is not set, else every
+ *  value assigned to it, in order and separated by newlines.  An empty
+ *  assignment drops the values before it.  Each must be freed by the caller.
+ */
+int lxc_config_peek(const char *path, const char **keys, char **values, int count);
+
 /*!
  * \brief Get a list of active containers for a given lxcpath.
  *
@@ -875,6 +996,52 @@ int list_active_containers(const char *lxcpath, char ***names, struct lxc_contai
  */
 int list_all_containers(const char *lxcpath, char ***names, struct lxc_container ***cret);
 
+/*!
+ * \brief Action for \ref lxc_containers_batch() to perform.
+ */
+enum lxc_batch_action {
+	LXC_BATCH_START,    /*!< Start daemonized, running \c /sbin/init */
+	LXC_BATCH_STOP,     /*!< Kill, see \ref stop */
+	LXC_BATCH_SHUTDOWN, /*!< Request a clean shutdown, see \ref shutdown */
+	LXC_BATCH_REBOOT,   /*!< Request a reboot, see \ref reboot */
+};
+
+/*!
+ * \brief Outcome for one container of \ref lxc_containers_batch().
+ */
+struct lxc_batch_result {
+	bool done;      /*!< Whether the action was needed at all */
+	bool success;   /*!< Whether it succeeded */
+	double seconds; /*!< How long it took, until running or stopped */
+};
+
+/*!
+ * \brief Start, stop, shut down or reboot several containers at once.
+ *
+ * Containers are taken in waves of equal \c lxc.start.order, the highest
+ * first when starting or rebooting and the lowest first otherwise.  Up to
+ * \p concurrency containers of a wave are acted on at the same time, each
+ * finishing when the container is running (or stopped) rather than after a
+ * fixed time.  Before the next wave, the longest \c lxc.start.delay of the
+ * containers started in this one is waited.  With a \p concurrency of 1
+ * each container is a wave of its own, so that its delay follows it.
+ *
+ * Containers already in the desired state are skipped.
+ *
+ * \param containers Containers to act on.
+ * \param count Number of containers.
+ * \param action What to do with each of them.
+ * \param concurrency Maximum number of actions in flight, at least 1.
+ * \param timeout Timeout for \ref shutdown.
+ * \param[out] results If not \c NULL, array of \p count results, in
+ *  the order of \p containers.
+ *
+ * \return Number of containers the action failed for, or \c -1 on error.
+ */
+int lxc_containers_batch(struct lxc_container **containers, int count,
+		enum lxc_batch_action action, int concurrency, int timeout,
+		struct lxc_batch_result *results);
+
 #ifdef  __cplusplus
 }
 #endif
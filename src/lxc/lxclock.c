@@ -25,6 +25,8 @@
 #include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <string.h>
+#include <time.h>
 #include <stdlib.h>
 #include <pthread.h>
 #include <lxc/utils.h>
@@ -40,6 +42,13 @@
 #define SEMVALUE 1
 #define SEMVALUE_LOCKED 0
 
+#ifndef F_OFD_SETLK
+#define F_OFD_SETLK 37
+#endif
+#ifndef F_OFD_SETLKW
+#define F_OFD_SETLKW 38
+#endif
+
 lxc_log_define(lxc_lock, lxc);
 
 #ifdef MUTEX_DEBUGGING
@@ -168,8 +177,12 @@ struct lxc_lock *lxc_newlock(const char *lxcpath, const char *name)
 	}
 
 	l->type = LXC_LOCK_FLOCK;
-	l->u.f.fname = lxclock_name(lxcpath, name);
-	if (!l->u.f.fname) {
+	l->u.f.fname = NULL;
+	l->u.f.lxcpath = strdup(lxcpath);
+	l->u.f.name = strdup(name);
+	if (!l->u.f.lxcpath || !l->u.f.name) {
+		free(l->u.f.lxcpath);
+		free(l->u.f.name);
 		free(l);
 		l = NULL;
 		goto out;
@@ -180,10 +193,70 @@ out:
 	return l;
 }
 
-int lxclock(struct lxc_lock *l, int timeout)
+/*
+ * Open file description locks belong to the fd rather than the process, so
+ * two struct lxc_container for the same container exclude each other even
+ * within one process, and closing some other fd on the file doesn't drop
+ * them.  Kernels before 3.15 don't know them; fall back to process locks.
+ */
+static int ofd_unsupported;
+
+static int flock_setlk(int fd, short type, bool wait)
 {
-	int ret = -1, saved_errno = errno;
 	struct flock lk;
+	int ret;
+
+	memset(&lk, 0, sizeof(lk));
+	lk.l_type = type;
+	lk.l_whence = SEEK_SET;
+	lk.l_start = 0;
+	lk.l_len = 0;
+
+	if (!__atomic_load_n(&ofd_unsupported, __ATOMIC_RELAXED)) {
+		ret = fcntl(fd, wait ? F_OFD_SETLKW : F_OFD_SETLK, &lk);
+		if (ret == 0 || errno != EINVAL)
+			return ret;
+		__atomic_store_n(&ofd_unsupported, 1, __ATOMIC_RELAXED);
+	}
+	return fcntl(fd, wait ? F_SETLKW : F_SETLK, &lk);
+}
+
+/*
+ * Wait for a file lock for at most timeout seconds without a blocking
+ * fcntl, so that no signal or timer is needed to interrupt it: retry
+ * the non-blocking call, backing off from 1ms to 100ms.
+ */
+static int flock_setlk_timed(int fd, short type, int timeout)
+{
+	struct timespec now, deadline, nap = { 0, 1000000 };
+
+	if (clock_gettime(CLOCK_MONOTONIC, &deadline) < 0)
+		return -2;
+	deadline.tv_sec += timeout;
+
+	for (;;) {
+		if (flock_setlk(fd, type, false) == 0)
+			return 0;
+		if (errno != EAGAIN && errno != EACCES)
+			return -1;
+
+		if (clock_gettime(CLOCK_MONOTONIC, &now) < 0)
+			return -2;
+		if (now.tv_sec > deadline.tv_sec ||
+		    (now.tv_sec == deadline.tv_sec && now.tv_nsec >= deadline.tv_nsec)) {
+			errno = ETIMEDOUT;
+			return -1;
+		}
+
+		nanosleep(&nap, NULL);
+		if (nap.tv_nsec < 100000000)
+			nap.tv_nsec *= 2;
+	}
+}
+
+static int do_lxclock(struct lxc_lock *l, int timeout, short type)
+{
+	int ret = -1, saved_errno = errno;
 
 	switch(l->type) {
 	case LXC_LOCK_ANON_SEM:
@@ -205,29 +278,29 @@ int lxclock(struct lxc_lock *l, int timeout)
 		break;
 	case LXC_LOCK_FLOCK:
 		ret = -2;
-		if (timeout) {
-			ERROR("Error: timeout not supported with flock");
-			ret = -2;
-			goto out;
-		}
 		if (!l->u.f.fname) {
-			ERROR("Error: filename not set for flock");
-			ret = -2;
-			goto out;
+			char *fname = lxclock_name(l->u.f.lxcpath, l->u.f.name);
+			if (!fname) {
+				ERROR("Error: filename not set for flock");
+				ret = -2;
+				goto out;
+			}
+			/* another thread may have got here first */
+			if (!__sync_bool_compare_and_swap(&l->u.f.fname, NULL, fname))
+				free(fname);
 		}
 		if (l->u.f.fd == -1) {
-			l->u.f.fd = open(l->u.f.fname, O_RDWR|O_CREAT,
+			l->u.f.fd = open(l->u.f.fname, O_RDWR|O_CREAT|O_CLOEXEC,
 					S_IWUSR | S_IRUSR);
 			if (l->u.f.fd == -1) {
 				ERROR("Error opening %s", l->u.f.fname);
 				goto out;
 			}
 		}
-		lk.l_type = F_WRLCK;
-		lk.l_whence = SEEK_SET;
-		lk.l_start = 0;
-		lk.l_len = 0;
-		ret = fcntl(l->u.f.fd, F_SETLKW, &lk);
+		if (!timeout)
+			ret = flock_setlk(l->u.f.fd, type, true);
+		else
+			ret = flock_setlk_timed(l->u.f.fd, type, timeout);
 		if (ret == -1)
 			saved_errno = errno;
 		break;
@@ -238,10 +311,19 @@ out:
 	return ret;
 }
 
+int lxclock(struct lxc_lock *l, int timeout)
+{
+	return do_lxclock(l, timeout, F_WRLCK);
+}
+
+int lxclock_shared(struct lxc_lock *l, int timeout)
+{
+	return do_lxclock(l, timeout, F_RDLCK);
+}
+
 int lxcunlock(struct lxc_lock *l)
 {
 	int ret = 0, saved_errno = errno;
-	struct flock lk;
 
 	switch(l->type) {
 	case LXC_LOCK_ANON_SEM:
@@ -254,11 +336,7 @@ int lxcunlock(struct lxc_lock *l)
 		break;
 	case LXC_LOCK_FLOCK:
 		if (l->u.f.fd != -1) {
-			lk.l_type = F_UNLCK;
-			lk.l_whence = SEEK_SET;
-			lk.l_start = 0;
-			lk.l_len = 0;
-			ret = fcntl(l->u.f.fd, F_SETLK, &lk);
+			ret = flock_setlk(l->u.f.fd, F_UNLCK, false);
 			if (ret < 0)
 				saved_errno = errno;
 			close(l->u.f.fd);
@@ -300,6 +378,8 @@ void lxc_putlock(struct lxc_lock *l)
 			free(l->u.f.fname);
 			l->u.f.fname = NULL;
 		}
+		free(l->u.f.lxcpath);
+		free(l->u.f.name);
 		break;
 	}
 	free(l);
@@ -349,6 +429,19 @@ int container_disk_lock(struct lxc_container *c)
 	return 0;
 }
 
+int container_disk_lock_shared(struct lxc_container *c)
+{
+	int ret;
+
+	if ((ret = lxclock(c->privlock, 0)))
+		return ret;
+	if ((ret = lxclock_shared(c->slock, 0))) {
+		lxcunlock(c->privlock);
+		return ret;
+	}
+	return 0;
+}
+
 void container_disk_unlock(struct lxc_container *c)
 {
 	lxcunlock(c->slock);
@@ -45,7 +45,9 @@ struct lxc_lock {
 		/*! LXC_LOCK_FLOCK details */
 		struct {
 			int   fd; //!< fd on which a lock is held (if not -1)
-			char *fname; //!< Name of lock
+			char *fname; //!< Name of lock (set on first \ref lxclock())
+			char *lxcpath; //!< lxcpath the lock relates to
+			char *name; //!< Name the lock file is derived from
 		} f;
 	} u; //!< Container for lock type elements
 };
@@ -71,10 +73,11 @@ struct lxc_lock {
  * given) then a lockfile is created as \c $lxcpath/$lxcname/locks/$name.
  * The lock is used to protect the containers on-disk representation.
  *
- * \internal This function allocates the pathname for the given lock in memory
- * such that it can be can quickly opened and locked by \ref lxclock().
- * \c l->u.f.fname will contain the malloc'ed name (which must be
- * freed when the container is freed), and \c u.f.fd = -1.
+ * \internal This function only remembers \p lxcpath and \p name; the
+ * lock directory is created and \c l->u.f.fname is set the first time
+ * \ref lxclock() is called, so that containers which are never locked
+ * cost no filesystem access.  Until then \c u.f.fname is \c NULL and
+ * \c u.f.fd = -1.
  *
  */
 extern struct lxc_lock *lxc_newlock(const char *lxcpath, const char *name);
@@ -87,15 +90,29 @@ extern struct lxc_lock *lxc_newlock(const char *lxcpath, const char *name);
  * indefinite wait).
  *
  * \return \c 0 if lock obtained, \c -2 on failure to set timeout,
- *  or \c -1 on any other error (\c errno will be set by \c sem_wait(3)).
+ *  or \c -1 on any other error (\c errno will be set by \c sem_wait(3)
+ *  or \c fcntl(2), and is \c ETIMEDOUT if \p timeout expired).
  *
- * \note \p timeout is (currently?) only supported for privlock, not
- * for slock.  Since currently there is not a single use of the timeout
- * (except in the test case) I may remove the support for it in sem as
- * well.
+ * \note A lock file is taken exclusively, as an open file description
+ *  lock where the kernel has them, so it also excludes other locks on the
+ *  same file within this process.
  */
 extern int lxclock(struct lxc_lock *lock, int timeout);
 
+/*!
+ * \brief Take an existing lock in shared mode.
+ *
+ * \param lock Lock to operate on.
+ * \param timeout As for \ref lxclock().
+ *
+ * \return As for \ref lxclock().
+ *
+ * \note Any number of shared holders of a lock file may hold it at once,
+ *  while an exclusive holder excludes them all.  An anonymous semaphore
+ *  has no shared mode and is taken as by \ref lxclock().
+ */
+extern int lxclock_shared(struct lxc_lock *lock, int timeout);
+
 /*!
  * \brief Unlock specified lock previously locked using \ref lxclock().
  *
@@ -115,6 +132,9 @@ extern void lxc_putlock(struct lxc_lock *lock);
 
 /*!
  * \brief Lock the current process.
+ *
+ * \note liblxc itself no longer takes this lock; it is kept for callers
+ *  which used it to serialize their own calls.
  */
 extern void process_lock(void);
 
@@ -125,6 +145,9 @@ extern void process_unlock(void);
 
 /*!
  * \brief Lock global data.
+ *
+ * \note Kept for API compatibility only: lxc_global_config_value()
+ *  no longer takes it.
  */
 extern void static_lock(void);
 
@@ -161,6 +184,19 @@ extern void container_mem_unlock(struct lxc_container *c);
  */
 extern int container_disk_lock(struct lxc_container *c);
 
+/*!
+ * \brief Lock the containers disk data for reading only.
+ *
+ * \param c Container.
+ *
+ * \return As for \ref container_disk_lock().
+ *
+ * \note Readers of the same container only exclude each other through
+ *  the memory lock of their own struct lxc_container.  Release with
+ *  \ref container_disk_unlock().
+ */
+extern int container_disk_lock_shared(struct lxc_container *c);
+
 /*!
  * \brief Unlock the containers disk data.
  */
@@ -29,6 +29,7 @@
 #include <sys/epoll.h>
 
 #include "mainloop.h"
+#include "log.h"
 
 struct mainloop_handler {
 	lxc_mainloop_callback_t callback;
@@ -46,6 +47,9 @@ int lxc_mainloop(struct lxc_epoll_descr *descr, int timeout_ms)
 
 	for (;;) {
 
+		/* drain buffered log lines while there's nothing else to do */
+		lxc_log_flush();
+
 		nfds = epoll_wait(descr->epfd, events, MAX_EVENTS, timeout_ms);
 		if (nfds < 0) {
 			if (errno == EINTR)
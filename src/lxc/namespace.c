@@ -43,7 +43,13 @@ struct clone_arg {
 static int do_clone(void *arg)
 {
 	struct clone_arg *clone_arg = arg;
-	return clone_arg->fn(clone_arg->arg);
+	int ret;
+
+	lxc_log_child_init();
+	ret = clone_arg->fn(clone_arg->arg);
+	/* the child leaves through the raw exit syscall, without atexit() */
+	lxc_log_flush();
+	return ret;
 }
 
 pid_t lxc_clone(int (*fn)(void *), void *arg, int flags)
@@ -57,6 +63,9 @@ pid_t lxc_clone(int (*fn)(void *), void *arg, int flags)
 	void *stack = alloca(stack_size);
 	pid_t ret;
 
+	/* the child would write our buffered log lines a second time */
+	lxc_log_flush();
+
 #ifdef __ia64__
 	ret = __clone2(do_clone, stack,
 		       stack_size, flags | SIGCHLD, &clone_arg);
@@ -47,6 +47,7 @@
 #include <linux/if_bridge.h>
 
 #include "nl.h"
+#include "rtnl.h"
 #include "network.h"
 #include "conf.h"
 
@@ -105,19 +106,21 @@ struct rt_req {
 
 int lxc_netdev_move_by_index(int ifindex, pid_t pid)
 {
-	struct nl_handler nlh;
-	struct nlmsg *nlmsg = NULL;
-	struct link_req *link_req;
 	int err;
 
-	err = netlink_open(&nlh, NETLINK_ROUTE);
-	if (err)
-		return err;
+	lxc_netdev_move_many(&ifindex, 1, pid, &err);
+	return err;
+}
 
-	err = -ENOMEM;
-	nlmsg = nlmsg_alloc(NLMSG_GOOD_SIZE);
+static int link_req_queue(struct nl_handler *nlh, struct nlmsg **nlmsgp,
+			  int ifindex)
+{
+	struct nlmsg *nlmsg;
+	struct link_req *link_req;
+
+	nlmsg = netlink_queue(nlh, NLMSG_REQ_SIZE);
 	if (!nlmsg)
-		goto out;
+		return -ENOMEM;
 
 	link_req = (struct link_req *)nlmsg;
 	link_req->ifinfomsg.ifi_family = AF_UNSPEC;
@@ -126,13 +129,52 @@ int lxc_netdev_move_by_index(int ifindex, pid_t pid)
 	nlmsg->nlmsghdr.nlmsg_flags = NLM_F_REQUEST|NLM_F_ACK;
 	nlmsg->nlmsghdr.nlmsg_type = RTM_NEWLINK;
 
-	if (nla_put_u32(nlmsg, IFLA_NET_NS_PID, pid))
-		goto out;
+	*nlmsgp = nlmsg;
+	return 0;
+}
 
-	err = netlink_transaction(&nlh, nlmsg, nlmsg);
-out:
-	netlink_close(&nlh);
-	nlmsg_free(nlmsg);
+int lxc_netdev_move_many(const int *ifindexes, int nr, pid_t pid, int *errs)
+{
+	struct nl_handler *nlh;
+	struct nlmsg *nlmsg;
+	int i = 0, first = 0, err = 0, ret;
+
+	nlh = rtnetlink_handle();
+	if (!nlh) {
+		err = -errno;
+		goto out_errs;
+	}
+
+	for (; i < nr; i++) {
+		/* the queue is full, send what we have so far */
+		if (i - first == NLMSG_QUEUE_MAX) {
+			ret = netlink_flush(nlh, errs + first);
+			if (ret && !err)
+				err = ret;
+			first = i;
+		}
+
+		ret = link_req_queue(nlh, &nlmsg, ifindexes[i]);
+		if (!ret && nla_put_u32(nlmsg, IFLA_NET_NS_PID, pid)) {
+			netlink_unqueue(nlh, nlmsg);
+			ret = -EINVAL;
+		}
+		if (ret) {
+			err = ret;
+			goto out_flush;
+		}
+	}
+
+	ret = netlink_flush(nlh, errs + first);
+	if (ret && !err)
+		err = ret;
+	return err;
+
+out_flush:
+	netlink_flush(nlh, errs + first);
+out_errs:
+	for (; i < nr; i++)
+		errs[i] = err;
 	return err;
 }
 
@@ -150,37 +192,20 @@ int lxc_netdev_move_by_name(char *ifname, pid_t pid)
 
 int lxc_netdev_delete_by_index(int ifindex)
 {
-	struct nl_handler nlh;
-	struct nlmsg *nlmsg = NULL, *answer = NULL;
-	struct link_req *link_req;
+	struct nl_handler *nlh;
+	struct nlmsg *nlmsg;
 	int err;
 
-	err = netlink_open(&nlh, NETLINK_ROUTE);
+	nlh = rtnetlink_handle();
+	if (!nlh)
+		return -errno;
+
+	err = link_req_queue(nlh, &nlmsg, ifindex);
 	if (err)
 		return err;
-
-	err = -ENOMEM;
-	nlmsg = nlmsg_alloc(NLMSG_GOOD_SIZE);
-	if (!nlmsg)
-		goto out;
-
-	answer = nlmsg_alloc(NLMSG_GOOD_SIZE);
-	if (!answer)
-		goto out;
-
-	link_req = (struct link_req *)nlmsg;
-	link_req->ifinfomsg.ifi_family = AF_UNSPEC;
-	link_req->ifinfomsg.ifi_index = ifindex;
-	nlmsg->nlmsghdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
-	nlmsg->nlmsghdr.nlmsg_flags = NLM_F_ACK|NLM_F_REQUEST;
 	nlmsg->nlmsghdr.nlmsg_type = RTM_DELLINK;
 
-	err = netlink_transaction(&nlh, nlmsg, answer);
-out:
-	netlink_close(&nlh);
-	nlmsg_free(answer);
-	nlmsg_free(nlmsg);
-	return err;
+	return netlink_flush(nlh, NULL);
 }
 
 int lxc_netdev_delete_by_name(const char *name)
@@ -196,44 +221,28 @@ int lxc_netdev_delete_by_name(const char *name)
 
 int lxc_netdev_rename_by_index(int ifindex, const char *newname)
 {
-	struct nl_handler nlh;
-	struct nlmsg *nlmsg = NULL, *answer = NULL;
-	struct link_req *link_req;
+	struct nl_handler *nlh;
+	struct nlmsg *nlmsg;
 	int len, err;
 
-	err = netlink_open(&nlh, NETLINK_ROUTE);
-	if (err)
-		return err;
+	nlh = rtnetlink_handle();
+	if (!nlh)
+		return -errno;
 
 	len = strlen(newname);
 	if (len == 1 || len >= IFNAMSIZ)
-		goto out;
-
-	err = -ENOMEM;
-	nlmsg = nlmsg_alloc(NLMSG_GOOD_SIZE);
-	if (!nlmsg)
-		goto out;
-
-	answer = nlmsg_alloc(NLMSG_GOOD_SIZE);
-	if (!answer)
-		goto out;
+		return -EINVAL;
 
-	link_req = (struct link_req *)nlmsg;
-	link_req->ifinfomsg.ifi_family = AF_UNSPEC;
-	link_req->ifinfomsg.ifi_index = ifindex;
-	nlmsg->nlmsghdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
-	nlmsg->nlmsghdr.nlmsg_flags = NLM_F_ACK|NLM_F_REQUEST;
-	nlmsg->nlmsghdr.nlmsg_type = RTM_NEWLINK;
+	err = link_req_queue(nlh, &nlmsg, ifindex);
+	if (err)
+		return err;
 
-	if (nla_put_string(nlmsg, IFLA_IFNAME, newname))
-		goto out;
+	if (nla_put_string(nlmsg, IFLA_IFNAME, newname)) {
+		netlink_unqueue(nlh, nlmsg);
+		return -EINVAL;
+	}
 
-	err = netlink_transaction(&nlh, nlmsg, answer);
-out:
-	netlink_close(&nlh);
-	nlmsg_free(answer);
-	nlmsg_free(nlmsg);
-	return err;
+	return netlink_flush(nlh, NULL);
 }
 
 int lxc_netdev_rename_by_name(const char *oldname, const char *newname)
@@ -253,97 +262,62 @@ int lxc_netdev_rename_by_name(const char *oldname, const char *newname)
 
 int netdev_set_flag(const char *name, int flag)
 {
-	struct nl_handler nlh;
-	struct nlmsg *nlmsg = NULL, *answer = NULL;
+	struct nl_handler *nlh;
+	struct nlmsg *nlmsg;
 	struct link_req *link_req;
 	int index, len, err;
 
-	err = netlink_open(&nlh, NETLINK_ROUTE);
-	if (err)
-		return err;
+	nlh = rtnetlink_handle();
+	if (!nlh)
+		return -errno;
 
-	err = -EINVAL;
 	len = strlen(name);
 	if (len == 1 || len >= IFNAMSIZ)
-		goto out;
-
-	err = -ENOMEM;
-	nlmsg = nlmsg_alloc(NLMSG_GOOD_SIZE);
-	if (!nlmsg)
-		goto out;
-
-	answer = nlmsg_alloc(NLMSG_GOOD_SIZE);
-	if (!answer)
-		goto out;
+		return -EINVAL;
 
-	err = -EINVAL;
 	index = if_nametoindex(name);
 	if (!index)
-		goto out;
+		return -EINVAL;
+
+	err = link_req_queue(nlh, &nlmsg, index);
+	if (err)
+		return err;
 
 	link_req = (struct link_req *)nlmsg;
-	link_req->ifinfomsg.ifi_family = AF_UNSPEC;
-	link_req->ifinfomsg.ifi_index = index;
 	link_req->ifinfomsg.ifi_change |= IFF_UP;
 	link_req->ifinfomsg.ifi_flags |= flag;
-	nlmsg->nlmsghdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
-	nlmsg->nlmsghdr.nlmsg_flags = NLM_F_REQUEST|NLM_F_ACK;
-	nlmsg->nlmsghdr.nlmsg_type = RTM_NEWLINK;
 
-	err = netlink_transaction(&nlh, nlmsg, answer);
-out:
-	netlink_close(&nlh);
-	nlmsg_free(nlmsg);
-	nlmsg_free(answer);
-	return err;
+	return netlink_flush(nlh, NULL);
 }
 
 int lxc_netdev_set_mtu(const char *name, int mtu)
 {
-	struct nl_handler nlh;
-	struct nlmsg *nlmsg = NULL, *answer = NULL;
-	struct link_req *link_req;
+	struct nl_handler *nlh;
+	struct nlmsg *nlmsg;
 	int index, len, err;
 
-	err = netlink_open(&nlh, NETLINK_ROUTE);
-	if (err)
-		return err;
+	nlh = rtnetlink_handle();
+	if (!nlh)
+		return -errno;
 
-	err = -EINVAL;
 	len = strlen(name);
 	if (len == 1 || len >= IFNAMSIZ)
-		goto out;
-
-	err = -ENOMEM;
-	nlmsg = nlmsg_alloc(NLMSG_GOOD_SIZE);
-	if (!nlmsg)
-		goto out;
-
-	answer = nlmsg_alloc(NLMSG_GOOD_SIZE);
-	if (!answer)
-		goto out;
+		return -EINVAL;
 
-	err = -EINVAL;
 	index = if_nametoindex(name);
 	if (!index)
-		goto out;
+		return -EINVAL;
 
-	link_req = (struct link_req *)nlmsg;
-	link_req->ifinfomsg.ifi_family = AF_UNSPEC;
-	link_req->ifinfomsg.ifi_index = index;
-	nlmsg->nlmsghdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
-	nlmsg->nlmsghdr.nlmsg_flags = NLM_F_REQUEST|NLM_F_ACK;
-	nlmsg->nlmsghdr.nlmsg_type = RTM_NEWLINK;
+	err = link_req_queue(nlh, &nlmsg, index);
+	if (err)
+		return err;
 
-	if (nla_put_u32(nlmsg, IFLA_MTU, mtu))
-		goto out;
+	if (nla_put_u32(nlmsg, IFLA_MTU, mtu)) {
+		netlink_unqueue(nlh, nlmsg);
+		return -EINVAL;
+	}
 
-	err = netlink_transaction(&nlh, nlmsg, answer);
-out:
-	netlink_close(&nlh);
-	nlmsg_free(nlmsg);
-	nlmsg_free(answer);
-	return err;
+	return netlink_flush(nlh, NULL);
 }
 
 int lxc_netdev_up(const char *name)
@@ -356,63 +330,77 @@ int lxc_netdev_down(const char *name)
 	return netdev_set_flag(name, 0);
 }
 
-int lxc_veth_create(const char *name1, const char *name2)
+/* a random version of what setup_private_host_hw_addr() does */
+static int private_host_hw_addr(unsigned char *addr)
+{
+	int fd, ret;
+
+	fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	ret = read(fd, addr, ETH_ALEN);
+	close(fd);
+	if (ret != ETH_ALEN)
+		return -EIO;
+
+	addr[0] = 0xfe;
+	return 0;
+}
+
+/*
+ * Fill nlmsg with the request creating the veth pair name1/name2.  mtu,
+ * unless 0, is set on both sides.  If host is set, name1 is meant for the
+ * host: it gets a private hardware address and is brought up right away.
+ */
+static int veth_create_req(struct nlmsg *nlmsg, const char *name1,
+			   const char *name2, int mtu, bool host)
 {
-	struct nl_handler nlh;
-	struct nlmsg *nlmsg = NULL, *answer = NULL;
 	struct link_req *link_req;
 	struct rtattr *nest1, *nest2, *nest3;
+	unsigned char addr[ETH_ALEN];
 	int len, err;
 
-	err = netlink_open(&nlh, NETLINK_ROUTE);
-	if (err)
-		return err;
-
-	err = -EINVAL;
 	len = strlen(name1);
 	if (len == 1 || len >= IFNAMSIZ)
-		goto out;
+		return -EINVAL;
 
 	len = strlen(name2);
 	if (len == 1 || len >= IFNAMSIZ)
-		goto out;
-
-	err = -ENOMEM;
-	nlmsg = nlmsg_alloc(NLMSG_GOOD_SIZE);
-	if (!nlmsg)
-		goto out;
-
-	answer = nlmsg_alloc(NLMSG_GOOD_SIZE);
-	if (!answer)
-		goto out;
+		return -EINVAL;
 
 	link_req = (struct link_req *)nlmsg;
 	link_req->ifinfomsg.ifi_family = AF_UNSPEC;
+	if (host) {
+		link_req->ifinfomsg.ifi_change |= IFF_UP;
+		link_req->ifinfomsg.ifi_flags |= IFF_UP;
+	}
 	nlmsg->nlmsghdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
 	nlmsg->nlmsghdr.nlmsg_flags =
 		NLM_F_REQUEST|NLM_F_CREATE|NLM_F_EXCL|NLM_F_ACK;
 	nlmsg->nlmsghdr.nlmsg_type = RTM_NEWLINK;
 
-	err = -EINVAL;
 	nest1 = nla_begin_nested(nlmsg, IFLA_LINKINFO);
 	if (!nest1)
-		goto out;
+		return -EINVAL;
 
 	if (nla_put_string(nlmsg, IFLA_INFO_KIND, "veth"))
-		goto out;
+		return -EINVAL;
 
 	nest2 = nla_begin_nested(nlmsg, IFLA_INFO_DATA);
 	if (!nest2)
-		goto out;
+		return -EINVAL;
 
 	nest3 = nla_begin_nested(nlmsg, VETH_INFO_PEER);
 	if (!nest3)
-		goto out;
+		return -EINVAL;
 
 	nlmsg->nlmsghdr.nlmsg_len += sizeof(struct ifinfomsg);
 
 	if (nla_put_string(nlmsg, IFLA_IFNAME, name2))
-		goto out;
+		return -EINVAL;
+
+	if (mtu && nla_put_u32(nlmsg, IFLA_MTU, mtu))
+		return -EINVAL;
 
 	nla_end_nested(nlmsg, nest3);
 
@@ -421,51 +409,64 @@ int lxc_veth_create(const char *name1, const char *name2)
 	nla_end_nested(nlmsg, nest1);
 
 	if (nla_put_string(nlmsg, IFLA_IFNAME, name1))
-		goto out;
+		return -EINVAL;
 
-	err = netlink_transaction(&nlh, nlmsg, answer);
-out:
-	netlink_close(&nlh);
-	nlmsg_free(answer);
-	nlmsg_free(nlmsg);
-	return err;
+	if (mtu && nla_put_u32(nlmsg, IFLA_MTU, mtu))
+		return -EINVAL;
+
+	if (host) {
+		err = private_host_hw_addr(addr);
+		if (err)
+			return err;
+		if (nla_put_buffer(nlmsg, IFLA_ADDRESS, addr, ETH_ALEN))
+			return -EINVAL;
+	}
+
+	return 0;
 }
 
-/* XXX: merge with lxc_macvlan_create */
-int lxc_vlan_create(const char *master, const char *name, unsigned short vlanid)
+int lxc_veth_create(const char *name1, const char *name2)
 {
-	struct nl_handler nlh;
-	struct nlmsg *nlmsg = NULL, *answer = NULL;
-	struct link_req *link_req;
-	struct rtattr *nest, *nest2;
-	int lindex, len, err;
+	struct nl_handler *nlh;
+	struct nlmsg *nlmsg;
+	int err;
 
-	err = netlink_open(&nlh, NETLINK_ROUTE);
-	if (err)
+	nlh = rtnetlink_handle();
+	if (!nlh)
+		return -errno;
+
+	nlmsg = netlink_queue(nlh, NLMSG_REQ_SIZE);
+	if (!nlmsg)
+		return -ENOMEM;
+
+	err = veth_create_req(nlmsg, name1, name2, 0, false);
+	if (err) {
+		netlink_unqueue(nlh, nlmsg);
 		return err;
+	}
+
+	return netlink_flush(nlh, NULL);
+}
+
+/* XXX: merge with macvlan_create_req */
+static int vlan_create_req(struct nlmsg *nlmsg, const char *master,
+			   const char *name, unsigned short vlanid)
+{
+	struct link_req *link_req;
+	struct rtattr *nest, *nest2;
+	int lindex, len;
 
-	err = -EINVAL;
 	len = strlen(master);
 	if (len == 1 || len >= IFNAMSIZ)
-		goto err3;
+		return -EINVAL;
 
 	len = strlen(name);
 	if (len == 1 || len >= IFNAMSIZ)
-		goto err3;
-
-	err = -ENOMEM;
-	nlmsg = nlmsg_alloc(NLMSG_GOOD_SIZE);
-	if (!nlmsg)
-		goto err3;
-
-	answer = nlmsg_alloc(NLMSG_GOOD_SIZE);
-	if (!answer)
-		goto err2;
+		return -EINVAL;
 
-	err = -EINVAL;
 	lindex = if_nametoindex(master);
 	if (!lindex)
-		goto err1;
+		return -EINVAL;
 
 	link_req = (struct link_req *)nlmsg;
 	link_req->ifinfomsg.ifi_family = AF_UNSPEC;
@@ -476,72 +477,49 @@ int lxc_vlan_create(const char *master, const char *name, unsigned short vlanid)
 
 	nest = nla_begin_nested(nlmsg, IFLA_LINKINFO);
 	if (!nest)
-		goto err1;
+		return -EINVAL;
 
 	if (nla_put_string(nlmsg, IFLA_INFO_KIND, "vlan"))
-		goto err1;
+		return -EINVAL;
 
 	nest2 = nla_begin_nested(nlmsg, IFLA_INFO_DATA);
 	if (!nest2)
-		goto err1;
+		return -EINVAL;
 
 	if (nla_put_u16(nlmsg, IFLA_VLAN_ID, vlanid))
-		goto err1;
+		return -EINVAL;
 
 	nla_end_nested(nlmsg, nest2);
 
 	nla_end_nested(nlmsg, nest);
 
 	if (nla_put_u32(nlmsg, IFLA_LINK, lindex))
-		goto err1;
+		return -EINVAL;
 
 	if (nla_put_string(nlmsg, IFLA_IFNAME, name))
-		goto err1;
+		return -EINVAL;
 
-	err = netlink_transaction(&nlh, nlmsg, answer);
-err1:
-	nlmsg_free(answer);
-err2:
-	nlmsg_free(nlmsg);
-err3:
-	netlink_close(&nlh);
-	return err;
+	return 0;
 }
 
-int lxc_macvlan_create(const char *master, const char *name, int mode)
+static int macvlan_create_req(struct nlmsg *nlmsg, const char *master,
+			      const char *name, int mode)
 {
-	struct nl_handler nlh;
-	struct nlmsg *nlmsg = NULL, *answer = NULL;
 	struct link_req *link_req;
 	struct rtattr *nest, *nest2;
-	int index, len, err;
-
-	err = netlink_open(&nlh, NETLINK_ROUTE);
-	if (err)
-		return err;
+	int index, len;
 
-	err = -EINVAL;
 	len = strlen(master);
 	if (len == 1 || len >= IFNAMSIZ)
-		goto out;
+		return -EINVAL;
 
 	len = strlen(name);
 	if (len == 1 || len >= IFNAMSIZ)
-		goto out;
-
-	err = -ENOMEM;
-	nlmsg = nlmsg_alloc(NLMSG_GOOD_SIZE);
-	if (!nlmsg)
-		goto out;
-
-	answer = nlmsg_alloc(NLMSG_GOOD_SIZE);
-	if (!answer)
-		goto out;
+		return -EINVAL;
 
-	err = -EINVAL;
 	index = if_nametoindex(master);
 	if (!index)
-		goto out;
+		return -EINVAL;
 
 	link_req = (struct link_req *)nlmsg;
 	link_req->ifinfomsg.ifi_family = AF_UNSPEC;
@@ -552,18 +530,18 @@ int lxc_macvlan_create(const char *master, const char *name, int mode)
 
 	nest = nla_begin_nested(nlmsg, IFLA_LINKINFO);
 	if (!nest)
-		goto out;
+		return -EINVAL;
 
 	if (nla_put_string(nlmsg, IFLA_INFO_KIND, "macvlan"))
-		goto out;
+		return -EINVAL;
 
 	if (mode) {
 		nest2 = nla_begin_nested(nlmsg, IFLA_INFO_DATA);
 		if (!nest2)
-			goto out;
+			return -EINVAL;
 
 		if (nla_put_u32(nlmsg, IFLA_MACVLAN_MODE, mode))
-			goto out;
+			return -EINVAL;
 
 		nla_end_nested(nlmsg, nest2);
 	}
@@ -571,19 +549,113 @@ int lxc_macvlan_create(const char *master, const char *name, int mode)
 	nla_end_nested(nlmsg, nest);
 
 	if (nla_put_u32(nlmsg, IFLA_LINK, index))
-		goto out;
+		return -EINVAL;
 
 	if (nla_put_string(nlmsg, IFLA_IFNAME, name))
-		goto out;
+		return -EINVAL;
 
-	err = netlink_transaction(&nlh, nlmsg, answer);
-out:
-	netlink_close(&nlh);
-	nlmsg_free(answer);
-	nlmsg_free(nlmsg);
+	return 0;
+}
+
+int lxc_vlan_create(const char *master, const char *name, unsigned short vlanid)
+{
+	struct lxc_link_create link = {
+		.type = LXC_NET_VLAN,
+		.name = name,
+		.master = master,
+		.vid = vlanid,
+	};
+	int err;
+
+	lxc_links_create(&link, 1, &err);
 	return err;
 }
 
+int lxc_macvlan_create(const char *master, const char *name, int mode)
+{
+	struct lxc_link_create link = {
+		.type = LXC_NET_MACVLAN,
+		.name = name,
+		.master = master,
+		.mode = mode,
+	};
+	int err;
+
+	lxc_links_create(&link, 1, &err);
+	return err;
+}
+
+static int links_flush(struct nl_handler *nlh, const int *idx, int n, int *errs)
+{
+	int *sent = alloca(n * sizeof(*sent)), i;
+
+	netlink_flush(nlh, sent);
+	for (i = 0; i < n; i++)
+		errs[idx[i]] = sent[i];
+	return 0;
+}
+
+int lxc_links_create(const struct lxc_link_create *links, int nr, int *errs)
+{
+	struct nl_handler *nlh;
+	struct nlmsg *nlmsg;
+	int *idx, i, n = 0;
+
+	nlh = rtnetlink_handle();
+	if (!nlh) {
+		for (i = 0; i < nr; i++)
+			errs[i] = -errno;
+		return -errno;
+	}
+
+	/* idx maps the queued requests back to links */
+	idx = alloca(nr * sizeof(*idx));
+	for (i = 0; i < nr; i++) {
+		const struct lxc_link_create *l = &links[i];
+
+		nlmsg = netlink_queue(nlh, NLMSG_REQ_SIZE);
+		if (!nlmsg && n) {
+			links_flush(nlh, idx, n, errs);
+			n = 0;
+			nlmsg = netlink_queue(nlh, NLMSG_REQ_SIZE);
+		}
+		if (!nlmsg) {
+			errs[i] = -ENOMEM;
+			continue;
+		}
+
+		switch (l->type) {
+		case LXC_NET_VETH:
+			errs[i] = veth_create_req(nlmsg, l->name, l->peer,
+						  l->mtu, true);
+			break;
+		case LXC_NET_MACVLAN:
+			errs[i] = macvlan_create_req(nlmsg, l->master, l->name,
+						     l->mode);
+			break;
+		case LXC_NET_VLAN:
+			errs[i] = vlan_create_req(nlmsg, l->master, l->name,
+						  l->vid);
+			break;
+		default:
+			errs[i] = -EINVAL;
+		}
+		/* requests we could not even build fail on their own */
+		if (errs[i]) {
+			netlink_unqueue(nlh, nlmsg);
+			continue;
+		}
+		idx[n++] = i;
+	}
+	if (n)
+		links_flush(nlh, idx, n, errs);
+
+	for (i = 0; i < nr; i++)
+		if (errs[i])
+			return errs[i];
+	return 0;
+}
+
 static int proc_sys_net_write(const char *path, const char *value)
 {
 	int fd, err = 0;
@@ -702,8 +774,8 @@ int lxc_convert_mac(char *macaddr, struct sockaddr *sockaddr)
 static int ip_addr_add(int family, int ifindex,
 		       void *addr, void *bcast, void *acast, int prefix)
 {
-	struct nl_handler nlh;
-	struct nlmsg *nlmsg = NULL, *answer = NULL;
+	struct nl_handler *nlh;
+	struct nlmsg *nlmsg;
 	struct ip_req *ip_req;
 	int addrlen;
 	int err;
@@ -711,18 +783,19 @@ static int ip_addr_add(int family, int ifindex,
 	addrlen = family == AF_INET ? sizeof(struct in_addr) :
 		sizeof(struct in6_addr);
 
-	err = netlink_open(&nlh, NETLINK_ROUTE);
-	if (err)
-		return err;
+	/* TODO : multicast, anycast with ipv6 */
+	if (family == AF_INET6 &&
+	    (memcmp(bcast, &in6addr_any, sizeof(in6addr_any)) ||
+	     memcmp(acast, &in6addr_any, sizeof(in6addr_any))))
+		return -EPROTONOSUPPORT;
 
-	err = -ENOMEM;
-	nlmsg = nlmsg_alloc(NLMSG_GOOD_SIZE);
-	if (!nlmsg)
-		goto out;
+	nlh = rtnetlink_handle();
+	if (!nlh)
+		return -errno;
 
-	answer = nlmsg_alloc(NLMSG_GOOD_SIZE);
-	if (!answer)
-		goto out;
+	nlmsg = netlink_queue(nlh, NLMSG_REQ_SIZE);
+	if (!nlmsg)
+		return -ENOMEM;
 
 	ip_req = (struct ip_req *)nlmsg;
         ip_req->nlmsg.nlmsghdr.nlmsg_len =
@@ -745,18 +818,9 @@ static int ip_addr_add(int family, int ifindex,
 	if (nla_put_buffer(nlmsg, IFA_BROADCAST, bcast, addrlen))
 		goto out;
 
-	/* TODO : multicast, anycast with ipv6 */
-	err = -EPROTONOSUPPORT;
-	if (family == AF_INET6 &&
-	    (memcmp(bcast, &in6addr_any, sizeof(in6addr_any)) ||
-	     memcmp(acast, &in6addr_any, sizeof(in6addr_any))))
-		goto out;
-
-	err = netlink_transaction(&nlh, nlmsg, answer);
+	return netlink_flush(nlh, NULL);
 out:
-	netlink_close(&nlh);
-	nlmsg_free(answer);
-	nlmsg_free(nlmsg);
+	netlink_unqueue(nlh, nlmsg);
 	return err;
 }
 
@@ -938,8 +1002,8 @@ int lxc_ipv4_addr_get(int ifindex, struct in_addr** res)
 
 static int ip_gateway_add(int family, int ifindex, void *gw)
 {
-	struct nl_handler nlh;
-	struct nlmsg *nlmsg = NULL, *answer = NULL;
+	struct nl_handler *nlh;
+	struct nlmsg *nlmsg;
 	struct rt_req *rt_req;
 	int addrlen;
 	int err;
@@ -947,18 +1011,13 @@ static int ip_gateway_add(int family, int ifindex, void *gw)
 	addrlen = family == AF_INET ? sizeof(struct in_addr) :
 		sizeof(struct in6_addr);
 
-	err = netlink_open(&nlh, NETLINK_ROUTE);
-	if (err)
-		return err;
+	nlh = rtnetlink_handle();
+	if (!nlh)
+		return -errno;
 
-	err = -ENOMEM;
-	nlmsg = nlmsg_alloc(NLMSG_GOOD_SIZE);
+	nlmsg = netlink_queue(nlh, NLMSG_REQ_SIZE);
 	if (!nlmsg)
-		goto out;
-
-	answer = nlmsg_alloc(NLMSG_GOOD_SIZE);
-	if (!answer)
-		goto out;
+		return -ENOMEM;
 
 	rt_req = (struct rt_req *)nlmsg;
 	rt_req->nlmsg.nlmsghdr.nlmsg_len =
@@ -983,11 +1042,9 @@ static int ip_gateway_add(int family, int ifindex, void *gw)
 	if (nla_put_u32(nlmsg, RTA_OIF, ifindex))
 		goto out;
 
-	err = netlink_transaction(&nlh, nlmsg, answer);
+	return netlink_flush(nlh, NULL);
 out:
-	netlink_close(&nlh);
-	nlmsg_free(answer);
-	nlmsg_free(nlmsg);
+	netlink_unqueue(nlh, nlmsg);
 	return err;
 }
 
@@ -1003,8 +1060,8 @@ int lxc_ipv6_gateway_add(int ifindex, struct in6_addr *gw)
 
 static int ip_route_dest_add(int family, int ifindex, void *dest)
 {
-	struct nl_handler nlh;
-	struct nlmsg *nlmsg = NULL, *answer = NULL;
+	struct nl_handler *nlh;
+	struct nlmsg *nlmsg;
 	struct rt_req *rt_req;
 	int addrlen;
 	int err;
@@ -1012,18 +1069,13 @@ static int ip_route_dest_add(int family, int ifindex, void *dest)
 	addrlen = family == AF_INET ? sizeof(struct in_addr) :
 		sizeof(struct in6_addr);
 	
-	err = netlink_open(&nlh, NETLINK_ROUTE);
-	if (err)
-		return err;
+	nlh = rtnetlink_handle();
+	if (!nlh)
+		return -errno;
 	
-	err = -ENOMEM;
-	nlmsg = nlmsg_alloc(NLMSG_GOOD_SIZE);
+	nlmsg = netlink_queue(nlh, NLMSG_REQ_SIZE);
 	if (!nlmsg)
-		goto out;
-	
-	answer = nlmsg_alloc(NLMSG_GOOD_SIZE);
-	if (!answer)
-		goto out;
+		return -ENOMEM;
 	
 	rt_req = (struct rt_req *)nlmsg;
 	rt_req->nlmsg.nlmsghdr.nlmsg_len =
@@ -1043,11 +1095,9 @@ static int ip_route_dest_add(int family, int ifindex, void *dest)
 		goto out;
 	if (nla_put_u32(nlmsg, RTA_OIF, ifindex))
 		goto out;
-	err = netlink_transaction(&nlh, nlmsg, answer);
+	return netlink_flush(nlh, NULL);
 out:
-	netlink_close(&nlh);
-	nlmsg_free(answer);
-	nlmsg_free(nlmsg);
+	netlink_unqueue(nlh, nlmsg);
 	return err;
 }
 
@@ -23,6 +23,8 @@
 #ifndef _network_h
 #define _network_h
 
+#include <net/if.h>
+
 /*
  * Convert a string mac address to a socket structure
  */
@@ -33,6 +35,12 @@ extern int lxc_convert_mac(char *macaddr, struct sockaddr *sockaddr);
  */
 extern int lxc_netdev_move_by_index(int ifindex, pid_t pid);
 extern int lxc_netdev_move_by_name(char *ifname, pid_t pid);
+/*
+ * Move several devices at once, with one netlink batch; errs[i] is set
+ * to the result for ifindexes[i]
+ */
+extern int lxc_netdev_move_many(const int *ifindexes, int nr, pid_t pid,
+				int *errs);
 
 /*
  * Delete a network device
@@ -66,6 +74,25 @@ extern int lxc_veth_create(const char *name1, const char *name2);
 extern int lxc_macvlan_create(const char *master, const char *name, int mode);
 extern int lxc_vlan_create(const char *master, const char *name, unsigned short vid);
 
+/*
+ * Create several virtual network devices at once, with one netlink
+ * batch; errs[i] is set to the result for links[i].  The host side of a
+ * veth pair gets a private hardware address, like with
+ * setup_private_host_hw_addr(), and is brought up.
+ */
+struct lxc_link_create {
+	int type;		/* LXC_NET_VETH, LXC_NET_MACVLAN or LXC_NET_VLAN */
+	const char *name;	/* for a veth, the host side */
+	const char *peer;	/* veth: the container side */
+	const char *master;	/* macvlan, vlan: the lower device */
+	int mtu;		/* veth: mtu of both sides, 0 for the default */
+	int mode;		/* macvlan mode */
+	unsigned short vid;	/* vlan id */
+	char buf[IFNAMSIZ];	/* for the caller, e.g. to hold name */
+};
+extern int lxc_links_create(const struct lxc_link_create *links, int nr,
+			    int *errs);
+
 /*
  * Activate forwarding
  */
@@ -214,6 +214,142 @@ extern int netlink_transaction(struct nl_handler *handler,
 	return 0;
 }
 
+static int netlink_batch_chunk(struct nl_handler *handler,
+			       struct nlmsg **requests, int nr, int *errs,
+			       struct nlmsg *answer)
+{
+	struct sockaddr_nl nladdr;
+	struct iovec iov[NLMSG_BATCH_MAX];
+	struct msghdr msg = {
+		.msg_name = &nladdr,
+		.msg_namelen = sizeof(nladdr),
+		.msg_iov = iov,
+		.msg_iovlen = nr,
+	};
+	struct nlmsghdr *hdr;
+	int first = handler->seq + 1, pending = nr, i, ret;
+
+	memset(&nladdr, 0, sizeof(nladdr));
+	nladdr.nl_family = AF_NETLINK;
+
+	for (i = 0; i < nr; i++) {
+		requests[i]->nlmsghdr.nlmsg_seq = ++handler->seq;
+		requests[i]->nlmsghdr.nlmsg_flags |= NLM_F_ACK;
+		iov[i].iov_base = requests[i];
+		iov[i].iov_len = requests[i]->nlmsghdr.nlmsg_len;
+		errs[i] = 1; /* no ack yet */
+	}
+
+	ret = sendmsg(handler->fd, &msg, 0);
+	if (ret < 0) {
+		ret = -errno;
+		goto out;
+	}
+
+	while (pending) {
+		answer->nlmsghdr.nlmsg_len = NLMSG_GOOD_SIZE;
+		ret = netlink_rcv(handler, answer);
+		if (ret <= 0) {
+			if (!ret)
+				ret = -ECONNRESET;
+			goto out;
+		}
+
+		for (hdr = &answer->nlmsghdr; NLMSG_OK(hdr, ret);
+		     hdr = NLMSG_NEXT(hdr, ret)) {
+			struct nlmsgerr *err = NLMSG_DATA(hdr);
+
+			if (hdr->nlmsg_type != NLMSG_ERROR)
+				continue;
+			i = hdr->nlmsg_seq - first;
+			if (i < 0 || i >= nr || errs[i] != 1)
+				continue;
+			errs[i] = err->error;
+			pending--;
+		}
+	}
+	return 0;
+
+out:
+	for (i = 0; i < nr; i++)
+		if (errs[i] == 1)
+			errs[i] = ret;
+	return ret;
+}
+
+extern int netlink_transaction_batch(struct nl_handler *handler,
+				     struct nlmsg **requests, int nr, int *errs)
+{
+	struct nlmsg *answer;
+	int i, n, ret = 0;
+
+	answer = nlmsg_alloc(NLMSG_GOOD_SIZE);
+	if (!answer)
+		return -ENOMEM;
+
+	for (i = 0; i < nr; i += n) {
+		n = nr - i < NLMSG_BATCH_MAX ? nr - i : NLMSG_BATCH_MAX;
+		netlink_batch_chunk(handler, requests + i, n, errs + i, answer);
+	}
+
+	for (i = 0; i < nr; i++)
+		if (errs[i] && !ret)
+			ret = errs[i];
+
+	nlmsg_free(answer);
+	return ret;
+}
+
+extern struct nlmsg *netlink_queue(struct nl_handler *handler, size_t size)
+{
+	struct nlmsg *nlmsg;
+
+	size = NLMSG_ALIGN(size);
+	if (!handler->arena) {
+		handler->arena = malloc(NLMSG_ARENA_SIZE);
+		if (!handler->arena)
+			return NULL;
+	}
+
+	if (handler->nr_queued == NLMSG_QUEUE_MAX ||
+	    handler->arena_used + size > NLMSG_ARENA_SIZE)
+		return NULL;
+
+	nlmsg = (struct nlmsg *)(handler->arena + handler->arena_used);
+	memset(nlmsg, 0, size);
+	nlmsg->nlmsghdr.nlmsg_len = size;
+
+	handler->arena_used += size;
+	handler->queued[handler->nr_queued++] = nlmsg;
+	return nlmsg;
+}
+
+extern void netlink_unqueue(struct nl_handler *handler, struct nlmsg *nlmsg)
+{
+	if (!handler->nr_queued ||
+	    handler->queued[handler->nr_queued - 1] != nlmsg)
+		return;
+
+	handler->nr_queued--;
+	handler->arena_used = (char *)nlmsg - handler->arena;
+}
+
+extern int netlink_flush(struct nl_handler *handler, int *errs)
+{
+	int nr = handler->nr_queued, ret;
+
+	if (!nr)
+		return 0;
+	if (!errs)
+		errs = alloca(nr * sizeof(*errs));
+
+	ret = netlink_transaction_batch(handler, handler->queued, nr, errs);
+
+	handler->nr_queued = 0;
+	handler->arena_used = 0;
+	return ret;
+}
+
 extern int netlink_open(struct nl_handler *handler, int protocol)
 {
 	socklen_t socklen;
@@ -222,7 +358,7 @@ extern int netlink_open(struct nl_handler *handler, int protocol)
 
         memset(handler, 0, sizeof(*handler));
 
-        handler->fd = socket(AF_NETLINK, SOCK_RAW, protocol);
+        handler->fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, protocol);
         if (handler->fd < 0)
                 return -errno;
 
@@ -262,6 +398,10 @@ extern int netlink_close(struct nl_handler *handler)
 {
 	close(handler->fd);
 	handler->fd = -1;
+	free(handler->arena);
+	handler->arena = NULL;
+	handler->arena_used = 0;
+	handler->nr_queued = 0;
 	return 0;
 }
 
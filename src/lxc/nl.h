@@ -43,13 +43,26 @@
  * @fd: the file descriptor of the netlink socket
  * @seq: the sequence number of the netlink messages
  * @local: the bind address
+ * @arena: where netlink_queue() carves the requests from
+ * @arena_used: how much of the arena is taken by the queued requests
+ * @nr_queued: the number of requests waiting for netlink_flush()
  * @peer: the peer address
  */
+#define NLMSG_ARENA_SIZE (16*PAGE_SIZE)
+#define NLMSG_QUEUE_MAX 64
+#define NLMSG_REQ_SIZE 1024
+
+struct nlmsg;
+
 struct nl_handler {
         int fd;
 	int seq;
         struct sockaddr_nl local;
         struct sockaddr_nl peer;
+	char *arena;
+	size_t arena_used;
+	int nr_queued;
+	struct nlmsg *queued[NLMSG_QUEUE_MAX];
 };
 
 /*
@@ -123,6 +136,58 @@ int netlink_send(struct nl_handler *handler, struct nlmsg *nlmsg);
 int netlink_transaction(struct nl_handler *handler,
 			struct nlmsg *request, struct nlmsg *anwser);
 
+/*
+ * netlink_transaction_batch: send several requests to the kernel with
+ *  one sendmsg and collect their acknowledgments, which are matched to
+ *  the requests by sequence number.  The requests are sent in chunks of
+ *  NLMSG_BATCH_MAX so that their acks fit in the receive buffer.
+ *
+ * @handler: a handler to a opened netlink socket
+ * @requests: an array of nr netlink message pointers
+ * @nr: the number of requests
+ * @errs: an array of nr integers, set to the result of each request
+ *
+ * Returns 0 if all the requests succeeded, the first error otherwise
+ */
+#define NLMSG_BATCH_MAX 16
+int netlink_transaction_batch(struct nl_handler *handler,
+			      struct nlmsg **requests, int nr, int *errs);
+
+/*
+ * netlink_queue: reserve a zeroed request of size bytes (at most
+ *  NLMSG_REQ_SIZE is enough for any of the rtnetlink requests we
+ *  build) in the handler's arena, to be sent with the other queued
+ *  requests by netlink_flush().  The arena is allocated once and reused
+ *  for the life of the handler.
+ *
+ * @handler: a handler to a opened netlink socket
+ * @size: the room needed by the request
+ *
+ * Returns the request, or NULL if the queue is full (flush it) or out of
+ * memory
+ */
+struct nlmsg *netlink_queue(struct nl_handler *handler, size_t size);
+
+/*
+ * netlink_unqueue: drop the last request queued, e.g. because it could
+ *  not be built
+ *
+ * @handler: a handler to a opened netlink socket
+ * @nlmsg: the request returned by the last netlink_queue()
+ */
+void netlink_unqueue(struct nl_handler *handler, struct nlmsg *nlmsg);
+
+/*
+ * netlink_flush: send the queued requests as a batch, see
+ *  netlink_transaction_batch(), and empty the queue
+ *
+ * @handler: a handler to a opened netlink socket
+ * @errs: NULL, or an array set to the result of each queued request
+ *
+ * Returns 0 if all the requests succeeded, the first error otherwise
+ */
+int netlink_flush(struct nl_handler *handler, int *errs);
+
 /*
  * nla_put_string: copy a null terminated string to a netlink message
  *  attribute
@@ -27,6 +27,9 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "parse.h"
 #include "config.h"
@@ -65,6 +68,92 @@ int lxc_file_for_each_line(const char *file, lxc_file_cb callback, void *data)
 	return err;
 }
 
+/*
+ * Read the whole file into one buffer and hand out its lines in place, NUL
+ * terminated where the newline was.  Unlike lxc_file_for_each_line() there
+ * is no copy per line, and the callback may modify the line it is given.
+ * The file is read rather than mapped: a writer truncating it under us
+ * must only make it look short, not raise SIGBUS in the caller.
+ */
+int lxc_file_for_each_line_inplace(const char *file, lxc_file_cb callback,
+				   void *data)
+{
+	struct stat st;
+	char *buf, *n, *line, *eol, *end;
+	size_t size, len = 0;
+	ssize_t ret;
+	int fd, err = 0;
+
+	fd = open(file, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		SYSERROR("failed to open %s", file);
+		return -1;
+	}
+
+	if (fstat(fd, &st) < 0) {
+		SYSERROR("failed to stat %s", file);
+		close(fd);
+		return -1;
+	}
+
+	/* one more byte to see the end, and to terminate the last line */
+	size = st.st_size + 2;
+	buf = malloc(size);
+	if (!buf) {
+		SYSERROR("failed to allocate memory");
+		close(fd);
+		return -1;
+	}
+	for (;;) {
+		if (len == size - 1) {
+			/* it grew since the fstat() */
+			n = realloc(buf, size * 2);
+			if (!n) {
+				SYSERROR("failed to allocate memory");
+				goto out_err;
+			}
+			buf = n;
+			size *= 2;
+		}
+		ret = lxc_read_nointr(fd, buf + len, size - 1 - len);
+		if (ret < 0) {
+			SYSERROR("failed to read %s", file);
+			goto out_err;
+		}
+		if (!ret)
+			break;
+		len += ret;
+	}
+	close(fd);
+	buf[len] = '\0';
+
+	end = buf + len;
+	for (line = buf; line < end; line = eol + 1) {
+		eol = memchr(line, '\n', end - line);
+		if (eol)
+			*eol = '\0';
+		else
+			eol = end;
+
+		err = callback(line, data);
+		if (err) {
+			// callback rv > 0 means stop here
+			// callback rv < 0 means error
+			if (err < 0)
+				ERROR("Failed to parse config: %s", line);
+			break;
+		}
+	}
+
+	free(buf);
+	return err;
+
+out_err:
+	free(buf);
+	close(fd);
+	return -1;
+}
+
 int lxc_char_left_gc(char *buffer, size_t len)
 {
 	int i;
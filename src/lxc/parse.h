@@ -31,6 +31,9 @@ typedef int (*lxc_file_cb)(char *buffer, void *data);
 extern int lxc_file_for_each_line(const char *file, lxc_file_cb callback,
 				  void* data);
 
+extern int lxc_file_for_each_line_inplace(const char *file, lxc_file_cb callback,
+					  void *data);
+
 extern int lxc_char_left_gc(char *buffer, size_t len);
 
 extern int lxc_char_right_gc(char *buffer, size_t len);
@@ -0,0 +1,283 @@
+/*
+ * lxc: linux Container library
+ *
+ * Copyright © 2014 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <signal.h>
+#include <pthread.h>
+#include <alloca.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/reboot.h>
+#include <linux/reboot.h>
+
+#include "log.h"
+#include "utils.h"
+#include "probe.h"
+
+lxc_log_define(lxc_probe, lxc);
+
+/* bump when the meaning or set of fields changes */
+#define PROBE_VERSION 2
+
+static struct lxc_host_probe probe;
+static pthread_once_t probe_once = PTHREAD_ONCE_INIT;
+
+/*
+ * reboot(LINUX_REBOOT_CMD_CAD_ON) will return -EINVAL
+ * in a child pid namespace if container reboot support exists.
+ * Otherwise, it will either succeed or return -EPERM.
+ */
+static int container_reboot_supported(void *arg)
+{
+	int *cmd = arg;
+	int ret;
+
+	ret = reboot(*cmd);
+	if (ret == -1 && errno == EINVAL)
+		return 1;
+	return 0;
+}
+
+/* returns 1 if supported, 0 if not, -1 if we couldn't tell */
+static int probe_reboot(int flags)
+{
+	FILE *f;
+	int ret, cmd, v;
+	long stack_size = 4096;
+	void *stack = alloca(stack_size);
+	int status;
+	pid_t pid;
+
+	f = fopen("/proc/sys/kernel/ctrl-alt-del", "r");
+	if (!f) {
+		DEBUG("failed to open /proc/sys/kernel/ctrl-alt-del");
+		return -1;
+	}
+
+	ret = fscanf(f, "%d", &v);
+	fclose(f);
+	if (ret != 1) {
+		DEBUG("Failed to read /proc/sys/kernel/ctrl-alt-del");
+		return -1;
+	}
+	cmd = v ? LINUX_REBOOT_CMD_CAD_ON : LINUX_REBOOT_CMD_CAD_OFF;
+
+	flags |= CLONE_NEWPID | SIGCHLD;
+#ifdef __ia64__
+	pid = __clone2(container_reboot_supported, stack, stack_size, flags, &cmd);
+#else
+	stack += stack_size;
+	pid = clone(container_reboot_supported, stack, flags, &cmd);
+#endif
+	if (pid < 0) {
+		// running out of processes is no answer about the kernel
+		if (errno == EAGAIN || errno == ENOMEM) {
+			SYSERROR("failed to clone");
+			return -1;
+		}
+		DEBUG("can't clone a pid namespace with flags %x: %m", flags);
+		return 0;
+	}
+	while ((ret = waitpid(pid, &status, 0)) < 0 && errno == EINTR)
+		;
+	if (ret < 0) {
+		SYSERROR("unexpected wait error");
+		return -1;
+	}
+
+	return WIFEXITED(status) && WEXITSTATUS(status) == 1;
+}
+
+static int probe_namespaces(void)
+{
+	static const struct {
+		const char *name;
+		int flag;
+	} ns[] = {
+		{ "mnt", CLONE_NEWNS },
+		{ "pid", CLONE_NEWPID },
+		{ "uts", CLONE_NEWUTS },
+		{ "ipc", CLONE_NEWIPC },
+		{ "user", CLONE_NEWUSER },
+		{ "net", CLONE_NEWNET },
+	};
+	char path[MAXPATHLEN];
+	int i, flags = 0;
+
+	for (i = 0; i < sizeof(ns) / sizeof(ns[0]); i++) {
+		snprintf(path, MAXPATHLEN, "/proc/self/ns/%s", ns[i].name);
+		if (access(path, F_OK) == 0)
+			flags |= ns[i].flag;
+	}
+	return flags;
+}
+
+static int get_boot_id(char *buf, size_t len)
+{
+	if (lxc_read_from_file("/proc/sys/kernel/random/boot_id", buf, len - 1) <= 0)
+		return -1;
+	buf[len - 1] = '\0';
+	buf[strcspn(buf, "\n")] = '\0';
+	return 0;
+}
+
+static char *probe_cache_path(void)
+{
+	const char *rundir = get_rundir();
+	char *path;
+	size_t len;
+
+	len = strlen(rundir) + strlen("/lxc/host-probe") + 1;
+	path = malloc(len);
+	if (!path)
+		return NULL;
+	snprintf(path, len, "%s/lxc", rundir);
+	if (mkdir_p(path, 0755) < 0) {
+		free(path);
+		return NULL;
+	}
+	snprintf(path, len, "%s/lxc/host-probe", rundir);
+	return path;
+}
+
+static const struct {
+	const char *key;
+	int *value;
+} probe_keys[] = {
+	{ "reboot_pidns", &probe.reboot_pidns },
+	{ "reboot_pidns_userns", &probe.reboot_pidns_userns },
+	{ "namespaces", &probe.namespaces },
+};
+
+#define NR_PROBE_KEYS (sizeof(probe_keys) / sizeof(probe_keys[0]))
+
+static int load_probe(const char *path, const char *boot_id)
+{
+	char line[128], key[64], value[64];
+	int seen = 0, version = -1, ok = 0, i;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%63s %63s", key, value) != 2)
+			continue;
+		if (strcmp(key, "version") == 0) {
+			version = atoi(value);
+			continue;
+		}
+		if (strcmp(key, "boot_id") == 0) {
+			ok = strcmp(value, boot_id) == 0;
+			continue;
+		}
+		for (i = 0; i < NR_PROBE_KEYS; i++) {
+			if (strcmp(key, probe_keys[i].key) == 0) {
+				*probe_keys[i].value = atoi(value);
+				seen++;
+				break;
+			}
+		}
+	}
+	fclose(f);
+
+	if (version != PROBE_VERSION || !ok || seen != NR_PROBE_KEYS) {
+		memset(&probe, 0, sizeof(probe));
+		return -1;
+	}
+	return 0;
+}
+
+static void save_probe(const char *path, const char *boot_id)
+{
+	char *tmp;
+	FILE *f;
+	int fd, i;
+
+	tmp = alloca(strlen(path) + 8);
+	sprintf(tmp, "%s.XXXXXX", path);
+	fd = mkstemp(tmp);
+	if (fd < 0) {
+		DEBUG("can't cache the host probe in %s: %m", path);
+		return;
+	}
+	fchmod(fd, 0644);
+	f = fdopen(fd, "w");
+	if (!f) {
+		close(fd);
+		unlink(tmp);
+		return;
+	}
+	fprintf(f, "version %d\nboot_id %s\n", PROBE_VERSION, boot_id);
+	for (i = 0; i < NR_PROBE_KEYS; i++)
+		fprintf(f, "%s %d\n", probe_keys[i].key, *probe_keys[i].value);
+	// concurrent starts race to write the same answer, last rename wins
+	if (fclose(f) != 0 || rename(tmp, path) < 0) {
+		DEBUG("can't cache the host probe in %s: %m", path);
+		unlink(tmp);
+	}
+}
+
+static void do_probe(const char *path, const char *boot_id)
+{
+	int complete = 1;
+
+	probe.reboot_pidns = probe_reboot(0);
+	probe.reboot_pidns_userns = probe_reboot(CLONE_NEWUSER);
+	if (probe.reboot_pidns < 0 || probe.reboot_pidns_userns < 0) {
+		complete = 0;
+		if (probe.reboot_pidns < 0)
+			probe.reboot_pidns = 0;
+		if (probe.reboot_pidns_userns < 0)
+			probe.reboot_pidns_userns = 0;
+	}
+	probe.namespaces = probe_namespaces();
+
+	/* don't keep an answer which only reflects a transient failure */
+	if (complete && path && boot_id)
+		save_probe(path, boot_id);
+}
+
+static void host_probe_once(void)
+{
+	char boot_id[64], *path;
+	int have_id;
+
+	have_id = get_boot_id(boot_id, sizeof(boot_id)) == 0;
+	path = probe_cache_path();
+	if (!path || !have_id || load_probe(path, boot_id) < 0) {
+		INFO("probing host capabilities");
+		do_probe(path, have_id ? boot_id : NULL);
+	}
+	free(path);
+}
+
+const struct lxc_host_probe *lxc_host_probe(void)
+{
+	pthread_once(&probe_once, host_probe_once);
+	return &probe;
+}
@@ -0,0 +1,40 @@
+/*
+ * lxc: linux Container library
+ *
+ * Copyright © 2014 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#ifndef __lxc_probe_h
+#define __lxc_probe_h
+
+/*
+ * Properties of the running kernel which don't change until the next
+ * boot.  They are probed once and kept in $rundir/lxc/host-probe, which
+ * is tied to the boot by the kernel's boot_id.
+ */
+struct lxc_host_probe {
+	int reboot_pidns;         // reboot(2) in a child pid ns stops its init
+	int reboot_pidns_userns;  // the same, when also in a new user ns
+	int namespaces;           // CLONE_NEW* flags with a /proc/self/ns entry
+};
+
+/*
+ * Return the probe results, loading or computing them on first use.
+ * Never returns NULL; whatever couldn't be probed reads as unsupported.
+ */
+extern const struct lxc_host_probe *lxc_host_probe(void);
+
+#endif
@@ -26,6 +26,8 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
 
@@ -71,3 +73,76 @@ extern void rtnlmsg_free(struct rtnlmsg *rtnlmsg)
 {
 	free(rtnlmsg);
 }
+
+static __thread struct nl_handler route_nlh = { .fd = -1 };
+static __thread pid_t route_pid;
+static __thread ino_t route_netns;
+static __thread unsigned int route_gen;
+static unsigned int route_forgotten;
+static pthread_key_t route_key;
+static pthread_once_t route_once = PTHREAD_ONCE_INIT;
+
+/* drop the cached socket, which may no longer be ours to close */
+static void route_handle_drop(struct nl_handler *nlh)
+{
+	if (route_gen != __sync_fetch_and_add(&route_forgotten, 0))
+		nlh->fd = -1;
+	netlink_close(nlh);
+}
+
+static void route_handle_free(void *nlh)
+{
+	route_handle_drop(nlh);
+}
+
+static void route_key_create(void)
+{
+	pthread_key_create(&route_key, route_handle_free);
+}
+
+/* the network namespace of the calling thread, or 0 if we can't tell */
+static ino_t current_netns(void)
+{
+	struct stat st;
+
+	if (stat("/proc/thread-self/ns/net", &st) < 0 &&
+	    stat("/proc/self/ns/net", &st) < 0)
+		return 0;
+	return st.st_ino;
+}
+
+extern struct nl_handler *rtnetlink_handle(void)
+{
+	pid_t pid = getpid();
+	ino_t netns = current_netns();
+	int err;
+
+	if (route_nlh.fd >= 0 && route_pid == pid && route_netns == netns &&
+	    route_gen == __sync_fetch_and_add(&route_forgotten, 0))
+		return &route_nlh;
+
+	/* a socket inherited across fork is shared with the parent */
+	if (route_nlh.fd >= 0)
+		route_handle_drop(&route_nlh);
+
+	err = netlink_open(&route_nlh, NETLINK_ROUTE);
+	if (err) {
+		if (route_nlh.fd >= 0)
+			close(route_nlh.fd);
+		route_nlh.fd = -1;
+		errno = -err;
+		return NULL;
+	}
+	route_pid = pid;
+	route_netns = netns;
+	route_gen = __sync_fetch_and_add(&route_forgotten, 0);
+
+	pthread_once(&route_once, route_key_create);
+	pthread_setspecific(route_key, &route_nlh);
+	return &route_nlh;
+}
+
+extern void rtnetlink_handle_forget(void)
+{
+	__sync_fetch_and_add(&route_forgotten, 1);
+}
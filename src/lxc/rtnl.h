@@ -107,4 +107,21 @@ void rtnlmsg_free(struct rtnlmsg *rtnlmsg);
  */
 int rtnetlink_transaction(struct rtnl_handler *handler,
 			  struct rtnlmsg *request, struct rtnlmsg *answer);
+
+/*
+ * rtnetlink_handle : get the calling thread's long-lived route netlink
+ *  socket, opened on first use and reopened after a fork or a switch to
+ *  another network namespace.  It is closed when the thread exits; do
+ *  not close it yourself.
+ *
+ * Returns the handler, or NULL with errno set
+ */
+struct nl_handler *rtnetlink_handle(void);
+
+/*
+ * rtnetlink_handle_forget : tell every thread its cached handle's socket
+ *  was closed behind its back, e.g. by lxc_close_inherited(); the next
+ *  rtnetlink_handle() opens a fresh one without touching the old fd.
+ */
+void rtnetlink_handle_forget(void);
 #endif
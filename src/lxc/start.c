@@ -45,6 +45,7 @@
 #include <sys/un.h>
 #include <sys/poll.h>
 #include <sys/syscall.h>
+#include <linux/netlink.h>
 
 #if HAVE_SYS_CAPABILITY_H
 #include <sys/capability.h>
@@ -71,6 +72,9 @@
 #include "lxcseccomp.h"
 #include "caps.h"
 #include "lsm/lsm.h"
+#include "probe.h"
+#include "nl.h"
+#include "rtnl.h"
 
 lxc_log_define(lxc_start, lxc);
 
@@ -95,17 +99,21 @@ static void close_ns(int ns_fd[LXC_NS_MAX]) {
 }
 
 static int preserve_ns(int ns_fd[LXC_NS_MAX], int clone_flags) {
+	const struct lxc_host_probe *probe = lxc_host_probe();
 	int i, saved_errno;
 	char path[MAXPATHLEN];
 
-	if (access("/proc/self/ns", X_OK)) {
-		ERROR("Does this kernel version support 'attach'?");
-		return -1;
-	}
-
 	for (i = 0; i < LXC_NS_MAX; i++)
 		ns_fd[i] = -1;
 
+	for (i = 0; i < LXC_NS_MAX; i++) {
+		if ((clone_flags & ns_info[i].clone_flag) &&
+		    !(probe->namespaces & ns_info[i].clone_flag)) {
+			ERROR("Does this kernel version support 'attach'?");
+			return -1;
+		}
+	}
+
 	for (i = 0; i < LXC_NS_MAX; i++) {
 		if ((clone_flags & ns_info[i].clone_flag) == 0)
 			continue;
@@ -142,54 +150,34 @@ error:
 	return -1;
 }
 
-static int match_fd(int fd)
-{
-	return (fd == 0 || fd == 1 || fd == 2);
-}
-
 int lxc_check_inherited(struct lxc_conf *conf, int fd_to_ignore)
 {
-	struct dirent dirent, *direntp;
-	int fd, fddir;
-	DIR *dir;
+	int keep[2] = { lxc_log_fd, fd_to_ignore };
+	int *fds, n, i, ret;
+
+	if (conf->close_all_fds) {
+		ret = lxc_close_inherited(keep, 2, false);
+		/* even a partial sweep may have taken the netlink socket */
+		rtnetlink_handle_forget();
+		if (ret < 0) {
+			WARN("failed to close inherited fds: %m");
+			return -1;
+		}
+		INFO("closed inherited fds");
+		return 0;
+	}
 
-restart:
-	dir = opendir("/proc/self/fd");
-	if (!dir) {
+	n = lxc_inherited_fds(&fds);
+	if (n < 0) {
 		WARN("failed to open directory: %m");
 		return -1;
 	}
-
-	fddir = dirfd(dir);
-
-	while (!readdir_r(dir, &dirent, &direntp)) {
-		if (!direntp)
-			break;
-
-		if (!strcmp(direntp->d_name, "."))
-			continue;
-
-		if (!strcmp(direntp->d_name, ".."))
+	for (i = 0; i < n; i++) {
+		if (fds[i] == lxc_log_fd || fds[i] == fd_to_ignore)
 			continue;
-
-		fd = atoi(direntp->d_name);
-
-		if (fd == fddir || fd == lxc_log_fd || fd == fd_to_ignore)
-			continue;
-
-		if (match_fd(fd))
-			continue;
-
-		if (conf->close_all_fds) {
-			close(fd);
-			closedir(dir);
-			INFO("closed inherited fd %d", fd);
-			goto restart;
-		}
-		WARN("inherited fd %d", fd);
+		WARN("inherited fd %d", fds[i]);
 	}
-
-	closedir(dir); /* cannot fail */
+	free(fds);
 	return 0;
 }
 
@@ -344,6 +332,17 @@ struct lxc_handler *lxc_init(const char *name, struct lxc_conf *conf, const char
 	handler->lxcpath = lxcpath;
 	handler->pinfd = -1;
 
+	/* only a container being started needs one */
+	if (!conf->start_trace)
+		conf->start_trace = malloc(sizeof(*conf->start_trace));
+	if (!conf->start_trace) {
+		ERROR("failed to allocate memory");
+		free(handler);
+		return NULL;
+	}
+	lxc_trace_reset(conf->start_trace);
+	lxc_trace_mark(conf->start_trace, "init");
+
 	lsm_init();
 
 	handler->name = strdup(name);
@@ -360,6 +359,13 @@ struct lxc_handler *lxc_init(const char *name, struct lxc_conf *conf, const char
 		goto out_close_maincmd_fd;
 	}
 
+	/* compiled here so that it outlives this start and is reused by the
+	 * next one, lxc_setup() only recompiles if the fstab changed since */
+	if (lxc_mount_plan_compile(conf, name)) {
+		ERROR("failed to compile the mounts for '%s'", name);
+		goto out_close_maincmd_fd;
+	}
+
 	/* Begin by setting the state to STARTING */
 	if (lxc_set_state(name, handler, STARTING)) {
 		ERROR("failed to set state '%s'", lxc_state2str(STARTING));
@@ -391,6 +397,7 @@ struct lxc_handler *lxc_init(const char *name, struct lxc_conf *conf, const char
 		ERROR("failed to run pre-start hooks for container '%s'.", name);
 		goto out_aborting;
 	}
+	lxc_trace_mark(conf->start_trace, "hook.pre-start");
 
 	if (lxc_create_tty(name, conf)) {
 		ERROR("failed to create the ttys");
@@ -416,6 +423,7 @@ struct lxc_handler *lxc_init(const char *name, struct lxc_conf *conf, const char
 		ERROR("Failed to shift tty into container");
 		goto out_restore_sigmask;
 	}
+	lxc_trace_mark(conf->start_trace, "console");
 
 	INFO("'%s' is initialized", name);
 	return handler;
@@ -474,71 +482,18 @@ void lxc_abort(const char *name, struct lxc_handler *handler)
 	while ((ret = waitpid(-1, &status, 0)) > 0) ;
 }
 
-#include <sys/reboot.h>
-#include <linux/reboot.h>
-
 /*
- * reboot(LINUX_REBOOT_CMD_CAD_ON) will return -EINVAL
- * in a child pid namespace if container reboot support exists.
- * Otherwise, it will either succeed or return -EPERM.
+ * Whether the kernel reports a reboot(2) in the container's pid namespace
+ * to us is a property of the kernel, so it comes from the host probe cache
+ * rather than a fresh clone on every start.
  */
-static int container_reboot_supported(void *arg)
-{
-        int *cmd = arg;
-	int ret;
-
-        ret = reboot(*cmd);
-	if (ret == -1 && errno == EINVAL)
-		return 1;
-	return 0;
-}
-
 static int must_drop_cap_sys_boot(struct lxc_conf *conf)
 {
-	FILE *f;
-	int ret, cmd, v, flags;
-        long stack_size = 4096;
-        void *stack = alloca(stack_size);
-        int status;
-        pid_t pid;
-
-	f = fopen("/proc/sys/kernel/ctrl-alt-del", "r");
-	if (!f) {
-		DEBUG("failed to open /proc/sys/kernel/ctrl-alt-del");
-		return 1;
-	}
-
-	ret = fscanf(f, "%d", &v);
-	fclose(f);
-	if (ret != 1) {
-		DEBUG("Failed to read /proc/sys/kernel/ctrl-alt-del");
-		return 1;
-	}
-	cmd = v ? LINUX_REBOOT_CMD_CAD_ON : LINUX_REBOOT_CMD_CAD_OFF;
-
-	flags = CLONE_NEWPID | SIGCHLD;
-	if (!lxc_list_empty(&conf->id_map))
-		flags |= CLONE_NEWUSER;
-
-#ifdef __ia64__
-        pid = __clone2(container_reboot_supported, stack, stack_size, flags,  &cmd);
-#else
-        stack += stack_size;
-        pid = clone(container_reboot_supported, stack, flags, &cmd);
-#endif
-        if (pid < 0) {
-                SYSERROR("failed to clone\n");
-                return -1;
-        }
-        if (wait(&status) < 0) {
-                SYSERROR("unexpected wait error: %m\n");
-                return -1;
-        }
-
-	if (WEXITSTATUS(status) != 1)
-		return 1;
+	const struct lxc_host_probe *probe = lxc_host_probe();
 
-	return 0;
+	if (lxc_list_empty(&conf->id_map))
+		return !probe->reboot_pidns;
+	return !probe->reboot_pidns_userns;
 }
 
 static int do_start(void *data)
@@ -563,6 +518,7 @@ static int do_start(void *data)
 	}
 
 	lxc_sync_fini_parent(handler);
+	lxc_trace_enter_child(handler->conf->start_trace);
 
 	/* don't leak the pinfd to the container */
 	if (handler->pinfd >= 0) {
@@ -574,6 +530,7 @@ static int do_start(void *data)
 	 */
 	if (lxc_sync_barrier_parent(handler, LXC_SYNC_CONFIGURE))
 		return -1;
+	lxc_trace_mark(handler->conf->start_trace, "sync.configure");
 
 	/*
 	 * if we are in a new user namespace, become root there to have
@@ -610,6 +567,7 @@ static int do_start(void *data)
 	/* ask father to setup cgroups and wait for him to finish */
 	if (lxc_sync_barrier_parent(handler, LXC_SYNC_CGROUP))
 		return -1;
+	lxc_trace_mark(handler->conf->start_trace, "sync.cgroup");
 
 	/* Set the label to change to when we exec(2) the container's init */
 	if (!strcmp(lsm_name(), "AppArmor"))
@@ -622,11 +580,13 @@ static int do_start(void *data)
 
 	if (lxc_seccomp_load(handler->conf) != 0)
 		goto out_warn_father;
+	lxc_trace_mark(handler->conf->start_trace, "lsm");
 
 	if (run_lxc_hooks(handler->name, "start", handler->conf, handler->lxcpath, NULL)) {
 		ERROR("failed to run start hooks for container '%s'.", handler->name);
 		goto out_warn_father;
 	}
+	lxc_trace_mark(handler->conf->start_trace, "hook.start");
 
 	/* The clearenv() and putenv() calls have been moved here
 	 * to allow us to use enviroment variables passed to the various
@@ -645,6 +605,14 @@ static int do_start(void *data)
 
 	close(handler->sigfd);
 
+	lxc_trace_mark(handler->conf->start_trace, "exec");
+	if (lxc_sync_send_trace(handler))
+		goto out_warn_father;
+
+	/* a zygote waits here, fully set up, until it is given its init */
+	if (handler->conf->zygote && lxc_sync_zygote_park(handler))
+		goto out_warn_father;
+
 	/* after this call, we are in error because this
 	 * ops should not return as it execs */
 	handler->ops->start(handler, handler->data);
@@ -686,6 +654,24 @@ int save_phys_nics(struct lxc_conf *conf)
 	return 0;
 }
 
+/* the container's init has exec'd: tell everyone it is running */
+static int lxc_spawn_finish(struct lxc_handler *handler)
+{
+	if (handler->ops->post_start(handler, handler->data))
+		return -1;
+
+	if (lxc_set_state(handler->name, handler, RUNNING)) {
+		ERROR("failed to set state to %s",
+			      lxc_state2str(RUNNING));
+		return -1;
+	}
+	lxc_trace_mark(handler->conf->start_trace, "running");
+	if (handler->conf->print_start_trace)
+		lxc_trace_print(stderr, handler->conf->start_trace->entries,
+				handler->conf->start_trace->nr);
+	return 0;
+}
+
 int lxc_spawn(struct lxc_handler *handler)
 {
 	int failed_before_rename = 0;
@@ -732,6 +718,7 @@ int lxc_spawn(struct lxc_handler *handler)
 				lxc_sync_fini(handler);
 				return -1;
 			}
+			lxc_trace_mark(handler->conf->start_trace, "network.create");
 		}
 
 		if (save_phys_nics(handler->conf)) {
@@ -778,6 +765,7 @@ int lxc_spawn(struct lxc_handler *handler)
 		ERROR("failed to create cgroups for '%s'", name);
 		goto out_delete_net;
 	}
+	lxc_trace_mark(handler->conf->start_trace, "cgroup.create");
 
 	/*
 	 * if the rootfs is not a blockdev, prevent the container from
@@ -799,6 +787,7 @@ int lxc_spawn(struct lxc_handler *handler)
 	}
 
 	attach_ns(saved_ns_fd);
+	lxc_trace_mark(handler->conf->start_trace, "clone");
 
 	lxc_sync_fini_child(handler);
 
@@ -820,6 +809,7 @@ int lxc_spawn(struct lxc_handler *handler)
 
 	if (lxc_cgroup_enter(handler->cgroup, handler->pid, false) < 0)
 		goto out_delete_net;
+	lxc_trace_mark(handler->conf->start_trace, "cgroup.setup");
 
 	if (failed_before_rename)
 		goto out_delete_net;
@@ -830,6 +820,7 @@ int lxc_spawn(struct lxc_handler *handler)
 			ERROR("failed to create the configured network");
 			goto out_delete_net;
 		}
+		lxc_trace_mark(handler->conf->start_trace, "network.assign");
 	}
 
 	/* map the container uids - the container became an invalid
@@ -841,6 +832,7 @@ int lxc_spawn(struct lxc_handler *handler)
 		ERROR("failed to set up id mapping");
 		goto out_delete_net;
 	}
+	lxc_trace_mark(handler->conf->start_trace, "idmap");
 
 	/* Tell the child to continue its initialization.  we'll get
 	 * LXC_SYNC_CGROUP when it is ready for us to setup cgroups
@@ -852,28 +844,33 @@ int lxc_spawn(struct lxc_handler *handler)
 		ERROR("failed to setup the devices cgroup for '%s'", name);
 		goto out_delete_net;
 	}
+	lxc_trace_mark(handler->conf->start_trace, "cgroup.devices");
 
 	/* Tell the child to complete its initialization and wait for
-	 * it to exec or return an error.  (the child will never
-	 * return LXC_SYNC_POST_CGROUP+1.  It will either close the
-	 * sync pipe, causing lxc_sync_barrier_child to return
-	 * success, or return a different value, causing us to error
-	 * out).
+	 * it to exec or return an error.  (the child sends its part of
+	 * the start trace and then either closes the sync pipe by
+	 * exec'ing, causing lxc_sync_recv_trace to return success, or
+	 * returns a different value, causing us to error out).
 	 */
-	if (lxc_sync_barrier_child(handler, LXC_SYNC_POST_CGROUP))
+	if (lxc_sync_wake_child(handler, LXC_SYNC_POST_CGROUP))
+		return -1;
+	if (lxc_sync_recv_trace(handler))
 		return -1;
 
 	if (detect_shared_rootfs())
 		umount2(handler->conf->rootfs.mount, MNT_DETACH);
 
-	if (handler->ops->post_start(handler, handler->data))
-		goto out_abort;
+	/* a zygote stays STARTING, with the sync socket kept open, until
+	 * lxc_zygote_release() lets it exec */
+	if (handler->conf->zygote) {
+		lxc_trace_mark(handler->conf->start_trace, "zygote.parked");
+		INFO("'%s' is parked, waiting to be released", name);
+		lxc_cgroup_put_meta(cgroup_meta);
+		return 0;
+	}
 
-	if (lxc_set_state(name, handler, RUNNING)) {
-		ERROR("failed to set state to %s",
-			      lxc_state2str(RUNNING));
+	if (lxc_spawn_finish(handler))
 		goto out_abort;
-	}
 
 	lxc_cgroup_put_meta(cgroup_meta);
 	lxc_sync_fini(handler);
@@ -895,6 +892,36 @@ out_abort:
 	return -1;
 }
 
+/*
+ * Hand a parked zygote the command line to exec as its init (NUL
+ * separated strings, or none to use the one it was started with) and
+ * finish the start.  Called from the command handler of the monitor.
+ */
+int lxc_zygote_release(struct lxc_handler *handler, const char *args, int len)
+{
+	if (!handler->conf->zygote || handler->sv[1] < 0) {
+		ERROR("'%s' is not a parked zygote", handler->name);
+		return -EINVAL;
+	}
+
+	lxc_trace_mark(handler->conf->start_trace, "zygote.release");
+	handler->conf->zygote = 0;
+	if (lxc_sync_zygote_release(handler, args, len))
+		goto out_abort;
+	lxc_sync_fini(handler);
+
+	if (lxc_spawn_finish(handler))
+		goto out_abort;
+	return 0;
+
+out_abort:
+	/* the mainloop sees it die and tears the container down */
+	lxc_set_state(handler->name, handler, ABORTING);
+	kill(handler->pid, SIGKILL);
+	lxc_sync_fini(handler);
+	return -1;
+}
+
 int __lxc_start(const char *name, struct lxc_conf *conf,
 		struct lxc_operations* ops, void *data, const char *lxcpath)
 {
@@ -984,11 +1011,12 @@ struct start_args {
 static int start(struct lxc_handler *handler, void* data)
 {
 	struct start_args *arg = data;
+	char *const *argv = handler->zygote_argv ? handler->zygote_argv : arg->argv;
 
-	NOTICE("exec'ing '%s'", arg->argv[0]);
+	NOTICE("exec'ing '%s'", argv[0]);
 
-	execvp(arg->argv[0], arg->argv);
-	SYSERROR("failed to exec %s", arg->argv[0]);
+	execvp(argv[0], argv);
+	SYSERROR("failed to exec %s", argv[0]);
 	return 0;
 }
 
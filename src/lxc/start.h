@@ -71,6 +71,7 @@ struct lxc_handler {
 	int pinfd;
 	const char *lxcpath;
 	struct cgroup_process_info *cgroup;
+	char **zygote_argv;	/* child only: command line given on release */
 };
 
 extern struct lxc_handler *lxc_init(const char *name, struct lxc_conf *, const char *);
@@ -80,6 +81,8 @@ extern int lxc_poll(const char *name, struct lxc_handler *handler);
 extern void lxc_abort(const char *name, struct lxc_handler *handler);
 extern int lxc_set_state(const char *, struct lxc_handler *, lxc_state_t);
 extern int lxc_check_inherited(struct lxc_conf *conf, int fd_to_ignore);
+extern int lxc_zygote_release(struct lxc_handler *handler, const char *args,
+			      int len);
 int __lxc_start(const char *, struct lxc_conf *, struct lxc_operations *,
 		void *, const char *);
 
@@ -0,0 +1,135 @@
+/*
+ * lxc: linux Container library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "strlist.h"
+
+#define STRLIST_BUCKETS	4096	/* a power of two */
+
+static struct lxc_strlist *strlist_table[STRLIST_BUCKETS];
+static pthread_mutex_t strlist_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int strlist_equal(const struct lxc_strlist *a,
+			 const struct lxc_strlist *b)
+{
+	size_t i;
+
+	if (a->hash != b->hash || a->count != b->count)
+		return 0;
+	for (i = 0; i < a->count; i++)
+		if (strcmp(a->items[i], b->items[i]))
+			return 0;
+	return 1;
+}
+
+/*
+ * Build the list of the count strings in items, with item at index
+ * replacing or, at count, following them, and return the interned copy.
+ */
+static struct lxc_strlist *strlist_make(char *const *items, size_t count,
+					size_t index, const char *item)
+{
+	struct lxc_strlist *l, *old, **bucket;
+	size_t i, n, size, total;
+	unsigned int hash = 2166136261u;
+	const char *s;
+	char *p;
+
+	total = index == count ? count + 1 : count;
+	size = sizeof(*l) + total * sizeof(char *);
+	for (i = 0; i < total; i++)
+		size += strlen(i == index ? item : items[i]) + 1;
+
+	l = malloc(size);
+	if (!l)
+		return NULL;
+	l->refcount = 1;
+	l->count = total;
+	p = (char *)&l->items[total];
+	for (i = 0; i < total; i++) {
+		s = i == index ? item : items[i];
+		n = strlen(s) + 1;
+		memcpy(p, s, n);
+		l->items[i] = p;
+		for (; n; n--)
+			hash = (hash ^ (unsigned char)*p++) * 16777619u;
+	}
+	l->hash = hash;
+
+	pthread_mutex_lock(&strlist_mutex);
+	bucket = &strlist_table[hash & (STRLIST_BUCKETS - 1)];
+	for (old = *bucket; old; old = old->next) {
+		if (strlist_equal(old, l)) {
+			old->refcount++;
+			pthread_mutex_unlock(&strlist_mutex);
+			free(l);
+			return old;
+		}
+	}
+	l->next = *bucket;
+	*bucket = l;
+	pthread_mutex_unlock(&strlist_mutex);
+	return l;
+}
+
+struct lxc_strlist *lxc_strlist_append(struct lxc_strlist *l,
+				       const char *item)
+{
+	struct lxc_strlist *new;
+	size_t count = lxc_strlist_len(l);
+
+	new = strlist_make(l ? l->items : NULL, count, count, item);
+	if (new)
+		lxc_strlist_put(l);
+	return new;
+}
+
+struct lxc_strlist *lxc_strlist_set(struct lxc_strlist *l, size_t index,
+				    const char *item)
+{
+	struct lxc_strlist *new;
+
+	if (index >= lxc_strlist_len(l))
+		return NULL;
+	new = strlist_make(l->items, l->count, index, item);
+	if (new)
+		lxc_strlist_put(l);
+	return new;
+}
+
+void lxc_strlist_put(struct lxc_strlist *l)
+{
+	struct lxc_strlist **p;
+
+	if (!l)
+		return;
+
+	pthread_mutex_lock(&strlist_mutex);
+	if (--l->refcount) {
+		pthread_mutex_unlock(&strlist_mutex);
+		return;
+	}
+	p = &strlist_table[l->hash & (STRLIST_BUCKETS - 1)];
+	while (*p != l)
+		p = &(*p)->next;
+	*p = l->next;
+	pthread_mutex_unlock(&strlist_mutex);
+	free(l);
+}
@@ -0,0 +1,58 @@
+/*
+ * lxc: linux Container library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#ifndef _strlist_h
+#define _strlist_h
+
+#include <stddef.h>
+
+/*
+ * An immutable, interned list of strings, in one allocation.  Equal lists
+ * are the same object, so the lxc.cap.drop or lxc.hook.* lists of
+ * containers made from one template are held once, however many of them
+ * are loaded.  Changing a list makes a new one and lets go of the old.
+ * NULL is the empty list.
+ */
+struct lxc_strlist {
+	struct lxc_strlist *next;	/* in the intern table */
+	unsigned int refcount;
+	unsigned int hash;
+	size_t count;
+	char *items[];			/* the strings follow the array */
+};
+
+static inline size_t lxc_strlist_len(const struct lxc_strlist *l)
+{
+	return l ? l->count : 0;
+}
+
+#define lxc_strlist_for_each(item, l, i)				\
+	for ((i) = 0; (i) < lxc_strlist_len(l) && ((item) = (l)->items[i], 1); (i)++)
+
+/*
+ * Both return the list with item added, or item put at index, and drop
+ * the caller's reference to l.  On failure they return NULL and l is
+ * left as it was.
+ */
+extern struct lxc_strlist *lxc_strlist_append(struct lxc_strlist *l,
+					      const char *item);
+extern struct lxc_strlist *lxc_strlist_set(struct lxc_strlist *l,
+					   size_t index, const char *item);
+
+extern void lxc_strlist_put(struct lxc_strlist *l);
+
+#endif
@@ -26,9 +26,16 @@
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
 
 #include "log.h"
+#include "commands.h"
 #include "start.h"
+#include "conf.h"
+#include "sync.h"
+#include "utils.h"
 
 lxc_log_define(lxc_sync, lxc);
 
@@ -97,6 +104,134 @@ int lxc_sync_wake_child(struct lxc_handler *handler, int sequence)
 	return __sync_wake(handler->sv[1], sequence);
 }
 
+/*
+ * Called by the child right before it execs: hand the phases it recorded
+ * over to the parent, which is waiting in lxc_sync_recv_trace().
+ */
+int lxc_sync_send_trace(struct lxc_handler *handler)
+{
+	struct lxc_start_trace *t = handler->conf->start_trace;
+	int n = t->nr - t->child_first;
+	size_t len = n * sizeof(struct lxc_trace_entry);
+
+	if (__sync_wake(handler->sv[0], LXC_SYNC_TRACE))
+		return -1;
+	if (lxc_write_nointr(handler->sv[0], &n, sizeof(n)) != sizeof(n) ||
+	    lxc_write_nointr(handler->sv[0], &t->entries[t->child_first], len) != len) {
+		ERROR("failed to send the start trace : %m");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Called by the parent after LXC_SYNC_POST_CGROUP: merge the child's
+ * trace, then wait for the child to exec (which closes the socket), to
+ * park as a zygote (LXC_SYNC_ZYGOTE) or to report an error.
+ */
+int lxc_sync_recv_trace(struct lxc_handler *handler)
+{
+	struct lxc_trace_entry e[LXC_TRACE_MAX];
+	int fd = handler->sv[1], sync = -1, n;
+	ssize_t ret;
+
+	ret = lxc_read_nointr(fd, &sync, sizeof(sync));
+	if (ret < 0) {
+		ERROR("sync wait failure : %m");
+		return -1;
+	}
+	if (!ret)
+		return 0;
+	if (sync != LXC_SYNC_TRACE) {
+		ERROR("invalid sequence number %d. expected %d",
+		      sync, LXC_SYNC_TRACE);
+		return -1;
+	}
+
+	if (lxc_read_nointr(fd, &n, sizeof(n)) != sizeof(n) ||
+	    n < 0 || n > LXC_TRACE_MAX) {
+		ERROR("bad start trace from the child");
+		return -1;
+	}
+	if (lxc_read_nointr(fd, e, n * sizeof(e[0])) != n * sizeof(e[0])) {
+		ERROR("failed to receive the start trace : %m");
+		return -1;
+	}
+	lxc_trace_merge(handler->conf->start_trace, e, n);
+
+	return __sync_wait(fd, LXC_SYNC_ZYGOTE);
+}
+
+/*
+ * Called by a zygote child instead of exec'ing: tell the parent we are
+ * parked and block until lxc_sync_zygote_release() hands us the command
+ * line to run, as NUL separated strings.  An empty command line keeps
+ * the one we were started with.
+ */
+int lxc_sync_zygote_park(struct lxc_handler *handler)
+{
+	int fd = handler->sv[0], len, argc = 0, i;
+	char *buf, *p;
+	char **argv;
+
+	if (__sync_wake(fd, LXC_SYNC_ZYGOTE))
+		return -1;
+
+	if (lxc_read_nointr(fd, &len, sizeof(len)) != sizeof(len) ||
+	    len < 0 || len > LXC_CMD_DATA_MAX) {
+		ERROR("bad zygote release from the parent");
+		return -1;
+	}
+	if (!len)
+		return 0;
+
+	buf = malloc(len + 1);
+	if (!buf) {
+		ERROR("failed to allocate memory");
+		return -1;
+	}
+	if (lxc_read_nointr(fd, buf, len) != len) {
+		ERROR("failed to receive the zygote command line : %m");
+		free(buf);
+		return -1;
+	}
+	buf[len] = '\0';
+
+	for (i = 0; i < len; i++)
+		if (!buf[i] || i == len - 1)
+			argc++;
+	argv = malloc((argc + 1) * sizeof(*argv));
+	if (!argv) {
+		ERROR("failed to allocate memory");
+		free(buf);
+		return -1;
+	}
+	for (i = 0, p = buf; i < argc; i++, p += strlen(p) + 1)
+		argv[i] = p;
+	argv[argc] = NULL;
+
+	handler->zygote_argv = argv;
+	return 0;
+}
+
+/*
+ * Called by the parent to release a parked zygote child with the given
+ * command line, then wait for it to exec or report an error.
+ */
+int lxc_sync_zygote_release(struct lxc_handler *handler, const char *args,
+			    int len)
+{
+	int fd = handler->sv[1];
+
+	if (lxc_write_nointr(fd, &len, sizeof(len)) != sizeof(len) ||
+	    (len && lxc_write_nointr(fd, args, len) != len)) {
+		ERROR("failed to release the zygote : %m");
+		return -1;
+	}
+
+	return __sync_wait(fd, LXC_SYNC_ZYGOTE + 1);
+}
+
 int lxc_sync_init(struct lxc_handler *handler)
 {
 	int ret;
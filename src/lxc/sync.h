@@ -32,6 +32,8 @@ enum {
 	LXC_SYNC_POST_CGROUP,
 	LXC_SYNC_RESTART,
 	LXC_SYNC_POST_RESTART,
+	LXC_SYNC_TRACE,
+	LXC_SYNC_ZYGOTE,
 };
 
 int lxc_sync_init(struct lxc_handler *handler);
@@ -43,5 +45,9 @@ int lxc_sync_wait_child(struct lxc_handler *, int);
 int lxc_sync_wake_parent(struct lxc_handler *, int);
 int lxc_sync_barrier_parent(struct lxc_handler *, int);
 int lxc_sync_barrier_child(struct lxc_handler *, int);
+int lxc_sync_send_trace(struct lxc_handler *);
+int lxc_sync_recv_trace(struct lxc_handler *);
+int lxc_sync_zygote_park(struct lxc_handler *);
+int lxc_sync_zygote_release(struct lxc_handler *, const char *, int);
 
 #endif
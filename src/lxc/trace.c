@@ -0,0 +1,101 @@
+/*
+ * lxc: linux Container library
+ *
+ * Copyright © 2014 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+#include "trace.h"
+
+lxc_log_define(lxc_trace, lxc);
+
+void lxc_trace_reset(struct lxc_start_trace *t)
+{
+	t->nr = 0;
+	t->in_child = 0;
+	t->child_first = 0;
+}
+
+void lxc_trace_mark(struct lxc_start_trace *t, const char *phase)
+{
+	struct lxc_trace_entry *e;
+	struct timespec ts;
+
+	if (t->nr >= LXC_TRACE_MAX)
+		return;
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		return;
+
+	e = &t->entries[t->nr++];
+	e->ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	strncpy(e->phase, phase, LXC_TRACE_NAMELEN - 1);
+	e->phase[LXC_TRACE_NAMELEN - 1] = '\0';
+	e->child = t->in_child;
+}
+
+void lxc_trace_enter_child(struct lxc_start_trace *t)
+{
+	t->in_child = 1;
+	t->child_first = t->nr;
+}
+
+int lxc_trace_merge(struct lxc_start_trace *t,
+		    const struct lxc_trace_entry *e, int n)
+{
+	struct lxc_trace_entry tmp;
+	int i, j;
+
+	if (n < 0 || n > LXC_TRACE_MAX - t->nr) {
+		ERROR("start trace too long (%d entries)", n);
+		return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		tmp = e[i];
+		tmp.phase[LXC_TRACE_NAMELEN - 1] = '\0';
+		tmp.child = 1;
+		// insertion sort, both sides are already in order
+		for (j = t->nr; j > 0 && t->entries[j-1].ns > tmp.ns; j--)
+			t->entries[j] = t->entries[j-1];
+		t->entries[j] = tmp;
+		t->nr++;
+	}
+	return 0;
+}
+
+void lxc_trace_print(FILE *f, const struct lxc_trace_entry *e, int n)
+{
+	uint64_t prev;
+	int i;
+
+	if (n <= 0)
+		return;
+
+	fprintf(f, "%-*s %-9s %10s %10s\n", LXC_TRACE_NAMELEN, "phase",
+		"side", "at (ms)", "delta (ms)");
+	prev = e[0].ns;
+	for (i = 0; i < n; i++) {
+		fprintf(f, "%-*s %-9s %10.3f %10.3f\n", LXC_TRACE_NAMELEN,
+			e[i].phase, e[i].child ? "container" : "monitor",
+			(e[i].ns - e[0].ns) / 1000000.0,
+			(e[i].ns - prev) / 1000000.0);
+		prev = e[i].ns;
+	}
+}
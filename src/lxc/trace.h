@@ -0,0 +1,57 @@
+/*
+ * lxc: linux Container library
+ *
+ * Copyright © 2014 Canonical Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+#ifndef __lxc_trace_h
+#define __lxc_trace_h
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define LXC_TRACE_MAX 64
+#define LXC_TRACE_NAMELEN 24
+
+/*
+ * One start phase.  ns is the CLOCK_MONOTONIC time at which the phase
+ * ended, which is comparable between the monitor and the container's
+ * init as long as they share a host.
+ */
+struct lxc_trace_entry {
+	uint64_t ns;
+	char phase[LXC_TRACE_NAMELEN];
+	int child;  // recorded in the container's init before exec
+};
+
+struct lxc_start_trace {
+	int nr;
+	int in_child;
+	int child_first;  // first entry recorded by the child
+	struct lxc_trace_entry entries[LXC_TRACE_MAX];
+};
+
+extern void lxc_trace_reset(struct lxc_start_trace *t);
+/* record the end of a phase; entries past LXC_TRACE_MAX are dropped */
+extern void lxc_trace_mark(struct lxc_start_trace *t, const char *phase);
+/* called in the child right after clone */
+extern void lxc_trace_enter_child(struct lxc_start_trace *t);
+/* add the child's entries, keeping the trace in time order */
+extern int lxc_trace_merge(struct lxc_start_trace *t,
+			   const struct lxc_trace_entry *e, int n);
+extern void lxc_trace_print(FILE *f, const struct lxc_trace_entry *e, int n);
+
+#endif
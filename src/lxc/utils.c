@@ -38,7 +38,10 @@
 #include <libgen.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/file.h>
+#include <sys/syscall.h>
 #include <assert.h>
+#include <pthread.h>
 
 #ifndef HAVE_GETLINE
 #ifdef HAVE_FGETLN
@@ -54,22 +57,120 @@
 
 lxc_log_define(lxc_utils, lxc);
 
-static int _recursive_rmdir_onedev(char *dirname, dev_t pdev)
+/*
+ * lxc_rmdir_onedev() removes a tree with a handful of threads sharing a
+ * queue of directories.  A directory is only rmdir'ed once it has been
+ * scanned and all its subdirectories are gone, so every job counts what is
+ * still pending below it.  Entries are removed relative to their parent's
+ * fd, and d_type saves stat'ing everything but directories, whose device
+ * is checked when they are opened.
+ */
+#define RMDIR_MAX_THREADS 8
+
+struct rmdir_job {
+	struct rmdir_job *parent;
+	struct rmdir_job *next;
+	int fd;		/* open while being scanned or while subdirs are pending */
+	int pending;	/* the scan itself plus each subdir not yet removed */
+	bool remove;	/* false if the dir is to be left alone */
+	char name[];	/* relative to parent->fd, full path for the top */
+};
+
+struct rmdir_state {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct rmdir_job *queue;
+	int busy;	/* workers currently scanning a directory */
+	dev_t dev;
+	int failed;
+};
+
+static struct rmdir_job *rmdir_job_new(struct rmdir_job *parent, const char *name)
+{
+	struct rmdir_job *job;
+
+	job = malloc(sizeof(*job) + strlen(name) + 1);
+	if (!job)
+		return NULL;
+	job->parent = parent;
+	job->next = NULL;
+	job->fd = -1;
+	job->pending = 1;
+	job->remove = true;
+	strcpy(job->name, name);
+	return job;
+}
+
+static void rmdir_failed(struct rmdir_state *st)
+{
+	pthread_mutex_lock(&st->lock);
+	st->failed = 1;
+	pthread_mutex_unlock(&st->lock);
+}
+
+static inline int rmdir_parent_fd(struct rmdir_job *job)
+{
+	return job->parent ? job->parent->fd : AT_FDCWD;
+}
+
+/* drop a pending count, and remove the dirs which are now done */
+static void rmdir_job_put(struct rmdir_state *st, struct rmdir_job *job)
+{
+	struct rmdir_job *parent;
+	int left;
+
+	while (job) {
+		pthread_mutex_lock(&st->lock);
+		left = --job->pending;
+		pthread_mutex_unlock(&st->lock);
+		if (left)
+			return;
+
+		parent = job->parent;
+		if (job->fd >= 0)
+			close(job->fd);
+		if (job->remove &&
+		    unlinkat(rmdir_parent_fd(job), job->name, AT_REMOVEDIR) < 0) {
+			SYSERROR("%s: failed to delete %s", __func__, job->name);
+			rmdir_failed(st);
+		}
+		free(job);
+		job = parent;
+	}
+}
+
+static void rmdir_scan(struct rmdir_state *st, struct rmdir_job *job)
 {
 	struct dirent dirent, *direntp;
+	struct stat mystat;
 	DIR *dir;
-	int ret, failed=0;
-	char pathname[MAXPATHLEN];
+	int fd;
 
-	dir = opendir(dirname);
-	if (!dir) {
-		ERROR("%s: failed to open %s", __func__, dirname);
-		return -1;
+	fd = openat(rmdir_parent_fd(job), job->name,
+		    O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &mystat) < 0) {
+		SYSERROR("%s: failed to open %s", __func__, job->name);
+		rmdir_failed(st);
+		goto out;
+	}
+	job->fd = fd;
+	if (mystat.st_dev != st->dev) {
+		job->remove = false;
+		goto out;
+	}
+
+	fd = dup(job->fd);
+	if (fd < 0 || !(dir = fdopendir(fd))) {
+		SYSERROR("%s: failed to open %s", __func__, job->name);
+		if (fd >= 0)
+			close(fd);
+		rmdir_failed(st);
+		goto out;
 	}
 
 	while (!readdir_r(dir, &dirent, &direntp)) {
-		struct stat mystat;
-		int rc;
+		struct rmdir_job *child;
+		bool isdir;
 
 		if (!direntp)
 			break;
@@ -78,56 +179,213 @@ static int _recursive_rmdir_onedev(char *dirname, dev_t pdev)
 		    !strcmp(direntp->d_name, ".."))
 			continue;
 
-		rc = snprintf(pathname, MAXPATHLEN, "%s/%s", dirname, direntp->d_name);
-		if (rc < 0 || rc >= MAXPATHLEN) {
-			ERROR("pathname too long");
-			failed=1;
-			continue;
-		}
-		ret = lstat(pathname, &mystat);
-		if (ret) {
-			ERROR("%s: failed to stat %s", __func__, pathname);
-			failed=1;
+		if (direntp->d_type == DT_UNKNOWN) {
+			if (fstatat(job->fd, direntp->d_name, &mystat,
+				    AT_SYMLINK_NOFOLLOW) < 0) {
+				SYSERROR("%s: failed to stat %s", __func__, direntp->d_name);
+				rmdir_failed(st);
+				continue;
+			}
+			if (mystat.st_dev != st->dev)
+				continue;
+			isdir = S_ISDIR(mystat.st_mode);
+		} else
+			isdir = direntp->d_type == DT_DIR;
+
+		if (isdir) {
+			if (!(child = rmdir_job_new(job, direntp->d_name))) {
+				ERROR("%s: out of memory", __func__);
+				rmdir_failed(st);
+				continue;
+			}
+			pthread_mutex_lock(&st->lock);
+			job->pending++;
+			child->next = st->queue;
+			st->queue = child;
+			pthread_cond_signal(&st->cond);
+			pthread_mutex_unlock(&st->lock);
 			continue;
 		}
-		if (mystat.st_dev != pdev)
-			continue;
-		if (S_ISDIR(mystat.st_mode)) {
-			if (_recursive_rmdir_onedev(pathname, pdev) < 0)
-				failed=1;
-		} else {
-			if (unlink(pathname) < 0) {
-				ERROR("%s: failed to delete %s", __func__, pathname);
-				failed=1;
-			}
+
+		if (unlinkat(job->fd, direntp->d_name, 0) < 0) {
+			// a file bind-mounted from elsewhere is not ours to delete
+			if (errno == EBUSY &&
+			    fstatat(job->fd, direntp->d_name, &mystat,
+				    AT_SYMLINK_NOFOLLOW) == 0 &&
+			    mystat.st_dev != st->dev)
+				continue;
+			SYSERROR("%s: failed to delete %s", __func__, direntp->d_name);
+			rmdir_failed(st);
 		}
 	}
 
-	if (rmdir(dirname) < 0) {
-		ERROR("%s: failed to delete %s", __func__, dirname);
-		failed=1;
+	if (closedir(dir)) {
+		ERROR("%s: failed to close directory %s", __func__, job->name);
+		rmdir_failed(st);
 	}
 
-	ret = closedir(dir);
-	if (ret) {
-		ERROR("%s: failed to close directory %s", __func__, dirname);
-		failed=1;
-	}
+out:
+	rmdir_job_put(st, job);
+}
 
-	return failed ? -1 : 0;
+static void *rmdir_worker(void *arg)
+{
+	struct rmdir_state *st = arg;
+	struct rmdir_job *job;
+
+	pthread_mutex_lock(&st->lock);
+	for (;;) {
+		while (!st->queue && st->busy)
+			pthread_cond_wait(&st->cond, &st->lock);
+		if (!st->queue)
+			break;
+		job = st->queue;
+		st->queue = job->next;
+		st->busy++;
+		pthread_mutex_unlock(&st->lock);
+
+		rmdir_scan(st, job);
+
+		pthread_mutex_lock(&st->lock);
+		st->busy--;
+	}
+	// nothing queued and nobody left to queue more: wake the others
+	pthread_cond_broadcast(&st->cond);
+	pthread_mutex_unlock(&st->lock);
+	return NULL;
 }
 
 /* returns 0 on success, -1 if there were any failures */
 extern int lxc_rmdir_onedev(char *path)
 {
+	struct rmdir_state st;
 	struct stat mystat;
+	pthread_t threads[RMDIR_MAX_THREADS - 1];
+	long ncpus;
+	int i, nthreads = 0;
 
 	if (lstat(path, &mystat) < 0) {
 		ERROR("%s: failed to stat %s", __func__, path);
 		return -1;
 	}
 
-	return _recursive_rmdir_onedev(path, mystat.st_dev);
+	memset(&st, 0, sizeof(st));
+	st.dev = mystat.st_dev;
+	if (!(st.queue = rmdir_job_new(NULL, path))) {
+		ERROR("%s: out of memory", __func__);
+		return -1;
+	}
+	pthread_mutex_init(&st.lock, NULL);
+	pthread_cond_init(&st.cond, NULL);
+
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpus > RMDIR_MAX_THREADS)
+		ncpus = RMDIR_MAX_THREADS;
+	// if we can't get the helpers, we just do all the work ourselves
+	for (i = 0; i < ncpus - 1; i++) {
+		if (pthread_create(&threads[nthreads], NULL, rmdir_worker, &st))
+			break;
+		nthreads++;
+	}
+	rmdir_worker(&st);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_cond_destroy(&st.cond);
+	pthread_mutex_destroy(&st.lock);
+	return st.failed ? -1 : 0;
+}
+
+/*
+ * Remove @path in the background: it is renamed into @trashdir, which must
+ * be on the same filesystem, and a detached child deletes whatever is in
+ * @trashdir, including leftovers of earlier purges which got interrupted.
+ * If @path can't be moved, it is removed synchronously instead.
+ * returns 0 on success, -1 on failure
+ */
+extern int lxc_rmdir_onedev_async(char *path, const char *trashdir)
+{
+	char entry[MAXPATHLEN];
+	int ret, fd;
+	pid_t pid;
+
+	if (mkdir_p(trashdir, 0700) < 0) {
+		ERROR("%s: failed to create %s", __func__, trashdir);
+		return lxc_rmdir_onedev(path);
+	}
+	ret = snprintf(entry, MAXPATHLEN, "%s/XXXXXX", trashdir);
+	if (ret < 0 || ret >= MAXPATHLEN || !mkdtemp(entry))
+		return lxc_rmdir_onedev(path);
+	// rename() happily replaces the empty placeholder directory
+	if (rename(path, entry) < 0) {
+		SYSERROR("%s: failed to move %s to %s", __func__, path, entry);
+		rmdir(entry);
+		return lxc_rmdir_onedev(path);
+	}
+	INFO("moved %s to %s for removal", path, entry);
+
+	pid = fork();
+	if (pid < 0) {
+		SYSERROR("%s: fork", __func__);
+		return lxc_rmdir_onedev(entry);
+	}
+	if (pid > 0)
+		return wait_for_pid(pid);
+
+	setsid();
+	if (fork() != 0)
+		exit(0);
+
+	/*
+	 * Don't hold the caller's locks, sockets or pipes for as long as the
+	 * purge takes; only the log stays, as in lxc_check_inherited().
+	 */
+	lxc_close_inherited(&lxc_log_fd, 1, false);
+	fd = open("/dev/null", O_RDWR);
+	if (fd >= 0) {
+		dup2(fd, STDIN_FILENO);
+		dup2(fd, STDOUT_FILENO);
+		dup2(fd, STDERR_FILENO);
+		if (fd > STDERR_FILENO)
+			close(fd);
+	}
+	exit(lxc_purge_trash(trashdir) < 0 ? 1 : 0);
+}
+
+/*
+ * Delete everything in @trashdir.  Purges of the same trashdir are
+ * serialized with a flock on it.
+ */
+extern int lxc_purge_trash(const char *trashdir)
+{
+	struct dirent dirent, *direntp;
+	char entry[MAXPATHLEN];
+	DIR *dir;
+	int ret, fd, failed = 0;
+
+	fd = open(trashdir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) {
+		SYSERROR("%s: failed to open %s", __func__, trashdir);
+		return -1;
+	}
+	if (flock(fd, LOCK_EX) < 0 || !(dir = fdopendir(fd))) {
+		SYSERROR("%s: failed to lock %s", __func__, trashdir);
+		close(fd);
+		return -1;
+	}
+	while (!readdir_r(dir, &dirent, &direntp)) {
+		if (!direntp)
+			break;
+		if (!strcmp(direntp->d_name, ".") ||
+		    !strcmp(direntp->d_name, ".."))
+			continue;
+		ret = snprintf(entry, MAXPATHLEN, "%s/%s", trashdir, direntp->d_name);
+		if (ret < 0 || ret >= MAXPATHLEN || lxc_rmdir_onedev(entry) < 0)
+			failed = 1;
+	}
+	// closing the fd drops the lock
+	closedir(dir);
+	return failed ? -1 : 0;
 }
 
 static int mount_fs(const char *source, const char *target, const char *type)
@@ -238,6 +496,9 @@ static char *copy_global_config_value(char *p)
 #define DEFAULT_THIN_POOL "lxc"
 #define DEFAULT_ZFSROOT "lxc"
 
+/* published in values[] for an option which is unset and has no default */
+static const char unset_value[] = "";
+
 const char *lxc_global_config_value(const char *option_name)
 {
 	static const char *options[][2] = {
@@ -250,30 +511,18 @@ const char *lxc_global_config_value(const char *option_name)
 		{ NULL, NULL },
 	};
 
-	/* Protected by a mutex to eliminate conflicting load and store operations */
+	/*
+	 * Each value is worked out once and then published with a single
+	 * compare-and-swap, so lookups after that take no lock at all.
+	 */
 	static const char *values[sizeof(options) / sizeof(options[0])] = { 0 };
 
 	char *user_config_path = NULL;
 	char *user_lxc_path = NULL;
-
-	if (geteuid() > 0) {
-		const char *user_home = getenv("HOME");
-		if (!user_home)
-			user_home = "/";
-
-		user_config_path = malloc(sizeof(char) * (22 + strlen(user_home)));
-		user_lxc_path = malloc(sizeof(char) * (19 + strlen(user_home)));
-
-		sprintf(user_config_path, "%s/.config/lxc/lxc.conf", user_home);
-		sprintf(user_lxc_path, "%s/.local/share/lxc/", user_home);
-	}
-	else {
-		user_config_path = strdup(LXC_GLOBAL_CONF);
-		user_lxc_path = strdup(LXCPATH);
-	}
-
 	const char *(*ptr)[2];
 	const char *value;
+	const char *expected = NULL;
+	char *owned = NULL;
 	size_t i;
 	char buf[1024], *p, *p2;
 	FILE *fin = NULL;
@@ -283,21 +532,29 @@ const char *lxc_global_config_value(const char *option_name)
 			break;
 	}
 	if (!(*ptr)[0]) {
-		free(user_config_path);
-		free(user_lxc_path);
 		errno = EINVAL;
 		return NULL;
 	}
 
-	static_lock();
-	if (values[i]) {
-		free(user_config_path);
-		free(user_lxc_path);
-		value = values[i];
-		static_unlock();
-		return value;
+	value = __atomic_load_n(&values[i], __ATOMIC_ACQUIRE);
+	if (value)
+		goto out;
+
+	if (geteuid() > 0) {
+		const char *user_home = getenv("HOME");
+		if (!user_home)
+			user_home = "/";
+
+		user_config_path = malloc(sizeof(char) * (22 + strlen(user_home)));
+		user_lxc_path = malloc(sizeof(char) * (19 + strlen(user_home)));
+
+		sprintf(user_config_path, "%s/.config/lxc/lxc.conf", user_home);
+		sprintf(user_lxc_path, "%s/.local/share/lxc/", user_home);
+	}
+	else {
+		user_config_path = strdup(LXC_GLOBAL_CONF);
+		user_lxc_path = strdup(LXCPATH);
 	}
-	static_unlock();
 
 	fin = fopen_cloexec(user_config_path, "r");
 	free(user_config_path);
@@ -333,35 +590,44 @@ const char *lxc_global_config_value(const char *option_name)
 			while (*p && (*p == ' ' || *p == '\t')) p++;
 			if (!*p)
 				continue;
-			static_lock();
-			values[i] = copy_global_config_value(p);
-			static_unlock();
+			owned = copy_global_config_value(p);
 			free(user_lxc_path);
-			goto out;
+			value = owned;
+			goto publish;
 		}
 	}
 	/* could not find value, use default */
-	static_lock();
-	if (strcmp(option_name, "lxcpath") == 0)
-		values[i] = user_lxc_path;
-	else {
+	if (strcmp(option_name, "lxcpath") == 0) {
+		owned = user_lxc_path;
+		value = owned;
+	} else {
 		free(user_lxc_path);
-		values[i] = (*ptr)[1];
+		value = (*ptr)[1];
 	}
 	/* special case: if default value is NULL,
 	 * and there is no config, don't view that
 	 * as an error... */
-	if (!values[i])
-		errno = 0;
-	static_unlock();
+	if (!value)
+		value = unset_value;
 
-out:
+publish:
 	if (fin)
 		fclose(fin);
+	if (!value)
+		return NULL;
 
-	static_lock();
-	value = values[i];
-	static_unlock();
+	/* another thread may have published first: its value wins */
+	if (!__atomic_compare_exchange_n(&values[i], &expected, value, false,
+					 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		free(owned);
+		value = __atomic_load_n(&values[i], __ATOMIC_ACQUIRE);
+	}
+
+out:
+	if (value == unset_value) {
+		errno = 0;
+		return NULL;
+	}
 	return value;
 }
 
@@ -534,6 +800,13 @@ int sha1sum_file(char *fnam, unsigned char *digest)
 	free(buf);
 	return ret;
 }
+
+int sha1sum_buf(const void *buf, size_t len, unsigned char *digest)
+{
+	if (!buf)
+		return -1;
+	return gnutls_hash_fast(GNUTLS_DIG_SHA1, buf, len, (void *)digest);
+}
 #endif
 
 char** lxc_va_arg_list_to_argv(va_list ap, size_t skip, int do_strdup)
@@ -625,6 +898,107 @@ FILE *fopen_cloexec(const char *path, const char *mode)
 	return ret;
 }
 
+#ifndef __NR_close_range
+#define __NR_close_range 436
+#endif
+
+#ifndef CLOSE_RANGE_CLOEXEC
+#define CLOSE_RANGE_CLOEXEC (1U << 2)
+#endif
+
+int lxc_inherited_fds(int **fdsp)
+{
+	struct dirent dirent, *direntp;
+	int fd, fddir, n = 0, size = 0, *fds = NULL, *tmp;
+	DIR *dir;
+
+	dir = opendir("/proc/self/fd");
+	if (!dir)
+		return -1;
+	fddir = dirfd(dir);
+
+	while (!readdir_r(dir, &dirent, &direntp)) {
+		if (!direntp)
+			break;
+		if (direntp->d_name[0] == '.')
+			continue;
+		fd = atoi(direntp->d_name);
+		if (fd <= 2 || fd == fddir)
+			continue;
+		if (n == size) {
+			size = size ? size * 2 : 64;
+			tmp = realloc(fds, size * sizeof(*fds));
+			if (!tmp) {
+				free(fds);
+				closedir(dir);
+				errno = ENOMEM;
+				return -1;
+			}
+			fds = tmp;
+		}
+		fds[n++] = fd;
+	}
+	closedir(dir);
+
+	*fdsp = fds;
+	return n;
+}
+
+static int cmp_fd(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+static bool fd_in(int fd, const int *keep, int nkeep)
+{
+	int i;
+
+	for (i = 0; i < nkeep; i++)
+		if (keep[i] == fd)
+			return true;
+	return false;
+}
+
+int lxc_close_inherited(const int *keep, int nkeep, bool cloexec)
+{
+	unsigned int flags = cloexec ? CLOSE_RANGE_CLOEXEC : 0;
+	unsigned int from = 3;
+	int sorted[nkeep + 1], i, n = 0, *fds;
+
+	for (i = 0; i < nkeep; i++)
+		if (keep[i] > 2)
+			sorted[n++] = keep[i];
+	qsort(sorted, n, sizeof(int), cmp_fd);
+
+	/* close the gaps between the fds we keep */
+	for (i = 0; i < n; i++) {
+		if (sorted[i] < from)
+			continue;
+		if (sorted[i] > from &&
+		    syscall(__NR_close_range, from, sorted[i] - 1, flags) < 0)
+			goto sweep;
+		from = sorted[i] + 1;
+	}
+	if (syscall(__NR_close_range, from, ~0U, flags) == 0)
+		return 0;
+
+sweep:
+	/* no close_range, or too old for CLOSE_RANGE_CLOEXEC */
+	n = lxc_inherited_fds(&fds);
+	if (n < 0)
+		return -1;
+	for (i = 0; i < n; i++) {
+		if (fd_in(fds[i], keep, nkeep))
+			continue;
+		if (cloexec)
+			fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+		else
+			close(fds[i]);
+	}
+	free(fds);
+	return 0;
+}
+
 extern struct lxc_popen_FILE *lxc_popen(const char *command)
 {
 	struct lxc_popen_FILE *fp = NULL;
@@ -664,6 +1038,9 @@ extern struct lxc_popen_FILE *lxc_popen(const char *command)
 			fcntl(child_end, F_SETFD, 0);
 		}
 
+		/* don't hand the caller's fds to the command */
+		lxc_close_inherited(NULL, 0, false);
+
 		/*
 		 * Unblock signals.
 		 * This is the main/only reason
@@ -675,6 +1052,7 @@ extern struct lxc_popen_FILE *lxc_popen(const char *command)
 			sigprocmask(SIG_UNBLOCK, &mask, NULL);
 		}
 
+		lxc_log_flush();
 		execl("/bin/sh", "sh", "-c", command, (char *) NULL);
 		exit(127);
 	}
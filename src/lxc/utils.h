@@ -32,8 +32,11 @@
 #include <unistd.h>
 #include "config.h"
 
-/* returns 1 on success, 0 if there were any failures */
+/* returns 0 on success, -1 if there were any failures */
 extern int lxc_rmdir_onedev(char *path);
+/* move path into trashdir and delete it in the background */
+extern int lxc_rmdir_onedev_async(char *path, const char *trashdir);
+extern int lxc_purge_trash(const char *trashdir);
 extern void lxc_setup_fs(void);
 extern int get_u16(unsigned short *val, const char *arg, int base);
 extern int mkdir_p(const char *dir, mode_t mode);
@@ -157,6 +160,17 @@ static inline int signalfd(int fd, const sigset_t *mask, int flags)
 /* open a file with O_CLOEXEC */
 FILE *fopen_cloexec(const char *path, const char *mode);
 
+/*
+ * Collect the open fds above stderr in one pass over /proc/self/fd.
+ * Returns their number and an array the caller must free(), or -1.
+ */
+extern int lxc_inherited_fds(int **fdsp);
+/*
+ * Close every fd above stderr except those in keep, or with cloexec just
+ * mark them close-on-exec.  Uses close_range(2) if the kernel has it.
+ */
+extern int lxc_close_inherited(const int *keep, int nkeep, bool cloexec);
+
 
 /* Struct to carry child pid from lxc_popen() to lxc_pclose().
  * Not an opaque struct to allow direct access to the underlying FILE *
@@ -223,6 +237,7 @@ extern ssize_t lxc_read_nointr_expect(int fd, void* buf, size_t count, const voi
 #if HAVE_LIBGNUTLS
 #define SHA_DIGEST_LENGTH 20
 extern int sha1sum_file(char *fnam, unsigned char *md_value);
+extern int sha1sum_buf(const void *buf, size_t len, unsigned char *md_value);
 #endif
 
 /* read and write whole files */
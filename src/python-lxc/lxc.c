@@ -1739,6 +1739,7 @@ PyInit__lxc(void)
 
     /* create: create flags */
     PYLXC_EXPORT_CONST(LXC_CREATE_QUIET);
+    PYLXC_EXPORT_CONST(LXC_CREATE_CACHE);
 
     #undef PYLXC_EXPORT_CONST
 
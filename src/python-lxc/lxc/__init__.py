@@ -460,3 +460,4 @@ LXC_CLONE_SNAPSHOT = _lxc.LXC_CLONE_SNAPSHOT
 
 # create: create flags
 LXC_CREATE_QUIET = _lxc.LXC_CREATE_QUIET
+LXC_CREATE_CACHE = _lxc.LXC_CREATE_CACHE
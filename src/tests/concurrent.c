@@ -22,6 +22,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <fcntl.h>
+#include <time.h>
 #define _GNU_SOURCE
 #include <getopt.h>
 
@@ -31,6 +32,8 @@ static int nthreads = 5;
 static int iterations = 1;
 static int quiet = 0;
 static int delay = 0;
+static int loops = 1000;
+static struct lxc_container *shared;
 static const char *template = "busybox";
 
 static struct option options[] = {
@@ -39,6 +42,7 @@ static struct option options[] = {
     { "template",    required_argument, NULL, 't' },
     { "delay",       required_argument, NULL, 'd' },
     { "modes",       required_argument, NULL, 'm' },
+    { "loops",       required_argument, NULL, 'l' },
     { "quiet",       no_argument,       NULL, 'q' },
     { "help",        no_argument,       NULL, '?' },
     { 0, 0, 0, 0 },
@@ -52,7 +56,10 @@ static void usage(void) {
         "  -i, --iterations=N           Number times to run the test (default: 1)\n"
         "  -t, --template=t             Template to use (default: busybox)\n"
         "  -d, --delay=N                Delay in seconds between start and stop\n"
-        "  -m, --modes=<mode,mode,...>  Modes to run (create, start, stop, destroy)\n"
+        "  -m, --modes=<mode,mode,...>  Modes to run (create, start, stop, destroy,\n"
+        "                               lock)\n"
+        "  -l, --loops=N                Lock operations per thread in lock mode\n"
+        "                               (default: 1000)\n"
         "  -q, --quiet                  Don't produce any output\n"
         "  -?, --help                   Give this help list\n"
         "\n"
@@ -112,6 +119,36 @@ static void do_function(void *arguments)
                 goto out;
             }
         }
+    } else if(strcmp(args->mode, "lock") == 0) {
+        /* needs no container on disk: every thread hammers its own
+         * container's lock, one container shared by all of them and the
+         * global config values */
+        char buf[NAME_MAX+1];
+        int k;
+
+        for (k = 0; k < loops; k++) {
+            if (!lxc_get_default_config_path() || !lxc_get_default_lvm_vg()) {
+                fprintf(stderr, "Reading the global config failed...\n");
+                goto out;
+            }
+            if (!c->set_config_item(c, "lxc.utsname", name) ||
+                c->get_config_item(c, "lxc.utsname", buf, sizeof(buf)) < 0 ||
+                strcmp(buf, name)) {
+                fprintf(stderr, "Config of container (%s) got mixed up...\n", name);
+                goto out;
+            }
+            if (!lxc_container_get(shared)) {
+                fprintf(stderr, "Taking a reference on the shared container failed...\n");
+                goto out;
+            }
+            if (shared->get_config_item(shared, "lxc.utsname", buf, sizeof(buf)) < 0 ||
+                strcmp(buf, "lxc-test-concurrent-shared")) {
+                fprintf(stderr, "Config of the shared container got mixed up...\n");
+                lxc_container_put(shared);
+                goto out;
+            }
+            lxc_container_put(shared);
+        }
     } else if(strcmp(args->mode, "destroy") == 0) {
         if (c->is_defined(c) && !c->is_running(c)) {
             if (!c->destroy(c)) {
@@ -144,7 +181,7 @@ int main(int argc, char *argv[]) {
 
     pthread_attr_init(&attr);
 
-    while ((opt = getopt_long(argc, argv, "j:i:t:d:m:q", options, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "j:i:t:d:m:l:q", options, NULL)) != -1) {
         switch(opt) {
         case 'j':
             nthreads = atoi(optarg);
@@ -158,6 +195,9 @@ int main(int argc, char *argv[]) {
         case 'd':
             delay = atoi(optarg);
             break;
+        case 'l':
+            loops = atoi(optarg);
+            break;
         case 'q':
             quiet = 1;
             break;
@@ -187,6 +227,13 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
+    shared = lxc_container_new("lxc-test-concurrent-shared", NULL);
+    if (!shared || !shared->set_config_item(shared, "lxc.utsname",
+                                            "lxc-test-concurrent-shared")) {
+        fprintf(stderr, "Unable to instantiate the shared container\n");
+        exit(EXIT_FAILURE);
+    }
+
     for (iter = 1; iter <= iterations; iter++) {
         int fd;
         fd = open("/", O_RDONLY);
@@ -195,8 +242,11 @@ int main(int argc, char *argv[]) {
         close(fd);
 
         for (i = 0; modes[i];i++) {
+            struct timespec t0, t1;
+
             if (!quiet)
                 printf("Executing (%s) for %d containers...\n", modes[i], nthreads);
+            clock_gettime(CLOCK_MONOTONIC, &t0);
             for (j = 0; j < nthreads; j++) {
                 args[j].thread_id = j;
                 args[j].mode = modes[i];
@@ -223,9 +273,14 @@ int main(int argc, char *argv[]) {
                     exit(EXIT_FAILURE);
                 }
             }
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            if (!quiet)
+                printf("  took %.3fs\n", (t1.tv_sec - t0.tv_sec) +
+                       (t1.tv_nsec - t0.tv_nsec) / 1e9);
         }
     }
 
+    lxc_container_put(shared);
     free(args);
     free(threads);
     pthread_attr_destroy(&attr);
@@ -0,0 +1,148 @@
+/* configcache.c
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Rewrite a container's config in place with content of the same size,
+ * in the same timestamp tick as its compiled config cache was written,
+ * and check that the next load does not replay the cache of the old
+ * content.  The tick is made up by setting the times by hand.
+ */
+#include <lxc/lxccontainer.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#define MYNAME "lxctest-configcache"
+
+#define TSTERR(fmt, ...) do { \
+	fprintf(stderr, "%s:%d " fmt "\n", __FILE__, __LINE__, ##__VA_ARGS__); \
+} while (0)
+
+static char lxcpath[] = "/tmp/lxc-test-configcache-XXXXXX";
+static char dir[sizeof(lxcpath) + sizeof(MYNAME) + 1];
+static char config[sizeof(dir) + sizeof("/config")];
+static char cache[sizeof(dir) + sizeof("/.config.cache")];
+
+/* same size every time, truncated in place like save_config() does */
+static int write_config(int n)
+{
+	char buf[64];
+	int fd, len;
+
+	len = snprintf(buf, sizeof(buf), "lxc.utsname = name%04d\n", n);
+	fd = open(config, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return -1;
+	if (write(fd, buf, len) != len) {
+		close(fd);
+		return -1;
+	}
+	return close(fd);
+}
+
+static int set_mtime(const char *path, time_t t)
+{
+	struct timespec times[2];
+
+	times[0].tv_sec = t;
+	times[0].tv_nsec = 0;
+	times[1] = times[0];
+	return utimensat(AT_FDCWD, path, times, 0);
+}
+
+static int check_config(int n)
+{
+	struct lxc_container *c;
+	char want[16], v[64];
+	int ret = -1;
+
+	c = lxc_container_new(MYNAME, lxcpath);
+	if (!c) {
+		TSTERR("failed to create container object");
+		return -1;
+	}
+	snprintf(want, sizeof(want), "name%04d", n);
+	if (c->get_config_item(c, "lxc.utsname", v, sizeof(v)) < 0)
+		TSTERR("failed to get lxc.utsname");
+	else if (strcmp(v, want))
+		TSTERR("lxc.utsname is %s, not %s", v, want);
+	else
+		ret = 0;
+	lxc_container_put(c);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	time_t tick = time(NULL) - 60;
+	int ret = EXIT_FAILURE;
+
+	if (!mkdtemp(lxcpath)) {
+		TSTERR("failed to create %s", lxcpath);
+		exit(EXIT_FAILURE);
+	}
+	snprintf(dir, sizeof(dir), "%s/%s", lxcpath, MYNAME);
+	snprintf(config, sizeof(config), "%s/config", dir);
+	snprintf(cache, sizeof(cache), "%s/.config.cache", dir);
+	if (mkdir(dir, 0755) < 0) {
+		TSTERR("failed to create %s", dir);
+		goto out;
+	}
+
+	/* an old config gets a cache, and loads from it */
+	if (write_config(0) < 0 || set_mtime(config, tick) < 0) {
+		TSTERR("failed to write %s", config);
+		goto out;
+	}
+	if (check_config(0) < 0)
+		goto out;
+	if (access(cache, F_OK) < 0) {
+		TSTERR("no cache written for an old config");
+		goto out;
+	}
+	if (check_config(0) < 0)
+		goto out;
+
+	/*
+	 * Make it look like the cache was written in the tick the config
+	 * was last changed in, and change the config once more in that
+	 * tick, keeping its size.
+	 */
+	if (set_mtime(cache, tick) < 0) {
+		TSTERR("failed to set the times of %s", cache);
+		goto out;
+	}
+	if (write_config(1) < 0 || set_mtime(config, tick) < 0) {
+		TSTERR("failed to rewrite %s", config);
+		goto out;
+	}
+	if (check_config(1) < 0)
+		goto out;
+
+	printf("All configcache tests passed\n");
+	ret = EXIT_SUCCESS;
+out:
+	unlink(cache);
+	unlink(config);
+	rmdir(dir);
+	rmdir(lxcpath);
+	exit(ret);
+}
@@ -0,0 +1,186 @@
+/* confmem.c
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Load many containers made from one template and report how much memory
+ * each costs, then check that changing one's shared settings leaves the
+ * others alone.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <lxc/lxccontainer.h>
+
+static const char *template =
+	"lxc.utsname = %s\n"
+	"lxc.rootfs = /var/lib/lxc/%s/rootfs\n"
+	"lxc.group = onboot\n"
+	"lxc.group = web\n"
+	"lxc.cap.drop = mac_admin mac_override sys_time sys_module\n"
+	"lxc.cap.drop = sys_rawio sys_pacct sys_boot sys_nice\n"
+	"lxc.cap.drop = sys_resource audit_control audit_write\n"
+	"lxc.hook.pre-start = /usr/share/lxc/hooks/pre-start-check-network\n"
+	"lxc.hook.pre-start = /usr/share/lxc/hooks/pre-start-setup-quota\n"
+	"lxc.hook.mount = /usr/share/lxc/hooks/mountcgroups\n"
+	"lxc.hook.mount = /usr/share/lxc/hooks/mount-overlays\n"
+	"lxc.hook.autodev = /usr/share/lxc/hooks/autodev-devices\n"
+	"lxc.hook.start = /usr/share/lxc/hooks/start-log-boot\n"
+	"lxc.hook.post-stop = /usr/share/lxc/hooks/post-stop-release-ips\n"
+	"lxc.hook.clone = /usr/share/lxc/hooks/clonehostname\n";
+
+static long rss_kib(void)
+{
+	long pages = 0, resident = 0;
+	FILE *f = fopen("/proc/self/statm", "r");
+
+	if (!f)
+		return 0;
+	if (fscanf(f, "%ld %ld", &pages, &resident) != 2)
+		resident = 0;
+	fclose(f);
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static int write_config(const char *lxcpath, const char *name)
+{
+	char path[1024];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%s", lxcpath, name);
+	if (mkdir(path, 0755) < 0)
+		return -1;
+	snprintf(path, sizeof(path), "%s/%s/config", lxcpath, name);
+	f = fopen(path, "w");
+	if (!f)
+		return -1;
+	fprintf(f, template, name, name);
+	fclose(f);
+	return 0;
+}
+
+static void remove_config(const char *lxcpath, const char *name)
+{
+	char path[1024];
+
+	snprintf(path, sizeof(path), "%s/%s/config", lxcpath, name);
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/%s", lxcpath, name);
+	rmdir(path);
+}
+
+static int same_item(struct lxc_container *a, struct lxc_container *b,
+		     const char *key)
+{
+	char va[4096], vb[4096];
+
+	if (a->get_config_item(a, key, va, sizeof(va)) < 0 ||
+	    b->get_config_item(b, key, vb, sizeof(vb)) < 0)
+		return 0;
+	return strcmp(va, vb) == 0;
+}
+
+int main(int argc, char *argv[])
+{
+	char lxcpath[] = "/tmp/lxc-test-confmem-XXXXXX";
+	struct lxc_container **c;
+	char name[64], v[4096];
+	long before, after;
+	int i, n = 1000, opt, ret = 1;
+
+	while ((opt = getopt(argc, argv, "n:")) != -1) {
+		switch (opt) {
+		case 'n':
+			n = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n containers]\n", argv[0]);
+			exit(1);
+		}
+	}
+	if (n < 2)
+		n = 2;
+
+	if (!mkdtemp(lxcpath)) {
+		perror("mkdtemp");
+		exit(1);
+	}
+	c = calloc(n, sizeof(*c));
+	if (!c)
+		goto out;
+	for (i = 0; i < n; i++) {
+		snprintf(name, sizeof(name), "c%d", i);
+		if (write_config(lxcpath, name) < 0) {
+			fprintf(stderr, "failed to write config for %s\n", name);
+			goto out;
+		}
+	}
+
+	before = rss_kib();
+	for (i = 0; i < n; i++) {
+		snprintf(name, sizeof(name), "c%d", i);
+		c[i] = lxc_container_new(name, lxcpath);
+		if (!c[i] || !c[i]->is_defined(c[i])) {
+			fprintf(stderr, "failed to load %s\n", name);
+			goto out;
+		}
+	}
+	after = rss_kib();
+	printf("%d containers: %ld KiB, %ld bytes each\n", n,
+	       after - before, (after - before) * 1024 / n);
+
+	/* copy on write: c0's change must not show through c1 */
+	if (!same_item(c[0], c[1], "lxc.cap.drop") ||
+	    !same_item(c[0], c[1], "lxc.hook.mount")) {
+		fprintf(stderr, "containers from one template differ\n");
+		goto out;
+	}
+	if (!c[0]->set_config_item(c[0], "lxc.cap.drop", "sys_admin") ||
+	    !c[0]->set_config_item(c[0], "lxc.hook.mount", "/bin/true") ||
+	    !c[0]->clear_config_item(c[0], "lxc.group")) {
+		fprintf(stderr, "failed to change c0\n");
+		goto out;
+	}
+	if (same_item(c[0], c[1], "lxc.cap.drop") ||
+	    same_item(c[0], c[1], "lxc.hook.mount")) {
+		fprintf(stderr, "c0's change did not make a copy\n");
+		goto out;
+	}
+	if (c[1]->get_config_item(c[1], "lxc.group", v, sizeof(v)) < 0 ||
+	    strcmp(v, "onboot\nweb\n") != 0) {
+		fprintf(stderr, "clearing c0's groups changed c1's: '%s'\n", v);
+		goto out;
+	}
+	if (!same_item(c[1], c[n - 1], "lxc.cap.drop")) {
+		fprintf(stderr, "c0's change reached the others\n");
+		goto out;
+	}
+	printf("shared settings are copied on write\n");
+	ret = 0;
+
+out:
+	for (i = 0; c && i < n; i++) {
+		if (c[i])
+			lxc_container_put(c[i]);
+		snprintf(name, sizeof(name), "c%d", i);
+		remove_config(lxcpath, name);
+	}
+	free(c);
+	rmdir(lxcpath);
+	exit(ret);
+}
@@ -23,6 +23,7 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <stdlib.h>
+#include <errno.h>
 
 #define mycontainername "lxctest.sem"
 #define TIMEOUT_SECS 3
@@ -92,6 +93,44 @@ void test_two_locks(void)
 	lxc_putlock(l);
 }
 
+void test_shared_locks(void)
+{
+	struct lxc_lock *r1, *r2, *w;
+	int ret;
+
+	r1 = lxc_newlock("/tmp", "lxctest-shared");
+	r2 = lxc_newlock("/tmp", "lxctest-shared");
+	w = lxc_newlock("/tmp", "lxctest-shared");
+	if (!r1 || !r2 || !w) {
+		fprintf(stderr, "%d: failed to create locks\n", __LINE__);
+		exit(1);
+	}
+	if (lxclock_shared(r1, 0) || lxclock_shared(r2, TIMEOUT_SECS)) {
+		fprintf(stderr, "%d: failed to share lock\n", __LINE__);
+		exit(1);
+	}
+	ret = lxclock(w, 1);
+	if (ret != -1 || errno != ETIMEDOUT) {
+		fprintf(stderr, "%d: exclusive lock did not time out (%d)\n", __LINE__, ret);
+		exit(1);
+	}
+	lxcunlock(r1);
+	lxcunlock(r2);
+	if (lxclock(w, TIMEOUT_SECS)) {
+		fprintf(stderr, "%d: failed to get exclusive lock\n", __LINE__);
+		exit(1);
+	}
+	ret = lxclock_shared(r1, 1);
+	if (ret != -1 || errno != ETIMEDOUT) {
+		fprintf(stderr, "%d: shared lock did not time out (%d)\n", __LINE__, ret);
+		exit(1);
+	}
+	lxcunlock(w);
+	lxc_putlock(r1);
+	lxc_putlock(r2);
+	lxc_putlock(w);
+}
+
 int main(int argc, char *argv[])
 {
 	int ret;
@@ -121,20 +160,26 @@ int main(int argc, char *argv[])
 		exit(1);
 	}
 	struct stat sb;
-	// we don't create the file until the container is running, so this
-	// bit of the test needs to be changed
-	//char *pathname = "/run/lock/lxc/var/lib/lxc/" mycontainername;
-	char *pathname = "/run/lock/lxc/var/lib/lxc/";
+	// the lock file is only created when the lock is first taken
+	char *pathname = "/run/lock/lxc/var/lib/lxc/" mycontainername;
+	ret = lxclock(lock, 0);
+	if (ret) {
+		fprintf(stderr, "%d: failed to take lock (%d)\n", __LINE__, ret);
+		exit(1);
+	}
 	ret = stat(pathname, &sb);
 	if (ret != 0) {
 		fprintf(stderr, "%d: filename %s not created\n", __LINE__,
 			pathname);
 		exit(1);
 	}
+	lxcunlock(lock);
 	lxc_putlock(lock);
 
 	test_two_locks();
 
+	test_shared_locks();
+
 	fprintf(stderr, "all tests passed\n");
 
 	exit(ret);
@@ -0,0 +1,139 @@
+/* logbuffer.c
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * With lxc.logbuffer set, check that the lines a child buffered reach the
+ * logfile when it crashes, and when a lxc_clone() child returns.
+ */
+#include <lxc/lxccontainer.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "../lxc/log.h"
+#include "../lxc/namespace.h"
+
+#define MYNAME "lxctest-logbuffer"
+
+lxc_log_define(lxc_test_logbuffer, lxc);
+
+#define TSTERR(fmt, ...) do { \
+	fprintf(stderr, "%s:%d " fmt "\n", __FILE__, __LINE__, ##__VA_ARGS__); \
+} while (0)
+
+static char logfile[] = "/tmp/lxc-test-logbuffer-XXXXXX";
+
+static int in_log(const char *needle)
+{
+	char line[4096];
+	int found = 0;
+	FILE *f;
+
+	f = fopen(logfile, "r");
+	if (!f)
+		return 0;
+	while (!found && fgets(line, sizeof(line), f))
+		found = strstr(line, needle) != NULL;
+	fclose(f);
+	return found;
+}
+
+static int cloned(void *arg)
+{
+	INFO("line from the cloned child");
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct lxc_container *c;
+	int fd, status, ret = EXIT_FAILURE;
+	pid_t pid;
+
+	fd = mkstemp(logfile);
+	if (fd < 0) {
+		TSTERR("failed to create %s", logfile);
+		exit(EXIT_FAILURE);
+	}
+	close(fd);
+
+	c = lxc_container_new(MYNAME, NULL);
+	if (!c) {
+		TSTERR("failed to create container object");
+		goto out;
+	}
+	if (!c->set_config_item(c, "lxc.logfile", logfile) ||
+	    !c->set_config_item(c, "lxc.loglevel", "INFO") ||
+	    !c->set_config_item(c, "lxc.logbuffer", "64")) {
+		TSTERR("failed to set up the log");
+		goto out;
+	}
+
+	INFO("line from the parent");
+	if (in_log("line from the parent")) {
+		TSTERR("INFO line was not buffered");
+		goto out;
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		TSTERR("fork failed");
+		goto out;
+	}
+	if (pid == 0) {
+		INFO("line from the crashing child");
+		abort();
+	}
+	if (waitpid(pid, &status, 0) != pid || !WIFSIGNALED(status)) {
+		TSTERR("child did not crash");
+		goto out;
+	}
+	/* fork() flushed the parent's line, the crash the child's */
+	if (!in_log("line from the parent")) {
+		TSTERR("parent's line lost at fork");
+		goto out;
+	}
+	if (!in_log("line from the crashing child")) {
+		TSTERR("crashing child's line lost");
+		goto out;
+	}
+
+	pid = lxc_clone(cloned, NULL, 0);
+	if (pid < 0) {
+		TSTERR("lxc_clone failed");
+		goto out;
+	}
+	if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status)) {
+		TSTERR("cloned child failed");
+		goto out;
+	}
+	if (!in_log("line from the cloned child")) {
+		TSTERR("cloned child's line lost");
+		goto out;
+	}
+
+	printf("All logbuffer tests passed\n");
+	ret = EXIT_SUCCESS;
+out:
+	if (c)
+		lxc_container_put(c);
+	unlink(logfile);
+	exit(ret);
+}
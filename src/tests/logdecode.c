@@ -0,0 +1,143 @@
+/* logdecode.c
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2, as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Write a log with lxc.logformat = binary, with a text line in between,
+ * and check what lxc-log-decode makes of it, as text and as JSON.
+ */
+#include <lxc/lxccontainer.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include "../lxc/log.h"
+
+#define MYNAME "lxctest-logdecode"
+
+lxc_log_define(lxc_test_logdecode, lxc);
+
+#define TSTERR(fmt, ...) do { \
+	fprintf(stderr, "%s:%d " fmt "\n", __FILE__, __LINE__, ##__VA_ARGS__); \
+} while (0)
+
+static char logfile[] = "/tmp/lxc-test-logdecode-XXXXXX";
+
+/* every line of the decoder's output that should be there */
+static const char *text_lines[] = {
+	"INFO     lxc_test_logdecode - binary 42 -7 0x1f abc 2.50",
+	"INFO     lxc_test_logdecode - null (null)",
+	"INFO     lxc_test_logdecode - errno No such file or directory",
+	"INFO     lxc_test_logdecode - plain text line",
+	"INFO     lxc_test_logdecode - binary again",
+	NULL
+};
+
+static const char *json_lines[] = {
+	"\"level\":\"INFO\",\"category\":\"lxc_test_logdecode\",\"file\":\"logdecode.c\"",
+	"\"message\":\"binary 42 -7 0x1f abc 2.50\"}",
+	"\"message\":\"null (null)\"}",
+	"\"message\":\"errno No such file or directory\"}",
+	"{\"text\":\"",
+	"plain text line\"}",
+	"\"message\":\"binary again\"}",
+	NULL
+};
+
+static int check_decoded(const char *options, const char **expected)
+{
+	char cmd[256], out[65536];
+	size_t len;
+	FILE *f;
+	int i, ret = 0;
+
+	snprintf(cmd, sizeof(cmd), "lxc-log-decode %s %s", options, logfile);
+	f = popen(cmd, "r");
+	if (!f) {
+		TSTERR("failed to run '%s'", cmd);
+		return -1;
+	}
+	len = fread(out, 1, sizeof(out) - 1, f);
+	out[len] = '\0';
+	if (pclose(f) != 0) {
+		TSTERR("'%s' failed", cmd);
+		return -1;
+	}
+
+	for (i = 0; expected[i]; i++) {
+		if (!strstr(out, expected[i])) {
+			TSTERR("'%s' output lacks '%s':\n%s", cmd, expected[i], out);
+			ret = -1;
+		}
+	}
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	struct lxc_container *c;
+	const char *null = NULL;
+	int fd, ret = EXIT_FAILURE;
+
+	fd = mkstemp(logfile);
+	if (fd < 0) {
+		TSTERR("failed to create %s", logfile);
+		exit(EXIT_FAILURE);
+	}
+	close(fd);
+
+	c = lxc_container_new(MYNAME, NULL);
+	if (!c) {
+		TSTERR("failed to create container object");
+		goto out;
+	}
+	if (!c->set_config_item(c, "lxc.logfile", logfile) ||
+	    !c->set_config_item(c, "lxc.loglevel", "INFO") ||
+	    !c->set_config_item(c, "lxc.logformat", "binary")) {
+		TSTERR("failed to set up the log");
+		goto out;
+	}
+
+	INFO("binary %d %ld %#x %s %.2f", 42, -7L, 31, "abc", 2.5);
+	INFO("null %s", null);
+	/* %m is formatted on the spot and written as text */
+	errno = ENOENT;
+	INFO("errno %m");
+
+	if (!c->set_config_item(c, "lxc.logformat", "text")) {
+		TSTERR("failed to switch to text");
+		goto out;
+	}
+	INFO("plain text line");
+	if (!c->set_config_item(c, "lxc.logformat", "binary")) {
+		TSTERR("failed to switch back to binary");
+		goto out;
+	}
+	INFO("binary again");
+
+	if (check_decoded("", text_lines) < 0 ||
+	    check_decoded("-j", json_lines) < 0)
+		goto out;
+
+	printf("All logdecode tests passed\n");
+	ret = EXIT_SUCCESS;
+out:
+	if (c)
+		lxc_container_put(c);
+	unlink(logfile);
+	exit(ret);
+}